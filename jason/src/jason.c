@@ -9,155 +9,55 @@
  *       Prints "Not an accepted JSON!" to stderr and exits with code 1
  *       if the file is not a valid JSON in the expected shape.
  *
- *   --bot
+ *   --bot [--stats] [--context TOKENS]
  *       Repeatedly prompt the user for a question, send it to the AI
- *       service via neurolib, parse the JSON response, and print the
- *       answer.  Stops when the user sends EOF (Ctrl-D).
+ *       service via neurolib, and print the answer as it streams in.
+ *       Earlier questions and answers are sent along as context, up to
+ *       TOKENS tokens (default 8000).  Stops when the user sends EOF
+ *       (Ctrl-D).  With --stats, a table of per-phase request latencies
+ *       is printed to stderr on exit.
+ *
+ *   --batch <file> [--concurrency N]
+ *       Send every non-empty line of <file> as a question, up to N at a
+ *       time, and print the answers in the order of the questions.
  *
  * Compilation:
  *   gcc -Wall -Wextra -Werror -pedantic -c neurolib.c
+ *   gcc -Wall -Wextra -Werror -pedantic -c neurocache.c
+ *   gcc -Wall -Wextra -Werror -pedantic -c neurotok.c
+ *   gcc -Wall -Wextra -Werror -pedantic -c neuroh2.c
+ *   gcc -Wall -Wextra -Werror -pedantic -c jasonlib.c
  *   gcc -Wall -Wextra -Werror -pedantic -c jason.c
- *   gcc -o jason neurolib.o jason.o -lssl -lcrypto
+ *   gcc -o jason neurolib.o neurocache.o neurotok.o neuroh2.o jasonlib.o \
+ *       jason.o -lssl -lcrypto -lz -pthread
  */
 
 #include <stdio.h>   /* printf, fprintf, fgetc, fgets, stdin, stdout     */
 #include <stdlib.h>  /* malloc, free, exit                               */
-#include <string.h>  /* strcmp, strstr, strchr, strlen, strdup           */
+#include <string.h>  /* strcmp, strchr, strlen                           */
 
-#include "neurolib.h" /* neuro_ask                                       */
+#include "jasonlib.h" /* jason_parser, jason_get                         */
+#include "neurolib.h" /* neuro_ask_stream, neuro_ask_batch, neuro_timing_* */
 
 /* Maximum size of a JSON file we will read into memory (1 MB) */
 #define MAX_JSON_SIZE (1024 * 1024)
 
-/* Maximum length of a single line of user input */
-#define MAX_INPUT_LEN 4096
-
-/* -------------------------------------------------------------------------
- * extract_content
- *
- * Navigates a JSON string looking for:
- *   .choices  →  array  →  first element  →  .message  →  .content
- *
- * Returns a heap-allocated, NUL-terminated, unescaped string containing
- * the value of that field, or NULL if the path cannot be found or the
- * JSON is malformed.  The caller must free() the result.
- * ---------------------------------------------------------------------- */
-static char *extract_content(const char *json)
-{
-    const char *p;        /* read cursor inside json                       */
-    const char *str_end;  /* marks the closing '"' of the content value    */
-    char       *out;      /* output buffer (unescaped content)             */
-    size_t      i;        /* write index into out                          */
-    size_t      cap;      /* allocated capacity of out                     */
-
-    /* ---- Step 1: find the "choices" key ---- */
-    p = strstr(json, "\"choices\"");
-    if (p == NULL) {
-        return NULL; /* "choices" key is absent */
-    }
-    p += strlen("\"choices\""); /* move past the key itself */
-
-    /* Skip optional whitespace and the colon */
-    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') { p++; }
-    if (*p != ':') { return NULL; } /* expected ':' after key */
-    p++;
-
-    /* ---- Step 2: find the opening '[' of the choices array ---- */
-    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') { p++; }
-    if (*p != '[') { return NULL; } /* "choices" value is not an array */
-    p++;
-
-    /* ---- Step 3: find the opening '{' of the first array element ---- */
-    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') { p++; }
-    if (*p != '{') { return NULL; } /* first element is not an object */
-    p++;
-
-    /* ---- Step 4: find the "message" key inside that object ---- */
-    p = strstr(p, "\"message\"");
-    if (p == NULL) { return NULL; }
-    p += strlen("\"message\"");
-
-    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') { p++; }
-    if (*p != ':') { return NULL; }
-    p++;
-
-    /* ---- Step 5: find the opening '{' of the message object ---- */
-    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') { p++; }
-    if (*p != '{') { return NULL; }
-    p++;
-
-    /* ---- Step 6: find the "content" key inside message ---- */
-    p = strstr(p, "\"content\"");
-    if (p == NULL) { return NULL; }
-    p += strlen("\"content\"");
-
-    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') { p++; }
-    if (*p != ':') { return NULL; }
-    p++;
-
-    /* ---- Step 7: find the opening '"' of the content string ---- */
-    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') { p++; }
-    if (*p != '"') { return NULL; } /* content value is not a string */
-    p++; /* move past the opening quote */
-
-    /* ---- Step 8: decode the JSON string into a plain C string ---- */
-
-    /*
-     * We do not know the final length, so start with a reasonable
-     * buffer and grow if needed.  The decoded string can only be
-     * shorter than or equal to the encoded one, so strlen(p) is safe.
-     */
-    cap = strlen(p) + 1;
-    out = (char *)malloc(cap);
-    if (out == NULL) { return NULL; }
-
-    i = 0;
-    while (*p != '\0') {
-        if (*p == '"') {
-            break; /* unescaped '"' marks the end of the JSON string */
-        }
+/* Where the answer is in a chat completion response */
+#define CONTENT_PATH "choices[0].message.content"
 
-        if (*p == '\\') {
-            /* Escape sequence — interpret the next character */
-            p++;
-            switch (*p) {
-                case 'n':  out[i++] = '\n'; break; /* newline            */
-                case 't':  out[i++] = '\t'; break; /* horizontal tab     */
-                case 'r':  out[i++] = '\r'; break; /* carriage return    */
-                case '"':  out[i++] = '"';  break; /* double quote       */
-                case '\\': out[i++] = '\\'; break; /* backslash          */
-                case '/':  out[i++] = '/';  break; /* forward slash      */
-                case 'b':  out[i++] = '\b'; break; /* backspace          */
-                case 'f':  out[i++] = '\f'; break; /* form feed          */
-                default:
-                    /* Unknown escape — keep both characters literally */
-                    out[i++] = '\\';
-                    out[i++] = *p;
-                    break;
-            }
-        } else {
-            out[i++] = *p; /* ordinary character — copy as-is */
-        }
+/* Arena lent to the parser by --extract; longer answers grow past it */
+#define EXTRACT_ARENA 4096
 
-        p++;
-
-        /* Safety check: ensure we have not gone past the closing '"' */
-        if (i >= cap - 1) {
-            free(out);
-            return NULL; /* unexpected end of buffer */
-        }
-    }
+/* Maximum length of a single line of user input */
+#define MAX_INPUT_LEN 4096
 
-    /* Verify we stopped at a closing '"', not at '\0' */
-    str_end = p;
-    if (*str_end != '"') {
-        free(out);
-        return NULL; /* string was not properly closed */
-    }
+/* Connections used by --batch when --concurrency is not given */
+#define DEFAULT_CONCURRENCY 4
 
-    out[i] = '\0'; /* NUL-terminate the decoded string */
-    return out;
-}
+/* Usage line shown for a missing or unknown mode flag */
+#define USAGE "Usage: %s [--extract <file> | " \
+              "--bot [--stats] [--context TOKENS] | " \
+              "--batch <file> [--concurrency N]]\n"
 
 /* -------------------------------------------------------------------------
  * read_file
@@ -190,6 +90,166 @@ static char *read_file(const char *filename)
     return buf;
 }
 
+/* -------------------------------------------------------------------------
+ * read_all
+ *
+ * Reads the entire contents of 'filename', however large, into a
+ * heap-allocated buffer that doubles as it fills.  Unlike read_file
+ * nothing is cut off: a questions file past MAX_JSON_SIZE would
+ * otherwise lose its last questions and send a half line as a whole
+ * one.  Returns a NUL-terminated string on success, or NULL if the file
+ * cannot be opened or read or memory runs out.  Caller must free().
+ * ---------------------------------------------------------------------- */
+static char *read_all(const char *filename)
+{
+    FILE   *fp;    /* file handle                                        */
+    char   *buf;   /* destination buffer                                 */
+    char   *grown; /* buffer after realloc                               */
+    size_t  cap;   /* bytes allocated, excluding the NUL                 */
+    size_t  len;   /* bytes read so far                                  */
+
+    fp = fopen(filename, "r");
+    if (fp == NULL) {
+        return NULL;
+    }
+
+    cap = 64 * 1024;
+    len = 0;
+    buf = (char *)malloc(cap + 1);
+    while (buf != NULL) {
+        len += fread(buf + len, 1, cap - len, fp);
+        if (len < cap) {
+            break; /* end of file, or an error */
+        }
+        cap  *= 2;
+        grown = (char *)realloc(buf, cap + 1);
+        if (grown == NULL) {
+            free(buf);
+        }
+        buf = grown;
+    }
+    if (buf != NULL && ferror(fp)) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(fp);
+
+    if (buf != NULL) {
+        buf[len] = '\0';
+    }
+    return buf;
+}
+
+/* -------------------------------------------------------------------------
+ * print_fragment
+ *
+ * neuro_ask_stream callback: prints each piece of the answer the moment
+ * it arrives.  'user' points to a counter of bytes printed so far.
+ * ---------------------------------------------------------------------- */
+static int print_fragment(const char *text, size_t len, void *user)
+{
+    size_t *printed = (size_t *)user; /* running total for this answer */
+
+    fwrite(text, 1, len, stdout);
+    fflush(stdout); /* show the tokens now, not at the next newline */
+    *printed += len;
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ * print_stats
+ *
+ * Prints the latency percentiles neurolib collected, one line per phase
+ * (DNS, connect, TLS, time to first byte, transfer, total).
+ * ---------------------------------------------------------------------- */
+static void print_stats(void)
+{
+    int phase; /* enum neuro_phase being printed */
+
+    fflush(stdout); /* keep the table after the conversation */
+    if (neuro_timing_count(NEURO_PHASE_TOTAL) == 0) {
+        fprintf(stderr, "No requests were timed.\n");
+        return;
+    }
+    fprintf(stderr, "%-9s %7s %10s %10s %10s %10s\n",
+            "phase", "count", "p50 ms", "p95 ms", "p99 ms", "max ms");
+    for (phase = 0; phase < NEURO_PHASE_COUNT; phase++) {
+        if (neuro_timing_count((enum neuro_phase)phase) == 0) {
+            continue; /* e.g. no new connection was needed */
+        }
+        fprintf(stderr, "%-9s %7lu %10.3f %10.3f %10.3f %10.3f\n",
+                neuro_phase_name((enum neuro_phase)phase),
+                neuro_timing_count((enum neuro_phase)phase),
+                neuro_timing_percentile((enum neuro_phase)phase, 50.0),
+                neuro_timing_percentile((enum neuro_phase)phase, 95.0),
+                neuro_timing_percentile((enum neuro_phase)phase, 99.0),
+                neuro_timing_percentile((enum neuro_phase)phase, 100.0));
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * Batch output
+ *
+ * neuro_ask_batch reports answers in whatever order they complete.  To
+ * print them in question order, each response is parked until every
+ * earlier one has been printed, and only then parsed.  One parser serves
+ * every response: it is reset after each, so its arena is reused.
+ * ---------------------------------------------------------------------- */
+
+/* Per-question result state */
+enum { ANSWER_PENDING, ANSWER_OK, ANSWER_NO_RESPONSE };
+
+struct batch_output {
+    char              **answers; /* raw responses waiting to be printed  */
+    unsigned char      *state;   /* ANSWER_* for each question           */
+    size_t              next;    /* index of the next answer to print    */
+    size_t              n;       /* number of questions                  */
+    struct jason_parser parser;  /* decodes the answer being printed     */
+};
+
+/*
+ * print_answer — Prints the answer in a response, or reports why it
+ * cannot.
+ */
+static void print_answer(struct batch_output *out, const char *response)
+{
+    struct jason_slice content; /* choices[0].message.content */
+
+    if (jason_get(&out->parser, response, strlen(response), CONTENT_PATH,
+                  &content) == 0 && content.type == JASON_STRING) {
+        fwrite(content.ptr, 1, content.len, stdout);
+        putchar('\n');
+    } else {
+        fflush(stdout); /* keep stdout and stderr in order */
+        fprintf(stderr, "Error: could not parse the response.\n");
+    }
+    jason_parser_reset(&out->parser);
+}
+
+/*
+ * print_in_order — neuro_ask_batch callback.  Parks the response, then
+ * prints every answer that is now at the front of the queue.
+ */
+static void print_in_order(size_t index, char *response, void *user)
+{
+    struct batch_output *out = (struct batch_output *)user;
+
+    out->answers[index] = response;
+    out->state[index]   = (response != NULL) ? ANSWER_OK
+                                             : ANSWER_NO_RESPONSE;
+
+    while (out->next < out->n && out->state[out->next] != ANSWER_PENDING) {
+        if (out->state[out->next] == ANSWER_OK) {
+            print_answer(out, out->answers[out->next]);
+            free(out->answers[out->next]); /* raw JSON no longer needed */
+        } else {
+            fflush(stdout); /* keep stdout and stderr in order */
+            fprintf(stderr, "Error: failed to get a response.\n");
+        }
+        out->next++;
+    }
+}
+
 /* =========================================================================
  * main
  * ====================================================================== */
@@ -201,7 +261,7 @@ int main(int argc, char *argv[])
 
     if (argc < 2) {
         /* No mode flag given at all */
-        fprintf(stderr, "Usage: %s [--extract <file> | --bot]\n", argv[0]);
+        fprintf(stderr, USAGE, argv[0]);
         return 1;
     }
 
@@ -211,8 +271,11 @@ int main(int argc, char *argv[])
 
     if (strcmp(argv[1], "--extract") == 0) {
 
-        char *json;     /* raw JSON text loaded from the file  */
-        char *content;  /* decoded choices[0].message.content  */
+        char                json_arena[EXTRACT_ARENA]; /* for escapes */
+        struct jason_parser parser;   /* finds the content in the JSON   */
+        struct jason_slice  content;  /* choices[0].message.content      */
+        char               *json;     /* raw JSON text loaded from file  */
+        int                 rc;       /* jason_get result                */
 
         if (argc != 3) {
             /* --extract requires exactly one additional argument */
@@ -227,20 +290,24 @@ int main(int argc, char *argv[])
             return 1;
         }
 
-        /* Extract choices[0].message.content from the JSON */
-        content = extract_content(json);
-        free(json); /* no longer needed once parsed */
+        /* Find choices[0].message.content in the JSON */
+        jason_parser_init(&parser, json_arena, sizeof(json_arena));
+        rc = jason_get(&parser, json, strlen(json), CONTENT_PATH, &content);
 
-        if (content == NULL) {
+        if (rc != 0 || content.type != JASON_STRING) {
             /* The file exists but is not in the expected JSON shape */
             fprintf(stderr, "Not an accepted JSON!\n");
+            jason_parser_free(&parser);
+            free(json);
             return 1;
         }
 
         /* Print the decoded content to stdout */
-        printf("%s\n", content);
-        free(content); /* release the decoded string */
+        fwrite(content.ptr, 1, content.len, stdout);
+        putchar('\n');
 
+        jason_parser_free(&parser);
+        free(json); /* content may point into it, so freed last */
         return 0; /* success */
     }
 
@@ -250,14 +317,38 @@ int main(int argc, char *argv[])
 
     if (strcmp(argv[1], "--bot") == 0) {
 
-        char  input[MAX_INPUT_LEN]; /* line of text typed by the user  */
-        char *json_response;        /* raw JSON returned by neuro_ask  */
-        char *answer;               /* decoded content field           */
-        int   len;                  /* length of the input string      */
+        char        input[MAX_INPUT_LEN]; /* line typed by the user       */
+        size_t      printed;  /* bytes of the answer shown so far         */
+        int         len;      /* length of the input string               */
+        int         stats;    /* print latencies on exit                  */
+        long        context;  /* token budget of the history, 0 = default */
+        char       *endptr;   /* strtol validation                        */
+        neuro_conv *conv;     /* the questions and answers so far         */
+        int         a;
+
+        stats   = 0;
+        context = 0;
+        for (a = 2; a < argc; a++) {
+            if (strcmp(argv[a], "--stats") == 0) {
+                stats = 1;
+            } else if (strcmp(argv[a], "--context") == 0 && a + 1 < argc) {
+                context = strtol(argv[++a], &endptr, 10);
+                if (*endptr != '\0' || context < 1) {
+                    fprintf(stderr, "Context must be a positive number "
+                                    "of tokens\n");
+                    return 1;
+                }
+            } else {
+                /* --bot takes only --stats and --context */
+                fprintf(stderr, "Usage: %s --bot [--stats] "
+                                "[--context TOKENS]\n", argv[0]);
+                return 1;
+            }
+        }
 
-        if (argc != 2) {
-            /* --bot takes no additional arguments */
-            fprintf(stderr, "Usage: %s --bot\n", argv[0]);
+        conv = neuro_conv_new(context);
+        if (conv == NULL) {
+            fprintf(stderr, "Error: out of memory.\n");
             return 1;
         }
 
@@ -290,34 +381,113 @@ int main(int argc, char *argv[])
                 continue;
             }
 
-            /* Send the question to the AI service */
-            json_response = neuro_ask(input);
-            if (json_response == NULL) {
+            /* Send the question, with the conversation so far, and print
+             * the answer as it streams in */
+            printed = 0;
+            if (neuro_ask_conv(conv, input, print_fragment, &printed) != 0) {
+                if (printed > 0) {
+                    printf("\n"); /* finish the partial answer's line */
+                }
                 fprintf(stderr, "Error: failed to get a response.\n");
                 continue;
             }
+            printf("\n");
+        }
 
-            /* Extract the assistant's answer from the JSON */
-            answer = extract_content(json_response);
-            free(json_response); /* raw JSON no longer needed */
+        if (stats) {
+            print_stats();
+        }
+        neuro_conv_free(conv);
+        neuro_cleanup(); /* close the kept-alive connection */
+        return 0; /* success */
+    }
 
-            if (answer == NULL) {
-                fprintf(stderr, "Error: could not parse the response.\n");
-                continue;
+    /* ------------------------------------------------------------------ */
+    /* MODE C: --batch <file> [--concurrency N]                             */
+    /* ------------------------------------------------------------------ */
+
+    if (strcmp(argv[1], "--batch") == 0) {
+
+        char                *text;        /* the whole questions file     */
+        char               **prompts;     /* pointers to each question    */
+        size_t               n;           /* number of questions          */
+        char                *line;        /* cursor over text             */
+        char                *nl;          /* end of the current line      */
+        long                 concurrency; /* simultaneous connections     */
+        char                *endptr;      /* strtol validation            */
+        struct batch_output  out;         /* in-order printing state      */
+
+        concurrency = DEFAULT_CONCURRENCY;
+        if (argc == 5 && strcmp(argv[3], "--concurrency") == 0) {
+            concurrency = strtol(argv[4], &endptr, 10);
+            if (*endptr != '\0' || concurrency < 1 || concurrency > 1024) {
+                fprintf(stderr, "Concurrency must be between 1 and 1024\n");
+                return 1;
+            }
+        } else if (argc != 3) {
+            fprintf(stderr, "Usage: %s --batch <file> [--concurrency N]\n",
+                    argv[0]);
+            return 1;
+        }
+
+        text = read_all(argv[2]);
+        if (text == NULL) {
+            fprintf(stderr, "Cannot read file: %s\n", argv[2]);
+            return 1;
+        }
+
+        /* Split into lines in place; one pointer per non-empty line */
+        prompts = (char **)malloc((strlen(text) / 2 + 1) * sizeof(char *));
+        if (prompts == NULL) {
+            free(text);
+            return 1;
+        }
+        n = 0;
+        for (line = text; *line != '\0'; line = nl + 1) {
+            nl = strchr(line, '\n');
+            if (nl == NULL) {
+                nl = line + strlen(line) - 1; /* last line, no newline */
+            } else {
+                *nl = '\0';
+            }
+            if (*line != '\0' && line[strlen(line) - 1] == '\r') {
+                line[strlen(line) - 1] = '\0';
+            }
+            if (*line != '\0') {
+                prompts[n++] = line;
             }
+        }
 
-            /* Print the answer */
-            printf("%s\n", answer);
-            free(answer); /* release the decoded answer string */
+        out.answers = (char **)calloc(n + 1, sizeof(char *));
+        out.state   = (unsigned char *)calloc(n + 1, 1);
+        out.next    = 0;
+        out.n       = n;
+        jason_parser_init(&out.parser, NULL, 0);
+        if (out.answers == NULL || out.state == NULL ||
+            neuro_ask_batch((const char *const *)prompts, n,
+                            (int)concurrency, print_in_order, &out) != 0) {
+            fprintf(stderr, "Error: failed to get a response.\n");
+            jason_parser_free(&out.parser);
+            free(out.answers);
+            free(out.state);
+            free(prompts);
+            free(text);
+            return 1;
         }
 
-        return 0; /* success */
+        jason_parser_free(&out.parser);
+        free(out.answers);
+        free(out.state);
+        free(prompts);
+        free(text);
+        neuro_cleanup();
+        return 0;
     }
 
     /* ------------------------------------------------------------------ */
     /* Unknown flag                                                          */
     /* ------------------------------------------------------------------ */
 
-    fprintf(stderr, "Usage: %s [--extract <file> | --bot]\n", argv[0]);
+    fprintf(stderr, USAGE, argv[0]);
     return 1;
 }
@@ -0,0 +1,622 @@
+/*
+ * jasonlib.c — Implementation of the JSON value extractor.
+ *
+ * jason_get() walks the path one step at a time.  At an object it reads
+ * each member's key and either descends into the value (the key
+ * matches) or skips the value; at an array it skips elements until the
+ * wanted index.  Skipping a container only tracks strings and bracket
+ * nesting, so it runs at close to memory speed.
+ *
+ * Keys are compared where they are in the document; one with escape
+ * sequences is compared character by character as it is decoded, never
+ * copied.  The final value is returned as a slice, and only a string
+ * that contains escapes is decoded into the arena.  The decoded text is
+ * never longer than the escaped text, so the arena is reserved once per
+ * string, before decoding.
+ *
+ * Arenas the parser allocates carry a small header.  An arena that is
+ * outgrown is not reallocated, since earlier slices still point into it;
+ * it goes onto the 'retired' list and is freed at the next reset.
+ */
+
+#include "jasonlib.h"
+
+#include <stdlib.h>     /* malloc, free, strtoul                        */
+#include <string.h>     /* memchr, memcmp, memcpy, strlen, strcspn      */
+
+/* -------------------------------------------------------------------------
+ * Constants
+ * ---------------------------------------------------------------------- */
+
+#define ARENA_MIN  4096 /* first arena the parser allocates             */
+#define MAX_DEPTH  512  /* nesting a skipped value may have             */
+
+/* Header of an arena the parser allocated; the bytes follow it */
+struct arena_block {
+    struct arena_block *next; /* next retired block */
+};
+
+/* -------------------------------------------------------------------------
+ * Arena
+ * ---------------------------------------------------------------------- */
+
+static struct arena_block *block_of(char *arena)
+{
+    return (struct arena_block *)(void *)arena - 1;
+}
+
+/*
+ * arena_reserve — Makes room for 'need' more bytes.  A fresh arena is
+ * at least twice the old one, so growth stops after a few documents.
+ * Returns 0 on success, -1 if out of memory.
+ */
+static int arena_reserve(struct jason_parser *p, size_t need)
+{
+    struct arena_block *b;
+    size_t              cap;
+
+    if (p->cap - p->used >= need) {
+        return 0;
+    }
+    cap = (p->cap * 2 > ARENA_MIN) ? p->cap * 2 : ARENA_MIN;
+    if (cap < need) {
+        cap = need;
+    }
+    b = (struct arena_block *)malloc(sizeof(*b) + cap);
+    if (b == NULL) {
+        return -1;
+    }
+    if (p->owned) {
+        block_of(p->arena)->next = (struct arena_block *)p->retired;
+        p->retired               = block_of(p->arena);
+    }
+    p->arena = (char *)(b + 1);
+    p->cap   = cap;
+    p->used  = 0;
+    p->owned = 1;
+    p->allocs++;
+    return 0;
+}
+
+void jason_parser_init(struct jason_parser *p, char *buf, size_t cap)
+{
+    p->arena   = buf;
+    p->cap     = (buf != NULL) ? cap : 0;
+    p->used    = 0;
+    p->owned   = 0;
+    p->retired = NULL;
+    p->allocs  = 0;
+}
+
+void jason_parser_reset(struct jason_parser *p)
+{
+    struct arena_block *b;
+
+    while (p->retired != NULL) { /* only while the arena is growing */
+        b          = (struct arena_block *)p->retired;
+        p->retired = b->next;
+        free(b);
+    }
+    p->used = 0;
+}
+
+void jason_parser_free(struct jason_parser *p)
+{
+    jason_parser_reset(p);
+    if (p->owned) {
+        free(block_of(p->arena));
+    }
+    jason_parser_init(p, NULL, 0);
+}
+
+unsigned long jason_parser_allocs(const struct jason_parser *p)
+{
+    return p->allocs;
+}
+
+/* -------------------------------------------------------------------------
+ * Strings
+ * ---------------------------------------------------------------------- */
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/* hex4 — The four hex digits at s (s + 4 <= end), or -1 */
+static long hex4(const char *s, const char *end)
+{
+    long v = 0;
+    int  i, d;
+
+    if (end - s < 4) {
+        return -1;
+    }
+    for (i = 0; i < 4; i++) {
+        d = hex_value(s[i]);
+        if (d < 0) {
+            return -1;
+        }
+        v = v * 16 + d;
+    }
+    return v;
+}
+
+/*
+ * decode_escape — Decodes the escape sequence after the backslash at s
+ * into out (up to 4 bytes).  Sets *outlen and returns the number of
+ * input bytes used, or 0 if the sequence is cut off.
+ *
+ * \uXXXX becomes UTF-8, with surrogate pairs combined; a lone surrogate
+ * becomes U+FFFD.  An unknown escape is kept as it is, backslash and
+ * all, as jason always did.
+ */
+static size_t decode_escape(const char *s, const char *end, char *out,
+                            size_t *outlen)
+{
+    long cp, lo;
+    size_t used = 2;
+
+    if (end - s < 2) {
+        return 0;
+    }
+    switch (s[1]) {
+        case 'n':  out[0] = '\n'; *outlen = 1; return 2;
+        case 't':  out[0] = '\t'; *outlen = 1; return 2;
+        case 'r':  out[0] = '\r'; *outlen = 1; return 2;
+        case 'b':  out[0] = '\b'; *outlen = 1; return 2;
+        case 'f':  out[0] = '\f'; *outlen = 1; return 2;
+        case '"':  out[0] = '"';  *outlen = 1; return 2;
+        case '\\': out[0] = '\\'; *outlen = 1; return 2;
+        case '/':  out[0] = '/';  *outlen = 1; return 2;
+        case 'u':  break;
+        default:
+            out[0]  = '\\';
+            out[1]  = s[1];
+            *outlen = 2;
+            return 2;
+    }
+
+    cp = hex4(s + 2, end);
+    if (cp < 0) {
+        out[0]  = '\\';       /* not \uXXXX: keep it as it is */
+        out[1]  = 'u';
+        *outlen = 2;
+        return 2;
+    }
+    used = 6;
+    if (cp >= 0xD800 && cp <= 0xDBFF && end - s >= 12 && s[6] == '\\' &&
+        s[7] == 'u' && (lo = hex4(s + 8, end)) >= 0xDC00 && lo <= 0xDFFF) {
+        cp   = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+        used = 12;
+    } else if (cp >= 0xD800 && cp <= 0xDFFF) {
+        cp = 0xFFFD;
+    }
+
+    if (cp < 0x80) {
+        out[0]  = (char)cp;
+        *outlen = 1;
+    } else if (cp < 0x800) {
+        out[0]  = (char)(0xC0 | (cp >> 6));
+        out[1]  = (char)(0x80 | (cp & 0x3F));
+        *outlen = 2;
+    } else if (cp < 0x10000) {
+        out[0]  = (char)(0xE0 | (cp >> 12));
+        out[1]  = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[2]  = (char)(0x80 | (cp & 0x3F));
+        *outlen = 3;
+    } else {
+        out[0]  = (char)(0xF0 | (cp >> 18));
+        out[1]  = (char)(0x80 | ((cp >> 12) & 0x3F));
+        out[2]  = (char)(0x80 | ((cp >> 6) & 0x3F));
+        out[3]  = (char)(0x80 | (cp & 0x3F));
+        *outlen = 4;
+    }
+    return used;
+}
+
+/*
+ * string_end — Given s just after an opening quote, returns the closing
+ * quote, or NULL if the string is not terminated.  *escaped is set if
+ * the string contains a backslash.
+ *
+ * memchr jumps from quote to quote; a quote is the end of the string
+ * unless an odd number of backslashes comes right before it.
+ */
+static const char *string_end(const char *s, const char *end, int *escaped)
+{
+    const char *start = s;
+    const char *q, *b;
+
+    for (;;) {
+        q = (const char *)memchr(s, '"', (size_t)(end - s));
+        if (q == NULL) {
+            return NULL;
+        }
+        for (b = q; b > start && b[-1] == '\\'; b--) {
+            ;
+        }
+        if ((q - b) % 2 == 0) {
+            break;
+        }
+        s = q + 1; /* an escaped quote */
+    }
+    *escaped = memchr(start, '\\', (size_t)(q - start)) != NULL;
+    return q;
+}
+
+/*
+ * skip_string — Like string_end, for the strings inside a skipped
+ * container.  Those are mostly short keys and values, which a plain loop
+ * gets through faster than memchr calls.
+ */
+static const char *skip_string(const char *s, const char *end)
+{
+    while (s < end) {
+        if (*s == '"') {
+            return s;
+        }
+        if (*s == '\\') {
+            s++;
+        }
+        s++;
+    }
+    return NULL;
+}
+
+/*
+ * decode_string — Decodes the escaped string s[0..len) into out, which
+ * has room for len bytes.  Returns the decoded length.
+ *
+ * Runs without escapes are copied whole; the escapes of one character
+ * are handled here and only \\u and unknown ones go to decode_escape.
+ */
+static size_t decode_string(const char *s, size_t len, char *out)
+{
+    const char *end = s + len;
+    const char *b;
+    size_t      n = 0;
+    size_t      used, k;
+    char        c;
+
+    while (s < end) {
+        b = (const char *)memchr(s, '\\', (size_t)(end - s));
+        if (b == NULL) {
+            b = end;
+        }
+        memcpy(out + n, s, (size_t)(b - s)); /* the run before the escape */
+        n += (size_t)(b - s);
+        s  = b;
+        if (s + 1 >= end) {
+            break; /* cannot happen inside a terminated string */
+        }
+        switch (s[1]) {
+            case 'n':  c = '\n'; break;
+            case 't':  c = '\t'; break;
+            case 'r':  c = '\r'; break;
+            case '"':  c = '"';  break;
+            case '\\': c = '\\'; break;
+            case '/':  c = '/';  break;
+            default:
+                used = decode_escape(s, end, out + n, &k);
+                s += used;
+                n += k;
+                continue;
+        }
+        out[n++] = c;
+        s += 2;
+    }
+    return n;
+}
+
+/*
+ * key_equals — Whether the escaped key s[0..len) decodes to key[0..klen).
+ */
+static int key_equals(const char *s, size_t len, int escaped,
+                      const char *key, size_t klen)
+{
+    const char *end = s + len;
+    char        ch[4];
+    size_t      used, k;
+
+    if (!escaped) {
+        return len == klen && memcmp(s, key, len) == 0;
+    }
+    while (s < end) {
+        if (*s != '\\') {
+            ch[0] = *s;
+            k     = 1;
+            used  = 1;
+        } else if ((used = decode_escape(s, end, ch, &k)) == 0) {
+            return 0;
+        }
+        if (k > klen || memcmp(ch, key, k) != 0) {
+            return 0;
+        }
+        key  += k;
+        klen -= k;
+        s    += used;
+    }
+    return klen == 0;
+}
+
+/* -------------------------------------------------------------------------
+ * Values
+ * ---------------------------------------------------------------------- */
+
+static const char *skip_ws(const char *s, const char *end)
+{
+    while (s < end && (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r')) {
+        s++;
+    }
+    return s;
+}
+
+/*
+ * number_end — End of the number at s, or NULL if there is none:
+ * -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+ */
+static const char *number_end(const char *s, const char *end)
+{
+    const char *d;
+
+    if (s < end && *s == '-') {
+        s++;
+    }
+    if (s == end || *s < '0' || *s > '9') {
+        return NULL;
+    }
+    if (*s == '0') {
+        s++;
+    } else {
+        while (s < end && *s >= '0' && *s <= '9') s++;
+    }
+    if (s < end && *s == '.') {
+        d = ++s;
+        while (s < end && *s >= '0' && *s <= '9') s++;
+        if (s == d) return NULL;
+    }
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        s++;
+        if (s < end && (*s == '+' || *s == '-')) s++;
+        d = s;
+        while (s < end && *s >= '0' && *s <= '9') s++;
+        if (s == d) return NULL;
+    }
+    return s;
+}
+
+/* literal_end — End of the literal 'word' at s, or NULL */
+static const char *literal_end(const char *s, const char *end,
+                               const char *word)
+{
+    size_t n = strlen(word);
+
+    return ((size_t)(end - s) >= n && memcmp(s, word, n) == 0) ? s + n
+                                                                : NULL;
+}
+
+/*
+ * skip_value — Returns the end of the value starting at s (no leading
+ * whitespace), or NULL if it is malformed.  Inside a container only
+ * strings and the nesting of brackets are checked.
+ */
+static const char *skip_value(const char *s, const char *end)
+{
+    char stack[MAX_DEPTH]; /* closing bracket expected at each level */
+    int  depth = 0;
+    int  escaped;
+
+    if (s == end) {
+        return NULL;
+    }
+    switch (*s) {
+        case '"':
+            s = string_end(s + 1, end, &escaped);
+            return (s != NULL) ? s + 1 : NULL;
+        case 't': return literal_end(s, end, "true");
+        case 'f': return literal_end(s, end, "false");
+        case 'n': return literal_end(s, end, "null");
+        case '{': case '[': break;
+        default:  return number_end(s, end);
+    }
+
+    while (s < end) {
+        switch (*s) {
+            case '{':
+            case '[':
+                if (depth == MAX_DEPTH) {
+                    return NULL;
+                }
+                stack[depth++] = (*s == '{') ? '}' : ']';
+                break;
+            case '}':
+            case ']':
+                if (depth == 0 || stack[--depth] != *s) {
+                    return NULL;
+                }
+                if (depth == 0) {
+                    return s + 1;
+                }
+                break;
+            case '"':
+                s = skip_string(s + 1, end);
+                if (s == NULL) {
+                    return NULL;
+                }
+                break;
+            default:
+                break;
+        }
+        s++;
+    }
+    return NULL; /* unterminated container */
+}
+
+/*
+ * find_member — Given s just after an object's '{', returns the value
+ * of member 'key', or NULL with *rc set.
+ */
+static const char *find_member(const char *s, const char *end,
+                               const char *key, size_t klen, int *rc)
+{
+    const char *k, *kend;
+    int         escaped;
+
+    *rc = JASON_MALFORMED;
+    s   = skip_ws(s, end);
+    if (s < end && *s == '}') {
+        *rc = JASON_NOT_FOUND;
+        return NULL;
+    }
+    while (s < end && *s == '"') {
+        k    = s + 1;
+        kend = string_end(k, end, &escaped);
+        if (kend == NULL) {
+            return NULL;
+        }
+        s = skip_ws(kend + 1, end);
+        if (s == end || *s != ':') {
+            return NULL;
+        }
+        s = skip_ws(s + 1, end);
+        if (key_equals(k, (size_t)(kend - k), escaped, key, klen)) {
+            return s;
+        }
+        s = skip_value(s, end);
+        if (s == NULL) {
+            return NULL;
+        }
+        s = skip_ws(s, end);
+        if (s < end && *s == '}') {
+            *rc = JASON_NOT_FOUND;
+            return NULL;
+        }
+        if (s == end || *s != ',') {
+            return NULL;
+        }
+        s = skip_ws(s + 1, end);
+    }
+    return NULL;
+}
+
+/*
+ * find_element — Given s just after an array's '[', returns element
+ * 'index', or NULL with *rc set.
+ */
+static const char *find_element(const char *s, const char *end,
+                                unsigned long index, int *rc)
+{
+    *rc = JASON_MALFORMED;
+    s   = skip_ws(s, end);
+    if (s < end && *s == ']') {
+        *rc = JASON_NOT_FOUND;
+        return NULL;
+    }
+    for (; index > 0; index--) {
+        s = skip_value(s, end);
+        if (s == NULL) {
+            return NULL;
+        }
+        s = skip_ws(s, end);
+        if (s < end && *s == ']') {
+            *rc = JASON_NOT_FOUND;
+            return NULL;
+        }
+        if (s == end || *s != ',') {
+            return NULL;
+        }
+        s = skip_ws(s + 1, end);
+    }
+    return s;
+}
+
+int jason_get(struct jason_parser *p, const char *json, size_t len,
+              const char *path, struct jason_slice *out)
+{
+    const char   *s   = json;
+    const char   *end = json + len;
+    const char   *v;
+    char         *digits_end;
+    unsigned long index;
+    size_t        klen;
+    int           escaped;
+    int           rc;
+
+    s = skip_ws(s, end);
+    while (*path != '\0') {
+        if (*path == '.') {
+            path++;
+            continue;
+        }
+        if (s == end) {
+            return JASON_MALFORMED;
+        }
+        if (*path == '[') {
+            index = strtoul(path + 1, &digits_end, 10);
+            if (digits_end == path + 1 || *digits_end != ']') {
+                return JASON_NOT_FOUND; /* not a path */
+            }
+            path = digits_end + 1;
+            if (*s != '[') {
+                return (*s == '{' || *s == '"' || skip_value(s, end) != NULL)
+                           ? JASON_NOT_FOUND : JASON_MALFORMED;
+            }
+            s = find_element(s + 1, end, index, &rc);
+        } else {
+            klen = strcspn(path, ".[");
+            if (*s != '{') {
+                return (*s == '[' || *s == '"' || skip_value(s, end) != NULL)
+                           ? JASON_NOT_FOUND : JASON_MALFORMED;
+            }
+            s     = find_member(s + 1, end, path, klen, &rc);
+            path += klen;
+        }
+        if (s == NULL) {
+            return rc;
+        }
+    }
+
+    /* The value itself */
+    if (s == end) {
+        return JASON_MALFORMED;
+    }
+    if (*s == '"') {
+        v = string_end(s + 1, end, &escaped);
+        if (v == NULL) {
+            return JASON_MALFORMED;
+        }
+        out->type = JASON_STRING;
+        out->len  = (size_t)(v - (s + 1));
+        if (!escaped) {
+            out->ptr = s + 1;
+            return 0;
+        }
+        if (arena_reserve(p, out->len) != 0) {
+            return JASON_NO_MEMORY;
+        }
+        out->ptr  = p->arena + p->used;
+        out->len  = decode_string(s + 1, out->len, p->arena + p->used);
+        p->used  += out->len;
+        return 0;
+    }
+
+    v = skip_value(s, end);
+    if (v == NULL) {
+        return JASON_MALFORMED;
+    }
+    switch (*s) {
+        case '{': out->type = JASON_OBJECT; break;
+        case '[': out->type = JASON_ARRAY;  break;
+        case 't': out->type = JASON_TRUE;   break;
+        case 'f': out->type = JASON_FALSE;  break;
+        case 'n': out->type = JASON_NULL;   break;
+        default:  out->type = JASON_NUMBER; break;
+    }
+    out->ptr = s;
+    out->len = (size_t)(v - s);
+    return 0;
+}
@@ -0,0 +1,110 @@
+/*
+ * jasonlib.h — Allocation-free JSON value extraction.
+ *
+ * A jason_parser finds the value at a path such as
+ * "choices[0].message.content" in a JSON document without building a
+ * tree: it scans the document once and skips everything off the path.
+ * Values come back as slices of the input.  Only a string that contains
+ * escape sequences has to be decoded, and it is decoded into the
+ * parser's arena.
+ *
+ * The arena is a buffer the caller lends (a stack array, say), or one
+ * the parser allocates and grows itself.  jason_parser_reset() rewinds
+ * it in O(1), so a parser kept from one document to the next stops
+ * allocating once its arena has grown to the largest decoded string.
+ *
+ * Compilation: built together with jason.c (see jason.c).
+ */
+
+#ifndef JASONLIB_H
+#define JASONLIB_H
+
+#include <stddef.h> /* size_t */
+
+/* jason_get() results other than 0 */
+#define JASON_NOT_FOUND  (-1) /* the document has no value at the path */
+#define JASON_MALFORMED  (-2) /* the document is not valid JSON        */
+#define JASON_NO_MEMORY  (-3) /* the arena could not grow              */
+
+enum jason_type {
+    JASON_STRING,
+    JASON_NUMBER,
+    JASON_OBJECT,
+    JASON_ARRAY,
+    JASON_TRUE,
+    JASON_FALSE,
+    JASON_NULL
+};
+
+/*
+ * A value found by jason_get().  For a string, ptr/len is its decoded
+ * text, without the quotes: a slice of the document when the string
+ * has no escapes, else a slice of the arena.  For any other type it is
+ * the value's JSON text in the document.  Not NUL-terminated.
+ */
+struct jason_slice {
+    const char     *ptr;
+    size_t          len;
+    enum jason_type type;
+};
+
+/*
+ * Parser state.  Treat the fields as private; they are here so that a
+ * parser can live on the stack or inside another structure.
+ */
+struct jason_parser {
+    char          *arena;   /* where decoded strings go               */
+    size_t         cap;     /* bytes in arena                         */
+    size_t         used;    /* bytes handed out since the last reset  */
+    int            owned;   /* arena was allocated by the parser      */
+    void          *retired; /* outgrown arenas, freed at reset        */
+    unsigned long  allocs;  /* arenas allocated so far                */
+};
+
+/*
+ * jason_parser_init — Prepares a parser.  'buf' (cap bytes) is lent to
+ * it as its first arena and must outlive it; buf may be NULL (cap 0),
+ * in which case the arena is allocated when first needed.
+ */
+void jason_parser_init(struct jason_parser *p, char *buf, size_t cap);
+
+/*
+ * jason_parser_reset — Forgets every decoded string, making the arena
+ * free again.  Slices of the arena from before are then invalid.  O(1)
+ * once the arena has stopped growing.
+ */
+void jason_parser_reset(struct jason_parser *p);
+
+/*
+ * jason_parser_free — Frees whatever the parser allocated.  The parser
+ * may be initialised again afterwards.
+ */
+void jason_parser_free(struct jason_parser *p);
+
+/*
+ * jason_get — Finds the value at 'path' in the JSON document
+ * json[0..len).
+ *
+ * A path is a sequence of object keys and array indexes: "a.b[2].c",
+ * "[0]", or "" for the document itself.  Keys containing '.' or '[' can
+ * not be expressed.
+ *
+ * Only the part of the document read on the way to the value is
+ * checked; values that are skipped are checked for balanced brackets
+ * and terminated strings only.
+ *
+ * Returns:
+ *   0 with *out filled in, or JASON_NOT_FOUND, JASON_MALFORMED or
+ *   JASON_NO_MEMORY.  Slices stay valid until the document is freed or,
+ *   for decoded strings, until the parser is reset or freed.
+ */
+int jason_get(struct jason_parser *p, const char *json, size_t len,
+              const char *path, struct jason_slice *out);
+
+/*
+ * jason_parser_allocs — Number of arenas the parser has allocated since
+ * it was initialised; constant in the steady state.
+ */
+unsigned long jason_parser_allocs(const struct jason_parser *p);
+
+#endif /* JASONLIB_H */
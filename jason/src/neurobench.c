@@ -0,0 +1,1674 @@
+/*
+ * neurobench.c — Load generator for neurolib, with a built-in mock server.
+ *
+ * Sends a number of requests through neuro_ask, neuro_ask_stream or
+ * neuro_ask_batch and reports requests per second, response bytes per
+ * second and latency percentiles.  With --threads N the requests are
+ * split over N threads, each with its own neuro_client; built with
+ * -fsanitize=thread this doubles as a stress test of the client handles.
+ *
+ * --tokenize measures neuro_count_tokens instead: it counts the tokens
+ * of FILE over and over for a second and reports MB/s.  The vocabulary
+ * comes from NEURO_TOKENIZER; without one the estimate is timed.
+ *
+ * --parse measures jasonlib: it extracts PATH (by default the answer of
+ * a chat completion) from the JSON document in FILE, first with a new
+ * parser per document and then with one parser that is reset between
+ * documents, and reports documents per second and allocations per
+ * document.
+ *
+ * Unless --target is given, the requests go to a mock of the chat
+ * completions endpoint that runs inside this process: a TLS server on
+ * 127.0.0.1 with a self-signed certificate generated at start-up.  The
+ * mock can add latency, make answers bigger, use chunked encoding, fail
+ * a share of requests and enforce a rate limit (with 429s and the same
+ * headers as the real API).  Like the real API it compresses answers
+ * when the request's Accept-Encoding allows it.  With --http2 the mock
+ * also speaks HTTP/2, answering the streams of a connection side by
+ * side, and neurolib offers it.  neurolib is pointed at the mock through
+ * NEURO_API_HOST and NEURO_API_PORT, the same override any program can
+ * use.
+ *
+ * Usage:
+ *   neurobench [--mode ask|stream|batch] [--requests N] [--concurrency N]
+ *              [--latency MS] [--size BYTES] [--chunked] [--errors PCT]
+ *              [--rate-limit RPS] [--no-pacing] [--retries N]
+ *              [--threads N] [--encoding NAME] [--http2]
+ *              [--target HOST:PORT]
+ *   neurobench --tokenize FILE
+ *   neurobench --parse FILE [PATH]
+ *
+ * Compilation (with neurolib):
+ *   gcc -Wall -Wextra -Werror -pedantic -c neurolib.c
+ *   gcc -Wall -Wextra -Werror -pedantic -c neurocache.c
+ *   gcc -Wall -Wextra -Werror -pedantic -c neurotok.c
+ *   gcc -Wall -Wextra -Werror -pedantic -c neuroh2.c
+ *   gcc -Wall -Wextra -Werror -pedantic -c jasonlib.c
+ *   gcc -Wall -Wextra -Werror -pedantic -c neurobench.c
+ *   gcc -o neurobench neurobench.o neurolib.o neurocache.o neurotok.o \
+ *       neuroh2.o jasonlib.o -lssl -lcrypto -lz -pthread
+ * With -DNEURO_BROTLI (and -lbrotlienc -lbrotlidec) the mock can also
+ * answer in br; with -DNEURO_ZSTD (and -lzstd) in zstd.
+ */
+
+#include <stdio.h>      /* printf, fprintf, snprintf                    */
+#include <stdlib.h>     /* malloc, free, strtol, setenv, qsort          */
+#include <string.h>     /* strcmp, strlen, memcpy, strstr               */
+#include <strings.h>    /* strncasecmp                                  */
+#include <time.h>       /* clock_gettime, nanosleep                     */
+#include <pthread.h>    /* pthread_create, pthread_detach               */
+#include <ctype.h>      /* tolower                                      */
+
+/* POSIX networking */
+#include <sys/types.h>  /* type definitions required by socket headers  */
+#include <sys/socket.h> /* socket, bind, listen, accept                 */
+#include <netinet/in.h> /* struct sockaddr_in, IPPROTO_TCP              */
+#include <netinet/tcp.h> /* TCP_NODELAY                                 */
+#include <arpa/inet.h>  /* htonl, htons, ntohs                          */
+#include <unistd.h>     /* close, getpid                                */
+#include <fcntl.h>      /* fcntl, O_NONBLOCK                            */
+#include <poll.h>       /* poll                                         */
+
+/* OpenSSL TLS and certificate generation */
+#include <openssl/ssl.h>     /* SSL_CTX, SSL, SSL_accept, ...           */
+#include <openssl/x509.h>    /* X509_new, X509_sign, ...                */
+#include <openssl/evp.h>     /* EVP_EC_gen, EVP_sha256                  */
+
+/* Compression of the mock's answers */
+#include <zlib.h>            /* deflateInit2, compress2                 */
+#ifdef NEURO_BROTLI
+#include <brotli/encode.h>   /* BrotliEncoderCompress                   */
+#endif
+#ifdef NEURO_ZSTD
+#include <zstd.h>            /* ZSTD_compress                           */
+#endif
+
+#include "jasonlib.h"   /* jason_parser, jason_get                      */
+#include "neurolib.h"   /* neuro_ask*, neuro_set_timing_cb, ...         */
+#include "neuroh2.h"    /* neuro_h2_*, for the mock's HTTP/2            */
+
+/* -------------------------------------------------------------------------
+ * Constants
+ * ---------------------------------------------------------------------- */
+
+/* Defaults for the command-line options */
+#define DEFAULT_REQUESTS    1000
+#define DEFAULT_CONCURRENCY 1
+#define DEFAULT_SIZE        256
+
+/* Bytes of answer text per Server-Sent Event in stream mode */
+#define MOCK_SSE_FRAGMENT 64
+
+/* Value --parse extracts when no PATH is given */
+#define PARSE_PATH "choices[0].message.content"
+
+/* Chunk size used by the mock for chunked bodies */
+#define MOCK_CHUNK 4096
+
+/* Header fields in an HTTP/2 answer of the mock, and their block */
+#define MOCK_H2_FIELDS 16
+#define MOCK_H2_BLOCK  1024
+
+/* Usage line shown for a bad option */
+#define USAGE "Usage: %s [--mode ask|stream|batch] [--requests N] " \
+              "[--concurrency N]\n" \
+              "       [--latency MS] [--size BYTES] [--chunked] " \
+              "[--errors PCT]\n" \
+              "       [--rate-limit RPS] [--no-pacing] [--retries N] " \
+              "[--threads N]\n" \
+              "       [--encoding NAME] [--http2] [--target HOST:PORT]\n" \
+              "       %s --tokenize FILE\n" \
+              "       %s --parse FILE [PATH]\n"
+
+/* -------------------------------------------------------------------------
+ * Mock server
+ * ---------------------------------------------------------------------- */
+
+/* Content codings the mock can answer with, in order of preference */
+static const char *const mock_codings[] = {
+#ifdef NEURO_BROTLI
+    "br",
+#endif
+#ifdef NEURO_ZSTD
+    "zstd",
+#endif
+    "gzip", "deflate"
+};
+#define MOCK_CODINGS (sizeof(mock_codings) / sizeof(mock_codings[0]))
+
+/* Bodies of the injected errors */
+static const char mock_err[]  = "{\"error\":{\"message\":\"mock 500\"}}";
+static const char mock_slow[] = "{\"error\":{\"message\":\"rate limited\"}}";
+
+/* How the mock answers, and what it has done so far */
+struct mock {
+    SSL_CTX       *ctx;        /* server TLS context (self-signed cert)   */
+    int            lsock;      /* listening socket                        */
+    int            port;       /* port it listens on                      */
+    long           latency_ms; /* delay before every answer               */
+    int            chunked;    /* chunked bodies instead of Content-Length */
+    int            error_pct;  /* share of requests answered with 500     */
+    const char    *text;       /* answer text (--size bytes of letters)   */
+    size_t         text_len;
+    char          *json;       /* the whole non-streamed answer           */
+    size_t         json_len;
+    char          *sse;        /* the whole streamed answer (for HTTP/2)  */
+    size_t         sse_len;
+    char          *coded[MOCK_CODINGS];     /* json in each coding        */
+    size_t         coded_len[MOCK_CODINGS];
+    const char    *encoding;   /* --encoding: the only coding used, or NULL */
+    long           rate_limit; /* requests per second allowed, 0 = any    */
+    int            http2;      /* offer h2 during the TLS handshake       */
+    pthread_mutex_t lock;      /* guards level and last                   */
+    double         level;      /* requests the client may still send      */
+    double         last;       /* when level was last topped up (s)       */
+    unsigned long  answered;   /* responses sent (atomic)                 */
+    unsigned long  failed;     /* of which injected errors (atomic)       */
+    unsigned long  limited;    /* of which 429s (atomic)                  */
+    unsigned long long wire;   /* HTTP bytes written (atomic)             */
+    unsigned long  conns;      /* connections accepted (atomic)           */
+    unsigned long  conns_h2;   /* of which over HTTP/2 (atomic)           */
+};
+
+/* What the mock answers a request with */
+enum { MOCK_OK, MOCK_ERROR, MOCK_LIMITED };
+
+/* One accepted connection */
+struct mock_conn {
+    struct mock *m;
+    int          sock;
+};
+
+/* A request on an HTTP/2 connection of the mock */
+struct mock_stream {
+    struct mock_stream *next;     /* next stream of the connection      */
+    struct mock        *m;        /* the mock                           */
+    unsigned int        id;       /* stream id                          */
+    int                 coding;   /* mock_codings index, or -1          */
+    char               *body;     /* request body so far                */
+    size_t              len;
+    size_t              cap;
+    double              due;      /* when to answer (s), 0 = not ended  */
+    int                 answered; /* the response has been queued       */
+    int                 closed;   /* on_close has been called           */
+};
+
+/* An HTTP/2 connection of the mock */
+struct mock_h2 {
+    struct mock        *m;
+    struct mock_stream *streams;  /* open streams, newest first         */
+    int                 failed;   /* out of memory: give up             */
+};
+
+/*
+ * mock_cert — Gives the context a fresh P-256 key and a self-signed
+ * certificate for "localhost", valid for a day.
+ * Returns 0 on success, -1 on failure.
+ */
+static int mock_cert(SSL_CTX *ctx)
+{
+    EVP_PKEY  *key;  /* private key                    */
+    X509      *cert; /* certificate                    */
+    X509_NAME *name; /* subject, and issuer (the same) */
+    int        ok;
+
+    key  = EVP_EC_gen("P-256");
+    cert = X509_new();
+    ok   = (key != NULL && cert != NULL);
+    if (ok) {
+        X509_set_version(cert, 2); /* v3 */
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), (long)getpid());
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 24L * 60 * 60);
+        X509_set_pubkey(cert, key);
+        name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                                   (const unsigned char *)"localhost", -1,
+                                   -1, 0);
+        X509_set_issuer_name(cert, name);
+        ok = X509_sign(cert, key, EVP_sha256()) > 0 &&
+             SSL_CTX_use_certificate(ctx, cert) == 1 &&
+             SSL_CTX_use_PrivateKey(ctx, key) == 1;
+    }
+    X509_free(cert);     /* the context holds its own references */
+    EVP_PKEY_free(key);
+    return ok ? 0 : -1;
+}
+
+/*
+ * mock_write — Writes all of 'data' and counts it.  Returns 0 on
+ * success, -1 if the client went away.
+ */
+static int mock_write(struct mock *m, SSL *ssl, const char *data, size_t len)
+{
+    int n;
+
+    __atomic_fetch_add(&m->wire, (unsigned long long)len, __ATOMIC_RELAXED);
+    while (len > 0) {
+        n = SSL_write(ssl, data, (int)len);
+        if (n <= 0) {
+            return -1;
+        }
+        data += n;
+        len  -= (size_t)n;
+    }
+    return 0;
+}
+
+/*
+ * mock_read_request — Reads one HTTP request (headers and
+ * Content-Length body) into *buf, growing it as needed.
+ * Returns the total length, or -1 on EOF or a malformed request.
+ */
+static long mock_read_request(SSL *ssl, char **buf, size_t *cap)
+{
+    size_t  len;      /* bytes in *buf                         */
+    size_t  head;     /* length of the header block, 0 = unknown */
+    size_t  body;     /* Content-Length                        */
+    char   *end;      /* end of the header block               */
+    char   *line;     /* header line being looked at           */
+    char   *grown;
+    int     n;
+
+    len  = 0;
+    head = 0;
+    body = 0;
+    for (;;) {
+        if (head != 0 && len >= head + body) {
+            return (long)len;
+        }
+        if (len + 4096 + 1 > *cap) {
+            grown = (char *)realloc(*buf, *cap * 2 + 4096);
+            if (grown == NULL) {
+                return -1;
+            }
+            *buf = grown;
+            *cap = *cap * 2 + 4096;
+        }
+        n = SSL_read(ssl, *buf + len, 4096);
+        if (n <= 0) {
+            return -1;
+        }
+        len += (size_t)n;
+        (*buf)[len] = '\0';
+
+        if (head == 0 && (end = strstr(*buf, "\r\n\r\n")) != NULL) {
+            head = (size_t)(end - *buf) + 4;
+            for (line = *buf; line < end; line = strstr(line, "\r\n") + 2) {
+                if (strncasecmp(line, "Content-Length:", 15) == 0) {
+                    body = (size_t)strtoul(line + 15, NULL, 10);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * mock_compress — Compresses m->json in the coding mock_codings[i] into
+ * m->coded[i].  Returns 0 on success, -1 on failure.
+ */
+static int mock_compress(struct mock *m, size_t i)
+{
+    const char *name = mock_codings[i];
+    size_t      cap  = m->json_len + m->json_len / 8 + 1024; /* ample */
+    uLongf      zlen;  /* compress2 in/out length */
+    z_stream    zs;
+    int         ok = 0;
+
+    m->coded[i] = (char *)malloc(cap);
+    if (m->coded[i] == NULL) {
+        return -1;
+    }
+    if (strcmp(name, "deflate") == 0) {
+        zlen = (uLongf)cap;
+        ok = compress2((Bytef *)m->coded[i], &zlen, (const Bytef *)m->json,
+                       (uLong)m->json_len, 6) == Z_OK;
+        m->coded_len[i] = (size_t)zlen;
+    } else if (strcmp(name, "gzip") == 0) {
+        memset(&zs, 0, sizeof(zs));
+        if (deflateInit2(&zs, 6, Z_DEFLATED, 15 + 16, 8,
+                         Z_DEFAULT_STRATEGY) == Z_OK) {
+            zs.next_in   = (Bytef *)m->json;
+            zs.avail_in  = (uInt)m->json_len;
+            zs.next_out  = (Bytef *)m->coded[i];
+            zs.avail_out = (uInt)cap;
+            ok = deflate(&zs, Z_FINISH) == Z_STREAM_END;
+            m->coded_len[i] = cap - zs.avail_out;
+            deflateEnd(&zs);
+        }
+    }
+#ifdef NEURO_BROTLI
+    else if (strcmp(name, "br") == 0) {
+        m->coded_len[i] = cap;
+        ok = BrotliEncoderCompress(5, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT,
+                                   m->json_len, (const uint8_t *)m->json,
+                                   &m->coded_len[i],
+                                   (uint8_t *)m->coded[i]) == BROTLI_TRUE;
+    }
+#endif
+#ifdef NEURO_ZSTD
+    else if (strcmp(name, "zstd") == 0) {
+        m->coded_len[i] = ZSTD_compress(m->coded[i], cap, m->json,
+                                        m->json_len, 3);
+        ok = !ZSTD_isError(m->coded_len[i]);
+    }
+#endif
+    return ok ? 0 : -1;
+}
+
+/*
+ * mock_accepts — True if the Accept-Encoding value in [value, end) lists
+ * 'name' as a whole token.
+ */
+static int mock_accepts(const char *value, const char *end, const char *name)
+{
+    size_t      n = strlen(name);
+    const char *p;
+
+    for (p = value; p + n <= end; p++) {
+        if (strncasecmp(p, name, n) == 0 &&
+            (p == value || p[-1] == ' ' || p[-1] == ',') &&
+            (p + n == end || p[n] == ',' || p[n] == ' ' || p[n] == ';')) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * mock_pick — The coding to answer with, as an index into mock_codings,
+ * or -1 for none: the first one (or just --encoding) that the
+ * Accept-Encoding value in [value, end) lists.
+ */
+static int mock_pick(const struct mock *m, const char *value,
+                     const char *end)
+{
+    size_t i;
+
+    for (i = 0; i < MOCK_CODINGS; i++) {
+        if ((m->encoding == NULL ||
+             strcmp(m->encoding, mock_codings[i]) == 0) &&
+            mock_accepts(value, end, mock_codings[i])) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * mock_pick_coding — mock_pick for the Accept-Encoding header of an
+ * HTTP/1.1 request.
+ */
+static int mock_pick_coding(const struct mock *m, const char *req)
+{
+    const char *line; /* header line being looked at */
+    const char *end;  /* its CRLF                    */
+
+    for (line = req; (end = strstr(line, "\r\n")) != NULL && end != line;
+         line = end + 2) {
+        if (strncasecmp(line, "Accept-Encoding:", 16) == 0) {
+            return mock_pick(m, line + 16, end);
+        }
+    }
+    return -1;
+}
+
+/*
+ * mock_answer — Sends the response to one request: an injected 500, a
+ * 429 when over the limit, an event stream, or the JSON answer (chunked
+ * or not).  'limits' holds the rate-limit header lines, possibly "".
+ * The JSON answer is sent in coding 'coding' (an index into
+ * mock_codings, or -1 for none); events and errors never are.
+ * Returns 0 on success, -1 if the client went away.
+ */
+static int mock_answer(struct mock *m, SSL *ssl, int stream, int kind,
+                       int coding, const char *limits)
+{
+    static const char done[] = "e\r\ndata: [DONE]\n\n\r\n0\r\n\r\n";
+    char   out[MOCK_SSE_FRAGMENT + 512]; /* headers, or one event */
+    char   ev[MOCK_SSE_FRAGMENT + 128];  /* event payload          */
+    char   framing[96];                  /* coding, length/chunked */
+    const char *body;                    /* the JSON answer, coded */
+    size_t body_len;
+    size_t off, part;
+    int    n, e;
+
+    if (kind != MOCK_OK) {
+        n = snprintf(out, sizeof(out),
+                     "HTTP/1.1 %s\r\n"
+                     "Content-Type: application/json\r\n"
+                     "Content-Length: %zu\r\n"
+                     "%s\r\n%s",
+                     kind == MOCK_ERROR ? "500 Internal Server Error"
+                                        : "429 Too Many Requests",
+                     kind == MOCK_ERROR ? sizeof(mock_err) - 1
+                                        : sizeof(mock_slow) - 1,
+                     limits, kind == MOCK_ERROR ? mock_err : mock_slow);
+        return mock_write(m, ssl, out, (size_t)n);
+    }
+
+    body     = m->json;
+    body_len = m->json_len;
+    if (!stream && coding >= 0) {
+        body     = m->coded[coding];
+        body_len = m->coded_len[coding];
+    }
+    n = 0;
+    if (!stream && coding >= 0) {
+        n = snprintf(framing, sizeof(framing), "Content-Encoding: %s\r\n",
+                     mock_codings[coding]);
+    }
+    if (stream || m->chunked) {
+        snprintf(framing + n, sizeof(framing) - (size_t)n,
+                 "Transfer-Encoding: chunked");
+    } else {
+        snprintf(framing + n, sizeof(framing) - (size_t)n,
+                 "Content-Length: %zu", body_len);
+    }
+    n = snprintf(out, sizeof(out),
+                 "HTTP/1.1 200 OK\r\n"
+                 "Content-Type: %s\r\n"
+                 "%s%s\r\n\r\n",
+                 stream ? "text/event-stream" : "application/json", limits,
+                 framing);
+    if (mock_write(m, ssl, out, (size_t)n) != 0) {
+        return -1;
+    }
+    if (!stream && !m->chunked) {
+        return mock_write(m, ssl, body, body_len);
+    }
+
+    if (stream) {
+        for (off = 0; off < m->text_len; off += part) {
+            part = m->text_len - off;
+            if (part > MOCK_SSE_FRAGMENT) {
+                part = MOCK_SSE_FRAGMENT;
+            }
+            e = snprintf(ev, sizeof(ev),
+                         "data: {\"choices\":[{\"delta\":{\"content\":"
+                         "\"%.*s\"}}]}\n\n", (int)part, m->text + off);
+            n = snprintf(out, sizeof(out), "%x\r\n%s\r\n", e, ev);
+            if (mock_write(m, ssl, out, (size_t)n) != 0) {
+                return -1;
+            }
+        }
+        return mock_write(m, ssl, done, sizeof(done) - 1);
+    }
+
+    for (off = 0; off < body_len; off += part) {
+        part = body_len - off;
+        if (part > MOCK_CHUNK) {
+            part = MOCK_CHUNK;
+        }
+        n = snprintf(out, sizeof(out), "%zx\r\n", part);
+        if (mock_write(m, ssl, out, (size_t)n) != 0 ||
+            mock_write(m, ssl, body + off, part) != 0 ||
+            mock_write(m, ssl, "\r\n", 2) != 0) {
+            return -1;
+        }
+    }
+    return mock_write(m, ssl, "0\r\n\r\n", 5);
+}
+
+/*
+ * mock_admit — Enforces --rate-limit: a bucket of 'rate_limit' requests
+ * that refills at that many per second, shared by all connections.
+ * Takes one request from it if it can, and writes the OpenAI-style
+ * rate-limit headers (with Retry-After when refused) into 'limits'.
+ * Returns 1 if the request may be answered, 0 for a 429.
+ */
+static int mock_admit(struct mock *m, char *limits, size_t size)
+{
+    struct timespec ts;
+    double          now, wait_ms;
+    int             ok;
+
+    limits[0] = '\0';
+    if (m->rate_limit <= 0) {
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now = (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+
+    pthread_mutex_lock(&m->lock);
+    if (m->last == 0.0) {
+        m->level = m->rate_limit; /* starts full */
+    } else {
+        m->level += (now - m->last) * m->rate_limit;
+        if (m->level > m->rate_limit) {
+            m->level = m->rate_limit;
+        }
+    }
+    m->last = now;
+    ok = (m->level >= 1.0);
+    if (ok) {
+        m->level -= 1.0;
+    }
+    wait_ms = ok ? 0.0 : (1.0 - m->level) / m->rate_limit * 1000.0;
+    snprintf(limits, size,
+             "x-ratelimit-limit-requests: %ld\r\n"
+             "x-ratelimit-remaining-requests: %ld\r\n"
+             "x-ratelimit-reset-requests: %.0fms\r\n",
+             m->rate_limit, (long)m->level,
+             (m->rate_limit - m->level) / m->rate_limit * 1000.0);
+    pthread_mutex_unlock(&m->lock);
+
+    if (!ok) {
+        snprintf(limits + strlen(limits), size - strlen(limits),
+                 "retry-after-ms: %.0f\r\nRetry-After: 1\r\n", wait_ms + 1.0);
+    }
+    return ok;
+}
+
+/*
+ * mock_kind — Decides how to answer the next request (MOCK_*): a 429 if
+ * over the rate limit, an injected 500 for --errors of them, else the
+ * answer.  Fills in 'limits' as mock_admit does and counts the response.
+ */
+static int mock_kind(struct mock *m, unsigned long long *rng, char *limits,
+                     size_t size)
+{
+    int kind;
+
+    *rng ^= *rng >> 12;
+    *rng ^= *rng << 25;
+    *rng ^= *rng >> 27;
+    kind = MOCK_OK;
+    if (!mock_admit(m, limits, size)) {
+        kind = MOCK_LIMITED;
+    } else if ((int)((*rng * 0x2545F4914F6CDD1DULL) >> 33) % 100 <
+               m->error_pct) {
+        kind = MOCK_ERROR;
+    }
+    /* Counted first: the client may finish before we return */
+    __atomic_fetch_add(&m->answered, 1, __ATOMIC_RELAXED);
+    if (kind == MOCK_ERROR) {
+        __atomic_fetch_add(&m->failed, 1, __ATOMIC_RELAXED);
+    } else if (kind == MOCK_LIMITED) {
+        __atomic_fetch_add(&m->limited, 1, __ATOMIC_RELAXED);
+    }
+    return kind;
+}
+
+/*
+ * mock_alpn — ALPN callback: picks h2 if --http2 was given and the
+ * client offers it, else http/1.1.
+ */
+static int mock_alpn(SSL *ssl, const unsigned char **out,
+                     unsigned char *outlen, const unsigned char *in,
+                     unsigned int inlen, void *arg)
+{
+    const struct mock *m = (const struct mock *)arg;
+    const unsigned char *ours; /* our list, in order of preference */
+    unsigned char       *sel;
+    unsigned int         len;
+
+    (void)ssl;
+    ours = (const unsigned char *)(m->http2 ? NEURO_H2_ALPN
+                                            : NEURO_H2_ALPN + 3);
+    len  = m->http2 ? NEURO_H2_ALPN_LEN : NEURO_H2_ALPN_LEN - 3;
+    if (SSL_select_next_proto(&sel, outlen, ours, len, in, inlen) !=
+        OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = sel;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+/* -------------------------------------------------------------------------
+ * Mock server over HTTP/2
+ *
+ * One thread per connection, as for HTTP/1.1, but the thread does not
+ * sleep through --latency: each request gets a due time when its last
+ * byte arrives and is answered when that comes, so the streams of a
+ * connection are served side by side.  The socket is non-blocking and
+ * the thread waits in poll() for the peer or the next due time.
+ * ---------------------------------------------------------------------- */
+
+/*
+ * mock_now — Monotonic time in seconds.
+ */
+static double mock_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * h2m_open — on_open: a request starts.
+ */
+static void *h2m_open(void *user, unsigned int id)
+{
+    struct mock_h2     *mh = (struct mock_h2 *)user;
+    struct mock_stream *s;
+
+    s = (struct mock_stream *)calloc(1, sizeof(*s));
+    if (s == NULL) {
+        mh->failed = 1;
+        return NULL;
+    }
+    s->m        = mh->m;
+    s->id       = id;
+    s->coding   = -1;
+    s->next     = mh->streams;
+    mh->streams = s;
+    return s;
+}
+
+/*
+ * h2m_header — on_header: only Accept-Encoding matters to the mock.
+ */
+static int h2m_header(void *stream, const char *name, size_t name_len,
+                      const char *value, size_t value_len)
+{
+    struct mock_stream *s = (struct mock_stream *)stream;
+
+    if (name_len == 15 && memcmp(name, "accept-encoding", 15) == 0) {
+        s->coding = mock_pick(s->m, value, value + value_len);
+    }
+    return 0;
+}
+
+/*
+ * h2m_headers_end — on_headers_end: nothing to do.
+ */
+static int h2m_headers_end(void *stream)
+{
+    (void)stream;
+    return 0;
+}
+
+/*
+ * h2m_data — on_data: keeps the request body, to see whether it asks
+ * for a stream.
+ */
+static int h2m_data(void *stream, const char *data, size_t len)
+{
+    struct mock_stream *s = (struct mock_stream *)stream;
+    char               *grown;
+
+    if (s->len + len + 1 > s->cap) {
+        grown = (char *)realloc(s->body, s->cap * 2 + len + 1);
+        if (grown == NULL) {
+            return -1; /* resets the stream */
+        }
+        s->body = grown;
+        s->cap  = s->cap * 2 + len + 1;
+    }
+    memcpy(s->body + s->len, data, len);
+    s->len += len;
+    s->body[s->len] = '\0';
+    return 0;
+}
+
+/*
+ * h2m_end — on_end: the request is complete; it is due --latency later.
+ */
+static void h2m_end(void *stream)
+{
+    struct mock_stream *s = (struct mock_stream *)stream;
+
+    s->due = mock_now() + (double)s->m->latency_ms / 1000.0;
+}
+
+/*
+ * h2m_close — on_close: the stream is freed by mock_conn_h2.
+ */
+static void h2m_close(void *stream, int error)
+{
+    (void)error;
+    ((struct mock_stream *)stream)->closed = 1;
+}
+
+static const struct neuro_h2_cbs h2m_cbs = {
+    h2m_open, h2m_header, h2m_headers_end, h2m_data, h2m_end, h2m_close
+};
+
+/*
+ * mock_respond_h2 — Queues the answer to stream s, as mock_answer sends
+ * it over HTTP/1.1 ('limits' is overwritten).  The bodies belong to the
+ * mock and outlive the stream.  --chunked leaves out content-length.
+ * Returns 0, or -1 if the stream could not be answered.
+ */
+static int mock_respond_h2(struct mock *m, struct neuro_h2 *h2,
+                           struct mock_stream *s, int kind, char *limits)
+{
+    struct neuro_h2_field f[MOCK_H2_FIELDS];
+    struct neuro_h2_chunk body;
+    char   block[MOCK_H2_BLOCK];
+    char   length[24];
+    char  *line, *colon, *end, *c;
+    size_t n, len;
+    int    stream;
+
+    stream = (s->body != NULL && strstr(s->body, "\"stream\":true") != NULL);
+    if (kind != MOCK_OK) {
+        body.data = (kind == MOCK_ERROR) ? mock_err : mock_slow;
+        body.len  = (kind == MOCK_ERROR) ? sizeof(mock_err) - 1
+                                         : sizeof(mock_slow) - 1;
+    } else if (stream) {
+        body.data = m->sse;
+        body.len  = m->sse_len;
+    } else if (s->coding >= 0) {
+        body.data = m->coded[s->coding];
+        body.len  = m->coded_len[s->coding];
+    } else {
+        body.data = m->json;
+        body.len  = m->json_len;
+    }
+
+    memset(f, 0, sizeof(f));
+    n = 0;
+    f[n].name    = ":status";
+    f[n++].value = (kind == MOCK_OK) ? "200"
+                 : (kind == MOCK_ERROR) ? "500" : "429";
+    f[n].name    = "content-type";
+    f[n++].value = (kind == MOCK_OK && stream) ? "text/event-stream"
+                                               : "application/json";
+    if (kind == MOCK_OK && !stream && s->coding >= 0) {
+        f[n].name    = "content-encoding";
+        f[n++].value = mock_codings[s->coding];
+    }
+    if (!stream && !m->chunked) {
+        snprintf(length, sizeof(length), "%zu", body.len);
+        f[n].name    = "content-length";
+        f[n++].value = length;
+    }
+    /* The rate-limit lines, split in place into lower-case fields */
+    for (line = limits; n < MOCK_H2_FIELDS &&
+         (end = strstr(line, "\r\n")) != NULL; line = end + 2) {
+        colon = memchr(line, ':', (size_t)(end - line));
+        if (colon == NULL) {
+            continue;
+        }
+        *colon = '\0';
+        *end   = '\0';
+        for (c = line; c < colon; c++) {
+            *c = (char)tolower((unsigned char)*c);
+        }
+        f[n].name    = line;
+        f[n++].value = colon + 1 + (colon[1] == ' ');
+    }
+
+    len = neuro_h2_encode(block, sizeof(block), f, n);
+    if (len == 0) {
+        return -1;
+    }
+    return neuro_h2_respond(h2, s->id, block, len, &body, 1);
+}
+
+/*
+ * mock_flush_h2 — Writes as much of the connection's output as the
+ * socket takes.  Returns 0, or -1 if the client went away.
+ */
+static int mock_flush_h2(struct mock *m, SSL *ssl, struct neuro_h2 *h2)
+{
+    const char *out;
+    size_t      len;
+    int         n, err;
+
+    while ((len = neuro_h2_output(h2, &out)) > 0) {
+        n = SSL_write(ssl, out, len > 65536 ? 65536 : (int)len);
+        if (n <= 0) {
+            err = SSL_get_error(ssl, n);
+            return (err == SSL_ERROR_WANT_WRITE ||
+                    err == SSL_ERROR_WANT_READ) ? 0 : -1;
+        }
+        __atomic_fetch_add(&m->wire, (unsigned long long)n, __ATOMIC_RELAXED);
+        neuro_h2_sent(h2, (size_t)n);
+    }
+    return 0;
+}
+
+/*
+ * mock_conn_h2 — Serves an HTTP/2 connection until the client closes
+ * it.  'rng' is the connection's state for mock_kind.
+ */
+static void mock_conn_h2(struct mock *m, SSL *ssl, int sock,
+                         unsigned long long *rng)
+{
+    struct mock_h2       mh;
+    struct neuro_h2     *h2;
+    struct mock_stream **sp, *s;
+    struct pollfd        pfd;
+    const char          *out;
+    char                 buf[16384];
+    char                 limits[256];
+    double               now, next;
+    int                  n, err, dead, wait_ms;
+
+    memset(&mh, 0, sizeof(mh));
+    mh.m = m;
+    h2 = neuro_h2_new(1, &h2m_cbs, &mh);
+    if (h2 == NULL) {
+        return;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    SSL_set_mode(ssl, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                      SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    dead = 0;
+    for (;;) {
+        /* Answer what is due; note when the next one is */
+        now  = mock_now();
+        next = 0.0;
+        for (s = mh.streams; s != NULL; s = s->next) {
+            if (s->closed || s->answered || s->due == 0.0) {
+                continue;
+            }
+            if (s->due <= now) {
+                s->answered = 1;
+                if (mock_respond_h2(m, h2, s,
+                                    mock_kind(m, rng, limits, sizeof(limits)),
+                                    limits) != 0) {
+                    mh.failed = 1;
+                }
+            } else if (next == 0.0 || s->due < next) {
+                next = s->due;
+            }
+        }
+        if (mock_flush_h2(m, ssl, h2) != 0 || mh.failed) {
+            break;
+        }
+
+        /* Forget closed streams */
+        for (sp = &mh.streams; (s = *sp) != NULL; ) {
+            if (s->closed) {
+                *sp = s->next;
+                free(s->body);
+                free(s);
+            } else {
+                sp = &s->next;
+            }
+        }
+        if (dead && neuro_h2_output(h2, &out) == 0) {
+            break; /* GOAWAY sent */
+        }
+
+        /* Wait for the client, room to write or the next due time */
+        wait_ms = -1;
+        if (next != 0.0) {
+            wait_ms = (int)((next - now) * 1000.0) + 1;
+        }
+        pfd.fd      = sock;
+        pfd.events  = POLLIN;
+        pfd.revents = 0;
+        if (neuro_h2_output(h2, &out) > 0) {
+            pfd.events |= POLLOUT;
+        }
+        if (SSL_pending(ssl) == 0 && poll(&pfd, 1, wait_ms) < 0) {
+            break;
+        }
+
+        /* Take in everything that has arrived */
+        while (!dead) {
+            n = SSL_read(ssl, buf, sizeof(buf));
+            if (n <= 0) {
+                err = SSL_get_error(ssl, n);
+                if (err != SSL_ERROR_WANT_READ &&
+                    err != SSL_ERROR_WANT_WRITE) {
+                    goto done;
+                }
+                break;
+            }
+            if (neuro_h2_feed(h2, buf, (size_t)n) != 0) {
+                dead = 1;
+            }
+        }
+    }
+done:
+    neuro_h2_free(h2);
+    while ((s = mh.streams) != NULL) {
+        mh.streams = s->next;
+        free(s->body);
+        free(s);
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * Mock server connections
+ * ---------------------------------------------------------------------- */
+
+/*
+ * mock_conn — Thread serving one keep-alive connection until the client
+ * closes it, over HTTP/2 if the handshake chose it.
+ */
+static void *mock_conn(void *arg)
+{
+    struct mock_conn    *mc = (struct mock_conn *)arg;
+    struct mock         *m  = mc->m;
+    SSL                 *ssl;
+    char                *buf;  /* request being read          */
+    size_t               cap;
+    long                 len;
+    unsigned long long   rng;  /* xorshift state for errors   */
+    struct timespec      ts;
+    char                 limits[256]; /* rate-limit headers */
+    const unsigned char *proto;       /* ALPN choice        */
+    unsigned int         plen;
+    int                  h2;
+
+    buf = NULL;
+    cap = 0;
+    rng = ((unsigned long long)mc->sock << 32) ^ (unsigned long long)getpid();
+    rng |= 1;
+    ts.tv_sec  = m->latency_ms / 1000;
+    ts.tv_nsec = (m->latency_ms % 1000) * 1000000L;
+
+    ssl = SSL_new(m->ctx);
+    if (ssl != NULL) {
+        SSL_set_fd(ssl, mc->sock);
+        if (SSL_accept(ssl) == 1) {
+            SSL_get0_alpn_selected(ssl, &proto, &plen);
+            h2 = (plen == 2 && memcmp(proto, "h2", 2) == 0);
+            if (h2) {
+                __atomic_fetch_add(&m->conns_h2, 1, __ATOMIC_RELAXED);
+                mock_conn_h2(m, ssl, mc->sock, &rng);
+            }
+            while (!h2 &&
+                   (len = mock_read_request(ssl, &buf, &cap)) > 0) {
+                if (m->latency_ms > 0) {
+                    nanosleep(&ts, NULL);
+                }
+                if (mock_answer(m, ssl, strstr(buf, "\"stream\":true") != NULL,
+                                mock_kind(m, &rng, limits, sizeof(limits)),
+                                mock_pick_coding(m, buf), limits) != 0) {
+                    break;
+                }
+            }
+        }
+        SSL_free(ssl);
+    }
+    close(mc->sock);
+    free(buf);
+    free(mc);
+    return NULL;
+}
+
+/*
+ * mock_accept — Thread that accepts connections for the life of the
+ * process, one thread per connection.
+ */
+static void *mock_accept(void *arg)
+{
+    struct mock      *m = (struct mock *)arg;
+    struct mock_conn *mc;
+    pthread_t         tid;
+    int               sock, one = 1;
+
+    for (;;) {
+        sock = accept(m->lsock, NULL, NULL);
+        if (sock == -1) {
+            continue;
+        }
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        __atomic_fetch_add(&m->conns, 1, __ATOMIC_RELAXED);
+        mc = (struct mock_conn *)malloc(sizeof(*mc));
+        if (mc == NULL) {
+            close(sock);
+            continue;
+        }
+        mc->m    = m;
+        mc->sock = sock;
+        if (pthread_create(&tid, NULL, mock_conn, mc) != 0) {
+            close(sock);
+            free(mc);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    return NULL;
+}
+
+/*
+ * mock_start — Builds the answer, the TLS context and the listening
+ * socket (127.0.0.1, a free port), and starts accepting.
+ * Returns 0 on success, -1 on failure.
+ */
+static int mock_start(struct mock *m, size_t size)
+{
+    static const char head[] =
+        "{\"object\":\"chat.completion\",\"choices\":[{\"index\":0,"
+        "\"message\":{\"role\":\"assistant\",\"content\":\"";
+    static const char tail[] = "\"},\"finish_reason\":\"stop\"}]}";
+    static const char *const words[] = {
+        "the", "model", "answers", "a", "question", "about", "latency",
+        "and", "every", "request", "is", "sent", "over", "one", "connection",
+        "to", "server", "which", "replies", "with", "tokens", "in", "order",
+        "of", "time", "so", "cache", "helps", "when", "prompts", "repeat",
+        "quickly"
+    };
+    unsigned long long rng; /* xorshift state for the words */
+    const char        *word;
+    struct sockaddr_in addr;
+    socklen_t          alen;
+    pthread_t          tid;
+    char              *text;
+    size_t             i, part;
+
+    /* Answer text: words picked at random (letters and spaces, so it
+     * needs no JSON escaping and compresses roughly like prose) */
+    text = (char *)malloc(size + 1);
+    m->json = (char *)malloc(sizeof(head) + size + sizeof(tail));
+    if (text == NULL || m->json == NULL) {
+        free(text);
+        return -1;
+    }
+    rng = 88172645463325252ULL;
+    for (i = 0; i < size; ) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        word = words[rng % (sizeof(words) / sizeof(words[0]))];
+        for (; *word != '\0' && i < size; word++) {
+            text[i++] = *word;
+        }
+        if (i < size) {
+            text[i++] = ' ';
+        }
+    }
+    text[size]  = '\0';
+    m->text     = text;
+    m->text_len = size;
+    memcpy(m->json, head, sizeof(head) - 1);
+    memcpy(m->json + sizeof(head) - 1, text, size);
+    memcpy(m->json + sizeof(head) - 1 + size, tail, sizeof(tail));
+    m->json_len = sizeof(head) - 1 + size + sizeof(tail) - 1;
+    for (i = 0; i < MOCK_CODINGS; i++) {
+        if (mock_compress(m, i) != 0) {
+            return -1;
+        }
+    }
+
+    /* The same text as events, whole, for HTTP/2 (HTTP/1.1 sends each
+     * event as a chunk) */
+    m->sse = (char *)malloc((size / MOCK_SSE_FRAGMENT + 1) *
+                            (MOCK_SSE_FRAGMENT + 128) + 16);
+    if (m->sse == NULL) {
+        return -1;
+    }
+    m->sse_len = 0;
+    for (i = 0; i < size; i += part) {
+        part = size - i;
+        if (part > MOCK_SSE_FRAGMENT) {
+            part = MOCK_SSE_FRAGMENT;
+        }
+        m->sse_len += (size_t)sprintf(m->sse + m->sse_len,
+                                      "data: {\"choices\":[{\"delta\":"
+                                      "{\"content\":\"%.*s\"}}]}\n\n",
+                                      (int)part, text + i);
+    }
+    m->sse_len += (size_t)sprintf(m->sse + m->sse_len, "data: [DONE]\n\n");
+
+    pthread_mutex_init(&m->lock, NULL);
+    m->ctx = SSL_CTX_new(TLS_server_method());
+    if (m->ctx == NULL || mock_cert(m->ctx) != 0) {
+        return -1;
+    }
+    SSL_CTX_set_alpn_select_cb(m->ctx, mock_alpn, m);
+
+    m->lsock = socket(AF_INET, SOCK_STREAM, 0);
+    if (m->lsock == -1) {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port        = 0; /* any free port */
+    alen = sizeof(addr);
+    if (bind(m->lsock, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(m->lsock, 128) != 0 ||
+        getsockname(m->lsock, (struct sockaddr *)&addr, &alen) != 0) {
+        close(m->lsock);
+        return -1;
+    }
+    m->port = ntohs(addr.sin_port);
+
+    if (pthread_create(&tid, NULL, mock_accept, m) != 0) {
+        close(m->lsock);
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ * Load generator
+ * ---------------------------------------------------------------------- */
+
+/* Results gathered while the benchmark runs */
+struct results {
+    double *lat;   /* total latency of each successful request, ms */
+    size_t  n_lat; /* entries in lat                               */
+    size_t  max;   /* capacity of lat                              */
+    size_t  ok;    /* successful requests                          */
+    size_t  bytes; /* response bytes received                      */
+};
+
+/*
+ * on_timing — neuro_timing_cb: keeps the total latency of each request.
+ */
+static void on_timing(const struct neuro_timing *t, void *user)
+{
+    struct results *r = (struct results *)user;
+
+    if (r->n_lat < r->max) {
+        r->lat[r->n_lat++] = t->ms[NEURO_PHASE_TOTAL];
+    }
+}
+
+/*
+ * on_fragment — neuro_stream_cb: counts the streamed bytes.
+ */
+static int on_fragment(const char *text, size_t len, void *user)
+{
+    (void)text;
+    ((struct results *)user)->bytes += len;
+    return 0;
+}
+
+/*
+ * on_answer — neuro_batch_cb: counts the answer and its bytes.
+ */
+static void on_answer(size_t index, char *response, void *user)
+{
+    struct results *r = (struct results *)user;
+
+    (void)index;
+    if (response != NULL) {
+        r->ok++;
+        r->bytes += strlen(response);
+        free(response);
+    }
+}
+
+/*
+ * run_requests — Sends n requests in the given mode, through client 'c'
+ * or, if it is NULL, through the default client.
+ */
+static void run_requests(neuro_client *c, const char *mode,
+                         const char *const *prompts, size_t n,
+                         int concurrency, struct results *r)
+{
+    char  *answer; /* one JSON response */
+    size_t i;
+    int    rc;
+
+    if (strcmp(mode, "batch") == 0) {
+        if (c != NULL) {
+            neuro_client_ask_batch(c, prompts, n, concurrency, on_answer, r);
+        } else {
+            neuro_ask_batch(prompts, n, concurrency, on_answer, r);
+        }
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        if (mode[0] == 's') {
+            rc = (c != NULL)
+                ? neuro_client_ask_stream(c, prompts[i], on_fragment, r)
+                : neuro_ask_stream(prompts[i], on_fragment, r);
+            if (rc == 0) {
+                r->ok++;
+            }
+            continue;
+        }
+        answer = (c != NULL) ? neuro_client_ask(c, prompts[i])
+                             : neuro_ask(prompts[i]);
+        if (answer != NULL) {
+            r->ok++;
+            r->bytes += strlen(answer);
+            free(answer);
+        }
+    }
+}
+
+/* One load-generating thread of --threads, with its own client */
+struct worker {
+    pthread_t          tid;         /* the thread                         */
+    neuro_client      *client;      /* its client                         */
+    const char        *mode;        /* ask, stream or batch               */
+    const char *const *prompts;     /* its share of the prompts           */
+    size_t             n;           /* number of them                     */
+    int                concurrency; /* connections in batch mode          */
+    struct results     r;           /* what it measured                   */
+};
+
+/*
+ * worker_main — Thread body: runs the worker's share of the requests.
+ */
+static void *worker_main(void *arg)
+{
+    struct worker *w = (struct worker *)arg;
+
+    run_requests(w->client, w->mode, w->prompts, w->n, w->concurrency, &w->r);
+    return NULL;
+}
+
+/*
+ * run_threads — Splits the requests over 'threads' workers, each with a
+ * client of its own, and merges their results into *r.  'http2' turns
+ * HTTP/2 on in every client (else NEURO_HTTP2 decides).
+ * Returns 0, or -1 if the workers could not be set up.
+ */
+static int run_threads(long threads, long retries, int http2,
+                       const char *mode, const char *const *prompts,
+                       size_t n, int concurrency, struct results *r)
+{
+    struct worker    *w;    /* the workers                 */
+    struct neuro_opts opts; /* settings of every client    */
+    size_t            first; /* first prompt of a worker   */
+    long              t;
+    long              started = 0;
+
+    w = (struct worker *)calloc((size_t)threads, sizeof(*w));
+    if (w == NULL) {
+        return -1;
+    }
+    first = 0;
+    for (t = 0; t < threads; t++) {
+        neuro_opts_init(&opts);
+        if (retries >= 0) {
+            opts.retries = (int)retries;
+        }
+        if (http2) {
+            opts.http2 = 1;
+        }
+        opts.timing_cb   = on_timing;
+        opts.timing_user = &w[t].r;
+
+        w[t].mode        = mode;
+        w[t].concurrency = concurrency;
+        w[t].prompts     = prompts + first;
+        w[t].n           = n / (size_t)threads +
+                           ((size_t)t < n % (size_t)threads ? 1 : 0);
+        first           += w[t].n;
+        w[t].r.max       = w[t].n;
+        w[t].r.lat       = (double *)malloc((w[t].n + 1) * sizeof(double));
+        w[t].client      = neuro_client_new(&opts);
+        if (w[t].r.lat == NULL || w[t].client == NULL) {
+            break;
+        }
+    }
+    if (t == threads) {
+        for (started = 0; started < threads; started++) {
+            if (pthread_create(&w[started].tid, NULL, worker_main,
+                               &w[started]) != 0) {
+                break;
+            }
+        }
+    }
+    for (t = 0; t < threads; t++) {
+        if (t < started) {
+            pthread_join(w[t].tid, NULL);
+            memcpy(r->lat + r->n_lat, w[t].r.lat,
+                   w[t].r.n_lat * sizeof(double));
+            r->n_lat += w[t].r.n_lat;
+            r->ok    += w[t].r.ok;
+            r->bytes += w[t].r.bytes;
+        }
+        neuro_client_free(w[t].client);
+        free(w[t].r.lat);
+    }
+    free(w);
+    return (started == threads) ? 0 : -1;
+}
+
+/*
+ * cmp_double — qsort comparator for latencies.
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * percentile — Value at 'pct' percent of a sorted array (nearest rank).
+ */
+static double percentile(const double *v, size_t n, double pct)
+{
+    size_t i;
+
+    if (n == 0) {
+        return 0.0;
+    }
+    i = (size_t)(pct / 100.0 * (double)n + 0.999999);
+    if (i < 1) {
+        i = 1;
+    }
+    return v[(i <= n ? i : n) - 1];
+}
+
+/*
+ * now_sec — Seconds on the monotonic clock.
+ */
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * read_whole — Reads the file at 'path' into a malloc'd buffer and sets
+ * *len.  Returns NULL (after saying why) if it cannot.
+ */
+static char *read_whole(const char *path, size_t *len)
+{
+    FILE *f;
+    char *text;
+    long  size;
+
+    f = fopen(path, "rb");
+    if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) <= 0 ||
+        fseek(f, 0, SEEK_SET) != 0) {
+        fprintf(stderr, "neurobench: cannot read %s\n", path);
+        if (f != NULL) {
+            fclose(f);
+        }
+        return NULL;
+    }
+    text = (char *)malloc((size_t)size);
+    if (text == NULL) {
+        fprintf(stderr, "neurobench: out of memory\n");
+        fclose(f);
+        return NULL;
+    }
+    *len = fread(text, 1, (size_t)size, f);
+    fclose(f);
+    return text;
+}
+
+/*
+ * run_tokenize — The --tokenize benchmark.  Returns the exit status.
+ */
+static int run_tokenize(const char *path)
+{
+    const char *vocab;  /* NEURO_TOKENIZER */
+    char       *text;
+    size_t      len, tokens = 0;
+    long        passes = 0;
+    double      t0, elapsed;
+
+    text = read_whole(path, &len);
+    if (text == NULL) {
+        return 1;
+    }
+
+    vocab = getenv("NEURO_TOKENIZER");
+    if (vocab != NULL && neuro_set_tokenizer(vocab) != 0) {
+        fprintf(stderr, "neurobench: %s is not a tiktoken vocabulary\n",
+                vocab);
+        free(text);
+        return 1;
+    }
+
+    t0 = now_sec();
+    do {
+        tokens = neuro_count_tokens(text, len);
+        passes++;
+        elapsed = now_sec() - t0;
+    } while (elapsed < 1.0);
+
+    printf("vocabulary  %s\n",
+           vocab != NULL ? vocab : "none (four bytes per token)");
+    printf("text        %zu bytes, %zu tokens, %.2f bytes per token\n", len,
+           tokens, tokens > 0 ? (double)len / (double)tokens : 0.0);
+    printf("throughput  %.1f MB/s (%ld passes)\n",
+           (double)len * (double)passes / elapsed / 1e6, passes);
+    free(text);
+    return 0;
+}
+
+/*
+ * run_parse — The --parse benchmark.  Extracts 'path' from the document
+ * in FILE for a second with a fresh parser per document, then for a
+ * second with one parser reset between documents, and reports documents
+ * per second and arenas allocated per document for each.  Returns the
+ * exit status.
+ */
+static int run_parse(const char *file, const char *path)
+{
+    struct jason_parser p;
+    struct jason_slice  v;
+    char               *json;
+    size_t              len;
+    unsigned long       allocs, warm;
+    long                docs;
+    double              t0, elapsed;
+    int                 reuse, rc;
+
+    json = read_whole(file, &len);
+    if (json == NULL) {
+        return 1;
+    }
+    jason_parser_init(&p, NULL, 0);
+    rc = jason_get(&p, json, len, path, &v);
+    jason_parser_free(&p);
+    if (rc != 0) {
+        fprintf(stderr, "neurobench: no value at %s in %s (%d)\n", path,
+                file, rc);
+        free(json);
+        return 1;
+    }
+    printf("document    %zu bytes, value %zu bytes\n", len, v.len);
+
+    for (reuse = 0; reuse <= 1; reuse++) {
+        allocs = 0;
+        docs   = 0;
+        jason_parser_init(&p, NULL, 0);
+        jason_get(&p, json, len, path, &v); /* warm-up */
+        jason_parser_reset(&p);
+        warm = jason_parser_allocs(&p);
+        t0   = now_sec();
+        do {
+            if (!reuse) {
+                jason_parser_init(&p, NULL, 0);
+            }
+            jason_get(&p, json, len, path, &v);
+            if (reuse) {
+                jason_parser_reset(&p);
+            } else {
+                allocs += jason_parser_allocs(&p);
+                jason_parser_free(&p);
+            }
+            docs++;
+            elapsed = now_sec() - t0;
+        } while (elapsed < 1.0);
+        if (reuse) {
+            allocs = jason_parser_allocs(&p) - warm;
+            jason_parser_free(&p);
+        }
+        printf("%-11s %.0f docs/s, %.1f MB/s, %.3f allocations/doc\n",
+               reuse ? "reused" : "fresh", (double)docs / elapsed,
+               (double)len * (double)docs / elapsed / 1e6,
+               (double)allocs / (double)docs);
+    }
+    free(json);
+    return 0;
+}
+
+/* =========================================================================
+ * main
+ * ====================================================================== */
+int main(int argc, char *argv[])
+{
+    static struct mock m;            /* shared with the mock's threads */
+    const char  *mode        = "ask";
+    long         requests    = DEFAULT_REQUESTS;
+    long         concurrency = DEFAULT_CONCURRENCY;
+    long         size        = DEFAULT_SIZE;
+    long         retries     = -1;   /* -1 = library default */
+    long         threads     = 0;    /* 0 = the default client */
+    const char  *target      = NULL;
+    const char **prompts;
+    struct results r;
+    char         host[256];
+    char         port[16];
+    const char  *colon;
+    double       t0, elapsed;
+    long         i;
+    int          a;
+
+    /* ---- Options ---- */
+    for (a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--chunked") == 0) {
+            m.chunked = 1;
+        } else if (strcmp(argv[a], "--no-pacing") == 0) {
+            neuro_set_pacing(0);
+        } else if (strcmp(argv[a], "--http2") == 0) {
+            m.http2 = 1;
+            neuro_set_http2(1);
+        } else if (a + 1 >= argc) {
+            fprintf(stderr, USAGE, argv[0], argv[0], argv[0]);
+            return 1;
+        } else if (strcmp(argv[a], "--mode") == 0) {
+            mode = argv[++a];
+        } else if (strcmp(argv[a], "--requests") == 0) {
+            requests = strtol(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--concurrency") == 0) {
+            concurrency = strtol(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--latency") == 0) {
+            m.latency_ms = strtol(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--size") == 0) {
+            size = strtol(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--errors") == 0) {
+            m.error_pct = (int)strtol(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--rate-limit") == 0) {
+            m.rate_limit = strtol(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--retries") == 0) {
+            retries = strtol(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--encoding") == 0) {
+            m.encoding = argv[++a];
+        } else if (strcmp(argv[a], "--threads") == 0) {
+            threads = strtol(argv[++a], NULL, 10);
+        } else if (strcmp(argv[a], "--target") == 0) {
+            target = argv[++a];
+        } else if (strcmp(argv[a], "--tokenize") == 0) {
+            return run_tokenize(argv[++a]);
+        } else if (strcmp(argv[a], "--parse") == 0) {
+            a++;
+            return run_parse(argv[a], a + 1 < argc ? argv[a + 1]
+                                                   : PARSE_PATH);
+        } else {
+            fprintf(stderr, USAGE, argv[0], argv[0], argv[0]);
+            return 1;
+        }
+    }
+    if ((strcmp(mode, "ask") != 0 && strcmp(mode, "stream") != 0 &&
+         strcmp(mode, "batch") != 0) ||
+        requests < 1 || concurrency < 1 || size < 0 || m.latency_ms < 0 ||
+        threads < 0 || threads > requests) {
+        fprintf(stderr, USAGE, argv[0], argv[0], argv[0]);
+        return 1;
+    }
+    if (m.encoding != NULL && strcmp(m.encoding, "identity") != 0) {
+        for (i = 0; i < (long)MOCK_CODINGS; i++) {
+            if (strcmp(m.encoding, mock_codings[i]) == 0) {
+                break;
+            }
+        }
+        if (i == (long)MOCK_CODINGS) {
+            fprintf(stderr, "neurobench: the mock cannot send %s\n",
+                    m.encoding);
+            return 1;
+        }
+    }
+    if (concurrency > 1 && strcmp(mode, "batch") != 0) {
+        fprintf(stderr, "neurobench: --concurrency only applies to "
+                        "--mode batch; running one at a time\n");
+    }
+
+    /* ---- Endpoint: the mock, or --target ---- */
+    if (target == NULL) {
+        if (mock_start(&m, (size_t)size) != 0) {
+            fprintf(stderr, "neurobench: cannot start the mock server\n");
+            return 1;
+        }
+        snprintf(host, sizeof(host), "127.0.0.1");
+        snprintf(port, sizeof(port), "%d", m.port);
+    } else {
+        colon = strrchr(target, ':');
+        if (colon == NULL || (size_t)(colon - target) >= sizeof(host) ||
+            strlen(colon + 1) >= sizeof(port)) {
+            fprintf(stderr, USAGE, argv[0], argv[0], argv[0]);
+            return 1;
+        }
+        memcpy(host, target, (size_t)(colon - target));
+        host[colon - target] = '\0';
+        strcpy(port, colon + 1);
+    }
+    setenv("NEURO_API_HOST", host, 1);
+    setenv("NEURO_API_PORT", port, 1);
+    if (getenv("OPENAI_API_KEY") == NULL) {
+        setenv("OPENAI_API_KEY", "neurobench", 1); /* any key: not mocks */
+    }
+    if (retries >= 0) {
+        neuro_set_retry((int)retries, 250, 8000);
+    }
+
+    /* ---- Run ---- */
+    memset(&r, 0, sizeof(r));
+    r.max     = (size_t)requests;
+    r.lat     = (double *)malloc((size_t)requests * sizeof(double));
+    prompts   = (const char **)malloc((size_t)requests * sizeof(char *));
+    if (r.lat == NULL || prompts == NULL) {
+        fprintf(stderr, "neurobench: out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < requests; i++) {
+        prompts[i] = "How fast is this?";
+    }
+    neuro_set_timing_cb(on_timing, &r);
+
+    t0 = now_sec();
+    if (threads == 0) {
+        run_requests(NULL, mode, prompts, (size_t)requests, (int)concurrency,
+                     &r);
+    } else if (run_threads(threads, retries, m.http2, mode, prompts,
+                           (size_t)requests, (int)concurrency, &r) != 0) {
+        fprintf(stderr, "neurobench: cannot start %ld threads\n", threads);
+        return 1;
+    }
+    elapsed = now_sec() - t0;
+
+    /* ---- Report ---- */
+    qsort(r.lat, r.n_lat, sizeof(double), cmp_double);
+    printf("target      %s:%s%s\n", host, port,
+           target == NULL ? " (built-in mock)" : "");
+    printf("mode        %s, concurrency %ld, threads %ld\n", mode,
+           strcmp(mode, "batch") == 0 ? concurrency : 1L,
+           threads > 0 ? threads : 1L);
+    printf("requests    %ld (%zu ok, %ld failed)\n", requests, r.ok,
+           requests - (long)r.ok);
+    printf("elapsed     %.3f s\n", elapsed);
+    printf("throughput  %.1f req/s, %.2f MB/s\n",
+           (double)r.ok / elapsed, (double)r.bytes / elapsed / 1e6);
+    printf("latency ms  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n",
+           percentile(r.lat, r.n_lat, 50.0), percentile(r.lat, r.n_lat, 90.0),
+           percentile(r.lat, r.n_lat, 99.0), percentile(r.lat, r.n_lat, 100.0));
+    if (target == NULL) {
+        printf("mock        %lu responses, %lu injected errors, %lu 429s\n",
+               __atomic_load_n(&m.answered, __ATOMIC_RELAXED),
+               __atomic_load_n(&m.failed, __ATOMIC_RELAXED),
+               __atomic_load_n(&m.limited, __ATOMIC_RELAXED));
+        printf("wire        %.3f MB of HTTP sent, %.3f MB of answers "
+               "received\n",
+               (double)__atomic_load_n(&m.wire, __ATOMIC_RELAXED) / 1e6,
+               (double)r.bytes / 1e6);
+        printf("connections %lu accepted, %lu of them over HTTP/2\n",
+               __atomic_load_n(&m.conns, __ATOMIC_RELAXED),
+               __atomic_load_n(&m.conns_h2, __ATOMIC_RELAXED));
+    }
+
+    neuro_cleanup();
+    free(r.lat);
+    free(prompts);
+    return (r.ok == (size_t)requests) ? 0 : 1;
+}
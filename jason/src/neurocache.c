@@ -0,0 +1,625 @@
+/*
+ * neurocache.c — Implementation of the on-disk response cache.
+ *
+ * File layout (all integers in host byte order; the file is a local
+ * cache, not an interchange format):
+ *
+ *   offset 0    header   (64 bytes, struct cache_header)
+ *   offset 64   record   (64-byte struct cache_record + value, padded
+ *   ...                   to a multiple of 8 bytes)
+ *
+ * Records are only ever appended.  A writer holds an exclusive flock(),
+ * writes the record past the end, and only then advances header.used, so
+ * a reader holding a shared lock never sees a half-written record.  The
+ * file itself is grown in CACHE_GROW steps (capped at the size bound)
+ * and mapped whole.
+ *
+ * When the next record would push the file past its size bound, the
+ * writer compacts: the newest copy of every unexpired entry is ranked by
+ * last use, the most recent ones are written to a fresh file (up to
+ * three quarters of the bound), and that file is renamed over the old
+ * one.  The old header is then flagged 'stale' so other processes that
+ * still have it open know to reopen the path.
+ */
+
+/* flock() and MAP_* need the BSD/default feature set on glibc */
+#define _DEFAULT_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include "neurocache.h"
+
+#include <stdio.h>      /* snprintf, rename                             */
+#include <stdlib.h>     /* malloc, calloc, free, qsort                  */
+#include <string.h>     /* memcpy, memcmp, memset, strlen               */
+#include <errno.h>      /* errno, EINTR                                 */
+#include <stdint.h>     /* uint32_t, uint64_t, int64_t                  */
+#include <time.h>       /* time                                         */
+
+#include <fcntl.h>      /* open                                         */
+#include <unistd.h>     /* close, pread, pwrite, ftruncate, getpid      */
+#include <sys/file.h>   /* flock                                        */
+#include <sys/mman.h>   /* mmap, munmap                                 */
+#include <sys/stat.h>   /* fstat                                        */
+
+#include <openssl/evp.h> /* EVP_Digest*, EVP_sha256                    */
+
+/* -------------------------------------------------------------------------
+ * Constants and on-disk structures
+ * ---------------------------------------------------------------------- */
+
+#define CACHE_MAGIC     "NEUROCA"          /* 7 chars + NUL = 8 bytes   */
+#define CACHE_VERSION   1
+#define RECORD_MAGIC    0x4345524EU         /* "NREC" little-endian      */
+#define CACHE_GROW      (1024 * 1024)       /* file growth step          */
+#define CACHE_DEFAULT   (64 * 1024 * 1024)  /* default size bound        */
+#define INDEX_MIN_CAP   64                  /* initial index slots       */
+
+struct cache_header {
+    char     magic[8];  /* CACHE_MAGIC                                  */
+    uint32_t version;   /* CACHE_VERSION                                */
+    uint32_t stale;     /* 1 once compaction replaced this file         */
+    uint64_t used;      /* end of the last complete record              */
+    uint64_t spare[5];  /* room for future fields; keeps 64 bytes       */
+};
+
+struct cache_record {
+    uint32_t      magic;                    /* RECORD_MAGIC             */
+    uint32_t      len;                      /* value length in bytes    */
+    unsigned char key[NEURO_CACHE_KEY_LEN]; /* SHA-256 content address  */
+    int64_t       created;                  /* time written (Unix)      */
+    int64_t       expires;                  /* 0 = never                */
+    int64_t       atime;                    /* last hit, updated in place */
+};
+
+/* -------------------------------------------------------------------------
+ * In-memory state
+ * ---------------------------------------------------------------------- */
+
+/*
+ * One index slot.  'tag' is the first 8 bytes of the key, so most probes
+ * are settled without touching the mapped record; off == 0 marks an
+ * empty slot (offset 0 is the header, never a record).
+ */
+struct cache_slot {
+    uint64_t tag; /* leading key bytes                   */
+    uint64_t off; /* file offset of the newest record    */
+};
+
+struct neuro_cache {
+    char              *path;      /* file name, to reopen after compaction  */
+    int                fd;        /* open cache file                        */
+    unsigned char     *map;       /* whole-file mapping                     */
+    size_t             map_len;   /* bytes mapped                           */
+    uint64_t           indexed;   /* records before this offset are indexed */
+    struct cache_slot *slots;     /* open-addressing table (linear probing) */
+    size_t             cap;       /* number of slots (power of two)         */
+    size_t             count;     /* occupied slots                         */
+    size_t             max_bytes; /* size bound for the file                */
+    long               ttl;       /* seconds; 0 = entries never expire      */
+};
+
+/* Records are padded so every header stays 8-byte aligned */
+static uint64_t record_size(uint32_t len)
+{
+    return (sizeof(struct cache_record) + (uint64_t)len + 7) & ~(uint64_t)7;
+}
+
+static uint64_t key_tag(const unsigned char *key)
+{
+    uint64_t tag;
+
+    memcpy(&tag, key, sizeof(tag));
+    return tag;
+}
+
+/* File length for 'used' bytes: rounded up to CACHE_GROW, but never
+ * past the size bound */
+static uint64_t file_size_for(const struct neuro_cache *c, uint64_t used)
+{
+    uint64_t size = (used + CACHE_GROW - 1) / CACHE_GROW * CACHE_GROW;
+
+    return (size > c->max_bytes && used <= c->max_bytes) ? c->max_bytes : size;
+}
+
+static struct cache_header *header_of(struct neuro_cache *c)
+{
+    return (struct cache_header *)c->map;
+}
+
+static struct cache_record *record_at(struct neuro_cache *c, uint64_t off)
+{
+    return (struct cache_record *)(c->map + off);
+}
+
+/* -------------------------------------------------------------------------
+ * Index
+ * ---------------------------------------------------------------------- */
+
+/*
+ * index_find — Returns the slot holding 'key', or the empty slot where it
+ * would go.  The table is never full (load factor <= 1/2).
+ */
+static struct cache_slot *index_find(struct neuro_cache *c,
+                                     const unsigned char *key)
+{
+    uint64_t tag  = key_tag(key);
+    size_t   mask = c->cap - 1;
+    size_t   i    = (size_t)(tag ^ (tag >> 29)) & mask;
+
+    while (c->slots[i].off != 0) {
+        if (c->slots[i].tag == tag &&
+            memcmp(record_at(c, c->slots[i].off)->key, key,
+                   NEURO_CACHE_KEY_LEN) == 0) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return &c->slots[i];
+}
+
+/*
+ * index_grow — Doubles the table and re-inserts every entry.
+ * Returns 0 on success, -1 if out of memory.
+ */
+static int index_grow(struct neuro_cache *c)
+{
+    struct cache_slot *old     = c->slots;
+    size_t             old_cap = c->cap;
+    size_t             i;
+
+    c->cap   = (old_cap != 0) ? old_cap * 2 : INDEX_MIN_CAP;
+    c->slots = (struct cache_slot *)calloc(c->cap, sizeof(struct cache_slot));
+    if (c->slots == NULL) {
+        c->slots = old;
+        c->cap   = old_cap;
+        return -1;
+    }
+    for (i = 0; i < old_cap; i++) {
+        if (old[i].off != 0) {
+            *index_find(c, record_at(c, old[i].off)->key) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+/*
+ * index_scan — Adds every record between c->indexed and header.used to
+ * the index.  A later record for the same key replaces the earlier one.
+ * Returns 0 on success, -1 on a corrupt file or out of memory.
+ */
+static int index_scan(struct neuro_cache *c)
+{
+    uint64_t             used = header_of(c)->used;
+    struct cache_record *rec;
+    struct cache_slot   *slot;
+
+    while (c->indexed < used) {
+        rec = record_at(c, c->indexed);
+        if (rec->magic != RECORD_MAGIC ||
+            c->indexed + record_size(rec->len) > used) {
+            return -1;
+        }
+        if ((c->count + 1) * 2 > c->cap && index_grow(c) != 0) {
+            return -1;
+        }
+        slot = index_find(c, rec->key);
+        if (slot->off == 0) {
+            c->count++;
+        }
+        slot->tag = key_tag(rec->key);
+        slot->off = c->indexed;
+        c->indexed += record_size(rec->len);
+    }
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ * File handling
+ * ---------------------------------------------------------------------- */
+
+/*
+ * file_lock — flock() that is restarted when a signal interrupts it.
+ * Returns 0 on success, -1 on failure.
+ */
+static int file_lock(int fd, int how)
+{
+    while (flock(fd, how) != 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * cache_map — (Re)maps the whole file after it has grown.
+ * Returns 0 on success, -1 on failure.
+ */
+static int cache_map(struct neuro_cache *c)
+{
+    struct stat st;
+    void       *map;
+
+    if (fstat(c->fd, &st) != 0 ||
+        (size_t)st.st_size < sizeof(struct cache_header)) {
+        return -1;
+    }
+    if ((size_t)st.st_size == c->map_len) {
+        return 0; /* unchanged */
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+               c->fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    if (c->map != NULL) {
+        munmap(c->map, c->map_len);
+    }
+    c->map     = (unsigned char *)map;
+    c->map_len = (size_t)st.st_size;
+    return 0;
+}
+
+/*
+ * cache_attach — Opens the file at c->path, creating and initialising it
+ * if it is empty, and maps it.  The index starts out empty.
+ * Returns 0 on success, -1 on failure.
+ */
+static int cache_attach(struct neuro_cache *c)
+{
+    struct cache_header hdr;
+    struct stat         st;
+
+    c->fd = open(c->path, O_RDWR | O_CREAT, 0600);
+    if (c->fd == -1) {
+        return -1;
+    }
+
+    /* Initialise a brand-new file under the exclusive lock */
+    if (file_lock(c->fd, LOCK_EX) != 0) {
+        return -1;
+    }
+    if (fstat(c->fd, &st) == 0 && st.st_size == 0) {
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+        hdr.version = CACHE_VERSION;
+        hdr.used    = sizeof(hdr);
+        if (pwrite(c->fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+            ftruncate(c->fd, (off_t)file_size_for(c, sizeof(hdr))) != 0) {
+            file_lock(c->fd, LOCK_UN);
+            return -1;
+        }
+    }
+    file_lock(c->fd, LOCK_UN);
+
+    if (cache_map(c) != 0 ||
+        memcmp(header_of(c)->magic, CACHE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        header_of(c)->version != CACHE_VERSION) {
+        return -1; /* not a cache file we understand */
+    }
+
+    memset(c->slots, 0, c->cap * sizeof(struct cache_slot));
+    c->count   = 0;
+    c->indexed = sizeof(struct cache_header);
+    return 0;
+}
+
+/*
+ * cache_detach — Unmaps and closes the current file.
+ */
+static void cache_detach(struct neuro_cache *c)
+{
+    if (c->map != NULL) {
+        munmap(c->map, c->map_len);
+        c->map     = NULL;
+        c->map_len = 0;
+    }
+    if (c->fd != -1) {
+        close(c->fd);
+        c->fd = -1;
+    }
+}
+
+/*
+ * cache_lock — Takes the file lock and brings the mapping and the index
+ * up to date with whatever other processes appended.  Follows a
+ * compaction by reopening the path.
+ * Returns 0 with the lock held, -1 (lock released) on failure.
+ */
+static int cache_lock(struct neuro_cache *c, int how)
+{
+    for (;;) {
+        if (c->fd == -1 && cache_attach(c) != 0) {
+            cache_detach(c);
+            return -1;
+        }
+        if (file_lock(c->fd, how) != 0) {
+            cache_detach(c);
+            return -1;
+        }
+        if (!header_of(c)->stale) {
+            break;
+        }
+        /* Another process compacted: the path now names a new file */
+        file_lock(c->fd, LOCK_UN);
+        cache_detach(c);
+    }
+
+    if ((header_of(c)->used > c->map_len && cache_map(c) != 0) ||
+        index_scan(c) != 0) {
+        file_lock(c->fd, LOCK_UN);
+        return -1;
+    }
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ * Compaction (LRU / size-bounded eviction)
+ * ---------------------------------------------------------------------- */
+
+/* Entry being considered for the compacted file */
+struct live_entry {
+    uint64_t off;  /* record offset in the old file   */
+    int64_t  used; /* last use: max(atime, created)   */
+};
+
+/* qsort comparator: most recently used first */
+static int by_recent_use(const void *a, const void *b)
+{
+    int64_t ua = ((const struct live_entry *)a)->used;
+    int64_t ub = ((const struct live_entry *)b)->used;
+
+    return (ua < ub) - (ua > ub);
+}
+
+/*
+ * cache_compact — Rewrites the cache keeping the most recently used live
+ * entries, within three quarters of the size bound and leaving room for
+ * a record of 'reserve' bytes.  Called with the exclusive lock held; on
+ * return the old file is detached (and the lock with it), so the caller
+ * must lock again.
+ * Returns 0 on success, -1 on failure.
+ */
+static int cache_compact(struct neuro_cache *c, uint64_t reserve)
+{
+    struct live_entry   *live;   /* candidates, newest use first       */
+    size_t               n;      /* number of candidates               */
+    size_t               i;
+    struct cache_record *rec;
+    struct cache_header  hdr;    /* header for the new file            */
+    char                *tmp;    /* temporary file name                */
+    size_t               tlen;
+    int                  fd;     /* the new file                       */
+    uint64_t             off;    /* write position in the new file     */
+    uint64_t             budget; /* bytes we may keep                  */
+    int64_t              now;
+    int                  rc;
+
+    now  = (int64_t)time(NULL);
+    live = (struct live_entry *)malloc((c->count + 1) * sizeof(*live));
+    tlen = strlen(c->path) + 32;
+    tmp  = (char *)malloc(tlen);
+    if (live == NULL || tmp == NULL) {
+        free(live);
+        free(tmp);
+        return -1;
+    }
+
+    /* The index already points at the newest record for every key */
+    n = 0;
+    for (i = 0; i < c->cap; i++) {
+        if (c->slots[i].off == 0) {
+            continue;
+        }
+        rec = record_at(c, c->slots[i].off);
+        if (rec->expires != 0 && rec->expires <= now) {
+            continue; /* expired: drop */
+        }
+        live[n].off  = c->slots[i].off;
+        live[n].used = (rec->atime > rec->created) ? rec->atime : rec->created;
+        n++;
+    }
+    qsort(live, n, sizeof(*live), by_recent_use);
+
+    snprintf(tmp, tlen, "%s.%ld.tmp", c->path, (long)getpid());
+    fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    rc = (fd == -1) ? -1 : 0;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = CACHE_VERSION;
+    off    = sizeof(hdr);
+    budget = (uint64_t)c->max_bytes / 4 * 3;
+    if (c->max_bytes - reserve < budget) {
+        budget = c->max_bytes - reserve; /* the new record must fit too */
+    }
+
+    for (i = 0; rc == 0 && i < n; i++) {
+        rec = record_at(c, live[i].off);
+        if (off + record_size(rec->len) > budget) {
+            break; /* everything older is evicted */
+        }
+        if (pwrite(fd, rec, (size_t)record_size(rec->len), (off_t)off) !=
+            (ssize_t)record_size(rec->len)) {
+            rc = -1;
+        }
+        off += record_size(rec->len);
+    }
+
+    hdr.used = off;
+    if (rc == 0 &&
+        (pwrite(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr) ||
+         ftruncate(fd, (off_t)file_size_for(c, off)) != 0 ||
+         rename(tmp, c->path) != 0)) {
+        rc = -1;
+    }
+    if (fd != -1) {
+        close(fd);
+    }
+    if (rc != 0) {
+        unlink(tmp);
+    } else {
+        header_of(c)->stale = 1; /* others must reopen the path */
+    }
+
+    free(live);
+    free(tmp);
+    file_lock(c->fd, LOCK_UN);
+    cache_detach(c);
+    return rc;
+}
+
+/* -------------------------------------------------------------------------
+ * Public functions
+ * ---------------------------------------------------------------------- */
+
+struct neuro_cache *neuro_cache_open(const char *path, size_t max_bytes,
+                                     long ttl_seconds)
+{
+    struct neuro_cache *c;
+
+    c = (struct neuro_cache *)calloc(1, sizeof(*c));
+    if (c == NULL) {
+        return NULL;
+    }
+    c->fd        = -1;
+    c->max_bytes = (max_bytes != 0) ? max_bytes : CACHE_DEFAULT;
+    c->ttl       = (ttl_seconds > 0) ? ttl_seconds : 0;
+    c->path      = (char *)malloc(strlen(path) + 1);
+    if (c->path == NULL || index_grow(c) != 0) {
+        neuro_cache_close(c);
+        return NULL;
+    }
+    strcpy(c->path, path);
+
+    if (cache_lock(c, LOCK_SH) != 0) {
+        neuro_cache_close(c);
+        return NULL;
+    }
+    file_lock(c->fd, LOCK_UN);
+    return c;
+}
+
+void neuro_cache_close(struct neuro_cache *c)
+{
+    if (c == NULL) {
+        return;
+    }
+    cache_detach(c);
+    free(c->slots);
+    free(c->path);
+    free(c);
+}
+
+int neuro_cache_key(const char *model, const char *body, size_t body_len,
+                    unsigned char key[NEURO_CACHE_KEY_LEN])
+{
+    EVP_MD_CTX *md; /* SHA-256 state */
+    int         ok;
+
+    md = EVP_MD_CTX_new();
+    if (md == NULL) {
+        return -1;
+    }
+    /* The model name's NUL separates the two parts */
+    ok = EVP_DigestInit_ex(md, EVP_sha256(), NULL) == 1 &&
+         EVP_DigestUpdate(md, model, strlen(model) + 1) == 1 &&
+         EVP_DigestUpdate(md, body, body_len) == 1 &&
+         EVP_DigestFinal_ex(md, key, NULL) == 1;
+    EVP_MD_CTX_free(md);
+    return ok ? 0 : -1;
+}
+
+char *neuro_cache_get(struct neuro_cache *c,
+                      const unsigned char key[NEURO_CACHE_KEY_LEN],
+                      size_t *len)
+{
+    struct cache_slot   *slot;
+    struct cache_record *rec;
+    char                *value;
+    int64_t              now;
+
+    if (cache_lock(c, LOCK_SH) != 0) {
+        return NULL;
+    }
+
+    value = NULL;
+    now   = (int64_t)time(NULL);
+    slot  = index_find(c, key);
+    if (slot->off != 0) {
+        rec = record_at(c, slot->off);
+        if (rec->expires == 0 || rec->expires > now) {
+            value = (char *)malloc((size_t)rec->len + 1);
+            if (value != NULL) {
+                memcpy(value, rec + 1, rec->len);
+                value[rec->len] = '\0';
+                *len = rec->len;
+                /* Last-use time for eviction; a racing write is harmless */
+                rec->atime = now;
+            }
+        }
+    }
+
+    file_lock(c->fd, LOCK_UN);
+    return value;
+}
+
+int neuro_cache_put(struct neuro_cache *c,
+                    const unsigned char key[NEURO_CACHE_KEY_LEN],
+                    const char *value, size_t len)
+{
+    struct cache_record rec;
+    uint64_t            size; /* record size on disk            */
+    uint64_t            at;   /* where the record is written    */
+    uint64_t            need; /* file size needed after writing */
+    uint64_t            end;  /* new header.used                */
+    int                 tries; /* compactions so far             */
+    int                 rc;
+    const off_t         used_at = (off_t)offsetof(struct cache_header, used);
+
+    size = record_size((uint32_t)len);
+    if (len > UINT32_MAX ||
+        sizeof(struct cache_header) + size > c->max_bytes / 4 * 3) {
+        return -1; /* would not survive a compaction anyway */
+    }
+
+    if (cache_lock(c, LOCK_EX) != 0) {
+        return -1;
+    }
+    /* Another writer may append between our compaction and relocking,
+     * so the bound is checked again each time */
+    for (tries = 0; header_of(c)->used + size > c->max_bytes; tries++) {
+        if (tries == 2) {
+            file_lock(c->fd, LOCK_UN);
+            return -1; /* still no room; give up on this record */
+        }
+        if (cache_compact(c, size) != 0 || cache_lock(c, LOCK_EX) != 0) {
+            return -1;
+        }
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.magic   = RECORD_MAGIC;
+    rec.len     = (uint32_t)len;
+    memcpy(rec.key, key, NEURO_CACHE_KEY_LEN);
+    rec.created = (int64_t)time(NULL);
+    rec.expires = (c->ttl != 0) ? rec.created + c->ttl : 0;
+
+    at   = header_of(c)->used;
+    end  = at + size;
+    need = file_size_for(c, end);
+
+    /* Record first, then the header: readers never see a partial record */
+    rc = -1;
+    if ((need <= c->map_len || ftruncate(c->fd, (off_t)need) == 0) &&
+        pwrite(c->fd, &rec, sizeof(rec), (off_t)at) == (ssize_t)sizeof(rec) &&
+        pwrite(c->fd, value, len, (off_t)(at + sizeof(rec))) == (ssize_t)len &&
+        pwrite(c->fd, &end, sizeof(end), used_at) == (ssize_t)sizeof(end) &&
+        cache_map(c) == 0 && index_scan(c) == 0) {
+        rc = 0;
+    }
+
+    file_lock(c->fd, LOCK_UN);
+    return rc;
+}
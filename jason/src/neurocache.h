@@ -0,0 +1,78 @@
+/*
+ * neurocache.h — On-disk response cache used by neurolib.
+ *
+ * Responses are stored under a content address: the SHA-256 of the model
+ * name and the exact request body.  Sending the same request again finds
+ * the earlier answer without touching the network.
+ *
+ * The cache is a single append-only file, memory-mapped for reading, with
+ * an in-memory open-addressing index from key to record.  Entries may
+ * expire after a TTL, and when the file would exceed its size bound it is
+ * compacted, keeping the most recently used entries.  Several processes
+ * may share one cache file; they coordinate with flock().
+ *
+ * Compilation: built together with neurolib.c (see neurolib.h).
+ */
+
+#ifndef NEUROCACHE_H
+#define NEUROCACHE_H
+
+#include <stddef.h> /* size_t */
+
+/* Length in bytes of a cache key (SHA-256 digest) */
+#define NEURO_CACHE_KEY_LEN 32
+
+/* Opaque cache handle */
+struct neuro_cache;
+
+/*
+ * neuro_cache_open — Opens (creating if needed) the cache file at 'path'.
+ *
+ * Parameters:
+ *   max_bytes    size bound for the file; 0 selects a default (64 MB).
+ *   ttl_seconds  lifetime of new entries; 0 means they never expire.
+ *
+ * Returns:
+ *   A handle, or NULL if the file cannot be opened or is not a cache.
+ */
+struct neuro_cache *neuro_cache_open(const char *path, size_t max_bytes,
+                                     long ttl_seconds);
+
+/*
+ * neuro_cache_close — Unmaps the file and frees the handle (NULL is ok).
+ */
+void neuro_cache_close(struct neuro_cache *cache);
+
+/*
+ * neuro_cache_key — Computes the content address of a request.
+ *
+ * Returns:
+ *   0 on success, -1 if the digest could not be computed.
+ */
+int neuro_cache_key(const char *model, const char *body, size_t body_len,
+                    unsigned char key[NEURO_CACHE_KEY_LEN]);
+
+/*
+ * neuro_cache_get — Looks up a key.
+ *
+ * Returns:
+ *   A heap-allocated, NUL-terminated copy of the stored response (its
+ *   length in *len), or NULL on a miss or an expired entry.  The CALLER
+ *   must free() it.
+ */
+char *neuro_cache_get(struct neuro_cache *cache,
+                      const unsigned char key[NEURO_CACHE_KEY_LEN],
+                      size_t *len);
+
+/*
+ * neuro_cache_put — Stores a response under a key, replacing any earlier
+ * entry for the same key.
+ *
+ * Returns:
+ *   0 on success, -1 on an I/O error or if the value can never fit.
+ */
+int neuro_cache_put(struct neuro_cache *cache,
+                    const unsigned char key[NEURO_CACHE_KEY_LEN],
+                    const char *value, size_t len);
+
+#endif /* NEUROCACHE_H */
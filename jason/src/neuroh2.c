@@ -0,0 +1,1521 @@
+/*
+ * neuroh2.c — Implementation of the HTTP/2 connection engine.
+ *
+ * Input is cut into frames: the 9-byte frame header first, then the
+ * payload, which is handled in place when the whole frame arrived in one
+ * piece and gathered into 'frame' when it did not.  A header block may
+ * be split over HEADERS and CONTINUATION frames, so it is gathered into
+ * 'block' and decoded once complete.
+ *
+ * Output frames are appended to one buffer that the caller drains.
+ * Bodies are not copied in: each stream keeps its pieces and the body is
+ * cut into DATA frames when output is asked for, round-robin over the
+ * streams and only as far as the flow-control windows and a bound on
+ * buffered output allow, so a long upload does not hold up the others.
+ *
+ * The HPACK decoder keeps the peer's dynamic table as a ring of entries
+ * whose names and values sit end to end in one byte buffer of twice the
+ * table size, compacted when the end is reached.  Huffman codes are
+ * decoded bit by bit with the canonical-code method of zlib's puff:
+ * HPACK's code is canonical, so a count of codes per length and the
+ * symbols in code order are enough.
+ *
+ * Streams live in an array ordered by id (ids only grow, so opening one
+ * appends) and are found by binary search.  A stream is closed, and its
+ * on_close called, from within neuro_h2_feed or neuro_h2_output only,
+ * never from inside another callback.
+ */
+
+#include "neuroh2.h"
+
+#include <stdlib.h>     /* malloc, realloc, free                        */
+#include <string.h>     /* memcpy, memmove, memcmp, strlen, strcmp      */
+
+/* -------------------------------------------------------------------------
+ * Constants
+ * ---------------------------------------------------------------------- */
+
+#define PREFACE      "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define PREFACE_LEN  24
+#define FRAME_HEAD   9            /* bytes of a frame header               */
+#define MAX_FRAME    16384        /* largest payload we accept (default)   */
+#define MAX_BLOCK    (64 * 1024)  /* largest header block we accept        */
+#define LOCAL_WINDOW (1L << 20)   /* receive window per stream             */
+#define LOCAL_CONN   (16L << 20)  /* receive window for the connection     */
+#define LOCAL_MAX_STREAMS 256     /* streams a peer may open (server)      */
+#define OUTPUT_HIGH  (64 * 1024)  /* body is framed while less is queued   */
+#define TABLE_MAX    4096         /* dynamic table size (the default)      */
+#define TABLE_SLOTS  (TABLE_MAX / 32) /* entries it can hold at most       */
+#define WINDOW_MAX   0x7fffffffL  /* largest flow-control window           */
+#define DEFAULT_WINDOW 65535L     /* initial window before SETTINGS        */
+
+/* Frame types */
+enum {
+    FT_DATA, FT_HEADERS, FT_PRIORITY, FT_RST_STREAM, FT_SETTINGS,
+    FT_PUSH_PROMISE, FT_PING, FT_GOAWAY, FT_WINDOW_UPDATE, FT_CONTINUATION
+};
+
+/* Frame flags */
+#define FL_END_STREAM  0x01
+#define FL_ACK         0x01
+#define FL_END_HEADERS 0x04
+#define FL_PADDED      0x08
+#define FL_PRIORITY    0x20
+
+/* Settings */
+#define SET_HEADER_TABLE_SIZE      1
+#define SET_ENABLE_PUSH            2
+#define SET_MAX_CONCURRENT_STREAMS 3
+#define SET_INITIAL_WINDOW_SIZE    4
+#define SET_MAX_FRAME_SIZE         5
+
+/* Error codes (RFC 9113 section 7) other than those in neuroh2.h */
+#define ERR_NO_ERROR           0x0
+#define ERR_PROTOCOL           0x1
+#define ERR_INTERNAL           0x2
+#define ERR_FLOW_CONTROL       0x3
+#define ERR_FRAME_SIZE         0x6
+#define ERR_COMPRESSION        0x9
+#define ERR_ENHANCE_YOUR_CALM  0xb
+
+/* -------------------------------------------------------------------------
+ * HPACK tables (RFC 7541 appendices A and B)
+ * ---------------------------------------------------------------------- */
+
+static const struct {
+    const char *name;
+    const char *value;
+} static_table[61] = {
+    { ":authority", "" },
+    { ":method", "GET" },
+    { ":method", "POST" },
+    { ":path", "/" },
+    { ":path", "/index.html" },
+    { ":scheme", "http" },
+    { ":scheme", "https" },
+    { ":status", "200" },
+    { ":status", "204" },
+    { ":status", "206" },
+    { ":status", "304" },
+    { ":status", "400" },
+    { ":status", "404" },
+    { ":status", "500" },
+    { "accept-charset", "" },
+    { "accept-encoding", "gzip, deflate" },
+    { "accept-language", "" },
+    { "accept-ranges", "" },
+    { "accept", "" },
+    { "access-control-allow-origin", "" },
+    { "age", "" },
+    { "allow", "" },
+    { "authorization", "" },
+    { "cache-control", "" },
+    { "content-disposition", "" },
+    { "content-encoding", "" },
+    { "content-language", "" },
+    { "content-length", "" },
+    { "content-location", "" },
+    { "content-range", "" },
+    { "content-type", "" },
+    { "cookie", "" },
+    { "date", "" },
+    { "etag", "" },
+    { "expect", "" },
+    { "expires", "" },
+    { "from", "" },
+    { "host", "" },
+    { "if-match", "" },
+    { "if-modified-since", "" },
+    { "if-none-match", "" },
+    { "if-range", "" },
+    { "if-unmodified-since", "" },
+    { "last-modified", "" },
+    { "link", "" },
+    { "location", "" },
+    { "max-forwards", "" },
+    { "proxy-authenticate", "" },
+    { "proxy-authorization", "" },
+    { "range", "" },
+    { "referer", "" },
+    { "refresh", "" },
+    { "retry-after", "" },
+    { "server", "" },
+    { "set-cookie", "" },
+    { "strict-transport-security", "" },
+    { "transfer-encoding", "" },
+    { "user-agent", "" },
+    { "vary", "" },
+    { "via", "" },
+    { "www-authenticate", "" },
+};
+
+/* The Huffman code: how many codes there are of each length (1 to 30
+ * bits), then the symbols in code order; 256 is EOS */
+static const unsigned short huff_count[31] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3,
+    0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+};
+static const unsigned short huff_sym[257] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45,
+    46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65, 95, 98,
+    100, 102, 103, 104, 108, 109, 110, 112, 114, 117, 58, 66, 67,
+    68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79, 80,
+    81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118, 119,
+    120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41,
+    63, 39, 43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94,
+    125, 60, 96, 123, 92, 195, 208, 128, 130, 131, 162, 184, 194,
+    224, 226, 153, 161, 167, 172, 176, 177, 179, 209, 216, 217, 227,
+    229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160, 163, 164,
+    169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228,
+    232, 233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+    151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182, 183,
+    188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159, 171, 206,
+    215, 225, 236, 237, 199, 207, 234, 235, 192, 193, 200, 201, 202,
+    205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+    212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251,
+    252, 253, 254, 2, 3, 4, 5, 6, 7, 8, 11, 12, 14,
+    15, 16, 17, 18, 19, 20, 21, 23, 24, 25, 26, 27, 28,
+    29, 30, 31, 127, 220, 249, 10, 13, 22, 256
+};
+
+/* -------------------------------------------------------------------------
+ * State
+ * ---------------------------------------------------------------------- */
+
+struct h2_stream {
+    unsigned int          id;
+    void                 *user;
+    int                   answered;    /* our HEADERS are queued           */
+    int                   local_done;  /* our END_STREAM is queued         */
+    int                   remote_done; /* the peer's END_STREAM arrived    */
+    int                   headers;     /* a header block was delivered     */
+    long                  window;      /* bytes we may still send          */
+    long                  recv;        /* bytes the peer may still send    */
+    struct neuro_h2_chunk body[NEURO_H2_MAX_CHUNKS];
+    size_t                nbody;       /* pieces of body                   */
+    size_t                piece;       /* piece being sent                 */
+    size_t                off;         /* bytes of it sent                 */
+};
+
+/* One entry of the dynamic table; its name and value are at 'off' */
+struct hp_entry {
+    size_t off;
+    size_t name_len;
+    size_t value_len;
+};
+
+/* The peer's dynamic table */
+struct hpack {
+    char            bytes[2 * TABLE_MAX];
+    size_t          lo, hi;       /* bytes in use                          */
+    struct hp_entry ent[TABLE_SLOTS];
+    size_t          first;        /* oldest entry                          */
+    size_t          count;
+    size_t          size;         /* RFC 7541 size: lengths + 32 each      */
+    size_t          max;
+};
+
+struct neuro_h2 {
+    struct neuro_h2_cbs cbs;
+    void               *user;
+    int                 server;
+    int                 failed;     /* after a connection error            */
+    int                 nomem;      /* an allocation failed                */
+    int                 goaway_in;  /* the peer sent GOAWAY                */
+    int                 goaway_out; /* we sent GOAWAY                      */
+    unsigned int        next_id;    /* client: id of the next stream       */
+    unsigned int        peer_id;    /* server: highest id the peer opened  */
+    size_t              preface;    /* server: preface bytes checked       */
+
+    /* The peer's settings, and the connection's windows */
+    unsigned long       max_streams;
+    size_t              max_frame;
+    long                init_window;
+    long                window;     /* bytes we may still send             */
+    long                recv;       /* bytes the peer may still send       */
+
+    /* Open streams, ordered by id */
+    struct h2_stream   *streams;
+    size_t              nstreams;
+    size_t              cap_streams;
+    size_t              turn;       /* where the next round of DATA starts */
+
+    /* The frame coming in */
+    unsigned char       head[FRAME_HEAD];
+    size_t              head_len;
+    size_t              frame_len;
+    size_t              frame_got;
+    unsigned char       frame[MAX_FRAME];
+
+    /* The header block coming in, across CONTINUATION frames */
+    unsigned char      *block;
+    size_t              block_len;
+    size_t              block_cap;
+    unsigned int        block_id;   /* its stream; 0 when none             */
+    int                 block_end;  /* its HEADERS had END_STREAM          */
+
+    struct hpack        table;
+    char               *scratch;    /* decoded names and values            */
+    size_t              scratch_cap;
+
+    /* Output */
+    unsigned char      *out;
+    size_t              out_off;
+    size_t              out_len;
+    size_t              out_cap;
+};
+
+/* -------------------------------------------------------------------------
+ * Helpers
+ * ---------------------------------------------------------------------- */
+
+static unsigned long get32(const unsigned char *p)
+{
+    return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) |
+           ((unsigned long)p[2] << 8) | (unsigned long)p[3];
+}
+
+static void put32(unsigned char *p, unsigned long v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+/*
+ * grow — Makes the array p of 'size'-byte elements hold at least 'need'
+ * of them, doubling its capacity *cap.
+ * Returns the array, or NULL if out of memory (p is then unchanged).
+ */
+static void *grow(void *p, size_t *cap, size_t need, size_t size)
+{
+    size_t n = (*cap > 0) ? *cap : 64;
+
+    if (need <= *cap) {
+        return p;
+    }
+    while (n < need) {
+        n *= 2;
+    }
+    p = realloc(p, n * size);
+    if (p != NULL) {
+        *cap = n;
+    }
+    return p;
+}
+
+/* -------------------------------------------------------------------------
+ * Output
+ * ---------------------------------------------------------------------- */
+
+/*
+ * frame_start — Appends a frame header for a payload of 'len' bytes and
+ * returns where the payload goes, or NULL if out of memory.
+ */
+static unsigned char *frame_start(struct neuro_h2 *h2, size_t len,
+                                  int type, int flags, unsigned int id)
+{
+    unsigned char *p;
+    void          *q;
+
+    if (h2->out_off == h2->out_len) {
+        h2->out_off = h2->out_len = 0;
+    } else if (h2->out_off > 0 &&
+               h2->out_len + FRAME_HEAD + len > h2->out_cap) {
+        memmove(h2->out, h2->out + h2->out_off, h2->out_len - h2->out_off);
+        h2->out_len -= h2->out_off;
+        h2->out_off  = 0;
+    }
+    q = grow(h2->out, &h2->out_cap, h2->out_len + FRAME_HEAD + len, 1);
+    if (q == NULL) {
+        h2->nomem = 1;
+        return NULL;
+    }
+    h2->out = (unsigned char *)q;
+    p    = h2->out + h2->out_len;
+    p[0] = (unsigned char)(len >> 16);
+    p[1] = (unsigned char)(len >> 8);
+    p[2] = (unsigned char)len;
+    p[3] = (unsigned char)type;
+    p[4] = (unsigned char)flags;
+    put32(p + 5, id & 0x7fffffffUL);
+    h2->out_len += FRAME_HEAD + len;
+    return p + FRAME_HEAD;
+}
+
+static void send_u32(struct neuro_h2 *h2, int type, unsigned int id,
+                     unsigned long v)
+{
+    unsigned char *p = frame_start(h2, 4, type, 0, id);
+
+    if (p != NULL) {
+        put32(p, v);
+    }
+}
+
+static void send_goaway(struct neuro_h2 *h2, unsigned long code)
+{
+    unsigned char *p = frame_start(h2, 8, FT_GOAWAY, 0, 0);
+
+    if (p != NULL) {
+        put32(p, h2->peer_id);
+        put32(p + 4, code);
+    }
+    h2->goaway_out = 1;
+}
+
+static void send_settings(struct neuro_h2 *h2)
+{
+    unsigned char *p = frame_start(h2, 12, FT_SETTINGS, 0, 0);
+
+    if (p == NULL) {
+        return;
+    }
+    p[0] = 0;   /* a server limits streams, a client turns push off */
+    p[1] = h2->server ? SET_MAX_CONCURRENT_STREAMS : SET_ENABLE_PUSH;
+    put32(p + 2, h2->server ? LOCAL_MAX_STREAMS : 0);
+    p[6] = 0;
+    p[7] = SET_INITIAL_WINDOW_SIZE;
+    put32(p + 8, (unsigned long)LOCAL_WINDOW);
+}
+
+/*
+ * send_block — Queues a header block: one HEADERS frame, and as many
+ * CONTINUATION frames as the peer's frame size makes necessary.
+ */
+static void send_block(struct neuro_h2 *h2, unsigned int id,
+                       const char *block, size_t len, int end_stream)
+{
+    unsigned char *p;
+    size_t         n;
+    int            type  = FT_HEADERS;
+    int            flags = end_stream ? FL_END_STREAM : 0;
+
+    do {
+        n = (len < h2->max_frame) ? len : h2->max_frame;
+        p = frame_start(h2, n, type,
+                        flags | (n == len ? FL_END_HEADERS : 0), id);
+        if (p == NULL) {
+            return;
+        }
+        memcpy(p, block, n);
+        block += n;
+        len   -= n;
+        type   = FT_CONTINUATION;
+        flags  = 0;
+    } while (len > 0);
+}
+
+/* -------------------------------------------------------------------------
+ * Streams
+ * ---------------------------------------------------------------------- */
+
+static struct h2_stream *find_stream(struct neuro_h2 *h2, unsigned int id)
+{
+    size_t lo = 0, hi = h2->nstreams, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (h2->streams[mid].id == id) {
+            return &h2->streams[mid];
+        }
+        if (h2->streams[mid].id < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+/* add_stream — Opens stream 'id', which is above every open one */
+static struct h2_stream *add_stream(struct neuro_h2 *h2, unsigned int id,
+                                    void *user)
+{
+    struct h2_stream *s;
+    void             *q;
+
+    q = grow(h2->streams, &h2->cap_streams, h2->nstreams + 1, sizeof(*s));
+    if (q == NULL) {
+        h2->nomem = 1;
+        return NULL;
+    }
+    h2->streams = (struct h2_stream *)q;
+    s = &h2->streams[h2->nstreams++];
+    memset(s, 0, sizeof(*s));
+    s->id     = id;
+    s->user   = user;
+    s->window = h2->init_window;
+    s->recv   = LOCAL_WINDOW;
+    return s;
+}
+
+/*
+ * close_stream — Forgets the stream and tells the caller.  's' is
+ * invalid afterwards, as are pointers to streams after it.
+ */
+static void close_stream(struct neuro_h2 *h2, struct h2_stream *s, int error)
+{
+    void  *user = s->user;
+    size_t i    = (size_t)(s - h2->streams);
+
+    memmove(s, s + 1, (h2->nstreams - i - 1) * sizeof(*s));
+    h2->nstreams--;
+    if (h2->turn > i) {
+        h2->turn--;
+    }
+    h2->cbs.on_close(user, error);
+}
+
+/* reset_stream — Sends RST_STREAM and closes the stream */
+static void reset_stream(struct neuro_h2 *h2, struct h2_stream *s, int code)
+{
+    send_u32(h2, FT_RST_STREAM, s->id, (unsigned long)code);
+    close_stream(h2, s, code);
+}
+
+/* set_body — Gives a stream the body it is to send */
+static void set_body(struct h2_stream *s, const struct neuro_h2_chunk *body,
+                     size_t nbody)
+{
+    size_t i;
+
+    s->nbody = 0;
+    for (i = 0; i < nbody && i < NEURO_H2_MAX_CHUNKS; i++) {
+        if (body[i].len > 0) {
+            s->body[s->nbody++] = body[i];
+        }
+    }
+    s->answered   = 1;
+    s->local_done = (s->nbody == 0);
+}
+
+/* sweep — Closes the streams both sides have finished */
+static void sweep(struct neuro_h2 *h2)
+{
+    size_t i = 0;
+
+    while (i < h2->nstreams) {
+        if (h2->streams[i].local_done && h2->streams[i].remote_done) {
+            close_stream(h2, &h2->streams[i], 0);
+        } else {
+            i++;
+        }
+    }
+}
+
+/*
+ * fail — The connection is unusable: queues a GOAWAY with 'code' (the
+ * peer broke the protocol, or we ran out of memory) and closes every
+ * stream.  Returns -1.
+ */
+static int fail(struct neuro_h2 *h2, int code)
+{
+    if (!h2->failed) {
+        h2->failed = 1;
+        h2->nomem  = 0;
+        send_goaway(h2, (unsigned long)code);
+    }
+    while (h2->nstreams > 0) {
+        close_stream(h2, &h2->streams[h2->nstreams - 1], NEURO_H2_LOST);
+    }
+    return -1;
+}
+
+/*
+ * send_data — Queues one DATA frame of a stream's body, as large as the
+ * windows and the peer's frame size allow (at least one byte).
+ */
+static void send_data(struct neuro_h2 *h2, struct h2_stream *s)
+{
+    unsigned char *p;
+    size_t         left = 0, n, i, take;
+
+    for (i = s->piece; i < s->nbody; i++) {
+        left += s->body[i].len;
+    }
+    left -= s->off;
+    n = left;
+    if (n > h2->max_frame) {
+        n = h2->max_frame;
+    }
+    if ((long)n > h2->window) {
+        n = (size_t)h2->window;
+    }
+    if ((long)n > s->window) {
+        n = (size_t)s->window;
+    }
+    p = frame_start(h2, n, FT_DATA, (n == left) ? FL_END_STREAM : 0, s->id);
+    if (p == NULL) {
+        return;
+    }
+    h2->window -= (long)n;
+    s->window  -= (long)n;
+    while (n > 0) {
+        take = s->body[s->piece].len - s->off;
+        if (take > n) {
+            take = n;
+        }
+        memcpy(p, s->body[s->piece].data + s->off, take);
+        p      += take;
+        n      -= take;
+        s->off += take;
+        if (s->off == s->body[s->piece].len) {
+            s->piece++;
+            s->off = 0;
+        }
+    }
+    if (s->piece == s->nbody) {
+        s->local_done = 1;
+    }
+}
+
+/*
+ * pump — Frames bodies into DATA, one frame per stream in turn, while
+ * the connection window lasts and the output is not too far ahead.
+ */
+static void pump(struct neuro_h2 *h2)
+{
+    struct h2_stream *s;
+    size_t            k, n;
+    int               sent = 1;
+
+    while (sent && h2->window > 0 && !h2->nomem &&
+           h2->out_len - h2->out_off < OUTPUT_HIGH) {
+        sent = 0;
+        n    = h2->nstreams;
+        for (k = 0; k < n && h2->window > 0 &&
+                    h2->out_len - h2->out_off < OUTPUT_HIGH; k++) {
+            s = &h2->streams[(h2->turn + k) % n];
+            if (s->answered && !s->local_done && s->window > 0) {
+                send_data(h2, s);
+                sent = 1;
+            }
+        }
+        if (n > 0) {
+            h2->turn = (h2->turn + 1) % n;
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * HPACK decoding
+ * ---------------------------------------------------------------------- */
+
+/*
+ * hp_int — Reads an integer with an n-bit prefix (RFC 7541 5.1).
+ * Returns 0, or -1 if it is cut off or too large.
+ */
+static int hp_int(const unsigned char **p, const unsigned char *end,
+                  int n, size_t *out)
+{
+    size_t max = ((size_t)1 << n) - 1, v;
+    int    shift = 0;
+    unsigned char b;
+
+    v = *(*p)++ & max;
+    if (v < max) {
+        *out = v;
+        return 0;
+    }
+    do {
+        if (*p == end || shift > 21) {
+            return -1;
+        }
+        b      = *(*p)++;
+        v     += (size_t)(b & 0x7f) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    *out = v;
+    return 0;
+}
+
+/*
+ * huff_decode — Decodes n bytes of Huffman code into out, which has room
+ * for n * 8 / 5 bytes (no code is shorter than 5 bits).  The code must
+ * end in fewer than 8 one-bits of padding, and EOS must not appear.
+ * Returns the decoded length, or -1.
+ */
+static long huff_decode(const unsigned char *in, size_t n, char *out)
+{
+    long   len   = 0;
+    int    code  = 0;   /* bits of the current code                 */
+    int    first = 0;   /* first code of the current length         */
+    int    index = 0;   /* index in huff_sym of that first code     */
+    int    bits  = 0;   /* length so far                            */
+    int    ones  = 1;   /* every bit so far was 1 (padding is EOS)  */
+    int    bit, count, b;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        for (b = 7; b >= 0; b--) {
+            bit   = (in[i] >> b) & 1;
+            code |= bit;
+            ones &= bit;
+            count = huff_count[++bits];
+            if (code - count < first) {
+                if (huff_sym[index + (code - first)] == 256) {
+                    return -1;
+                }
+                out[len++] = (char)huff_sym[index + (code - first)];
+                code = first = index = bits = 0;
+                ones = 1;
+                continue;
+            }
+            index += count;
+            first  = (first + count) << 1;
+            code <<= 1;
+        }
+    }
+    return (bits < 8 && ones) ? len : -1;
+}
+
+/*
+ * hp_string — Reads a string literal (RFC 7541 5.2).  A plain one is
+ * returned in place; a Huffman-coded one is decoded at *scratch, which
+ * is advanced past it.
+ * Returns 0, or -1 if malformed.
+ */
+static int hp_string(const unsigned char **p, const unsigned char *end,
+                     char **scratch, const char **str, size_t *len)
+{
+    int    huff;
+    size_t n;
+    long   got;
+
+    if (*p == end) {
+        return -1;
+    }
+    huff = **p & 0x80;
+    if (hp_int(p, end, 7, &n) < 0 || n > (size_t)(end - *p)) {
+        return -1;
+    }
+    if (huff) {
+        got = huff_decode(*p, n, *scratch);
+        if (got < 0) {
+            return -1;
+        }
+        *str      = *scratch;
+        *len      = (size_t)got;
+        *scratch += got;
+    } else {
+        *str = (const char *)*p;
+        *len = n;
+    }
+    *p += n;
+    return 0;
+}
+
+static void table_evict(struct hpack *t)
+{
+    struct hp_entry *e = &t->ent[t->first];
+
+    t->size  -= e->name_len + e->value_len + 32;
+    t->first  = (t->first + 1) % TABLE_SLOTS;
+    t->count--;
+    if (t->count == 0) {
+        t->lo = t->hi = 0;
+    } else {
+        t->lo = t->ent[t->first].off;
+    }
+}
+
+/* table_resize — Applies a dynamic table size update */
+static void table_resize(struct hpack *t, size_t max)
+{
+    t->max = max;
+    while (t->size > t->max) {
+        table_evict(t);
+    }
+}
+
+/*
+ * table_add — Adds an entry, evicting the oldest ones to make room.  The
+ * name and value must not point into the table.
+ */
+static void table_add(struct hpack *t, const char *name, size_t name_len,
+                      const char *value, size_t value_len)
+{
+    struct hp_entry *e;
+    size_t           i, k;
+
+    while (t->count > 0 && t->size + name_len + value_len + 32 > t->max) {
+        table_evict(t);
+    }
+    if (name_len + value_len + 32 > t->max) {
+        return; /* too large: the table is simply left empty */
+    }
+    if (t->hi + name_len + value_len > sizeof(t->bytes)) {
+        memmove(t->bytes, t->bytes + t->lo, t->hi - t->lo);
+        for (i = 0; i < t->count; i++) {
+            t->ent[(t->first + i) % TABLE_SLOTS].off -= t->lo;
+        }
+        t->hi -= t->lo;
+        t->lo  = 0;
+    }
+    k            = (t->first + t->count) % TABLE_SLOTS;
+    e            = &t->ent[k];
+    e->off       = t->hi;
+    e->name_len  = name_len;
+    e->value_len = value_len;
+    memcpy(t->bytes + t->hi, name, name_len);
+    memcpy(t->bytes + t->hi + name_len, value, value_len);
+    t->hi   += name_len + value_len;
+    t->size += name_len + value_len + 32;
+    t->count++;
+}
+
+/*
+ * table_get — Looks up index i of the static and dynamic tables.
+ * Returns 0, or -1 if there is no such entry.
+ */
+static int table_get(const struct hpack *t, size_t i, const char **name,
+                     size_t *name_len, const char **value, size_t *value_len)
+{
+    const struct hp_entry *e;
+
+    if (i >= 1 && i <= 61) {
+        *name      = static_table[i - 1].name;
+        *name_len  = strlen(*name);
+        *value     = static_table[i - 1].value;
+        *value_len = strlen(*value);
+        return 0;
+    }
+    if (i < 62 || i - 62 >= t->count) {
+        return -1;
+    }
+    e          = &t->ent[(t->first + t->count - 1 - (i - 62)) % TABLE_SLOTS];
+    *name      = t->bytes + e->off;
+    *name_len  = e->name_len;
+    *value     = t->bytes + e->off + e->name_len;
+    *value_len = e->value_len;
+    return 0;
+}
+
+/*
+ * hp_decode — Decodes a header block, handing each field to the stream
+ * (when s is not NULL).  The dynamic table is kept up to date even when
+ * the fields go nowhere, or the next block would not decode.  Sets
+ * *refused if on_header returned nonzero, and *interim if the block is
+ * an informational (1xx) response, whose fields are not handed on.
+ * Returns 0, or -1 if the block is malformed.
+ */
+static int hp_decode(struct neuro_h2 *h2, const unsigned char *p, size_t len,
+                     struct h2_stream *s, int *refused, int *interim)
+{
+    const unsigned char *end = p + len;
+    const char          *name, *value;
+    size_t               name_len, value_len, i;
+    char                *scratch;
+    int                  b, add;
+    int                  first = 1; /* the block's first field */
+    void                *q;
+
+    /* Room for a Huffman-coded name and value, and a name copied out of
+     * the dynamic table */
+    q = grow(h2->scratch, &h2->scratch_cap, len * 8 / 5 + TABLE_MAX, 1);
+    if (q == NULL) {
+        h2->nomem = 1;
+        return -1;
+    }
+    h2->scratch = (char *)q;
+
+    while (p < end) {
+        scratch = h2->scratch;
+        b       = *p;
+        if (b & 0x80) {                        /* indexed field */
+            if (hp_int(&p, end, 7, &i) < 0 || i == 0 ||
+                table_get(&h2->table, i, &name, &name_len, &value,
+                          &value_len) < 0) {
+                return -1;
+            }
+        } else if ((b & 0xe0) == 0x20) {       /* table size update */
+            if (hp_int(&p, end, 5, &i) < 0 || i > TABLE_MAX) {
+                return -1;
+            }
+            table_resize(&h2->table, i);
+            continue;
+        } else {                               /* literal field */
+            add = (b & 0xc0) == 0x40;
+            if (hp_int(&p, end, add ? 6 : 4, &i) < 0) {
+                return -1;
+            }
+            if (i == 0) {
+                if (hp_string(&p, end, &scratch, &name, &name_len) < 0) {
+                    return -1;
+                }
+            } else {
+                if (table_get(&h2->table, i, &name, &name_len, &value,
+                              &value_len) < 0) {
+                    return -1;
+                }
+                if (i > 61) { /* it may be evicted by table_add */
+                    memcpy(scratch, name, name_len);
+                    name     = scratch;
+                    scratch += name_len;
+                }
+            }
+            if (hp_string(&p, end, &scratch, &value, &value_len) < 0) {
+                return -1;
+            }
+            if (add) {
+                table_add(&h2->table, name, name_len, value, value_len);
+            }
+        }
+        if (first && s != NULL && !h2->server && name_len == 7 &&
+            memcmp(name, ":status", 7) == 0 && value_len == 3 &&
+            value[0] == '1') {
+            *interim = 1;   /* 100 Continue and the like */
+            s        = NULL;
+        }
+        first = 0;
+        if (s != NULL && !*refused &&
+            h2->cbs.on_header(s->user, name, name_len, value,
+                              value_len) != 0) {
+            *refused = 1;
+        }
+    }
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ * HPACK encoding
+ * ---------------------------------------------------------------------- */
+
+/* hp_put_int — Writes an integer with an n-bit prefix after 'flags' */
+static size_t hp_put_int(unsigned char *out, int flags, int n, size_t v)
+{
+    size_t max = ((size_t)1 << n) - 1, k = 0;
+
+    if (v < max) {
+        out[0] = (unsigned char)(flags | (int)v);
+        return 1;
+    }
+    out[k++] = (unsigned char)(flags | (int)max);
+    v       -= max;
+    while (v >= 128) {
+        out[k++] = (unsigned char)(0x80 | (v & 0x7f));
+        v      >>= 7;
+    }
+    out[k++] = (unsigned char)v;
+    return k;
+}
+
+size_t neuro_h2_encode(char *out, size_t cap,
+                       const struct neuro_h2_field *fields, size_t n)
+{
+    unsigned char *o = (unsigned char *)out;
+    size_t         len = 0, i, k, name_idx, nl, vl;
+
+    for (i = 0; i < n; i++) {
+        nl       = strlen(fields[i].name);
+        vl       = strlen(fields[i].value);
+        name_idx = 0;
+        for (k = 0; k < 61; k++) {
+            if (strcmp(static_table[k].name, fields[i].name) != 0) {
+                continue;
+            }
+            if (name_idx == 0) {
+                name_idx = k + 1;
+            }
+            if (!fields[i].sensitive &&
+                strcmp(static_table[k].value, fields[i].value) == 0) {
+                break;
+            }
+        }
+        if (len + nl + vl + 16 > cap) { /* 16: three integers at most */
+            return 0;
+        }
+        if (k < 61) {                  /* the whole field is in the table */
+            len += hp_put_int(o + len, 0x80, 7, k + 1);
+            continue;
+        }
+        /* A literal, not added to the peer's table; credentials are
+         * also marked never to be indexed by intermediaries */
+        len += hp_put_int(o + len, fields[i].sensitive ? 0x10 : 0x00, 4,
+                          name_idx);
+        if (name_idx == 0) {
+            len += hp_put_int(o + len, 0, 7, nl);
+            memcpy(o + len, fields[i].name, nl);
+            len += nl;
+        }
+        len += hp_put_int(o + len, 0, 7, vl);
+        memcpy(o + len, fields[i].value, vl);
+        len += vl;
+    }
+    return len;
+}
+
+/* -------------------------------------------------------------------------
+ * Frames received
+ * ---------------------------------------------------------------------- */
+
+/*
+ * remote_end — The peer finished its side of the stream.  A client whose
+ * request is still going up stops sending it: the response is complete.
+ */
+static void remote_end(struct neuro_h2 *h2, struct h2_stream *s)
+{
+    s->remote_done = 1;
+    h2->cbs.on_end(s->user);
+    if (!h2->server && !s->local_done) {
+        s->local_done = 1;
+        send_u32(h2, FT_RST_STREAM, s->id, NEURO_H2_CANCEL);
+    }
+}
+
+/*
+ * strip_padding — Removes the Pad Length field and the padding of a
+ * PADDED frame.  Returns 0, or -1 if the padding is too long.
+ */
+static int strip_padding(int flags, const unsigned char **p, size_t *len)
+{
+    size_t pad;
+
+    if (!(flags & FL_PADDED)) {
+        return 0;
+    }
+    if (*len < 1 || (pad = **p) >= *len) {
+        return -1;
+    }
+    *p   += 1;
+    *len -= 1 + pad;
+    return 0;
+}
+
+/*
+ * on_block — A complete header block for stream 'id'.  A server opens
+ * the stream here.  Blocks for streams that are gone, and a second block
+ * (trailers), are decoded for the sake of the table and dropped.
+ * Returns 0 or a connection error code.
+ */
+static int on_block(struct neuro_h2 *h2, unsigned int id, int end_stream)
+{
+    struct h2_stream *s = find_stream(h2, id);
+    void             *user;
+    int               refused = 0, refuse = 0, interim = 0;
+
+    if (s == NULL && h2->server && id > h2->peer_id) {
+        if (id % 2 == 0) {
+            return ERR_PROTOCOL;
+        }
+        h2->peer_id = id;
+        if (h2->goaway_out || h2->nstreams >= LOCAL_MAX_STREAMS ||
+            (user = h2->cbs.on_open(h2->user, id)) == NULL) {
+            refuse = 1;
+        } else if ((s = add_stream(h2, id, user)) == NULL) {
+            h2->cbs.on_close(user, NEURO_H2_LOST);
+            return ERR_INTERNAL;
+        }
+    }
+    if (s != NULL && s->headers) {
+        s = NULL;       /* trailers: nothing in them is of use */
+    }
+    if (hp_decode(h2, h2->block, h2->block_len, s, &refused, &interim) < 0) {
+        return h2->nomem ? ERR_INTERNAL : ERR_COMPRESSION;
+    }
+    if (refuse) {
+        send_u32(h2, FT_RST_STREAM, id, NEURO_H2_REFUSED);
+        return 0;
+    }
+    if (s == NULL) {
+        s = find_stream(h2, id);
+        if (s != NULL && end_stream) {
+            remote_end(h2, s);
+        }
+        return 0;
+    }
+    if (interim) {
+        if (end_stream) {   /* a 1xx response can not end the stream */
+            reset_stream(h2, s, ERR_PROTOCOL);
+        }
+        return 0;           /* the final response is still to come */
+    }
+    s->headers = 1;
+    if (refused || h2->cbs.on_headers_end(s->user) != 0) {
+        reset_stream(h2, s, NEURO_H2_CANCEL);
+        return 0;
+    }
+    if (end_stream) {
+        remote_end(h2, s);
+    }
+    return 0;
+}
+
+/* block_add — Appends a header block fragment */
+static int block_add(struct neuro_h2 *h2, const unsigned char *p, size_t len)
+{
+    void *q;
+
+    if (h2->block_len + len > MAX_BLOCK) {
+        return ERR_ENHANCE_YOUR_CALM;
+    }
+    q = grow(h2->block, &h2->block_cap, h2->block_len + len, 1);
+    if (q == NULL) {
+        return ERR_INTERNAL;
+    }
+    h2->block = (unsigned char *)q;
+    memcpy(h2->block + h2->block_len, p, len);
+    h2->block_len += len;
+    return 0;
+}
+
+static int on_headers(struct neuro_h2 *h2, int type, int flags,
+                      unsigned int id, const unsigned char *p, size_t len)
+{
+    int err;
+
+    if (id == 0) {
+        return ERR_PROTOCOL;
+    }
+    if (type == FT_HEADERS) {
+        if (strip_padding(flags, &p, &len) < 0) {
+            return ERR_PROTOCOL;
+        }
+        if (flags & FL_PRIORITY) {      /* priorities are not used */
+            if (len < 5) {
+                return ERR_FRAME_SIZE;
+            }
+            p   += 5;
+            len -= 5;
+        }
+        h2->block_len = 0;
+        h2->block_id  = id;
+        h2->block_end = flags & FL_END_STREAM;
+    } else if (id != h2->block_id) {
+        return ERR_PROTOCOL;            /* CONTINUATION out of place */
+    }
+    err = block_add(h2, p, len);
+    if (err != 0 || !(flags & FL_END_HEADERS)) {
+        return err;
+    }
+    h2->block_id = 0;
+    return on_block(h2, id, h2->block_end);
+}
+
+static int on_data(struct neuro_h2 *h2, int flags, unsigned int id,
+                   const unsigned char *p, size_t len)
+{
+    struct h2_stream *s;
+    size_t            flow = len; /* padding counts against the window */
+
+    if (id == 0) {
+        return ERR_PROTOCOL;
+    }
+    if (strip_padding(flags, &p, &len) < 0) {
+        return ERR_PROTOCOL;
+    }
+    h2->recv -= (long)flow;
+    if (h2->recv < 0) {
+        return ERR_FLOW_CONTROL;
+    }
+    if (h2->recv <= LOCAL_CONN / 2) {
+        send_u32(h2, FT_WINDOW_UPDATE, 0, (unsigned long)(LOCAL_CONN -
+                                                          h2->recv));
+        h2->recv = LOCAL_CONN;
+    }
+
+    s = find_stream(h2, id);
+    if (s == NULL || s->remote_done) {
+        return 0; /* reset by us, data still in flight */
+    }
+    if (!s->headers) {
+        reset_stream(h2, s, ERR_PROTOCOL); /* a body before the head */
+        return 0;
+    }
+    s->recv -= (long)flow;
+    if (s->recv < 0) {
+        reset_stream(h2, s, ERR_FLOW_CONTROL);
+        return 0;
+    }
+    if (len > 0 && h2->cbs.on_data(s->user, (const char *)p, len) != 0) {
+        reset_stream(h2, s, NEURO_H2_CANCEL);
+        return 0;
+    }
+    if (flags & FL_END_STREAM) {
+        remote_end(h2, s);
+    } else if (s->recv <= LOCAL_WINDOW / 2) {
+        send_u32(h2, FT_WINDOW_UPDATE, id,
+                 (unsigned long)(LOCAL_WINDOW - s->recv));
+        s->recv = LOCAL_WINDOW;
+    }
+    return 0;
+}
+
+static int on_settings(struct neuro_h2 *h2, int flags, unsigned int id,
+                       const unsigned char *p, size_t len)
+{
+    unsigned long v;
+    size_t        i;
+    long          delta;
+
+    if (id != 0) {
+        return ERR_PROTOCOL;
+    }
+    if (flags & FL_ACK) {
+        return (len == 0) ? 0 : ERR_FRAME_SIZE;
+    }
+    if (len % 6 != 0) {
+        return ERR_FRAME_SIZE;
+    }
+    for (; len > 0; p += 6, len -= 6) {
+        v = get32(p + 2);
+        switch ((p[0] << 8) | p[1]) {
+            case SET_ENABLE_PUSH:
+                if (v > 1 || (v == 1 && !h2->server)) {
+                    return ERR_PROTOCOL;
+                }
+                break;
+            case SET_MAX_CONCURRENT_STREAMS:
+                h2->max_streams = v;
+                break;
+            case SET_INITIAL_WINDOW_SIZE:
+                if (v > (unsigned long)WINDOW_MAX) {
+                    return ERR_FLOW_CONTROL;
+                }
+                delta           = (long)v - h2->init_window;
+                h2->init_window = (long)v;
+                for (i = 0; i < h2->nstreams; i++) {
+                    h2->streams[i].window += delta;
+                }
+                break;
+            case SET_MAX_FRAME_SIZE:
+                if (v < 16384 || v > 16777215) {
+                    return ERR_PROTOCOL;
+                }
+                h2->max_frame = v;
+                break;
+            default:            /* HEADER_TABLE_SIZE concerns a dynamic */
+                break;          /* table our encoder never uses         */
+        }
+    }
+    frame_start(h2, 0, FT_SETTINGS, FL_ACK, 0);
+    return 0;
+}
+
+static int on_window_update(struct neuro_h2 *h2, unsigned int id,
+                            const unsigned char *p, size_t len)
+{
+    struct h2_stream *s;
+    long              inc;
+
+    if (len != 4) {
+        return ERR_FRAME_SIZE;
+    }
+    inc = (long)(get32(p) & 0x7fffffffUL);
+    if (id == 0) {
+        if (inc == 0 || h2->window > WINDOW_MAX - inc) {
+            return inc == 0 ? ERR_PROTOCOL : ERR_FLOW_CONTROL;
+        }
+        h2->window += inc;
+        return 0;
+    }
+    s = find_stream(h2, id);
+    if (s == NULL) {
+        return 0;
+    }
+    if (inc == 0 || s->window > WINDOW_MAX - inc) {
+        reset_stream(h2, s, inc == 0 ? ERR_PROTOCOL : ERR_FLOW_CONTROL);
+        return 0;
+    }
+    s->window += inc;
+    return 0;
+}
+
+static int on_goaway(struct neuro_h2 *h2, unsigned int id,
+                     const unsigned char *p, size_t len)
+{
+    unsigned long last;
+    size_t        i;
+
+    if (id != 0) {
+        return ERR_PROTOCOL;
+    }
+    if (len < 8) {
+        return ERR_FRAME_SIZE;
+    }
+    last          = get32(p) & 0x7fffffffUL;
+    h2->goaway_in = 1;
+    /* Streams above the last one the peer will process never reached
+     * it: they may safely be sent again */
+    i = h2->nstreams;
+    while (i > 0 && h2->streams[i - 1].id > last) {
+        i--;
+        if (!h2->server) {
+            close_stream(h2, &h2->streams[i], NEURO_H2_REFUSED);
+        }
+    }
+    return 0;
+}
+
+/*
+ * on_frame — Handles one complete frame.
+ * Returns 0 or a connection error code.
+ */
+static int on_frame(struct neuro_h2 *h2, int type, int flags, unsigned int id,
+                    const unsigned char *p, size_t len)
+{
+    struct h2_stream *s;
+    unsigned char    *q;
+
+    if (h2->block_id != 0 && type != FT_CONTINUATION) {
+        return ERR_PROTOCOL;    /* a header block must be contiguous */
+    }
+    switch (type) {
+        case FT_DATA:
+            return on_data(h2, flags, id, p, len);
+        case FT_HEADERS:
+        case FT_CONTINUATION:
+            return on_headers(h2, type, flags, id, p, len);
+        case FT_PRIORITY:
+            return (len == 5) ? 0 : ERR_FRAME_SIZE;
+        case FT_RST_STREAM:
+            if (id == 0) {
+                return ERR_PROTOCOL;
+            }
+            if (len != 4) {
+                return ERR_FRAME_SIZE;
+            }
+            s = find_stream(h2, id);
+            if (s != NULL) {
+                close_stream(h2, s, (int)(get32(p) & 0x7fffffffUL));
+            }
+            return 0;
+        case FT_SETTINGS:
+            return on_settings(h2, flags, id, p, len);
+        case FT_PUSH_PROMISE:
+            return ERR_PROTOCOL;        /* push is turned off */
+        case FT_PING:
+            if (id != 0) {
+                return ERR_PROTOCOL;
+            }
+            if (len != 8) {
+                return ERR_FRAME_SIZE;
+            }
+            if (!(flags & FL_ACK) &&
+                (q = frame_start(h2, 8, FT_PING, FL_ACK, 0)) != NULL) {
+                memcpy(q, p, 8);
+            }
+            return 0;
+        case FT_GOAWAY:
+            return on_goaway(h2, id, p, len);
+        case FT_WINDOW_UPDATE:
+            return on_window_update(h2, id, p, len);
+        default:
+            return 0;                   /* unknown types are ignored */
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * Public API
+ * ---------------------------------------------------------------------- */
+
+struct neuro_h2 *neuro_h2_new(int server, const struct neuro_h2_cbs *cbs,
+                              void *user)
+{
+    struct neuro_h2 *h2 = (struct neuro_h2 *)calloc(1, sizeof(*h2));
+    unsigned char   *p;
+
+    if (h2 == NULL) {
+        return NULL;
+    }
+    h2->cbs         = *cbs;
+    h2->user        = user;
+    h2->server      = server;
+    h2->next_id     = 1;
+    h2->max_streams = 0xffffffffUL;
+    h2->max_frame   = MAX_FRAME;
+    h2->init_window = DEFAULT_WINDOW;
+    h2->window      = DEFAULT_WINDOW;
+    h2->recv        = LOCAL_CONN;
+    h2->table.max   = TABLE_MAX;
+
+    if (!server) {
+        p = (unsigned char *)grow(NULL, &h2->out_cap, 4096, 1);
+        if (p == NULL) {
+            free(h2);
+            return NULL;
+        }
+        h2->out = p;
+        memcpy(p, PREFACE, PREFACE_LEN);
+        h2->out_len = PREFACE_LEN;
+    }
+    send_settings(h2);
+    send_u32(h2, FT_WINDOW_UPDATE, 0,
+             (unsigned long)(LOCAL_CONN - DEFAULT_WINDOW));
+    if (h2->nomem) {
+        neuro_h2_free(h2);
+        return NULL;
+    }
+    return h2;
+}
+
+void neuro_h2_free(struct neuro_h2 *h2)
+{
+    if (h2 == NULL) {
+        return;
+    }
+    while (h2->nstreams > 0) {
+        close_stream(h2, &h2->streams[h2->nstreams - 1], NEURO_H2_LOST);
+    }
+    free(h2->streams);
+    free(h2->block);
+    free(h2->scratch);
+    free(h2->out);
+    free(h2);
+}
+
+int neuro_h2_request(struct neuro_h2 *h2, const char *block, size_t len,
+                     const struct neuro_h2_chunk *body, size_t nbody,
+                     void *stream)
+{
+    struct h2_stream *s;
+    unsigned int      id = h2->next_id;
+
+    if (h2->server || !neuro_h2_can_open(h2)) {
+        return -1;
+    }
+    s = add_stream(h2, id, stream);
+    if (s == NULL) {
+        h2->nomem = 0;
+        return -1;
+    }
+    h2->next_id += 2;
+    set_body(s, body, nbody);
+    send_block(h2, id, block, len, s->local_done);
+    if (h2->nomem) {
+        fail(h2, ERR_INTERNAL);
+        return -1;
+    }
+    return (int)id;
+}
+
+int neuro_h2_respond(struct neuro_h2 *h2, unsigned int id,
+                     const char *block, size_t len,
+                     const struct neuro_h2_chunk *body, size_t nbody)
+{
+    struct h2_stream *s = find_stream(h2, id);
+
+    if (!h2->server || s == NULL || s->answered) {
+        return -1;
+    }
+    set_body(s, body, nbody);
+    send_block(h2, id, block, len, s->local_done);
+    if (h2->nomem) {
+        fail(h2, ERR_INTERNAL);
+        return -1;
+    }
+    return 0;
+}
+
+int neuro_h2_feed(struct neuro_h2 *h2, const char *data, size_t len)
+{
+    const unsigned char *in = (const unsigned char *)data;
+    const unsigned char *payload;
+    size_t               n;
+    int                  err;
+
+    if (h2->failed) {
+        return -1;
+    }
+    while (len > 0) {
+        if (h2->server && h2->preface < PREFACE_LEN) {
+            n = PREFACE_LEN - h2->preface;
+            n = (n < len) ? n : len;
+            if (memcmp(in, PREFACE + h2->preface, n) != 0) {
+                return fail(h2, ERR_PROTOCOL);
+            }
+            h2->preface += n;
+            in          += n;
+            len         -= n;
+            continue;
+        }
+        if (h2->head_len < FRAME_HEAD) {
+            n = FRAME_HEAD - h2->head_len;
+            n = (n < len) ? n : len;
+            memcpy(h2->head + h2->head_len, in, n);
+            h2->head_len += n;
+            in           += n;
+            len          -= n;
+            if (h2->head_len < FRAME_HEAD) {
+                break;
+            }
+            h2->frame_len = ((size_t)h2->head[0] << 16) |
+                            ((size_t)h2->head[1] << 8) | h2->head[2];
+            h2->frame_got = 0;
+            if (h2->frame_len > MAX_FRAME) {
+                return fail(h2, ERR_FRAME_SIZE);
+            }
+        }
+        /* The payload: in place if it is all here, else gathered */
+        if (h2->frame_got == 0 && len >= h2->frame_len) {
+            payload = in;
+            in     += h2->frame_len;
+            len    -= h2->frame_len;
+        } else {
+            n = h2->frame_len - h2->frame_got;
+            n = (n < len) ? n : len;
+            memcpy(h2->frame + h2->frame_got, in, n);
+            h2->frame_got += n;
+            in            += n;
+            len           -= n;
+            if (h2->frame_got < h2->frame_len) {
+                break;
+            }
+            payload = h2->frame;
+        }
+        h2->head_len = 0;
+        err = on_frame(h2, h2->head[3], h2->head[4],
+                       (unsigned int)(get32(h2->head + 5) & 0x7fffffffUL),
+                       payload, h2->frame_len);
+        if (err == 0 && h2->nomem) {
+            err = ERR_INTERNAL;
+        }
+        if (err != 0) {
+            return fail(h2, err);
+        }
+    }
+    sweep(h2);
+    return 0;
+}
+
+size_t neuro_h2_output(struct neuro_h2 *h2, const char **data)
+{
+    if (!h2->failed) {
+        pump(h2);
+        if (h2->nomem) {
+            fail(h2, ERR_INTERNAL);
+        } else {
+            sweep(h2);
+        }
+    }
+    *data = (const char *)h2->out + h2->out_off;
+    return h2->out_len - h2->out_off;
+}
+
+void neuro_h2_sent(struct neuro_h2 *h2, size_t n)
+{
+    h2->out_off += n;
+    if (h2->out_off >= h2->out_len) {
+        h2->out_off = h2->out_len = 0;
+    }
+}
+
+int neuro_h2_can_open(const struct neuro_h2 *h2)
+{
+    return !h2->failed && !h2->goaway_in && !h2->goaway_out &&
+           h2->nstreams < h2->max_streams && h2->next_id < 0x7fffffffU;
+}
+
+size_t neuro_h2_streams(const struct neuro_h2 *h2)
+{
+    return h2->nstreams;
+}
+
+void neuro_h2_goaway(struct neuro_h2 *h2)
+{
+    if (!h2->goaway_out && !h2->failed) {
+        send_goaway(h2, ERR_NO_ERROR);
+    }
+}
@@ -0,0 +1,167 @@
+/*
+ * neuroh2.h — HTTP/2 framing (RFC 9113) and header compression (HPACK,
+ * RFC 7541) for neurolib.
+ *
+ * A neuro_h2 is one HTTP/2 connection without the socket: the caller
+ * moves the bytes.  Bytes that arrive are pushed in with neuro_h2_feed(),
+ * which calls back with each header, piece of body and end of stream;
+ * bytes to send are taken from neuro_h2_output().  Any number of streams
+ * run at once over the connection, each carrying a pointer of the
+ * caller's.  Either end can be played: neurolib is the client, the mock
+ * server in neurobench the server.
+ *
+ * Flow control is handled here.  Received data is acknowledged as soon
+ * as the callback has taken it, and bodies are sent no faster than the
+ * peer's windows allow.  Header blocks are encoded without the dynamic
+ * table or Huffman coding, which costs a few bytes per request but keeps
+ * the encoder stateless; the decoder understands everything.  Server
+ * push is turned off.
+ *
+ * Compilation: built together with neurolib.c (see neurolib.h).
+ */
+
+#ifndef NEUROH2_H
+#define NEUROH2_H
+
+#include <stddef.h> /* size_t */
+
+/* ALPN list offering h2 and then http/1.1, for SSL_set_alpn_protos */
+#define NEURO_H2_ALPN     "\x02h2\x08http/1.1"
+#define NEURO_H2_ALPN_LEN 12
+
+/* Body pieces a message may be given in */
+#define NEURO_H2_MAX_CHUNKS 4
+
+/* Errors passed to on_close besides the RFC 9113 codes */
+#define NEURO_H2_REFUSED 0x7  /* REFUSED_STREAM: not processed, retry  */
+#define NEURO_H2_CANCEL  0x8  /* CANCEL: a callback refused the stream */
+#define NEURO_H2_LOST    (-1) /* the connection failed or was freed    */
+
+/* Opaque connection state */
+struct neuro_h2;
+
+/* A header field to encode; name in lower case, both NUL-terminated */
+struct neuro_h2_field {
+    const char *name;
+    const char *value;
+    int         sensitive; /* a credential: "never indexed" for proxies */
+};
+
+/* A piece of body, sent from where it lies: it must stay valid until the
+ * stream is closed */
+struct neuro_h2_chunk {
+    const char *data;
+    size_t      len;
+};
+
+/*
+ * What the connection calls back with.  'stream' is the pointer the
+ * stream was opened with.  A callback returning nonzero resets its
+ * stream (on_close follows with NEURO_H2_CANCEL).  Callbacks must not
+ * call neuro_h2_request, neuro_h2_respond or neuro_h2_free.
+ */
+struct neuro_h2_cbs {
+    /* Server only: the peer opened stream 'id'.  Returns the stream's
+     * pointer, or NULL to refuse it. */
+    void *(*on_open)(void *user, unsigned int id);
+
+    /* One header field (":status", "content-type", ...), decoded.  A
+     * client is not shown informational (1xx) responses, nor trailers. */
+    int (*on_header)(void *stream, const char *name, size_t name_len,
+                     const char *value, size_t value_len);
+
+    /* The end of a block of header fields */
+    int (*on_headers_end)(void *stream);
+
+    /* A piece of the body */
+    int (*on_data)(void *stream, const char *data, size_t len);
+
+    /* The peer has sent all of its message */
+    void (*on_end)(void *stream);
+
+    /* The stream is gone: error 0 once both sides have ended, else an
+     * RFC 9113 error code or NEURO_H2_LOST.  Always called, exactly
+     * once per stream. */
+    void (*on_close)(void *stream, int error);
+};
+
+/*
+ * neuro_h2_new — Starts a connection, as the client or the server.  The
+ * preface and SETTINGS are queued for output at once.  'cbs' is copied;
+ * 'user' goes to on_open.
+ * Returns NULL if out of memory.
+ */
+struct neuro_h2 *neuro_h2_new(int server, const struct neuro_h2_cbs *cbs,
+                              void *user);
+
+/*
+ * neuro_h2_free — Frees the connection.  Streams still open are closed
+ * with NEURO_H2_LOST first.  NULL is ignored.
+ */
+void neuro_h2_free(struct neuro_h2 *h2);
+
+/*
+ * neuro_h2_encode — Encodes n header fields into an HPACK block.
+ * Returns its length, or 0 if it does not fit in 'cap' bytes.
+ */
+size_t neuro_h2_encode(char *out, size_t cap,
+                       const struct neuro_h2_field *fields, size_t n);
+
+/*
+ * neuro_h2_request — Client: opens a stream with the encoded header
+ * block (copied) and a body of up to NEURO_H2_MAX_CHUNKS pieces (not
+ * copied).
+ * Returns the stream id, or -1 if no stream may be opened now (see
+ * neuro_h2_can_open) or out of memory.
+ */
+int neuro_h2_request(struct neuro_h2 *h2, const char *block, size_t len,
+                     const struct neuro_h2_chunk *body, size_t nbody,
+                     void *stream);
+
+/*
+ * neuro_h2_respond — Server: answers stream 'id' with the encoded header
+ * block (copied) and a body as for neuro_h2_request.
+ * Returns 0, or -1 if the stream is not open or has been answered.
+ */
+int neuro_h2_respond(struct neuro_h2 *h2, unsigned int id,
+                     const char *block, size_t len,
+                     const struct neuro_h2_chunk *body, size_t nbody);
+
+/*
+ * neuro_h2_feed — Processes bytes received from the peer.
+ * Returns 0, or -1 on a connection error: a GOAWAY is then queued and
+ * every stream has been closed; send the output and close.
+ */
+int neuro_h2_feed(struct neuro_h2 *h2, const char *data, size_t len);
+
+/*
+ * neuro_h2_output — Points *data at the bytes waiting to be sent (frames
+ * for as much body as the flow-control windows allow).
+ * Returns their number; 0 when there is nothing to send.
+ */
+size_t neuro_h2_output(struct neuro_h2 *h2, const char **data);
+
+/*
+ * neuro_h2_sent — Marks n bytes of the output as sent.
+ */
+void neuro_h2_sent(struct neuro_h2 *h2, size_t n);
+
+/*
+ * neuro_h2_can_open — True if neuro_h2_request would open a stream now:
+ * the connection is healthy, no GOAWAY has been exchanged and the peer's
+ * limit of concurrent streams is not reached.
+ */
+int neuro_h2_can_open(const struct neuro_h2 *h2);
+
+/*
+ * neuro_h2_streams — Number of streams open.
+ */
+size_t neuro_h2_streams(const struct neuro_h2 *h2);
+
+/*
+ * neuro_h2_goaway — Starts a graceful shutdown: queues a GOAWAY, after
+ * which no new stream is opened or accepted.
+ */
+void neuro_h2_goaway(struct neuro_h2 *h2);
+
+#endif /* NEUROH2_H */
@@ -2,34 +2,75 @@
  * neurolib.c — Implementation of the AI query library.
  *
  * When OPENAI_API_KEY is set:
- *   Opens a TLS connection to api.openai.com:443, sends an HTTP POST
- *   to /v1/chat/completions with the user's prompt, and returns the
- *   raw JSON response body.
+ *   Sends an HTTP POST to /v1/chat/completions on api.openai.com:443
+ *   (or the endpoint set with neuro_set_endpoint) and returns the raw
+ *   JSON response body.  The TLS context and the connection are kept
+ *   between calls (HTTP/1.1 keep-alive), and a reconnect offers the
+ *   last TLS session ticket so the handshake can be resumed.
+ *   neuro_ask_batch drives many connections at once from an epoll loop.
+ *   With neuro_set_http2, HTTP/2 is offered as well (neuroh2.c); a
+ *   server that takes it carries every request, and a whole batch, as
+ *   streams of the one connection.
+ *   Responses may come back compressed (gzip or deflate through zlib;
+ *   br and zstd when built with NEURO_BROTLI / NEURO_ZSTD) and are
+ *   inflated as they arrive.
+ *   An optional on-disk cache (neurocache.c) answers repeated requests.
  *
  * When OPENAI_API_KEY is not set:
  *   Returns a pre-canned JSON string that looks exactly like a real
  *   OpenAI response, so the rest of the program works without a key.
  */
 
-/* POSIX extensions (needed for getaddrinfo, etc.) */
+/* POSIX extensions (needed for getaddrinfo, strncasecmp, clock_gettime) */
 #define _POSIX_C_SOURCE 200112L
 
 #include "neurolib.h"
+#include "neurocache.h"
+#include "neurotok.h"
+#include "neuroh2.h"
+#include "jasonlib.h"
 
 #include <stdio.h>      /* snprintf, fprintf                            */
 #include <stdlib.h>     /* malloc, free, getenv, realloc                */
 #include <string.h>     /* strlen, strcpy, strstr, memset               */
+#include <strings.h>    /* strncasecmp                                  */
+#include <ctype.h>      /* isdigit, tolower                             */
 
 /* POSIX networking */
 #include <sys/types.h>  /* type definitions required by socket headers  */
 #include <sys/socket.h> /* socket, connect                              */
+#include <sys/time.h>   /* struct timeval (SO_RCVTIMEO)                 */
 #include <netdb.h>      /* getaddrinfo, freeaddrinfo                    */
 #include <unistd.h>     /* close                                        */
+#include <time.h>       /* clock_gettime, CLOCK_MONOTONIC               */
+#include <poll.h>       /* poll                                         */
+#include <netinet/in.h> /* IPPROTO_TCP                                  */
+#include <netinet/tcp.h> /* TCP_NODELAY                                 */
+#include <fcntl.h>      /* fcntl, O_NONBLOCK                            */
+#include <errno.h>      /* errno, EINPROGRESS, EINTR                    */
+#include <sys/epoll.h>  /* epoll_create1, epoll_ctl, epoll_wait (Linux) */
+#include <pthread.h>    /* pthread_mutex_t (the shared rate limiter)    */
+
+/* SSE2 for the JSON escape scan (always present on x86-64) */
+#if defined(__SSE2__)
+#include <emmintrin.h>  /* _mm_loadu_si128, _mm_cmpeq_epi8, ...         */
+#endif
 
 /* OpenSSL TLS */
 #include <openssl/ssl.h>     /* SSL_CTX, SSL, SSL_connect, ...          */
 #include <openssl/err.h>     /* ERR_clear_error                         */
 
+/* Compressed responses: zlib always, Brotli and Zstandard optionally
+ * (-DNEURO_BROTLI with -lbrotlidec, -DNEURO_ZSTD with -lzstd) */
+#define ZLIB_CONST                /* next_in points to const bytes        */
+#include <zlib.h>            /* z_stream, inflateInit2, inflate         */
+#ifdef NEURO_BROTLI
+#include <brotli/decode.h>   /* BrotliDecoderDecompressStream           */
+#endif
+#ifdef NEURO_ZSTD
+#include <zstd.h>            /* ZSTD_decompressStream                   */
+#endif
+
 /* -------------------------------------------------------------------------
  * Constants
  * ---------------------------------------------------------------------- */
@@ -39,8 +80,79 @@
 #define API_PATH  "/v1/chat/completions" /* REST endpoint for chat        */
 #define API_MODEL "gpt-4o-mini"          /* cheap, fast chat model        */
 
-/* Maximum size for the response we will buffer (2 MB) */
-#define RESP_BUF_SIZE (2 * 1024 * 1024)
+/* Receive buffer for SSL_read; responses of any size stream through it */
+#define RECV_BUF_SIZE (16 * 1024)
+
+/* Longest status, header or chunk-size line the parser accepts */
+#define HTTP_LINE_MAX 8192
+
+/* Most header fields a request sends over HTTP/2 (pseudo-headers too) */
+#define H2_MAX_FIELDS 16
+
+/* Inflated body bytes are passed on in pieces of this size */
+#define DECODE_BUF_SIZE (16 * 1024)
+
+/* Accept-Encoding sent with every request: what this build can inflate */
+#ifdef NEURO_BROTLI
+#define ACCEPT_BR ", br"
+#else
+#define ACCEPT_BR ""
+#endif
+#ifdef NEURO_ZSTD
+#define ACCEPT_ZSTD ", zstd"
+#else
+#define ACCEPT_ZSTD ""
+#endif
+#define ACCEPT_ENCODING "gzip, deflate" ACCEPT_BR ACCEPT_ZSTD
+
+/* Resolver cache lifetime.  getaddrinfo does not report the record's DNS
+ * TTL, so a fixed, conservative one is used. */
+#define DNS_CACHE_TTL_MS 60000
+
+/* Most addresses kept for the API host */
+#define DNS_MAX_ADDRS 16
+
+/* Happy Eyeballs (RFC 8305): delay before racing the next address, and
+ * the limit for the whole connect */
+#define HE_ATTEMPT_DELAY_MS 250
+#define CONNECT_TIMEOUT_MS  10000
+
+/* Retries of a failed request: how many, and the backoff before each
+ * (a random wait up to BASE * 2^attempt, capped) */
+#define RETRY_MAX     2
+#define RETRY_BASE_MS 250
+#define RETRY_CAP_MS  8000
+
+/* Longest wait for the server to accept or produce any data */
+#define IO_TIMEOUT_MS 60000
+
+/* Pacing runs at this share of the refill rate the server advertises,
+ * to stay just under its limits */
+#define RATE_MARGIN 0.9
+
+/* Rate-limit buckets: requests and tokens */
+enum { RL_REQUESTS, RL_TOKENS, RL_COUNT };
+
+/* Adaptive hedging waits for this many first-byte samples before it
+ * trusts their p95 */
+#define HEDGE_MIN_SAMPLES 20
+
+/* Conversations: default history budget, and the estimated overhead of
+ * every message (role and framing), in tokens */
+#define CONV_BUDGET     8000
+#define CONV_MSG_TOKENS 4
+
+/* Latency histograms: 2^HIST_SUB_BITS linear sub-buckets per power of
+ * two (under 1.6% error), covering 1 us up to 2^40 us */
+#define HIST_SUB_BITS 6
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  (35 * HIST_SUB)
+
+/* Growable buffers: first allocation, pool size, and the largest
+ * capacity worth keeping in the pool once a request is over */
+#define BUF_MIN_CAP   4096
+#define BUF_POOL_SIZE 4
+#define BUF_KEEP_MAX  (4 * 1024 * 1024)
 
 /* -------------------------------------------------------------------------
  * Mock responses (used when no API key is available)
@@ -60,8 +172,26 @@ static const char *mock_contents[] = {
     NULL /* sentinel */
 };
 
-/* Index of the next mock response to return (cycles through the list) */
-static int mock_index = 0;
+/*
+ * next_mock_content — Returns the next mock answer, cycling back to the
+ * first one after the last.  '*index' is the caller's position in the
+ * list (each client keeps its own).
+ */
+static const char *next_mock_content(int *index)
+{
+    int idx; /* index into the mock_contents array */
+
+    idx = *index;
+
+    /* Count how many mock responses we have */
+    while (mock_contents[*index] != NULL) {
+        (*index)++;
+    }
+    /* *index now equals the total number of entries */
+    *index = (idx + 1) % *index; /* advance, wrapping around */
+
+    return mock_contents[idx];
+}
 
 /*
  * build_mock_json — Wraps a plain-text content string in a JSON envelope
@@ -87,278 +217,4564 @@ static char *build_mock_json(const char *content)
 }
 
 /* -------------------------------------------------------------------------
- * HTTPS helper functions (used only when an API key is present)
+ * Growable buffers
  * ---------------------------------------------------------------------- */
 
 /*
- * tcp_connect — Opens a TCP socket to host:port.
- * Returns the socket file descriptor on success, or -1 on failure.
+ * A byte buffer that grows on demand.  Buffers are recycled through the
+ * client's pool, so once the first few responses have been read their
+ * storage is already big enough and reading needs no allocation at all.
+ */
+struct neuro_buf {
+    char   *data; /* storage, NUL-terminated after every append */
+    size_t  len;  /* bytes in use                               */
+    size_t  cap;  /* bytes allocated                            */
+};
+
+/*
+ * buf_reserve — Makes room for 'extra' more bytes plus a NUL terminator,
+ * doubling the capacity as needed.
+ * Returns 0 on success, -1 if out of memory.
  */
-static int tcp_connect(const char *host, const char *port)
+static int buf_reserve(struct neuro_buf *b, size_t extra)
 {
-    struct addrinfo hints; /* criteria for address selection    */
-    struct addrinfo *res;  /* linked list of results            */
-    struct addrinfo *rp;   /* iterator over the result list     */
-    int sock;              /* file descriptor of the new socket */
-    int rv;                /* return value of getaddrinfo       */
+    size_t  cap;  /* new capacity             */
+    char   *data; /* reallocated storage      */
 
-    memset(&hints, 0, sizeof(hints)); /* zero all fields first */
-    hints.ai_family   = AF_UNSPEC;   /* accept IPv4 or IPv6   */
-    hints.ai_socktype = SOCK_STREAM; /* TCP stream socket      */
+    if (b->len + extra + 1 <= b->cap) {
+        return 0; /* already big enough */
+    }
+    cap = (b->cap != 0) ? b->cap : BUF_MIN_CAP;
+    while (cap < b->len + extra + 1) {
+        cap *= 2;
+    }
+    data = (char *)realloc(b->data, cap);
+    if (data == NULL) {
+        return -1;
+    }
+    b->data = data;
+    b->cap  = cap;
+    return 0;
+}
 
-    rv = getaddrinfo(host, port, &hints, &res);
-    if (rv != 0) {
-        return -1; /* DNS lookup or port resolution failed */
+/*
+ * buf_append — Appends 'len' bytes and keeps the contents NUL-terminated.
+ * Returns 0 on success, -1 if out of memory.
+ */
+static int buf_append(struct neuro_buf *b, const char *data, size_t len)
+{
+    if (buf_reserve(b, len) != 0) {
+        return -1;
     }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    b->data[b->len] = '\0';
+    return 0;
+}
 
-    sock = -1;
-    /* Try each address returned until one connects successfully */
-    for (rp = res; rp != NULL; rp = rp->ai_next) {
-        sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
-        if (sock == -1) {
-            continue; /* socket() failed for this address — try next */
+/*
+ * json_plain_run — Length of the longest prefix of 'data' that can go
+ * into a JSON string as it is, i.e. up to the first quote, backslash or
+ * control character.  With SSE2 sixteen bytes are checked at once; the
+ * scalar loop finishes the tail (and is all there is elsewhere).
+ */
+static size_t json_plain_run(const char *data, size_t len)
+{
+    size_t        i = 0;
+    unsigned char ch;
+
+#if defined(__SSE2__)
+    const __m128i quote  = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i ctl    = _mm_set1_epi8(0x1F);
+    __m128i       v, hit;
+    int           mask;
+
+    for (; i + 16 <= len; i += 16) {
+        v   = _mm_loadu_si128((const __m128i *)(const void *)(data + i));
+        hit = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash));
+        /* unsigned v <= 0x1F  <=>  min(v, 0x1F) == v */
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v));
+        mask = _mm_movemask_epi8(hit);
+        if (mask != 0) {
+            return i + (size_t)__builtin_ctz((unsigned int)mask);
+        }
+    }
+#endif
+
+    for (; i < len; i++) {
+        ch = (unsigned char)data[i];
+        if (ch < 0x20 || ch == '"' || ch == '\\') {
+            break;
+        }
+    }
+    return i;
+}
+
+/*
+ * buf_append_json — Appends 'len' bytes as the contents of a JSON string:
+ * quotes, backslashes and control characters are escaped, everything
+ * else (including UTF-8) is copied in runs found by json_plain_run.
+ * Returns 0 on success, -1 if out of memory.
+ */
+static int buf_append_json(struct neuro_buf *b, const char *data, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char     ch;
+    char              esc[6]; /* longest escape: \u00XX */
+    size_t            elen;   /* bytes used in esc        */
+    size_t            run;    /* bytes copied as they are */
+
+    if (buf_reserve(b, len) != 0) {
+        return -1; /* room for the common case: nothing to escape */
+    }
+    for (;;) {
+        run = json_plain_run(data, len);
+        if (buf_append(b, data, run) != 0) {
+            return -1;
+        }
+        if (run == len) {
+            return 0;
         }
-        if (connect(sock, rp->ai_addr, rp->ai_addrlen) == 0) {
-            break; /* connected successfully */
+        ch     = (unsigned char)data[run];
+        esc[0] = '\\';
+        esc[1] = (char)ch;
+        elen   = 2;
+        if (ch == '\n' || ch == '\r' || ch == '\t') {
+            esc[1] = (ch == '\n') ? 'n' : (ch == '\r') ? 'r' : 't';
+        } else if (ch < 0x20) {
+            esc[1] = 'u';
+            esc[2] = '0';
+            esc[3] = '0';
+            esc[4] = hex[ch >> 4];
+            esc[5] = hex[ch & 0xF];
+            elen   = 6;
         }
-        close(sock); /* connect failed — close and try next address */
-        sock = -1;
+        if (buf_append(b, esc, elen) != 0) {
+            return -1;
+        }
+        data += run + 1;
+        len  -= run + 1;
     }
+}
 
-    freeaddrinfo(res); /* free the address list regardless of outcome */
-    return sock;       /* -1 if no address worked */
+/*
+ * An HTTP request kept as segments: the header block and the JSON body.
+ * Both are growable buffers reused from one request to the next, and
+ * they are written one after the other instead of being joined.  The
+ * body of a conversation request continues with the messages straight
+ * from the conversation's arena ('more', borrowed, not copied) and a
+ * closing 'end'.
+ */
+struct neuro_req {
+    struct neuro_buf head; /* request line and headers, up to the blank line */
+    struct neuro_buf block; /* the same headers as an HTTP/2 HPACK block     */
+    struct neuro_buf body; /* JSON payload, or its first part               */
+    const char *more;      /* rest of the payload (borrowed), or NULL        */
+    size_t      more_len;
+    long        more_tokens; /* token estimate of 'more', or -1 to count it  */
+    const char *end;       /* bytes after 'more', or NULL                    */
+    size_t      end_len;
+};
+
+/*
+ * req_body_len — Length of the whole JSON payload.
+ */
+static size_t req_body_len(const struct neuro_req *r)
+{
+    return r->body.len + r->more_len + r->end_len;
 }
 
 /*
- * read_all_ssl — Reads every byte from the SSL connection until the
- * peer closes it, storing the data in a dynamically grown buffer.
- * Returns a heap-allocated NUL-terminated string, or NULL on error.
- * Caller must free().
+ * req_free — Releases the storage of a request's segments.
  */
-static char *read_all_ssl(SSL *ssl)
+static void req_free(struct neuro_req *r)
 {
-    char   chunk[4096]; /* temporary read buffer                    */
-    char  *buf;         /* accumulation buffer                      */
-    size_t total;       /* bytes stored in buf so far               */
-    int    n;           /* bytes returned by SSL_read in one call   */
+    free(r->head.data);
+    free(r->block.data);
+    free(r->body.data);
+    memset(r, 0, sizeof(*r));
+}
 
-    buf   = (char *)malloc(RESP_BUF_SIZE);
-    if (buf == NULL) {
-        return NULL;
+/* -------------------------------------------------------------------------
+ * Client context (one per neuro_client, plus the default one)
+ * ---------------------------------------------------------------------- */
+
+/* Content codings (Content-Encoding) */
+enum {
+    CE_IDENTITY,   /* not compressed                                  */
+    CE_GZIP,       /* gzip (zlib, with a gzip header)                 */
+    CE_DEFLATE,    /* deflate (zlib-wrapped, or raw from some servers)*/
+    CE_BR,         /* Brotli (only with NEURO_BROTLI)                 */
+    CE_ZSTD,       /* Zstandard (only with NEURO_ZSTD)                */
+    CE_UNKNOWN     /* anything else: the body cannot be used          */
+};
+
+/*
+ * Inflates one compressed response body at a time; the client has one,
+ * and so does every connection of a batch.  The zlib and Zstandard
+ * states are created on first use and reset, not freed, between
+ * responses, so they are allocated only once.
+ */
+struct http_decoder {
+    int       coding;   /* CE_* of the body being inflated          */
+    int       ended;    /* the compressed stream has been completed */
+    int       zlib_ok;  /* zs is initialised                        */
+    z_stream  zs;       /* gzip / deflate state                     */
+#ifdef NEURO_BROTLI
+    BrotliDecoderState *br; /* Brotli state, or NULL                */
+#endif
+#ifdef NEURO_ZSTD
+    ZSTD_DStream *zstd; /* Zstandard state, or NULL                 */
+#endif
+    char      out[DECODE_BUF_SIZE]; /* inflated bytes for on_body   */
+};
+
+/*
+ * Resolver cache: the addresses of the API host, interleaved by family
+ * and with the last address that connected first.
+ */
+struct dns_cache {
+    char                    host[256];  /* name these addresses belong to */
+    char                    port[16];   /* port they were resolved for    */
+    struct sockaddr_storage addr[DNS_MAX_ADDRS]; /* addresses, try order  */
+    socklen_t               len[DNS_MAX_ADDRS];  /* length of each        */
+    int                     count;      /* valid entries (0 = empty)      */
+    int                     verified;   /* addr[0] has connected before   */
+    long long               expires;    /* mono_ms() when stale           */
+};
+
+/*
+ * Latency histogram of one phase, in the style of HdrHistogram: values
+ * below 2 * HIST_SUB microseconds get a bucket each, and every power of
+ * two above that is split into HIST_SUB equal buckets.
+ */
+struct latency_hist {
+    unsigned long      count;                /* samples recorded         */
+    unsigned long long max_us;               /* largest sample           */
+    unsigned int       bucket[HIST_BUCKETS]; /* samples per bucket       */
+};
+
+/*
+ * Everything that is expensive to set up lives here and is reused across
+ * neuro_ask() calls: the TLS context (CA bundle is loaded once), the idle
+ * keep-alive connection, the last TLS session ticket so a reconnect can
+ * use an abbreviated handshake, a pool of response buffers, and the
+ * resolved addresses of the API host.  When the connection speaks
+ * HTTP/2 its framing state goes with it.  Latency statistics and
+ * settings are kept here too.  Nothing in it is shared with other
+ * clients, so the functions below need no locking as long as one client
+ * is used by one thread at a time.
+ */
+struct neuro_client {
+    SSL_CTX          *ctx;        /* TLS context, created on first use     */
+    SSL_SESSION      *session;    /* last session ticket from the server   */
+    SSL              *ssl;        /* pooled keep-alive connection, or NULL */
+    int               sock;       /* socket under ssl, or -1               */
+    struct neuro_h2  *h2;         /* HTTP/2 state of ssl, NULL = HTTP/1.1  */
+    int               http2;      /* offer HTTP/2 when connecting          */
+    int               http2_env;  /* NEURO_HTTP2 looked at                 */
+    char              host[256];  /* API hostname (also used for SNI)      */
+    char              port[16];   /* API port as a string                  */
+    int               endpoint_env; /* NEURO_API_HOST/PORT looked at       */
+    struct neuro_buf *pool[BUF_POOL_SIZE]; /* idle buffers for reuse       */
+    int               pool_len;   /* number of buffers in pool             */
+    char              rbuf[RECV_BUF_SIZE]; /* raw bytes from SSL_read      */
+    struct http_decoder dec;      /* inflates compressed answers           */
+    struct neuro_req  req;        /* request being sent (reused storage)  */
+    struct neuro_cache *cache;    /* response cache, or NULL               */
+    int               cache_env;  /* NEURO_CACHE has been looked at        */
+    struct dns_cache  dns;        /* resolved addresses of host:port       */
+    struct jason_parser json;     /* reads the answers of streams          */
+    struct neuro_timing timing;   /* breakdown of the request in flight    */
+    long long         t_start;    /* mono_us() when that request began     */
+    struct neuro_timing last;     /* last successful request               */
+    int               have_last;  /* 'last' is valid                       */
+    struct latency_hist hist[NEURO_PHASE_COUNT]; /* per-phase latencies    */
+    neuro_timing_cb   timing_cb;  /* caller's timing callback, or NULL     */
+    void             *timing_user; /* caller's pointer for timing_cb       */
+    int               retries;    /* retries after a failed attempt        */
+    long              retry_base_ms; /* backoff before the first retry     */
+    long              retry_cap_ms;  /* longest backoff                    */
+    long              timeout_ms; /* socket read/write timeout (0 = none)  */
+    long              hedge_ms;   /* hedge delay: -1 off, 0 adaptive (p95) */
+    unsigned long long rng;       /* backoff jitter state (0 = unseeded)   */
+    char             *api_key;    /* key from neuro_opts, NULL = env       */
+    int               mock_index; /* next mock answer                      */
+};
+
+/* Settings of a fresh client (also what neuro_opts_init reports) */
+#define CLIENT_DEFAULTS {                                         \
+    .sock = -1, .host = API_HOST, .port = API_PORT,               \
+    .retries = RETRY_MAX, .retry_base_ms = RETRY_BASE_MS,         \
+    .retry_cap_ms = RETRY_CAP_MS, .timeout_ms = IO_TIMEOUT_MS,    \
+    .hedge_ms = -1                                                \
+}
+
+/*
+ * The default client used by neuro_ask() and the other functions without
+ * a handle.  client_lock makes them take turns when called from several
+ * threads.
+ */
+static struct neuro_client client = CLIENT_DEFAULTS;
+static pthread_mutex_t     client_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * pool_get — Takes an empty buffer from the client's pool, or makes a new
+ * one if the pool is empty.  Returns NULL if out of memory.
+ */
+static struct neuro_buf *pool_get(struct neuro_client *c)
+{
+    struct neuro_buf *b; /* buffer handed out */
+
+    if (c->pool_len > 0) {
+        b = c->pool[--c->pool_len];
+        b->len = 0;
+        return b;
     }
-    total = 0;
+    return (struct neuro_buf *)calloc(1, sizeof(struct neuro_buf));
+}
 
-    /* Read chunks until SSL_read returns 0 (clean shutdown) or an error */
-    while ((n = SSL_read(ssl, chunk, (int)sizeof(chunk) - 1)) > 0) {
-        if (total + (size_t)n >= RESP_BUF_SIZE - 1) {
-            break; /* response is larger than our buffer — stop early */
-        }
-        memcpy(buf + total, chunk, (size_t)n); /* append chunk to buf */
-        total += (size_t)n;
+/*
+ * pool_put — Returns a buffer to the pool.  Buffers that grew very large
+ * (one huge response) are freed instead so they do not pin memory.
+ */
+static void pool_put(struct neuro_client *c, struct neuro_buf *b)
+{
+    if (b == NULL) {
+        return;
     }
+    if (c->pool_len < BUF_POOL_SIZE && b->cap <= BUF_KEEP_MAX) {
+        c->pool[c->pool_len++] = b;
+        return;
+    }
+    free(b->data);
+    free(b);
+}
+
+/*
+ * new_session_cb — Called by OpenSSL whenever the server issues a session
+ * ticket (with TLS 1.3 this happens after the handshake, while reading).
+ * Keeps the newest one for the next reconnect.  Returning 1 tells
+ * OpenSSL that we now own the reference.
+ */
+static int new_session_cb(SSL *ssl, SSL_SESSION *sess)
+{
+    struct neuro_client *c; /* owner of the connection's TLS context */
 
-    buf[total] = '\0'; /* NUL-terminate the accumulated data */
-    return buf;
+    c = (struct neuro_client *)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    if (c->session != NULL) {
+        SSL_SESSION_free(c->session); /* drop the older ticket */
+    }
+    c->session = sess;
+    return 1;
 }
 
 /*
- * extract_http_body — Given a full HTTP response (headers + body),
- * returns a pointer to the start of the body (past the blank line).
- * The pointer is into the same buffer — do not free it separately.
- * Returns NULL if the header separator is not found.
+ * client_endpoint_env — Applies NEURO_API_HOST and NEURO_API_PORT, once,
+ * unless neuro_set_endpoint() was called first.  Either one may be set
+ * alone; values that do not fit are ignored.
  */
-static char *extract_http_body(char *response)
+static void client_endpoint_env(struct neuro_client *c)
 {
-    char *sep; /* pointer to the blank-line separator "\r\n\r\n" */
+    const char *val; /* environment value */
+
+    if (c->endpoint_env) {
+        return;
+    }
+    c->endpoint_env = 1;
 
-    sep = strstr(response, "\r\n\r\n");
-    if (sep == NULL) {
-        return NULL; /* malformed HTTP response */
+    val = getenv("NEURO_API_HOST");
+    if (val != NULL && val[0] != '\0' && strlen(val) < sizeof(c->host)) {
+        strcpy(c->host, val);
+    }
+    val = getenv("NEURO_API_PORT");
+    if (val != NULL && val[0] != '\0' && strlen(val) < sizeof(c->port)) {
+        strcpy(c->port, val);
     }
-    return sep + 4; /* skip past the separator to reach the body */
 }
 
 /*
- * make_request_body — Builds the JSON payload for the OpenAI API call.
- * Returns a heap-allocated string; caller must free().
+ * client_http2_env — Applies NEURO_HTTP2 ("1" offers HTTP/2), once,
+ * unless neuro_set_http2() was called first.
  */
-static char *make_request_body(const char *prompt)
+static void client_http2_env(struct neuro_client *c)
 {
-    /*
-     * Minimal chat-completion request:
-     * { "model": "...", "messages": [ { "role": "user", "content": "..." } ] }
-     *
-     * NOTE: for simplicity we do not escape the prompt string here.
-     * A production library would JSON-encode every special character.
-     */
-    const char *fmt =
-        "{\"model\":\"%s\","
-        "\"messages\":[{\"role\":\"user\",\"content\":\"%s\"}]}";
-    size_t len;
-    char  *body;
+    const char *val; /* environment value */
 
-    len  = strlen(fmt) + strlen(API_MODEL) + strlen(prompt) + 1;
-    body = (char *)malloc(len);
-    if (body == NULL) {
-        return NULL;
+    if (c->http2_env) {
+        return;
     }
-    snprintf(body, len, fmt, API_MODEL, prompt);
-    return body;
+    c->http2_env = 1;
+
+    val = getenv("NEURO_HTTP2");
+    c->http2 = (val != NULL && strcmp(val, "1") == 0);
 }
 
 /*
- * real_api_call — Sends the prompt to the OpenAI REST API over HTTPS
- * and returns the JSON response body as a heap-allocated string.
- * Returns NULL on any network or TLS error.
- */
-static char *real_api_call(const char *api_key, const char *prompt)
-{
-    int      sock;        /* TCP socket file descriptor              */
-    SSL_CTX *ctx;         /* TLS context (holds CA certs, settings)  */
-    SSL     *ssl;         /* per-connection TLS state                */
-    char    *body;        /* JSON request body                       */
-    char    *headers;     /* HTTP request header block               */
-    char    *raw;         /* full HTTP response (headers + body)     */
-    char    *json_body;   /* pointer into raw, past the headers      */
-    char    *result;      /* final heap-allocated string to return   */
-    size_t   hdr_len;     /* length of the headers buffer            */
-
-    /* Step 1: open a TCP connection to api.openai.com:443 */
-    sock = tcp_connect(API_HOST, API_PORT);
-    if (sock == -1) {
-        return NULL; /* network unreachable or DNS failure */
+ * client_init — Creates the client's TLS context on first use.
+ * Returns 0 on success, -1 on failure.
+ */
+static int client_init(struct neuro_client *c)
+{
+    client_endpoint_env(c);
+    client_http2_env(c);
+    if (c->ctx != NULL) {
+        return 0; /* already initialised */
     }
 
-    /* Step 2: create a TLS context and wrap the socket */
-    ctx = SSL_CTX_new(TLS_client_method());
-    if (ctx == NULL) {
-        close(sock);
-        return NULL;
+    c->ctx = SSL_CTX_new(TLS_client_method());
+    if (c->ctx == NULL) {
+        return -1;
     }
 
     /* Load the system's default CA certificate bundle for verification */
-    SSL_CTX_set_default_verify_paths(ctx);
+    SSL_CTX_set_default_verify_paths(c->ctx);
 
-    ssl = SSL_new(ctx);    /* allocate a new TLS connection object    */
-    if (ssl == NULL) {
-        SSL_CTX_free(ctx);
-        close(sock);
-        return NULL;
+    /*
+     * Client-side session caching: OpenSSL hands every new ticket to
+     * new_session_cb instead of keeping its own internal store.
+     */
+    SSL_CTX_set_session_cache_mode(c->ctx, SSL_SESS_CACHE_CLIENT |
+                                           SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(c->ctx, new_session_cb);
+    SSL_CTX_set_app_data(c->ctx, c); /* how new_session_cb finds us */
+    return 0;
+}
+
+/*
+ * client_drop_conn — Closes the pooled connection (if any).
+ * 'clean' sends a GOAWAY (HTTP/2) and a TLS close_notify first; skip it
+ * when the peer is already gone.
+ */
+static void client_drop_conn(struct neuro_client *c, int clean)
+{
+    const char *out; /* HTTP/2 frames still to send */
+    size_t      len;
+
+    if (c->h2 != NULL) {
+        if (clean) { /* say goodbye: no more streams are coming */
+            neuro_h2_goaway(c->h2);
+            len = neuro_h2_output(c->h2, &out);
+            if (len > 0) {
+                SSL_write(c->ssl, out, (int)len);
+            }
+        }
+        neuro_h2_free(c->h2);
+        c->h2 = NULL;
+    }
+    if (c->ssl != NULL) {
+        if (clean) {
+            SSL_shutdown(c->ssl);
+        }
+        SSL_free(c->ssl);
+        c->ssl = NULL;
+    }
+    if (c->sock != -1) {
+        close(c->sock);
+        c->sock = -1;
     }
+}
 
-    SSL_set_fd(ssl, sock); /* bind the TLS layer to our TCP socket    */
+/* -------------------------------------------------------------------------
+ * Latency instrumentation
+ * ---------------------------------------------------------------------- */
 
-    /* SNI (Server Name Indication) lets the server pick the right cert */
-    SSL_set_tlsext_host_name(ssl, API_HOST);
+/*
+ * mono_us / mono_ms — Microseconds and milliseconds on the monotonic
+ * clock (unaffected by changes to the wall-clock time).
+ */
+static long long mono_us(void)
+{
+    struct timespec ts;
 
-    /* Perform the TLS handshake */
-    if (SSL_connect(ssl) != 1) {
-        SSL_free(ssl);
-        SSL_CTX_free(ctx);
-        close(sock);
-        return NULL;
-    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-    /* Step 3: build the JSON request body */
-    body = make_request_body(prompt);
-    if (body == NULL) {
-        SSL_free(ssl);
-        SSL_CTX_free(ctx);
-        close(sock);
-        return NULL;
+static long long mono_ms(void)
+{
+    return mono_us() / 1000;
+}
+
+/*
+ * sleep_us — Sleeps for 'us' microseconds, resuming after signals.
+ */
+static void sleep_us(long long us)
+{
+    struct timespec ts;
+
+    ts.tv_sec  = (time_t)(us / 1000000);
+    ts.tv_nsec = (long)(us % 1000000) * 1000L;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+        /* interrupted: sleep for the rest */
     }
+}
 
-    /* Step 4: build the HTTP/1.1 POST request headers */
-    hdr_len  = 512 + strlen(API_PATH) + strlen(API_HOST) +
-               strlen(api_key) + strlen(body);
-    headers  = (char *)malloc(hdr_len);
-    if (headers == NULL) {
-        free(body);
-        SSL_free(ssl);
-        SSL_CTX_free(ctx);
-        close(sock);
-        return NULL;
+/*
+ * hist_index — Bucket of a value in microseconds.
+ */
+static int hist_index(unsigned long long us)
+{
+    int e; /* bits dropped below the sub-bucket resolution */
+
+    if (us < 2 * HIST_SUB) {
+        return (int)us;
     }
+    if (us >> (HIST_BUCKETS / HIST_SUB + HIST_SUB_BITS - 1) != 0) {
+        us = (1ULL << (HIST_BUCKETS / HIST_SUB + HIST_SUB_BITS - 1)) - 1;
+    }
+    e = 1;
+    while (us >> (e + HIST_SUB_BITS + 1) != 0) {
+        e++;
+    }
+    return (e + 1) * HIST_SUB + (int)((us >> e) - HIST_SUB);
+}
 
-    snprintf(headers, hdr_len,
-             "POST %s HTTP/1.1\r\n"
-             "Host: %s\r\n"
-             "Content-Type: application/json\r\n"
-             "Authorization: Bearer %s\r\n"
-             "Content-Length: %zu\r\n"
-             "Connection: close\r\n"
-             "\r\n"
-             "%s",
-             API_PATH, API_HOST, api_key, strlen(body), body);
+/*
+ * hist_value — Highest value (microseconds) that falls into a bucket.
+ */
+static unsigned long long hist_value(int i)
+{
+    int e; /* bits dropped below the sub-bucket resolution */
 
-    free(body); /* body is now embedded in headers; no longer needed */
+    if (i < 2 * HIST_SUB) {
+        return (unsigned long long)i;
+    }
+    e = i / HIST_SUB - 1;
+    return ((unsigned long long)(i % HIST_SUB + HIST_SUB + 1) << e) - 1;
+}
 
-    /* Step 5: send the request over TLS */
-    SSL_write(ssl, headers, (int)strlen(headers));
-    free(headers);
+static void hist_add(struct latency_hist *h, double ms)
+{
+    unsigned long long us = (unsigned long long)(ms * 1000.0 + 0.5);
 
-    /* Step 6: read the entire HTTP response into a buffer */
-    raw = read_all_ssl(ssl);
+    h->bucket[hist_index(us)]++;
+    h->count++;
+    if (us > h->max_us) {
+        h->max_us = us;
+    }
+}
 
-    /* Step 7: tear down TLS and close the socket */
-    SSL_shutdown(ssl);
-    SSL_free(ssl);
-    SSL_CTX_free(ctx);
-    close(sock);
+/*
+ * hist_percentile — Value at percentile 'pct', in milliseconds, or -1 if
+ * the histogram is empty.
+ */
+static double hist_percentile(const struct latency_hist *h, double pct)
+{
+    unsigned long rank; /* samples at or below the answer */
+    unsigned long seen;
+    unsigned long long v;
+    int           i;
 
-    if (raw == NULL) {
-        return NULL; /* read failed */
+    if (h->count == 0) {
+        return -1.0;
+    }
+    if (pct >= 100.0) {
+        return (double)h->max_us / 1000.0;
+    }
+    rank = (unsigned long)(pct / 100.0 * (double)h->count + 0.999999);
+    if (rank == 0) {
+        rank = 1;
     }
+    seen = 0;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->bucket[i];
+        if (seen >= rank) {
+            break;
+        }
+    }
+    v = hist_value(i);
+    return (double)((v < h->max_us) ? v : h->max_us) / 1000.0;
+}
 
-    /* Step 8: skip past the HTTP headers to find the JSON body */
-    json_body = extract_http_body(raw);
-    if (json_body == NULL) {
-        free(raw);
-        return NULL;
+/*
+ * timing_begin — Starts timing a request on the client.  Every phase is
+ * marked "did not happen" until it is measured.
+ */
+static void timing_begin(struct neuro_client *c)
+{
+    int i;
+
+    for (i = 0; i < NEURO_PHASE_COUNT; i++) {
+        c->timing.ms[i] = -1.0;
     }
+    c->timing.reused = 0;
+    c->timing.cached = 0;
+    c->t_start = mono_us();
+}
 
-    /* Copy the body into its own allocation so we can free raw */
-    {
-        size_t body_len = strlen(json_body) + 1; /* +1 for NUL terminator */
-        result = (char *)malloc(body_len);
-        if (result != NULL) {
-            memcpy(result, json_body, body_len);
+/*
+ * timing_since — Stores the time elapsed since 'from' (a mono_us value)
+ * as the duration of a phase, and returns the current time.
+ */
+static long long timing_since(struct neuro_timing *t, int phase,
+                              long long from)
+{
+    long long now = mono_us();
+
+    t->ms[phase] = (double)(now - from) / 1000.0;
+    return now;
+}
+
+/*
+ * timing_record — A request succeeded: adds its phases to the
+ * histograms, keeps it as the last one and reports it to the callback.
+ */
+static void timing_record(struct neuro_client *c, struct neuro_timing *t,
+                          long long start)
+{
+    int i;
+
+    timing_since(t, NEURO_PHASE_TOTAL, start);
+    for (i = 0; i < NEURO_PHASE_COUNT; i++) {
+        if (t->ms[i] >= 0.0) {
+            hist_add(&c->hist[i], t->ms[i]);
         }
     }
-    free(raw); /* free the full response buffer */
-    return result;
+    c->last      = *t;
+    c->have_last = 1;
+    if (c->timing_cb != NULL) {
+        c->timing_cb(t, c->timing_user);
+    }
 }
 
-/* =========================================================================
- * Public function
- * ====================================================================== */
+/* -------------------------------------------------------------------------
+ * HTTPS helper functions (used only when an API key is present)
+ * ---------------------------------------------------------------------- */
 
-char *neuro_ask(const char *prompt)
+/*
+ * resolve — Fills the client's resolver cache for host:port, unless it
+ * already holds a fresh answer.
+ *
+ * getaddrinfo's order (RFC 6724 preference) is kept within each address
+ * family, but the families are interleaved as RFC 8305 asks — e.g.
+ * v6, v4, v6, v4 … — so a broken family costs at most one attempt delay.
+ *
+ * Returns 0 on success, -1 if the name cannot be resolved.
+ */
+static int resolve(struct neuro_client *c)
 {
-    const char *api_key; /* value of the OPENAI_API_KEY environment variable */
-    int         idx;     /* index into the mock_contents array               */
+    struct dns_cache *d = &c->dns;
+    struct addrinfo   hints;   /* criteria for address selection       */
+    struct addrinfo  *res;     /* linked list of results               */
+    struct addrinfo  *rp;      /* iterator over the result list        */
+    struct addrinfo  *fam[2][DNS_MAX_ADDRS]; /* results by family      */
+    int               nfam[2]; /* entries in each fam list             */
+    int               first;   /* family of the first result           */
+    int               f;       /* 0 = first family, 1 = the other      */
+    int               i;
+    long long         start;   /* when the lookup began (mono_us)      */
 
-    /* Check whether the caller has set an API key */
-    api_key = getenv("OPENAI_API_KEY");
+    if (d->count > 0 && mono_ms() < d->expires &&
+        strcmp(d->host, c->host) == 0 && strcmp(d->port, c->port) == 0) {
+        return 0; /* cached answer still valid */
+    }
 
-    if (api_key == NULL || api_key[0] == '\0') {
-        /*
-         * No API key — return the next mock response from the list,
-         * cycling back to the first one after the last.
-         */
-        idx = mock_index;
+    memset(&hints, 0, sizeof(hints)); /* zero all fields first */
+    hints.ai_family   = AF_UNSPEC;   /* accept IPv4 or IPv6   */
+    hints.ai_socktype = SOCK_STREAM; /* TCP stream socket      */
+
+    d->count = 0;
+    start    = mono_us();
+    if (getaddrinfo(c->host, c->port, &hints, &res) != 0) {
+        return -1; /* DNS lookup or port resolution failed */
+    }
+    timing_since(&c->timing, NEURO_PHASE_DNS, start);
 
-        /* Count how many mock responses we have */
-        while (mock_contents[mock_index] != NULL) {
-            mock_index++;
+    /* Split by family, keeping the resolver's order inside each */
+    nfam[0] = nfam[1] = 0;
+    first   = res->ai_family;
+    for (rp = res; rp != NULL; rp = rp->ai_next) {
+        f = (rp->ai_family == first) ? 0 : 1;
+        if (nfam[f] < DNS_MAX_ADDRS && rp->ai_addrlen <= sizeof(d->addr[0])) {
+            fam[f][nfam[f]++] = rp;
         }
-        /* mock_index now equals the total number of entries */
-        mock_index = (idx + 1) % mock_index; /* advance, wrapping around */
+    }
 
-        /* Restore mock_index for the count we need */
-        return build_mock_json(mock_contents[idx]);
+    /* Interleave the two families into the cache */
+    for (i = 0; i < DNS_MAX_ADDRS && d->count < DNS_MAX_ADDRS; i++) {
+        for (f = 0; f < 2 && d->count < DNS_MAX_ADDRS; f++) {
+            if (i < nfam[f]) {
+                memcpy(&d->addr[d->count], fam[f][i]->ai_addr,
+                       fam[f][i]->ai_addrlen);
+                d->len[d->count] = fam[f][i]->ai_addrlen;
+                d->count++;
+            }
+        }
     }
+    freeaddrinfo(res);
 
-    /* API key is present — make a real HTTPS request */
-    return real_api_call(api_key, prompt);
+    strcpy(d->host, c->host);
+    strcpy(d->port, c->port);
+    d->verified = 0;
+    d->expires  = mono_ms() + DNS_CACHE_TTL_MS;
+    return (d->count > 0) ? 0 : -1;
+}
+
+/*
+ * dns_promote — Moves the address that just connected to the front of
+ * the cached list, so later connections try the known-good one first.
+ */
+static void dns_promote(struct dns_cache *d, int i)
+{
+    struct sockaddr_storage addr; /* the winning address */
+    socklen_t               len;
+
+    addr = d->addr[i];
+    len  = d->len[i];
+    memmove(&d->addr[1], &d->addr[0], (size_t)i * sizeof(d->addr[0]));
+    memmove(&d->len[1], &d->len[0], (size_t)i * sizeof(d->len[0]));
+    d->addr[0] = addr;
+    d->len[0]  = len;
+    d->verified = 1;
+}
+
+/*
+ * set_nodelay — Disables Nagle's algorithm: requests are written whole,
+ * so there is nothing to gain from delaying small segments.
+ */
+static void set_nodelay(int sock)
+{
+    int one = 1;
+
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/*
+ * set_io_timeout — Makes a blocking read or write on the socket fail
+ * after 'ms' milliseconds without progress (0 = wait forever), so a
+ * server that stops answering cannot hang a request.
+ */
+static void set_io_timeout(int sock, long ms)
+{
+    struct timeval tv;
+
+    tv.tv_sec  = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/*
+ * set_blocking — Switches a socket between blocking and non-blocking mode.
+ */
+static void set_blocking(int sock, int on)
+{
+    int flags = fcntl(sock, F_GETFL, 0);
+
+    fcntl(sock, F_SETFL, on ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK));
+}
+
+/*
+ * tcp_connect — Opens a TCP connection to the client's host:port using
+ * Happy Eyeballs (RFC 8305).
+ *
+ * Attempts start in the cached (interleaved) address order.  The next
+ * attempt begins when the previous one fails, or after
+ * HE_ATTEMPT_DELAY_MS without an answer, while earlier attempts keep
+ * running; the first to complete wins and the rest are closed.  One dead
+ * route therefore costs a quarter of a second, not a full TCP timeout.
+ *
+ * Returns a connected, blocking socket with TCP_NODELAY set, or -1.
+ */
+static int tcp_connect(struct neuro_client *c)
+{
+    struct dns_cache *d = &c->dns;
+    struct pollfd     pfd[DNS_MAX_ADDRS]; /* attempts in progress        */
+    int               which[DNS_MAX_ADDRS]; /* address index per attempt */
+    int               nact;       /* attempts in progress                 */
+    int               next;       /* next address to try                  */
+    int               winner;     /* index into pfd of the winner, or -1  */
+    int               sock;
+    int               err;
+    socklen_t         elen;
+    long long         now;
+    long long         deadline;   /* give up at this time                 */
+    long long         next_start; /* start the next attempt at this time  */
+    long long         wait;       /* poll timeout                         */
+    long long         start;      /* when connecting began (mono_us)      */
+    int               i;
+
+    if (resolve(c) != 0) {
+        return -1;
+    }
+    start = mono_us();
+
+    nact       = 0;
+    next       = 0;
+    winner     = -1;
+    now        = mono_ms();
+    deadline   = now + CONNECT_TIMEOUT_MS;
+    next_start = now;
+
+    while (winner == -1) {
+        now = mono_ms();
+
+        /* Start another attempt if it is time, or if nothing is running */
+        if (next < d->count && (nact == 0 || now >= next_start)) {
+            sock = socket(d->addr[next].ss_family, SOCK_STREAM, 0);
+            if (sock != -1) {
+                fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+                if (connect(sock, (struct sockaddr *)&d->addr[next],
+                            d->len[next]) == 0 || errno == EINPROGRESS) {
+                    pfd[nact].fd     = sock;
+                    pfd[nact].events = POLLOUT;
+                    which[nact]      = next;
+                    nact++;
+                } else {
+                    close(sock); /* failed at once (e.g. no route) */
+                }
+            }
+            next++;
+            next_start = now + HE_ATTEMPT_DELAY_MS;
+            continue;
+        }
+
+        if (nact == 0 || now >= deadline) {
+            break; /* every address failed, or out of time */
+        }
+
+        wait = deadline - now;
+        if (next < d->count && next_start - now < wait) {
+            wait = next_start - now;
+        }
+        if (poll(pfd, (nfds_t)nact, (int)wait) <= 0) {
+            continue; /* timer expired (or EINTR): maybe start another */
+        }
+
+        /* Check finished attempts; drop the failures */
+        for (i = nact - 1; i >= 0; i--) {
+            if (pfd[i].revents == 0) {
+                continue;
+            }
+            err  = 0;
+            elen = sizeof(err);
+            getsockopt(pfd[i].fd, SOL_SOCKET, SO_ERROR, &err, &elen);
+            if (err == 0) {
+                winner = i;
+                break;
+            }
+            close(pfd[i].fd);
+            pfd[i]   = pfd[nact - 1];
+            which[i] = which[nact - 1];
+            nact--;
+        }
+    }
+
+    /* Close the losers */
+    sock = -1;
+    for (i = 0; i < nact; i++) {
+        if (i == winner) {
+            sock = pfd[i].fd;
+        } else {
+            close(pfd[i].fd);
+        }
+    }
+
+    if (sock == -1) {
+        d->count = 0; /* resolve again next time */
+        return -1;
+    }
+
+    dns_promote(d, which[winner]);
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) & ~O_NONBLOCK);
+    set_nodelay(sock);
+    timing_since(&c->timing, NEURO_PHASE_CONNECT, start);
+    return sock;
+}
+
+static int client_h2_start(struct neuro_client *c);
+
+/*
+ * client_connect — Opens a fresh TLS connection for the client and makes
+ * it the pooled one.  Offers the saved session ticket, so the server can
+ * resume instead of running a full handshake, and with http2 on offers
+ * HTTP/2 through ALPN.
+ * Returns 0 on success, -1 on failure.
+ */
+static int client_connect(struct neuro_client *c)
+{
+    long long start; /* when the handshake began (mono_us) */
+
+    c->sock = tcp_connect(c);
+    if (c->sock == -1) {
+        return -1; /* network unreachable or DNS failure */
+    }
+    set_io_timeout(c->sock, c->timeout_ms);
+
+    c->ssl = SSL_new(c->ctx); /* allocate a new TLS connection object */
+    if (c->ssl == NULL) {
+        client_drop_conn(c, 0);
+        return -1;
+    }
+
+    SSL_set_fd(c->ssl, c->sock); /* bind the TLS layer to our socket */
+
+    /* SNI (Server Name Indication) lets the server pick the right cert */
+    SSL_set_tlsext_host_name(c->ssl, c->host);
+
+    /* Offer the last ticket; the server may still choose a full handshake */
+    if (c->session != NULL) {
+        SSL_set_session(c->ssl, c->session);
+    }
+    if (c->http2) {
+        SSL_set_alpn_protos(c->ssl, (const unsigned char *)NEURO_H2_ALPN,
+                            NEURO_H2_ALPN_LEN);
+    }
+
+    /* Perform the TLS handshake */
+    start = mono_us();
+    if (SSL_connect(c->ssl) != 1 || client_h2_start(c) != 0) {
+        client_drop_conn(c, 0);
+        return -1;
+    }
+    timing_since(&c->timing, NEURO_PHASE_TLS, start);
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ * Incremental HTTP/1.1 response parser
+ * ---------------------------------------------------------------------- */
+
+/*
+ * Bytes are pushed in as they arrive, in pieces of any size.  The parser
+ * reads the status line and the headers, then frames the body by
+ * Content-Length, by Transfer-Encoding: chunked, or — only when neither
+ * is present — by the server closing the connection.  Body bytes are
+ * handed to on_body straight from the receive buffer; the caller decides
+ * where they go.
+ */
+
+/* Parser states */
+enum {
+    HP_STATUS,     /* reading the status line                       */
+    HP_HEADER,     /* reading header lines                          */
+    HP_BODY,       /* Content-Length body, 'remaining' bytes left   */
+    HP_BODY_EOF,   /* body runs until the connection closes         */
+    HP_CHUNK_SIZE, /* reading a chunk-size line                     */
+    HP_CHUNK_DATA, /* inside a chunk, 'remaining' bytes left        */
+    HP_CHUNK_END,  /* reading the CRLF after the chunk data         */
+    HP_TRAILER,    /* reading trailer lines after the last chunk    */
+    HP_DONE,       /* the response is complete                      */
+    HP_ERROR       /* malformed input, or on_body refused the data  */
+};
+
+struct http_parser;
+
+/* Receives body bytes; returns 0 to continue or -1 to abort the parse */
+typedef int (*http_body_fn)(struct http_parser *p, const char *data,
+                            size_t len);
+
+struct http_parser {
+    int           state;          /* one of the HP_* values            */
+    int           status;         /* HTTP status code                  */
+    int           keep_alive;     /* connection reusable afterwards    */
+    int           chunked;        /* Transfer-Encoding: chunked        */
+    int           event_stream;   /* Content-Type: text/event-stream   */
+    long long     content_length; /* Content-Length, -1 if absent      */
+    unsigned long remaining;      /* bytes left in the body or chunk   */
+    long long     rl_limit[RL_COUNT];     /* x-ratelimit-limit-*, or -1     */
+    long long     rl_remaining[RL_COUNT]; /* x-ratelimit-remaining-*, or -1 */
+    double        rl_reset_ms[RL_COUNT];  /* x-ratelimit-reset-*, or -1     */
+    double        retry_after_ms; /* Retry-After / retry-after-ms, or -1 */
+    int           coding;         /* Content-Encoding, one of CE_*     */
+    struct http_decoder *dec;     /* inflates the body, or NULL        */
+    char          line[HTTP_LINE_MAX]; /* status/header/size line      */
+    size_t        line_len;       /* bytes in line                     */
+    http_body_fn  on_body;        /* body sink                         */
+    void         *user;           /* for on_body                       */
+};
+
+/*
+ * http_init — Prepares the parser for a new response.  'dec' is used
+ * for compressed bodies; without one they fail.
+ */
+static void http_init(struct http_parser *p, struct http_decoder *dec,
+                      http_body_fn on_body, void *user)
+{
+    int i;
+
+    p->state          = HP_STATUS;
+    p->status         = 0;
+    p->keep_alive     = 1;
+    p->chunked        = 0;
+    p->event_stream   = 0;
+    p->content_length = -1;
+    p->remaining      = 0;
+    p->retry_after_ms = -1.0;
+    p->coding         = CE_IDENTITY;
+    p->dec            = dec;
+    for (i = 0; i < RL_COUNT; i++) {
+        p->rl_limit[i]     = -1;
+        p->rl_remaining[i] = -1;
+        p->rl_reset_ms[i]  = -1.0;
+    }
+    p->line_len       = 0;
+    p->on_body        = on_body;
+    p->user           = user;
+}
+
+/*
+ * dec_start — Gets the decoder ready for a new body in 'coding'.
+ * Returns 0, or -1 if the coding is not supported or out of memory.
+ */
+static int dec_start(struct http_decoder *d, int coding)
+{
+    d->coding = coding;
+    d->ended  = 0;
+
+    switch (coding) {
+    case CE_GZIP:
+    case CE_DEFLATE:
+        /* 15 + 32: a 32 KB window, and accept a zlib or a gzip header */
+        if (d->zlib_ok) {
+            return (inflateReset2(&d->zs, 15 + 32) == Z_OK) ? 0 : -1;
+        }
+        memset(&d->zs, 0, sizeof(d->zs));
+        if (inflateInit2(&d->zs, 15 + 32) != Z_OK) {
+            return -1;
+        }
+        d->zlib_ok = 1;
+        return 0;
+#ifdef NEURO_BROTLI
+    case CE_BR:
+        if (d->br != NULL) {
+            BrotliDecoderDestroyInstance(d->br); /* Brotli has no reset */
+        }
+        d->br = BrotliDecoderCreateInstance(NULL, NULL, NULL);
+        return (d->br != NULL) ? 0 : -1;
+#endif
+#ifdef NEURO_ZSTD
+    case CE_ZSTD:
+        if (d->zstd == NULL && (d->zstd = ZSTD_createDStream()) == NULL) {
+            return -1;
+        }
+        return ZSTD_isError(ZSTD_initDStream(d->zstd)) ? -1 : 0;
+#endif
+    default:
+        return -1;
+    }
+}
+
+/*
+ * dec_free — Frees the decompressor states.
+ */
+static void dec_free(struct http_decoder *d)
+{
+    if (d->zlib_ok) {
+        inflateEnd(&d->zs);
+        d->zlib_ok = 0;
+    }
+#ifdef NEURO_BROTLI
+    if (d->br != NULL) {
+        BrotliDecoderDestroyInstance(d->br);
+        d->br = NULL;
+    }
+#endif
+#ifdef NEURO_ZSTD
+    ZSTD_freeDStream(d->zstd);
+    d->zstd = NULL;
+#endif
+}
+
+/*
+ * dec_zlib — Inflates gzip or deflate input and passes the output on.
+ * Some servers send "deflate" without the zlib wrapper; if the very
+ * first bytes fail as zlib, they are tried again as raw deflate.
+ * Returns 0, or -1 on corrupt data or if on_body aborted.
+ */
+static int dec_zlib(struct http_parser *p, const char *data, size_t len)
+{
+    struct http_decoder *d = p->dec;
+    int    first = (d->zs.total_in == 0); /* nothing inflated yet */
+    size_t n;  /* bytes produced by one inflate call */
+    int    rc; /* its result                         */
+
+    d->zs.next_in  = (const Bytef *)data;
+    d->zs.avail_in = (uInt)len;
+    do {
+        d->zs.next_out  = (Bytef *)d->out;
+        d->zs.avail_out = (uInt)sizeof(d->out);
+        rc = inflate(&d->zs, Z_NO_FLUSH);
+        if (rc == Z_DATA_ERROR && first && p->coding == CE_DEFLATE) {
+            first = 0;
+            if (inflateReset2(&d->zs, -15) != Z_OK) {
+                return -1;
+            }
+            d->zs.next_in  = (const Bytef *)data; /* again, as raw */
+            d->zs.avail_in = (uInt)len;
+            continue;
+        }
+        n = sizeof(d->out) - d->zs.avail_out;
+        if (n > 0 && p->on_body(p, d->out, n) != 0) {
+            return -1;
+        }
+        if (rc == Z_STREAM_END) {
+            d->ended = 1; /* anything after the end is ignored */
+            return 0;
+        }
+        if (rc != Z_OK) {
+            return (rc == Z_BUF_ERROR) ? 0 : -1; /* BUF_ERROR: needs input */
+        }
+    } while (d->zs.avail_in > 0 || d->zs.avail_out == 0);
+    return 0;
+}
+
+#ifdef NEURO_BROTLI
+/*
+ * dec_brotli — Like dec_zlib, for Brotli.
+ */
+static int dec_brotli(struct http_parser *p, const char *data, size_t len)
+{
+    struct http_decoder *d = p->dec;
+    const uint8_t       *in = (const uint8_t *)data;
+    uint8_t             *out;   /* where the next output goes        */
+    size_t               avail; /* room left in d->out               */
+    BrotliDecoderResult  rc;
+
+    for (;;) {
+        out   = (uint8_t *)d->out;
+        avail = sizeof(d->out);
+        rc = BrotliDecoderDecompressStream(d->br, &len, &in, &avail, &out,
+                                           NULL);
+        if (rc == BROTLI_DECODER_RESULT_ERROR) {
+            return -1;
+        }
+        if (avail < sizeof(d->out) &&
+            p->on_body(p, d->out, sizeof(d->out) - avail) != 0) {
+            return -1;
+        }
+        if (rc == BROTLI_DECODER_RESULT_SUCCESS) {
+            d->ended = 1;
+            return 0;
+        }
+        if (rc == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT) {
+            return 0;
+        }
+        /* NEEDS_MORE_OUTPUT: go round with an empty buffer */
+    }
+}
+#endif
+
+#ifdef NEURO_ZSTD
+/*
+ * dec_zstd — Like dec_zlib, for Zstandard.  The body ends with the
+ * first complete frame.
+ */
+static int dec_zstd(struct http_parser *p, const char *data, size_t len)
+{
+    struct http_decoder *d = p->dec;
+    ZSTD_inBuffer        in;
+    ZSTD_outBuffer       out;
+    size_t               rc;
+
+    in.src  = data;
+    in.size = len;
+    in.pos  = 0;
+    do {
+        out.dst  = d->out;
+        out.size = sizeof(d->out);
+        out.pos  = 0;
+        rc = ZSTD_decompressStream(d->zstd, &out, &in);
+        if (ZSTD_isError(rc)) {
+            return -1;
+        }
+        if (out.pos > 0 && p->on_body(p, d->out, out.pos) != 0) {
+            return -1;
+        }
+        if (rc == 0) {
+            d->ended = 1; /* frame complete */
+            return 0;
+        }
+    } while (in.pos < in.size || out.pos == out.size);
+    return 0;
+}
+#endif
+
+/*
+ * http_body — Passes body bytes to on_body, inflated first if the body
+ * is compressed.  Returns 0, or -1 to abort the parse.
+ */
+static int http_body(struct http_parser *p, const char *data, size_t len)
+{
+    if (p->coding == CE_IDENTITY) {
+        return p->on_body(p, data, len);
+    }
+    if (p->dec->ended) {
+        return 0; /* trailing bytes after the compressed stream */
+    }
+    switch (p->coding) {
+#ifdef NEURO_BROTLI
+    case CE_BR:
+        return dec_brotli(p, data, len);
+#endif
+#ifdef NEURO_ZSTD
+    case CE_ZSTD:
+        return dec_zstd(p, data, len);
+#endif
+    default:
+        return dec_zlib(p, data, len);
+    }
+}
+
+/*
+ * http_truncated — True if the body was compressed and its compressed
+ * stream never reached its end (the response was cut short).
+ */
+static int http_truncated(const struct http_parser *p)
+{
+    return p->coding != CE_IDENTITY && !p->dec->ended;
+}
+
+/*
+ * content_coding — The CE_* value of a Content-Encoding header.  Only a
+ * single coding is understood; a list of several gives CE_UNKNOWN.
+ */
+static int content_coding(const char *value)
+{
+    static const struct {
+        const char *name;
+        int         coding;
+    } codings[] = {
+        { "identity", CE_IDENTITY }, { "gzip", CE_GZIP },
+        { "x-gzip",   CE_GZIP },     { "deflate", CE_DEFLATE },
+        { "br",       CE_BR },       { "zstd", CE_ZSTD }
+    };
+    size_t len = strcspn(value, " \t,"); /* the first token */
+    size_t i;
+
+    if (value[len + strspn(value + len, " \t")] != '\0') {
+        return CE_UNKNOWN; /* more than one coding */
+    }
+    for (i = 0; i < sizeof(codings) / sizeof(codings[0]); i++) {
+        if (strlen(codings[i].name) == len &&
+            strncasecmp(value, codings[i].name, len) == 0) {
+            return codings[i].coding;
+        }
+    }
+    return CE_UNKNOWN;
+}
+
+/*
+ * parse_duration_ms — Parses a rate-limit reset time such as "20ms",
+ * "1.5s" or "6m0s" (Go duration syntax).  Returns milliseconds, or -1.
+ */
+static double parse_duration_ms(const char *s)
+{
+    double total = 0.0; /* sum of the parts       */
+    double v;           /* number before a unit   */
+    char  *end;
+
+    do {
+        v = strtod(s, &end);
+        if (end == s) {
+            return -1.0;
+        }
+        s = end;
+        if (strncmp(s, "ms", 2) == 0) {
+            total += v;
+            s += 2;
+        } else if (*s == 's') {
+            total += v * 1000.0;
+            s++;
+        } else if (*s == 'm') {
+            total += v * 60000.0;
+            s++;
+        } else if (*s == 'h') {
+            total += v * 3600000.0;
+            s++;
+        } else {
+            return -1.0;
+        }
+    } while (*s != '\0' && *s != ' ' && *s != '\r');
+    return total;
+}
+
+/*
+ * value_has — Case-insensitive search for 'word' in a header value.
+ */
+static int value_has(const char *value, const char *word)
+{
+    size_t n = strlen(word);
+
+    for (; *value != '\0'; value++) {
+        if (strncasecmp(value, word, n) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * http_line — Collects bytes into p->line until a LF.  Consumes from
+ * data[*k] onwards.  Returns 1 when a full line (without CRLF) is ready,
+ * 0 if more input is needed, -1 if the line is too long.
+ */
+static int http_line(struct http_parser *p, const char *data, size_t len,
+                     size_t *k)
+{
+    char ch;
+
+    while (*k < len) {
+        ch = data[(*k)++];
+        if (ch == '\n') {
+            if (p->line_len > 0 && p->line[p->line_len - 1] == '\r') {
+                p->line_len--;
+            }
+            p->line[p->line_len] = '\0';
+            p->line_len = 0;
+            return 1;
+        }
+        if (p->line_len + 1 >= sizeof(p->line)) {
+            return -1;
+        }
+        p->line[p->line_len++] = ch;
+    }
+    return 0;
+}
+
+/*
+ * rate_header — Stores one x-ratelimit-* header; 'name' is what follows
+ * the prefix, e.g. "remaining-requests".
+ */
+static void rate_header(struct http_parser *p, const char *name,
+                        const char *value)
+{
+    static const char *const kinds[RL_COUNT] = { "requests", "tokens" };
+    int i;
+
+    for (i = 0; i < RL_COUNT; i++) {
+        if (strncasecmp(name, "limit-", 6) == 0 &&
+            strcasecmp(name + 6, kinds[i]) == 0) {
+            p->rl_limit[i] = strtoll(value, NULL, 10);
+        } else if (strncasecmp(name, "remaining-", 10) == 0 &&
+                   strcasecmp(name + 10, kinds[i]) == 0) {
+            p->rl_remaining[i] = strtoll(value, NULL, 10);
+        } else if (strncasecmp(name, "reset-", 6) == 0 &&
+                   strcasecmp(name + 6, kinds[i]) == 0) {
+            p->rl_reset_ms[i] = parse_duration_ms(value);
+        }
+    }
+}
+
+/*
+ * http_header — Interprets one header line.  Only the fields that affect
+ * framing or that the library uses are looked at.
+ * Returns 0, or -1 for an invalid Content-Length.
+ */
+static int http_header(struct http_parser *p)
+{
+    char *value; /* text after the colon */
+    char *end;   /* strtoll end pointer  */
+
+    value = strchr(p->line, ':');
+    if (value == NULL) {
+        return 0; /* not a header; ignore */
+    }
+    *value++ = '\0';
+    while (*value == ' ' || *value == '\t') { value++; }
+
+    if (strcasecmp(p->line, "Content-Length") == 0) {
+        p->content_length = strtoll(value, &end, 10);
+        if (end == value || p->content_length < 0) {
+            return -1;
+        }
+    } else if (strcasecmp(p->line, "Transfer-Encoding") == 0) {
+        p->chunked = value_has(value, "chunked");
+    } else if (strcasecmp(p->line, "Connection") == 0) {
+        if (value_has(value, "close")) {
+            p->keep_alive = 0;
+        } else if (value_has(value, "keep-alive")) {
+            p->keep_alive = 1;
+        }
+    } else if (strcasecmp(p->line, "Content-Type") == 0) {
+        p->event_stream = value_has(value, "text/event-stream");
+    } else if (strcasecmp(p->line, "Content-Encoding") == 0) {
+        p->coding = content_coding(value);
+    } else if (strncasecmp(p->line, "x-ratelimit-", 12) == 0) {
+        rate_header(p, p->line + 12, value);
+    } else if (strcasecmp(p->line, "retry-after-ms") == 0) {
+        p->retry_after_ms = strtod(value, NULL);
+    } else if (strcasecmp(p->line, "Retry-After") == 0 &&
+               p->retry_after_ms < 0 && isdigit((unsigned char)*value)) {
+        p->retry_after_ms = strtod(value, NULL) * 1000.0; /* not a date */
+    }
+    return 0;
+}
+
+/*
+ * http_head_done — Chooses the body framing once the blank line after
+ * the headers has been seen, and readies the decoder for a compressed
+ * body.
+ */
+static void http_head_done(struct http_parser *p)
+{
+    if (p->status >= 100 && p->status < 200) {
+        /* Interim response (e.g. 100 Continue): the real one follows */
+        http_init(p, p->dec, p->on_body, p->user);
+    } else if (p->status == 204 || p->status == 304) {
+        p->state = HP_DONE; /* never has a body */
+    } else if (p->chunked) {
+        p->state = HP_CHUNK_SIZE;
+    } else if (p->content_length >= 0) {
+        p->remaining = (unsigned long)p->content_length;
+        p->state     = (p->remaining > 0) ? HP_BODY : HP_DONE;
+    } else {
+        p->state      = HP_BODY_EOF; /* delimited by close */
+        p->keep_alive = 0;
+    }
+
+    if (p->coding != CE_IDENTITY && p->state != HP_STATUS) {
+        if (p->state == HP_DONE) {
+            p->coding = CE_IDENTITY; /* no body to inflate */
+        } else if (p->dec == NULL || dec_start(p->dec, p->coding) != 0) {
+            p->state = HP_ERROR;
+        }
+    }
+}
+
+/*
+ * http_feed — Pushes 'len' received bytes through the parser.
+ * Returns 1 once the response is complete, 0 if more bytes are needed,
+ * -1 on a parse error or if on_body aborted.
+ */
+static int http_feed(struct http_parser *p, const char *data, size_t len)
+{
+    size_t k;    /* bytes of data consumed so far        */
+    size_t take; /* body bytes passed on in one step     */
+    int    rc;   /* result of http_line                  */
+    int    minor;/* HTTP minor version from status line  */
+
+    k = 0;
+    while (p->state != HP_DONE && p->state != HP_ERROR) {
+        switch (p->state) {
+        case HP_BODY:
+        case HP_CHUNK_DATA:
+        case HP_BODY_EOF:
+            if (k == len) {
+                return 0;
+            }
+            take = len - k;
+            if (p->state != HP_BODY_EOF && take > p->remaining) {
+                take = p->remaining;
+            }
+            if (http_body(p, data + k, take) != 0) {
+                p->state = HP_ERROR;
+                break;
+            }
+            k += take;
+            if (p->state != HP_BODY_EOF) {
+                p->remaining -= take;
+                if (p->remaining == 0) {
+                    p->state = (p->state == HP_BODY) ? HP_DONE : HP_CHUNK_END;
+                }
+            }
+            break;
+
+        default:
+            /* Every other state consumes whole lines */
+            rc = http_line(p, data, len, &k);
+            if (rc == 0) {
+                return 0;
+            }
+            if (rc < 0) {
+                p->state = HP_ERROR;
+                break;
+            }
+
+            if (p->state == HP_STATUS) {
+                if (sscanf(p->line, "HTTP/1.%d %3d", &minor, &p->status) != 2) {
+                    p->state = HP_ERROR;
+                    break;
+                }
+                p->keep_alive = (minor >= 1); /* 1.0 closes by default */
+                p->state      = HP_HEADER;
+            } else if (p->state == HP_HEADER) {
+                if (p->line[0] == '\0') {
+                    http_head_done(p);
+                } else if (http_header(p) != 0) {
+                    p->state = HP_ERROR;
+                }
+            } else if (p->state == HP_CHUNK_SIZE) {
+                char *end; /* end of the hex digits */
+
+                p->remaining = strtoul(p->line, &end, 16);
+                if (end == p->line) {
+                    p->state = HP_ERROR;
+                } else {
+                    p->state = (p->remaining > 0) ? HP_CHUNK_DATA : HP_TRAILER;
+                }
+            } else if (p->state == HP_CHUNK_END) {
+                p->state = (p->line[0] == '\0') ? HP_CHUNK_SIZE : HP_ERROR;
+            } else if (p->line[0] == '\0') { /* HP_TRAILER */
+                p->state = HP_DONE;
+            }
+            break;
+        }
+    }
+    if (p->state == HP_DONE && http_truncated(p)) {
+        p->state = HP_ERROR; /* framing ended inside the compressed data */
+    }
+    return (p->state == HP_DONE) ? 1 : -1;
+}
+
+/*
+ * http_eof — Tells the parser that SSL_read returned 'ret' <= 0.  Only a
+ * clean TLS close (close_notify) completes a close-delimited body; a
+ * reset or a truncated stream means the body may be cut short.
+ * Returns 1 if the response is complete, -1 otherwise.
+ */
+static int http_eof(struct http_parser *p, SSL *ssl, int ret)
+{
+    if (p->state == HP_BODY_EOF && !http_truncated(p) &&
+        SSL_get_error(ssl, ret) == SSL_ERROR_ZERO_RETURN) {
+        p->state = HP_DONE;
+        return 1;
+    }
+    p->state = HP_ERROR;
+    return -1;
+}
+
+/*
+ * http_h2_end — Tells the parser that the HTTP/2 stream has ended.  That
+ * completes a body without a Content-Length (HTTP/2 frames the body
+ * itself); one with a Content-Length must be complete already.
+ * Returns 1 if the response is complete, -1 otherwise.
+ */
+static int http_h2_end(struct http_parser *p)
+{
+    if (p->state == HP_BODY_EOF && !http_truncated(p)) {
+        p->state = HP_DONE;
+    }
+    if (p->state != HP_DONE) {
+        p->state = HP_ERROR;
+        return -1;
+    }
+    return 1;
+}
+
+/* -------------------------------------------------------------------------
+ * Request serialisation
+ * ---------------------------------------------------------------------- */
+
+/*
+ * req_build_body — Writes the JSON payload for 'prompt' into r->body,
+ * replacing what was there.  The prompt is escaped on the way in.
+ * Returns 0 on success, -1 if out of memory.
+ */
+static int req_build_body(struct neuro_req *r, const char *prompt, int stream)
+{
+    /*
+     * Minimal chat-completion request:
+     * { "model": "...", "messages": [ { "role": "user", "content": "..." } ] }
+     */
+    static const char head[] = "{\"model\":\"" API_MODEL "\",";
+    static const char strm[] = "\"stream\":true,";
+    static const char msgs[] =
+        "\"messages\":[{\"role\":\"user\",\"content\":\"";
+    static const char tail[] = "\"}]}";
+    struct neuro_buf *b = &r->body;
+
+    r->more        = NULL; /* all of it is in r->body */
+    r->more_len    = 0;
+    r->more_tokens = -1;
+    r->end      = NULL;
+    r->end_len  = 0;
+    b->len = 0;
+    if (buf_append(b, head, sizeof(head) - 1) != 0 ||
+        (stream && buf_append(b, strm, sizeof(strm) - 1) != 0) ||
+        buf_append(b, msgs, sizeof(msgs) - 1) != 0 ||
+        buf_append_json(b, prompt, strlen(prompt)) != 0 ||
+        buf_append(b, tail, sizeof(tail) - 1) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * req_h2_block — Encodes the head in r->head as an HTTP/2 header block
+ * in r->block.  The request line becomes :method and :path, Host becomes
+ * :authority, names are lowercased, and Connection, which HTTP/2 does
+ * not allow, is left out; with the HTTP/1.1 text as the one source, both
+ * versions always send the same fields.  The text is split up in place
+ * at the start of r->block and the block is encoded after it, then moved
+ * to the front.
+ * Returns 0 on success, -1 if out of memory.
+ */
+static int req_h2_block(struct neuro_req *r)
+{
+    struct neuro_h2_field f[H2_MAX_FIELDS]; /* fields, pseudo-headers first */
+    struct neuro_buf     *b = &r->block;
+    char                 *line;  /* line being split up          */
+    char                 *next;  /* the line after it            */
+    char                 *value; /* value of a header line       */
+    char                 *k;
+    size_t                n;     /* fields in f                  */
+    size_t                len;   /* length of the encoded block  */
+
+    b->len = 0;
+    if (buf_reserve(b, 2 * r->head.len + 16 * H2_MAX_FIELDS) != 0) {
+        return -1;
+    }
+    memcpy(b->data, r->head.data, r->head.len);
+    b->data[r->head.len] = '\0';
+
+    /* "POST /path HTTP/1.1" */
+    line = b->data;
+    next = strstr(line, "\r\n");
+    *next = '\0';
+    f[0].name  = ":method";
+    f[0].value = line;
+    line = strchr(line, ' ');
+    *line++ = '\0';
+    f[1].name  = ":scheme";
+    f[1].value = "https";
+    f[2].name  = ":path";
+    f[2].value = line;
+    *strchr(line, ' ') = '\0';
+    f[3].name  = ":authority";
+    f[3].value = "";
+    n = 4;
+
+    for (line = next + 2; *line != '\0' && *line != '\r'; line = next + 2) {
+        next  = strstr(line, "\r\n");
+        *next = '\0';
+        value = strchr(line, ':');
+        *value++ = '\0';
+        while (*value == ' ') { value++; }
+        for (k = line; *k != '\0'; k++) {
+            *k = (char)tolower((unsigned char)*k);
+        }
+        if (strcmp(line, "host") == 0) {
+            f[3].value = value;
+        } else if (strcmp(line, "connection") != 0 && n < H2_MAX_FIELDS) {
+            f[n].name      = line;
+            f[n].value     = value;
+            f[n].sensitive = strcmp(line, "authorization") == 0;
+            n++;
+        }
+    }
+    f[0].sensitive = f[1].sensitive = f[2].sensitive = f[3].sensitive = 0;
+
+    len = neuro_h2_encode(b->data + r->head.len + 1,
+                          b->cap - r->head.len - 1, f, n);
+    if (len == 0) {
+        return -1;
+    }
+    memmove(b->data, b->data + r->head.len + 1, len);
+    b->len = len;
+    return 0;
+}
+
+/*
+ * req_build_head — Writes the HTTP/1.1 request line and headers for the
+ * body already in r->body, and with http2 on the same as an HTTP/2
+ * header block.  The connection is left open for the next call.
+ * Returns 0 on success, -1 if out of memory.
+ */
+static int req_build_head(struct neuro_req *r, const struct neuro_client *c,
+                          const char *api_key, int stream)
+{
+    int custom = strcmp(c->port, API_PORT) != 0; /* port goes in Host */
+    int n;
+
+    r->head.len = 0;
+    if (buf_reserve(&r->head, 512 + strlen(API_PATH) + strlen(c->host) +
+                              strlen(api_key)) != 0) {
+        return -1;
+    }
+    n = snprintf(r->head.data, r->head.cap,
+                 "POST %s HTTP/1.1\r\n"
+                 "Host: %s%s%s\r\n"
+                 "Content-Type: application/json\r\n"
+                 "Accept: %s\r\n"
+                 "Accept-Encoding: " ACCEPT_ENCODING "\r\n"
+                 "Authorization: Bearer %s\r\n"
+                 "Content-Length: %zu\r\n"
+                 "Connection: keep-alive\r\n"
+                 "\r\n",
+                 API_PATH, c->host, custom ? ":" : "", custom ? c->port : "",
+                 stream ? "text/event-stream" : "application/json",
+                 api_key, req_body_len(r));
+    if (n < 0 || (size_t)n >= r->head.cap) {
+        return -1;
+    }
+    r->head.len = (size_t)n;
+    return c->http2 ? req_h2_block(r) : 0;
+}
+
+/*
+ * req_build — Builds both segments of the request for 'prompt'.
+ * Returns 0 on success, -1 if out of memory.
+ */
+static int req_build(struct neuro_req *r, const struct neuro_client *c,
+                     const char *api_key, const char *prompt, int stream)
+{
+    if (req_build_body(r, prompt, stream) != 0) {
+        return -1;
+    }
+    return req_build_head(r, c, api_key, stream);
+}
+
+/*
+ * req_send — Writes the request, segment by segment, starting after the
+ * '*sent' bytes already written and advancing *sent.  SSL_write is
+ * called until everything is out, so a short write (or one interrupted
+ * on a non-blocking socket) simply resumes later.
+ * Returns 1 once the whole request is written, otherwise SSL_write's
+ * result (<= 0) for SSL_get_error.
+ */
+static int req_send(SSL *ssl, const struct neuro_req *r, size_t *sent)
+{
+    const char *seg[4];  /* the segments, in order        */
+    size_t      len[4];  /* their lengths                 */
+    size_t      off;     /* offset of *sent in segment i  */
+    int         i, n;
+
+    seg[0] = r->head.data; len[0] = r->head.len;
+    seg[1] = r->body.data; len[1] = r->body.len;
+    seg[2] = r->more;      len[2] = r->more_len;
+    seg[3] = r->end;       len[3] = r->end_len;
+
+    off = *sent;
+    for (i = 0; i < 4; i++) {
+        while (off < len[i]) {
+            n = SSL_write(ssl, seg[i] + off, (int)(len[i] - off));
+            if (n <= 0) {
+                return n;
+            }
+            off   += (size_t)n;
+            *sent += (size_t)n;
+        }
+        off -= len[i]; /* now relative to the next segment */
+    }
+    return 1;
+}
+
+/*
+ * req_write — req_send for a blocking connection: the whole request in
+ * one call.  Returns 0 on success, -1 on failure.
+ */
+static int req_write(SSL *ssl, const struct neuro_req *r)
+{
+    size_t sent = 0;
+
+    return (req_send(ssl, r, &sent) == 1) ? 0 : -1;
+}
+
+/* -------------------------------------------------------------------------
+ * Token counting (one vocabulary for the whole process)
+ * ---------------------------------------------------------------------- */
+
+static struct neuro_tok *tokenizer;  /* NULL = estimate from the length */
+static pthread_once_t    tokenizer_once = PTHREAD_ONCE_INIT;
+
+/*
+ * tokenizer_env — Loads the vocabulary named by NEURO_TOKENIZER, if any.
+ * Run once, before the first count or neuro_set_tokenizer().
+ */
+static void tokenizer_env(void)
+{
+    const char *path = getenv("NEURO_TOKENIZER");
+
+    if (path != NULL && path[0] != '\0') {
+        tokenizer = neuro_tok_open(path);
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * Conversations
+ * ---------------------------------------------------------------------- */
+
+/*
+ * A conversation keeps every message as a ready-to-send JSON fragment,
+ *
+ *   ,{"role":"user","content":"...escaped..."}
+ *
+ * appended to one growing arena.  A message is escaped exactly once,
+ * when it is added; a request then sends the arena from the oldest
+ * message still in the budget to the end as one borrowed segment of the
+ * body (see struct neuro_req), so building a request costs the same on
+ * the hundredth turn as on the first.
+ *
+ * Each message carries a token estimate.  When the messages exceed the
+ * budget, the oldest are dropped by moving 'first' forward.  The space
+ * they held is reclaimed only when it is more than half of the arena,
+ * so the copying stays proportional to what was appended.
+ */
+
+/* One message of a conversation */
+struct conv_turn {
+    size_t off;    /* its fragment, from the leading comma, in the arena */
+    long   tokens; /* estimated size                                     */
+    int    user;   /* 1 = user, 0 = assistant                            */
+};
+
+struct neuro_conv {
+    struct neuro_buf  arena;  /* the fragments, oldest first           */
+    struct conv_turn *turns;  /* one per fragment                      */
+    size_t            nturns; /* entries in turns                      */
+    size_t            cap;    /* capacity of turns                     */
+    size_t            first;  /* oldest message still sent             */
+    long              tokens; /* estimate for turns[first..]           */
+    long              budget; /* most tokens of history sent           */
+    struct neuro_buf  answer; /* assistant text being streamed         */
+    neuro_stream_cb   cb;     /* caller's callback during a question   */
+    void             *user;   /* caller's pointer for cb               */
+};
+
+/*
+ * conv_estimate — Tokens of a message: its text, plus the few tokens
+ * every message costs for its role and framing.
+ */
+static long conv_estimate(const char *text, size_t len)
+{
+    return (long)neuro_count_tokens(text, len) + CONV_MSG_TOKENS;
+}
+
+/*
+ * conv_add — Appends a message, escaping 'text' into the arena.
+ * Returns 0 on success, -1 if out of memory (nothing is added).
+ */
+static int conv_add(struct neuro_conv *conv, int user, const char *text,
+                    size_t len)
+{
+    static const char usr[]  = ",{\"role\":\"user\",\"content\":\"";
+    static const char bot[]  = ",{\"role\":\"assistant\",\"content\":\"";
+    static const char tail[] = "\"}";
+    struct conv_turn *turns; /* grown array */
+    size_t            off;   /* where the fragment starts */
+    size_t            cap;
+
+    if (conv->nturns == conv->cap) {
+        cap   = (conv->cap != 0) ? conv->cap * 2 : 16;
+        turns = (struct conv_turn *)realloc(conv->turns, cap * sizeof(*turns));
+        if (turns == NULL) {
+            return -1;
+        }
+        conv->turns = turns;
+        conv->cap   = cap;
+    }
+
+    off = conv->arena.len;
+    if ((user ? buf_append(&conv->arena, usr, sizeof(usr) - 1)
+              : buf_append(&conv->arena, bot, sizeof(bot) - 1)) != 0 ||
+        buf_append_json(&conv->arena, text, len) != 0 ||
+        buf_append(&conv->arena, tail, sizeof(tail) - 1) != 0) {
+        conv->arena.len = off; /* undo the partial fragment */
+        return -1;
+    }
+
+    conv->turns[conv->nturns].off    = off;
+    conv->turns[conv->nturns].tokens = conv_estimate(text, len);
+    conv->turns[conv->nturns].user   = user;
+    conv->tokens += conv->turns[conv->nturns].tokens;
+    conv->nturns++;
+    return 0;
+}
+
+/*
+ * conv_drop_last — Removes the newest message (a question that got no
+ * answer).
+ */
+static void conv_drop_last(struct neuro_conv *conv)
+{
+    conv->nturns--;
+    conv->tokens   -= conv->turns[conv->nturns].tokens;
+    conv->arena.len = conv->turns[conv->nturns].off;
+}
+
+/*
+ * conv_compact — Reclaims the arena space of dropped messages once it
+ * is more than half of the arena.
+ */
+static void conv_compact(struct neuro_conv *conv)
+{
+    size_t dead = conv->turns[conv->first].off; /* bytes before 'first' */
+    size_t i;
+
+    if (dead <= conv->arena.len / 2) {
+        return;
+    }
+    memmove(conv->arena.data, conv->arena.data + dead, conv->arena.len - dead);
+    conv->arena.len -= dead;
+    memmove(conv->turns, conv->turns + conv->first,
+            (conv->nturns - conv->first) * sizeof(*conv->turns));
+    conv->nturns -= conv->first;
+    conv->first   = 0;
+    for (i = 0; i < conv->nturns; i++) {
+        conv->turns[i].off -= dead;
+    }
+}
+
+/*
+ * conv_trim — Drops the oldest messages until the rest fit the budget.
+ * The newest message (the question being asked) always stays, and the
+ * history never starts with an assistant message.
+ */
+static void conv_trim(struct neuro_conv *conv)
+{
+    while (conv->first + 1 < conv->nturns &&
+           (conv->tokens > conv->budget || !conv->turns[conv->first].user)) {
+        conv->tokens -= conv->turns[conv->first].tokens;
+        conv->first++;
+    }
+    conv_compact(conv);
+}
+
+/*
+ * req_build_conv — Builds a streamed request whose messages are the
+ * conversation's, from the oldest one in the budget.  Only the short
+ * start of the body is written; the messages are borrowed from the
+ * arena, which must not change until the request has been sent.
+ * Returns 0 on success, -1 if out of memory.
+ */
+static int req_build_conv(struct neuro_req *r, const struct neuro_client *c,
+                          const char *api_key, const struct neuro_conv *conv)
+{
+    static const char head[] =
+        "{\"model\":\"" API_MODEL "\",\"stream\":true,\"messages\":[";
+    static const char tail[] = "]}";
+    size_t            off = conv->turns[conv->first].off + 1; /* no comma */
+
+    r->body.len = 0;
+    if (buf_append(&r->body, head, sizeof(head) - 1) != 0) {
+        return -1;
+    }
+    r->more        = conv->arena.data + off;
+    r->more_len    = conv->arena.len - off;
+    r->more_tokens = conv->tokens; /* counted as the messages were added */
+    r->end         = tail;
+    r->end_len     = sizeof(tail) - 1;
+    return req_build_head(r, c, api_key, 1);
+}
+
+/*
+ * conv_capture — neuro_stream_cb between the stream and the caller:
+ * keeps the answer for the conversation, then passes the fragment on.
+ */
+static int conv_capture(const char *text, size_t len, void *user)
+{
+    struct neuro_conv *conv = (struct neuro_conv *)user;
+
+    if (buf_append(&conv->answer, text, len) != 0) {
+        return -1;
+    }
+    return conv->cb(text, len, conv->user);
+}
+
+/* -------------------------------------------------------------------------
+ * Rate limits (shared by every request in the process)
+ * ---------------------------------------------------------------------- */
+
+/*
+ * The server advertises its limits on every answer:
+ *
+ *   x-ratelimit-limit-requests / -tokens      size of each budget
+ *   x-ratelimit-remaining-requests / -tokens  what is left of it
+ *   x-ratelimit-reset-requests / -tokens      time until it is full again
+ *
+ * and, with a 429, how long to stay away (Retry-After, retry-after-ms).
+ * The library mirrors each budget as a token bucket that refills at the
+ * rate those headers imply, times RATE_MARGIN.  Every request takes one
+ * request and an estimate of its tokens before it is sent, and waits
+ * when a bucket is empty, instead of running into 429s and retrying.
+ *
+ * The buckets are process-wide: all modes and all threads talk to the
+ * same account, so they share one limiter behind a mutex.
+ */
+struct rate_bucket {
+    double level;  /* units available now                        */
+    double cap;    /* advertised limit; 0 = not known yet         */
+    double per_us; /* refill rate in units per us; 0 = not paced  */
+};
+
+struct rate_limiter {
+    pthread_mutex_t    lock;
+    int                off;           /* neuro_set_pacing(0) was called  */
+    struct rate_bucket b[RL_COUNT];   /* requests, tokens                */
+    long long          last_us;       /* mono_us() of the last refill    */
+    long long          blocked_until; /* mono_us(): Retry-After expiry   */
+};
+
+static struct rate_limiter limiter = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/*
+ * rate_cost — Tokens a request is expected to use.  The server's count
+ * is only known afterwards; this counts the whole body, JSON framing
+ * included, so it errs on the high side.  A conversation's history
+ * comes with the estimate kept for it instead (text plus
+ * CONV_MSG_TOKENS per message, as the server counts), so that only the
+ * short head and tail are tokenized on every send, retry and hedge.
+ */
+static double rate_cost(const struct neuro_req *r)
+{
+    size_t more; /* tokens of the borrowed segment */
+
+    more = (r->more_tokens >= 0)
+               ? (size_t)r->more_tokens
+               : neuro_count_tokens(r->more, r->more_len);
+    return (double)(neuro_count_tokens(r->body.data, r->body.len) + more +
+                    neuro_count_tokens(r->end, r->end_len) + 1);
+}
+
+/*
+ * rate_refill — Tops the buckets up for the time since the last call.
+ * The limiter must be locked.
+ */
+static void rate_refill(struct rate_limiter *l, long long now)
+{
+    struct rate_bucket *b;
+    int                 i;
+
+    for (i = 0; i < RL_COUNT; i++) {
+        b = &l->b[i];
+        b->level += b->per_us * (double)(now - l->last_us);
+        if (b->level > b->cap) {
+            b->level = b->cap;
+        }
+    }
+    l->last_us = now;
+}
+
+/*
+ * rate_reserve — Asks to send a request expected to use 'tokens'.  If
+ * the buckets allow it, takes its share and returns 0; otherwise takes
+ * nothing and returns how long to wait (us) before asking again.
+ */
+static long long rate_reserve(double tokens)
+{
+    struct rate_limiter *l = &limiter;
+    struct rate_bucket  *b;
+    double               need[RL_COUNT]; /* units this request takes */
+    long long            now, wait, w;
+    int                  i;
+
+    pthread_mutex_lock(&l->lock);
+    now  = mono_us();
+    wait = 0;
+    if (!l->off) {
+        rate_refill(l, now);
+        need[RL_REQUESTS] = 1.0;
+        need[RL_TOKENS]   = tokens;
+        if (now < l->blocked_until) {
+            wait = l->blocked_until - now;
+        }
+        for (i = 0; i < RL_COUNT; i++) {
+            b = &l->b[i];
+            if (b->per_us <= 0.0) {
+                continue; /* this limit is not known: no pacing */
+            }
+            if (need[i] > b->cap) {
+                need[i] = b->cap; /* bigger than the bucket: send when full */
+            }
+            if (b->level < need[i]) {
+                w = (long long)((need[i] - b->level) / b->per_us) + 1;
+                if (w > wait) {
+                    wait = w;
+                }
+            }
+        }
+        if (wait == 0) {
+            for (i = 0; i < RL_COUNT; i++) {
+                if (l->b[i].per_us > 0.0) {
+                    l->b[i].level -= need[i];
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&l->lock);
+    return wait;
+}
+
+/*
+ * rate_acquire — Blocking form of rate_reserve: sleeps until the request
+ * may be sent.
+ */
+static void rate_acquire(double tokens)
+{
+    long long wait; /* us */
+
+    while ((wait = rate_reserve(tokens)) > 0) {
+        sleep_us(wait);
+    }
+}
+
+/*
+ * rate_hold — Holds every request back for 'us' microseconds, e.g. to
+ * back off after an overloaded answer without Retry-After.
+ */
+static void rate_hold(long long us)
+{
+    long long until; /* mono_us() */
+
+    pthread_mutex_lock(&limiter.lock);
+    until = mono_us() + us;
+    if (until > limiter.blocked_until) {
+        limiter.blocked_until = until;
+    }
+    pthread_mutex_unlock(&limiter.lock);
+}
+
+/*
+ * rate_update — Learns from the rate-limit headers of a response.
+ *
+ * Each bucket is clamped to what the server says remains (requests it
+ * has seen from other processes count too), and its refill rate is
+ * taken as the used part of the budget over the time until it is full
+ * again.  A 429 empties the request bucket.  Retry-After (on a 429 or
+ * a 503) holds every request back until it has passed.
+ */
+static void rate_update(const struct http_parser *p)
+{
+    struct rate_limiter *l = &limiter;
+    struct rate_bucket  *b;
+    double               used, rate, hold;
+    long long            now;
+    int                  i;
+
+    pthread_mutex_lock(&l->lock);
+    now = mono_us();
+    rate_refill(l, now);
+    for (i = 0; i < RL_COUNT; i++) {
+        b = &l->b[i];
+        if (p->rl_remaining[i] < 0) {
+            continue;
+        }
+        if (p->rl_limit[i] > 0) {
+            b->cap = (double)p->rl_limit[i];
+        } else if (b->cap < (double)p->rl_remaining[i]) {
+            b->cap = (double)p->rl_remaining[i];
+        }
+        if (b->cap > 0.0 && b->per_us == 0.0) {
+            b->level = b->cap; /* first sight of this limit */
+        }
+        if (b->level > (double)p->rl_remaining[i]) {
+            b->level = (double)p->rl_remaining[i];
+        }
+        used = b->cap - (double)p->rl_remaining[i];
+        if (used >= 1.0 && p->rl_reset_ms[i] > 0.0) {
+            rate = used / (p->rl_reset_ms[i] * 1000.0) * RATE_MARGIN;
+            /* Smooth: reset times are rounded, often to whole ms */
+            b->per_us = (b->per_us > 0.0) ? (b->per_us + rate) / 2.0 : rate;
+        } else if (b->per_us == 0.0 && p->rl_reset_ms[i] > 0.0) {
+            b->per_us = b->cap / (p->rl_reset_ms[i] * 1000.0) * RATE_MARGIN;
+        }
+    }
+
+    hold = p->retry_after_ms;
+    if (p->status == 429) {
+        if (l->b[RL_REQUESTS].level > 0.0) {
+            l->b[RL_REQUESTS].level = 0.0;
+        }
+        if (hold < 0.0) {
+            hold = p->rl_reset_ms[RL_REQUESTS]; /* best other hint */
+        }
+    }
+    if (hold > 0.0 && now + (long long)(hold * 1000.0) > l->blocked_until) {
+        l->blocked_until = now + (long long)(hold * 1000.0);
+    }
+    pthread_mutex_unlock(&l->lock);
+}
+
+/* -------------------------------------------------------------------------
+ * Retries and hedged requests
+ * ---------------------------------------------------------------------- */
+
+/*
+ * retryable_status — Statuses worth another attempt: the server timed
+ * out, is rate limiting, or failed in a way that is usually transient.
+ */
+static int retryable_status(int status)
+{
+    return status == 408 || status == 429 || status == 500 ||
+           status == 502 || status == 503 || status == 504;
+}
+
+/*
+ * client_rand — Next value of a xorshift64* generator, seeded from the
+ * clock, the pid and the client's address on first use.  Only used for
+ * backoff jitter.
+ */
+static unsigned long long client_rand(struct neuro_client *c)
+{
+    if (c->rng == 0) {
+        c->rng = ((unsigned long long)mono_us() * 0x9E3779B97F4A7C15ULL) ^
+                 (unsigned long long)getpid() ^ (unsigned long long)(size_t)c;
+        c->rng |= 1;
+    }
+    c->rng ^= c->rng >> 12;
+    c->rng ^= c->rng << 25;
+    c->rng ^= c->rng >> 27;
+    return c->rng * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+ * retry_backoff_ms — Random backoff before retry number 'attempt'.
+ */
+static long long retry_backoff_ms(struct neuro_client *c, int attempt)
+{
+    long long cap; /* upper bound of this backoff, ms */
+
+    cap = c->retry_base_ms;
+    while (attempt-- > 0 && cap < c->retry_cap_ms) {
+        cap *= 2;
+    }
+    if (cap > c->retry_cap_ms) {
+        cap = c->retry_cap_ms;
+    }
+    return (long long)(client_rand(c) % (unsigned long long)(cap + 1));
+}
+
+/*
+ * client_should_retry — Decides whether attempt number 'attempt' (0 for
+ * the first) deserves another go, given what client_exchange returned
+ * and the response it parsed.  If so, sleeps for the backoff first.
+ *
+ * The backoff is "full jitter": a random time between zero and
+ * retry_base_ms * 2^attempt (at most retry_cap_ms), so clients that
+ * failed together do not all come back at the same moment.  When the
+ * server sent Retry-After there is no backoff: the rate limiter holds
+ * the next attempt back for exactly that long.
+ *
+ * Returns 1 to try again, 0 to give up.
+ */
+static int client_should_retry(struct neuro_client *c, int attempt,
+                               int rc, const struct http_parser *p)
+{
+    if (attempt >= c->retries || (rc == 0 && !retryable_status(p->status))) {
+        return 0;
+    }
+    if (rc == 0 && p->retry_after_ms >= 0.0) {
+        return 1; /* the server said when; the rate limiter waits for it */
+    }
+    sleep_us(retry_backoff_ms(c, attempt) * 1000);
+    return 1;
+}
+
+/*
+ * hedge_delay — How long to wait for the first response byte before
+ * sending a second copy of the request, in ms; -1 for no hedging.  In
+ * adaptive mode this is the p95 of the first-byte times seen so far, so
+ * only about one request in twenty is ever duplicated.
+ */
+static long hedge_delay(const struct neuro_client *c)
+{
+    if (c->hedge_ms != 0) {
+        return c->hedge_ms;
+    }
+    if (c->hist[NEURO_PHASE_TTFB].count < HEDGE_MIN_SAMPLES) {
+        return -1; /* not enough history yet */
+    }
+    return (long)hist_percentile(&c->hist[NEURO_PHASE_TTFB], 95.0) + 1;
+}
+
+/*
+ * client_hedge — Opens a second connection and sends the request on it.
+ * The client's own connection and timing are left as they were; the new
+ * connection, already non-blocking, is returned through *ssl and *sock.
+ * Returns 0 on success, -1 on failure.
+ */
+static int client_hedge(struct neuro_client *c, const struct neuro_req *req,
+                        SSL **ssl, int *sock)
+{
+    SSL                *primary = c->ssl;    /* the request's connection */
+    int                 psock   = c->sock;
+    struct neuro_timing saved   = c->timing; /* not this connect's phases */
+    int                 ok;
+
+    if (rate_reserve(rate_cost(req)) != 0) {
+        return -1; /* paced: a duplicate would only make things worse */
+    }
+    c->ssl  = NULL;
+    c->sock = -1;
+    ok = client_connect(c) == 0 && c->h2 == NULL && /* same protocol */
+         req_write(c->ssl, req) == 0;
+    if (ok) {
+        *ssl  = c->ssl;
+        *sock = c->sock;
+        set_blocking(*sock, 0);
+    } else {
+        client_drop_conn(c, 0);
+    }
+    c->ssl    = primary;
+    c->sock   = psock;
+    c->timing = saved;
+    return ok ? 0 : -1;
+}
+
+/*
+ * client_first_read — Waits for the first bytes of the response to the
+ * request just written on the client's connection, and reads them into
+ * c->rbuf.
+ *
+ * With hedging on, if nothing has arrived after hedge_delay() the same
+ * request is also sent on a second connection.  Whichever answers first
+ * wins and becomes the client's connection; the other one is closed,
+ * which with HTTP/1.1 is the only way to cancel a request.  The server
+ * may still run (and bill) the cancelled copy, so hedging stays off
+ * unless asked for (neuro_set_hedge).
+ *
+ * Returns the number of bytes read, or <= 0 if the response failed or
+ * timed out before its first byte.
+ */
+static int client_first_read(struct neuro_client *c,
+                             const struct neuro_req *req)
+{
+    SSL          *ssl[2];  /* [0] the original, [1] the hedge       */
+    struct pollfd pfd[2];  /* their sockets                         */
+    int           nconn;   /* connections still in the race         */
+    int           win;     /* index of the winner, or -1            */
+    int           i, n, err;
+    long          delay;   /* hedge delay, ms                       */
+    long long     now, hedge_at, deadline, wait; /* mono_ms values  */
+
+    delay = hedge_delay(c);
+    if (delay < 0) {
+        /* No hedging: a plain blocking read, bounded by SO_RCVTIMEO */
+        return SSL_read(c->ssl, c->rbuf, (int)sizeof(c->rbuf));
+    }
+
+    ssl[0]     = c->ssl;
+    pfd[0].fd  = c->sock;
+    nconn      = 1;
+    win        = -1;
+    n          = -1;
+    c->ssl     = NULL;  /* the race owns both connections */
+    c->sock    = -1;
+    set_blocking(pfd[0].fd, 0);
+
+    now      = mono_ms();
+    hedge_at = now + delay;
+    deadline = (c->timeout_ms > 0) ? now + c->timeout_ms : -1;
+
+    while (win < 0 && nconn > 0) {
+        for (i = 0; i < nconn && win < 0; i++) {
+            n = SSL_read(ssl[i], c->rbuf, (int)sizeof(c->rbuf));
+            if (n > 0) {
+                win = i;
+                break;
+            }
+            err = SSL_get_error(ssl[i], n);
+            if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+                pfd[i].events  = (err == SSL_ERROR_WANT_READ) ? POLLIN
+                                                              : POLLOUT;
+                pfd[i].revents = 0;
+                continue;
+            }
+            /* This one failed; the other (if any) carries on alone */
+            SSL_free(ssl[i]);
+            close(pfd[i].fd);
+            nconn--;
+            if (i < nconn) {
+                ssl[i] = ssl[nconn];
+                pfd[i] = pfd[nconn];
+            }
+            i--;
+        }
+        if (win >= 0 || nconn == 0) {
+            break;
+        }
+
+        now = mono_ms();
+        if (deadline >= 0 && now >= deadline) {
+            n = -1; /* timed out */
+            break;
+        }
+        if (hedge_at >= 0 && now >= hedge_at) {
+            hedge_at = -1; /* at most one hedge per request */
+            if (nconn == 1 &&
+                client_hedge(c, req, &ssl[1], &pfd[1].fd) == 0) {
+                pfd[1].events = POLLIN;
+                nconn = 2;
+            }
+            continue;
+        }
+
+        wait = (deadline >= 0) ? deadline - now : -1;
+        if (hedge_at >= 0 && (wait < 0 || hedge_at - now < wait)) {
+            wait = hedge_at - now;
+        }
+        poll(pfd, (nfds_t)nconn, (int)wait);
+    }
+
+    /* Keep the winner, cancel everything else */
+    for (i = 0; i < nconn; i++) {
+        if (i == win) {
+            c->ssl  = ssl[i];
+            c->sock = pfd[i].fd;
+            set_blocking(c->sock, 1);
+        } else {
+            SSL_free(ssl[i]);
+            close(pfd[i].fd);
+        }
+    }
+    return (win >= 0) ? n : -1;
+}
+
+/* -------------------------------------------------------------------------
+ * HTTP/2 exchanges
+ * ---------------------------------------------------------------------- */
+
+/*
+ * When the server picks h2 during the handshake, the connection carries
+ * HTTP/2 (neuroh2.c) and every request is a stream of it.  The response
+ * still goes through the HTTP/1.1 parser: each decoded header field is
+ * handed to http_header as a "name: value" line, and DATA goes to the
+ * body states.  HTTP/2 frames the body itself, so the end of the stream
+ * ends the body.  neuro_ask and the other single calls send one stream
+ * at a time and keep the connection for the next call, as they would a
+ * keep-alive connection; neuro_ask_batch runs many at once (batch_h2).
+ * Hedging is for HTTP/1.1 only: HTTP/2 would rather reset a stream than
+ * race a second connection.
+ */
+
+/* A request on an HTTP/2 connection: the stream's user pointer */
+struct h2_call {
+    struct http_parser *p;        /* parses the response             */
+    size_t              received; /* response bytes (fields and body) */
+    int                 ended;    /* the response is complete        */
+    int                 closed;   /* the stream is gone              */
+    int                 error;    /* why (0 = both sides finished)   */
+};
+
+static int h2_on_header(void *stream, const char *name, size_t name_len,
+                        const char *value, size_t value_len)
+{
+    struct h2_call     *call = (struct h2_call *)stream;
+    struct http_parser *p    = call->p;
+
+    call->received += name_len + value_len;
+    if (name_len + value_len + 3 > sizeof(p->line)) {
+        return -1;
+    }
+    memcpy(p->line, name, name_len);
+    memcpy(p->line + name_len, ": ", 2);
+    memcpy(p->line + name_len + 2, value, value_len);
+    p->line[name_len + 2 + value_len] = '\0';
+
+    if (strncmp(p->line, ":status: ", 9) == 0) {
+        p->status = atoi(p->line + 9);
+        p->state  = HP_HEADER;
+        return 0;
+    }
+    if (name[0] == ':' || strncmp(p->line, "transfer-encoding:", 18) == 0 ||
+        strncmp(p->line, "connection:", 11) == 0) {
+        return 0; /* HTTP/1.1 framing has no meaning here */
+    }
+    return http_header(p);
+}
+
+static int h2_on_headers_end(void *stream)
+{
+    struct http_parser *p = ((struct h2_call *)stream)->p;
+
+    if (p->state != HP_HEADER) {
+        return -1; /* no :status */
+    }
+    http_head_done(p);
+    return (p->state == HP_ERROR) ? -1 : 0;
+}
+
+static int h2_on_data(void *stream, const char *data, size_t len)
+{
+    struct h2_call *call = (struct h2_call *)stream;
+
+    call->received += len;
+    return (http_feed(call->p, data, len) < 0) ? -1 : 0;
+}
+
+static void h2_on_end(void *stream)
+{
+    struct h2_call *call = (struct h2_call *)stream;
+
+    call->ended = (http_h2_end(call->p) == 1);
+}
+
+static void h2_on_close(void *stream, int error)
+{
+    struct h2_call *call = (struct h2_call *)stream;
+
+    call->closed = 1;
+    call->error  = error;
+}
+
+static const struct neuro_h2_cbs h2_client_cbs = {
+    NULL, h2_on_header, h2_on_headers_end, h2_on_data, h2_on_end,
+    h2_on_close
+};
+
+/*
+ * client_h2_start — Sets the new connection up for HTTP/2 if the server
+ * chose it.  Returns 0 (HTTP/2 or not), -1 if out of memory.
+ */
+static int client_h2_start(struct neuro_client *c)
+{
+    const unsigned char *proto; /* protocol ALPN settled on */
+    unsigned int         len;
+
+    SSL_get0_alpn_selected(c->ssl, &proto, &len);
+    if (len != 2 || memcmp(proto, "h2", 2) != 0) {
+        return 0; /* HTTP/1.1 */
+    }
+    c->h2 = neuro_h2_new(0, &h2_client_cbs, NULL);
+    return (c->h2 != NULL) ? 0 : -1;
+}
+
+/*
+ * h2_flush — Writes out the frames the connection has queued.
+ * Returns 1 once everything is written, otherwise SSL_write's result
+ * (<= 0) for SSL_get_error.
+ */
+static int h2_flush(SSL *ssl, struct neuro_h2 *h2)
+{
+    const char *out; /* queued frames */
+    size_t      len;
+    int         n;
+
+    while ((len = neuro_h2_output(h2, &out)) > 0) {
+        n = SSL_write(ssl, out, (int)len);
+        if (n <= 0) {
+            return n;
+        }
+        neuro_h2_sent(h2, (size_t)n);
+    }
+    return 1;
+}
+
+/*
+ * h2_body — The request's body segments as HTTP/2 body pieces.
+ */
+static void h2_body(const struct neuro_req *r, struct neuro_h2_chunk *body)
+{
+    body[0].data = r->body.data;
+    body[0].len  = r->body.len;
+    body[1].data = r->more;
+    body[1].len  = r->more_len;
+    body[2].data = r->end;
+    body[2].len  = r->end_len;
+}
+
+/*
+ * h2_exchange — Sends the request as a new stream on the client's
+ * HTTP/2 connection and reads until the stream closes.  *received counts
+ * the response bytes, and *mark moves on when the first arrive (the
+ * time to first byte).  The connection is dropped if it fails.
+ * Returns 1 once the response is complete, -1 on failure.
+ */
+static int h2_exchange(struct neuro_client *c, const struct neuro_req *req,
+                       struct http_parser *p, size_t *received,
+                       long long *mark)
+{
+    struct h2_call        call; /* the stream                  */
+    struct neuro_h2_chunk body[3];
+    int                   n;    /* bytes returned by SSL_read  */
+
+    memset(&call, 0, sizeof(call));
+    call.p = p;
+    h2_body(req, body);
+    if (neuro_h2_request(c->h2, req->block.data, req->block.len, body, 3,
+                         &call) < 0) {
+        return -1;
+    }
+    while (!call.closed && h2_flush(c->ssl, c->h2) == 1) {
+        n = SSL_read(c->ssl, c->rbuf, (int)sizeof(c->rbuf));
+        if (n <= 0) {
+            break;
+        }
+        if (neuro_h2_feed(c->h2, c->rbuf, (size_t)n) < 0) {
+            h2_flush(c->ssl, c->h2); /* the GOAWAY saying why */
+        }
+        if (*received == 0 && call.received > 0) {
+            *mark = timing_since(&c->timing, NEURO_PHASE_TTFB, *mark);
+        }
+        *received = call.received;
+    }
+    if (!call.closed) {
+        client_drop_conn(c, 0); /* closes the stream as well */
+    }
+    *received = call.received;
+    return (call.ended && call.error == 0) ? 1 : -1;
+}
+
+/* -------------------------------------------------------------------------
+ * Requests
+ * ---------------------------------------------------------------------- */
+
+/*
+ * client_exchange — Sends one request and runs the response through 'p'
+ * until it is complete.
+ *
+ * The pooled connection is used when there is one.  A server may close
+ * an idle keep-alive connection at any time, so if a reused connection
+ * fails before any response byte arrives the request is sent once more
+ * on a fresh connection.  Afterwards the connection stays pooled only if
+ * the response was framed and the server did not ask to close.  Waiting
+ * for the first byte may hedge the request (see client_first_read).
+ * Over HTTP/2 the request is a stream instead (h2_exchange), and the
+ * connection stays pooled until the server sends GOAWAY.
+ *
+ * Returns 0 once a complete response has been parsed, -1 on failure.
+ */
+static int client_exchange(struct neuro_client *c,
+                           const struct neuro_req *req, struct http_parser *p)
+{
+    int    reused;   /* 1 if this attempt used a pooled connection */
+    size_t received; /* response bytes seen on this attempt        */
+    int    rc;       /* 1 = complete, 0 = need more, -1 = failed   */
+    int    n;        /* bytes returned by SSL_read                 */
+    long long mark;  /* start of the current phase (mono_us)       */
+
+    for (;;) {
+        if (c->h2 != NULL && !neuro_h2_can_open(c->h2)) {
+            client_drop_conn(c, 1); /* the server is winding it down */
+        }
+        reused = (c->ssl != NULL);
+        c->timing.reused = reused;
+        if (!reused && client_connect(c) != 0) {
+            return -1; /* network, DNS or TLS failure */
+        }
+
+        received = 0;
+        rc       = -1;
+        rate_acquire(rate_cost(req));
+        mark     = mono_us();
+        if (c->h2 != NULL) {
+            rc = h2_exchange(c, req, p, &received, &mark);
+            p->keep_alive = (c->h2 != NULL && neuro_h2_can_open(c->h2));
+        } else if (req_write(c->ssl, req) == 0) {
+            n  = client_first_read(c, req);
+            rc = 0;
+            while (rc == 0) {
+                if (n <= 0) {
+                    rc = (received > 0) ? http_eof(p, c->ssl, n) : -1;
+                    break;
+                }
+                if (received == 0) {
+                    mark = timing_since(&c->timing, NEURO_PHASE_TTFB, mark);
+                }
+                received += (size_t)n;
+                rc = http_feed(p, c->rbuf, (size_t)n);
+                if (rc == 0) {
+                    n = SSL_read(c->ssl, c->rbuf, (int)sizeof(c->rbuf));
+                }
+            }
+        }
+
+        if (rc == 1) {
+            timing_since(&c->timing, NEURO_PHASE_TRANSFER, mark);
+            rate_update(p);
+            if (!p->keep_alive) {
+                client_drop_conn(c, 1); /* server closes or wants it closed */
+            }
+            return 0;
+        }
+
+        client_drop_conn(c, 0); /* stale or broken connection */
+        if (!reused || received > 0) {
+            return -1;
+        }
+        http_init(p, p->dec, p->on_body, p->user); /* retry on a new conn */
+    }
+}
+
+/*
+ * collect_body — http_body_fn that appends the body to a buffer.
+ */
+static int collect_body(struct http_parser *p, const char *data, size_t len)
+{
+    return buf_append((struct neuro_buf *)p->user, data, len);
+}
+
+/*
+ * client_cache — Returns the response cache, opening it from the
+ * environment the first time if neuro_set_cache() was not called:
+ *   NEURO_CACHE         path of the cache file (unset = no cache)
+ *   NEURO_CACHE_MAX_MB  size bound in MB (default 64)
+ *   NEURO_CACHE_TTL     entry lifetime in seconds (default: forever)
+ */
+static struct neuro_cache *client_cache(struct neuro_client *c)
+{
+    const char *path; /* NEURO_CACHE  */
+    const char *val;  /* other settings */
+    size_t      max;
+    long        ttl;
+
+    if (c->cache_env) {
+        return c->cache;
+    }
+    c->cache_env = 1;
+
+    path = getenv("NEURO_CACHE");
+    if (path == NULL || path[0] == '\0') {
+        return NULL;
+    }
+    val = getenv("NEURO_CACHE_MAX_MB");
+    max = (val != NULL) ? (size_t)strtoul(val, NULL, 10) * 1024 * 1024 : 0;
+    val = getenv("NEURO_CACHE_TTL");
+    ttl = (val != NULL) ? strtol(val, NULL, 10) : 0;
+
+    c->cache = neuro_cache_open(path, max, ttl);
+    return c->cache;
+}
+
+/*
+ * client_cache_key — Computes the cache key for a (non-streamed) request
+ * body.  Every mode shares that key, so an answer stored by one of
+ * neuro_ask, neuro_ask_stream or neuro_ask_batch serves the others.
+ * Returns the cache, or NULL when there is none (or hashing failed).
+ */
+static struct neuro_cache *client_cache_key(struct neuro_client *c,
+                                            const struct neuro_buf *json,
+                                            unsigned char *key)
+{
+    struct neuro_cache *cache = client_cache(c);
+
+    if (cache != NULL &&
+        neuro_cache_key(API_MODEL, json->data, json->len, key) != 0) {
+        return NULL;
+    }
+    return cache;
+}
+
+/*
+ * real_api_call — Sends the prompt to the OpenAI REST API over HTTPS
+ * and returns the JSON response body as a heap-allocated string.
+ * Returns NULL on any network or TLS error, or if the server answers
+ * with a status other than 2xx.  Failures that may be transient are
+ * retried first (client_should_retry).
+ *
+ * With a cache, the request body is hashed first; a hit is returned
+ * without any network traffic, and every 2xx answer is stored.
+ */
+static char *real_api_call(struct neuro_client *c, const char *api_key,
+                           const char *prompt)
+{
+    struct neuro_cache  *cache;  /* response cache, or NULL           */
+    unsigned char        key[NEURO_CACHE_KEY_LEN]; /* content address */
+    struct http_parser   p;      /* response parser                   */
+    struct neuro_buf    *body;   /* response body, from the pool      */
+    char                *result; /* final heap-allocated string       */
+    size_t               len;    /* length of a cached answer         */
+    int                  attempt; /* attempts made so far             */
+    int                  rc;     /* result of the last attempt        */
+
+    timing_begin(c);
+    if (req_build_body(&c->req, prompt, 0) != 0) {
+        return NULL;
+    }
+
+    cache = client_cache_key(c, &c->req.body, key);
+    if (cache != NULL) {
+        result = neuro_cache_get(cache, key, &len);
+        if (result != NULL) {
+            c->timing.cached = 1;
+            timing_record(c, &c->timing, c->t_start);
+            return result; /* hit: no network at all */
+        }
+    }
+
+    if (client_init(c) != 0 ||
+        req_build_head(&c->req, c, api_key, 0) != 0) {
+        return NULL;
+    }
+    body = pool_get(c);
+    if (body == NULL) {
+        return NULL;
+    }
+
+    attempt = 0;
+    for (;;) {
+        body->len = 0;
+        http_init(&p, &c->dec, collect_body, body);
+        rc = client_exchange(c, &c->req, &p);
+        if (!client_should_retry(c, attempt++, rc, &p)) {
+            break;
+        }
+    }
+
+    result = NULL;
+    if (rc == 0 && p.status >= 200 && p.status < 300) {
+        /* Hand the caller an exactly-sized copy; the buffer is reused */
+        result = (char *)malloc(body->len + 1);
+        if (result != NULL) {
+            memcpy(result, body->data != NULL ? body->data : "", body->len);
+            result[body->len] = '\0';
+            if (cache != NULL) {
+                neuro_cache_put(cache, key, result, body->len);
+            }
+            timing_record(c, &c->timing, c->t_start);
+        }
+    }
+
+    pool_put(c, body);
+    return result;
+}
+
+/* -------------------------------------------------------------------------
+ * Streaming responses (Server-Sent Events)
+ * ---------------------------------------------------------------------- */
+
+/*
+ * A streamed answer arrives as a sequence of events, each one a line
+ *   data: {"choices":[{"delta":{"content":"..."}}]}
+ * followed by a blank line, and finally "data: [DONE]".  The body goes
+ * through the same HTTP parser as a normal response (it is usually
+ * chunked), and sse_body turns it into lines as the bytes arrive.
+ */
+
+/*
+ * State of one streamed answer while its body is being parsed.
+ */
+struct sse_state {
+    struct neuro_buf *line;  /* current, not yet complete, line   */
+    struct jason_parser *json; /* decodes the events (the client's) */
+    neuro_stream_cb   cb;    /* caller's fragment callback        */
+    void             *user;  /* caller's pointer for cb           */
+    struct neuro_buf *text;  /* whole answer, for the cache; or NULL */
+    int               done;  /* "[DONE]" seen; drain the rest     */
+    int               sent;  /* fragments already passed to cb    */
+};
+
+/*
+ * json_content — Finds the string at 'path' in json[0..len) with the
+ * parser 'jp' (see jasonlib.h), which first forgets the strings of the
+ * previous document.  The lookup follows the document's structure, and
+ * escapes are decoded by the same rules as jason --extract.
+ * Returns the length with the text at *text (not NUL-terminated, valid
+ * until 'jp' is next used), -1 if there is no such string (e.g. a
+ * role-only event, or "content": null), or -2 if the document is
+ * malformed on the way to it or the parser is out of memory.
+ */
+static long json_content(struct jason_parser *jp, const char *json,
+                         size_t len, const char *path, const char **text)
+{
+    struct jason_slice v; /* the value at path */
+    int                rc;
+
+    jason_parser_reset(jp);
+    rc = jason_get(jp, json, len, path, &v);
+    if (rc == JASON_NOT_FOUND || (rc == 0 && v.type != JASON_STRING)) {
+        return -1;
+    }
+    if (rc != 0) {
+        return -2;
+    }
+    *text = v.ptr;
+    return (long)v.len;
+}
+
+/*
+ * sse_data — Handles the payload of one "data:" line.  Finds
+ * choices[0].delta.content, decodes it and hands the text to the
+ * callback (and to st->text, when the answer is being kept).  A
+ * fragment that does not decode fails the stream rather than leaving a
+ * hole in the answer.
+ * Returns 1 at "[DONE]", -1 on error or if the callback asked to stop,
+ * 0 otherwise.
+ */
+static int sse_data(const char *data, size_t len, struct sse_state *st)
+{
+    const char *text; /* decoded fragment                 */
+    long        n;    /* its length                       */
+
+    if (strncmp(data, "[DONE]", 6) == 0) {
+        return 1;
+    }
+
+    n = json_content(st->json, data, len, "choices[0].delta.content", &text);
+    if (n == -2) {
+        return -1;
+    }
+    if (n <= 0) {
+        return 0;
+    }
+    if (st->text != NULL && buf_append(st->text, text, (size_t)n) != 0) {
+        return -1;
+    }
+    st->sent++;
+    if (st->cb(text, (size_t)n, st->user) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * sse_body — http_body_fn for event streams.  Splits the body into lines
+ * and dispatches every "data:" line.  Bodies of error responses (wrong
+ * status or content type) are drained without being interpreted.
+ */
+static int sse_body(struct http_parser *p, const char *data, size_t len)
+{
+    struct sse_state *st = (struct sse_state *)p->user;
+    const char       *nl;      /* next newline in data         */
+    char             *payload; /* value of the "data:" field   */
+    size_t            seg;     /* bytes up to the newline      */
+    int               rc;
+
+    if (st->done || p->status != 200 || !p->event_stream) {
+        return 0;
+    }
+
+    while (len > 0) {
+        nl  = (const char *)memchr(data, '\n', len);
+        seg = (nl != NULL) ? (size_t)(nl - data) : len;
+        if (buf_append(st->line, data, seg) != 0) {
+            return -1;
+        }
+        if (nl == NULL) {
+            return 0; /* partial line; wait for the rest */
+        }
+        data += seg + 1;
+        len  -= seg + 1;
+
+        /* Complete line: strip CR and look for the "data:" field */
+        if (st->line->len > 0 && st->line->data[st->line->len - 1] == '\r') {
+            st->line->data[--st->line->len] = '\0';
+        }
+        rc = 0;
+        if (st->line->len >= 5 && strncmp(st->line->data, "data:", 5) == 0) {
+            payload = st->line->data + 5;
+            if (*payload == ' ') { payload++; }
+            seg = st->line->len - (size_t)(payload - st->line->data);
+            rc  = sse_data(payload, seg, st);
+        }
+        st->line->len = 0;
+
+        if (rc < 0) {
+            return -1; /* bad event, or callback aborted */
+        }
+        if (rc == 1) {
+            st->done = 1; /* the remainder is just drained */
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/*
+ * stream_replay — Plays a cached answer through the stream callback, as
+ * a single fragment.  Returns 0 on success, -1 if the callback stopped.
+ */
+static int stream_replay(struct neuro_client *c, const char *json,
+                         size_t len, neuro_stream_cb cb, void *user)
+{
+    const char *text; /* decoded answer text */
+    long        n;
+
+    n = json_content(&c->json, json, len, "choices[0].message.content",
+                     &text);
+    if (n > 0 && cb(text, (size_t)n, user) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * stream_store — Caches a streamed answer in the shape of a normal
+ * (non-streamed) response, so that any mode can answer from it later.
+ */
+static void stream_store(struct neuro_client *c, struct neuro_cache *cache,
+                         const unsigned char *key, const struct neuro_buf *text)
+{
+    static const char head[] =
+        "{\"object\":\"chat.completion\",\"model\":\"" API_MODEL "\","
+        "\"choices\":[{\"index\":0,\"message\":{\"role\":\"assistant\","
+        "\"content\":\"";
+    static const char tail[] = "\"},\"finish_reason\":\"stop\"}]}";
+    struct neuro_buf *json; /* the synthesized response */
+
+    json = pool_get(c);
+    if (json == NULL) {
+        return;
+    }
+    if (buf_append(json, head, sizeof(head) - 1) == 0 &&
+        buf_append_json(json, text->data != NULL ? text->data : "",
+                        text->len) == 0 &&
+        buf_append(json, tail, sizeof(tail) - 1) == 0) {
+        neuro_cache_put(cache, key, json->data, json->len);
+    }
+    pool_put(c, json);
+}
+
+/*
+ * stream_api_call — Like real_api_call, but asks for a streamed answer
+ * and passes each content fragment to 'cb' as soon as it arrives.  With
+ * a cache, a known answer is replayed without touching the network, and
+ * a new one is stored once "[DONE]" arrives.  With 'conv', the request
+ * carries the conversation's messages instead of 'prompt' (the question
+ * is already its newest message), and the cache is not used.
+ * Returns 0 on success, -1 on any error.
+ */
+static int stream_api_call(struct neuro_client *c, const char *api_key,
+                           const char *prompt, const struct neuro_conv *conv,
+                           neuro_stream_cb cb, void *user)
+{
+    struct neuro_cache  *cache; /* response cache, or NULL           */
+    unsigned char        key[NEURO_CACHE_KEY_LEN]; /* content address */
+    struct http_parser   p;     /* response parser                  */
+    struct sse_state     st;    /* event-stream splitter            */
+    char                *json;  /* a cached answer                  */
+    size_t               len;   /* its length                       */
+    int                  rc;    /* result to return                 */
+    int                  attempt; /* attempts made so far           */
+
+    timing_begin(c);
+
+    /* The cache key is that of the plain request, shared by all modes;
+     * conversations are not cached */
+    cache = NULL;
+    if (conv == NULL && client_cache(c) != NULL) {
+        if (req_build_body(&c->req, prompt, 0) != 0) {
+            return -1;
+        }
+        cache = client_cache_key(c, &c->req.body, key);
+        json = (cache != NULL) ? neuro_cache_get(cache, key, &len) : NULL;
+        if (json != NULL) {
+            rc = stream_replay(c, json, len, cb, user); /* no network */
+            free(json);
+            if (rc == 0) {
+                c->timing.cached = 1;
+                timing_record(c, &c->timing, c->t_start);
+            }
+            return rc;
+        }
+    }
+
+    if (client_init(c) != 0 ||
+        (conv != NULL ? req_build_conv(&c->req, c, api_key, conv)
+                      : req_build(&c->req, c, api_key, prompt, 1)) != 0) {
+        return -1;
+    }
+    st.line = pool_get(c);
+    st.text = (cache != NULL) ? pool_get(c) : NULL;
+    if (st.line == NULL || (cache != NULL && st.text == NULL)) {
+        pool_put(c, st.line);
+        pool_put(c, st.text);
+        return -1;
+    }
+    st.json = &c->json;
+    st.cb   = cb;
+    st.user = user;
+    st.sent = 0;
+
+    /* Only retry while the caller has seen nothing of the answer */
+    attempt = 0;
+    do {
+        st.line->len = 0;
+        if (st.text != NULL) {
+            st.text->len = 0;
+        }
+        st.done = 0;
+        http_init(&p, &c->dec, sse_body, &st);
+        rc = client_exchange(c, &c->req, &p);
+    } while (st.sent == 0 && client_should_retry(c, attempt++, rc, &p));
+
+    if (rc == 0 && (p.status != 200 || !p.event_stream)) {
+        rc = -1; /* an HTTP error, not an answer */
+    }
+    if (rc == 0 && st.done && cache != NULL) {
+        stream_store(c, cache, key, st.text);
+    }
+    if (rc == 0) {
+        timing_record(c, &c->timing, c->t_start);
+    }
+
+    pool_put(c, st.line);
+    pool_put(c, st.text);
+    return rc;
+}
+
+/* -------------------------------------------------------------------------
+ * Batch requests (event-driven, many connections at once)
+ * ---------------------------------------------------------------------- */
+
+/*
+ * neuro_ask_batch keeps up to 'concurrency' TLS connections busy from a
+ * single thread.  Every socket is non-blocking and registered with epoll;
+ * each connection is a small state machine that advances whenever its
+ * socket is ready:
+ *
+ *   CONNECTING → HANDSHAKE → [PACED →] WRITING → READING → (next prompt) …
+ *
+ * A connection that finishes a response takes the next unstarted prompt
+ * and, if the server allows keep-alive, sends it on the same connection.
+ * Responses go through the same incremental parser as neuro_ask.  When
+ * the rate limiter says to wait, the connection sits in PACED with a
+ * timer instead of sending; answers such as 429 and 503 put the prompt
+ * back in the queue.
+ */
+
+/* Connection states */
+enum {
+    BC_CONNECTING, /* non-blocking connect() in progress        */
+    BC_HANDSHAKE,  /* TLS handshake in progress                 */
+    BC_PACED,      /* held back by the rate limiter             */
+    BC_WRITING,    /* sending the request                       */
+    BC_READING,    /* reading and parsing the response          */
+    BC_IDLE        /* HTTP/2 slot with no prompt                */
+};
+
+/* One connection of a batch */
+struct batch_conn {
+    int                sock;     /* socket, -1 when closed               */
+    SSL               *ssl;      /* TLS state, NULL before the handshake */
+    int                state;    /* one of the BC_* values               */
+    int                addr;     /* index in the client's dns cache of the
+                                    address being connected to, or of the
+                                    last one that worked                 */
+    long long          started;  /* mono_ms() when that connect began, or
+                                    (BC_PACED) when to try sending       */
+    struct neuro_timing t;       /* latency breakdown of the job         */
+    long long          t_start;  /* mono_us() when the job was taken     */
+    long long          t_mark;   /* mono_us() when the phase began       */
+    int                reused;   /* already answered a request           */
+    size_t             job;      /* index of the prompt in flight        */
+    struct neuro_req   req;      /* request for that prompt              */
+    int                req_ok;   /* req was built (not out of memory)    */
+    int                admitted; /* the rate limiter let req go          */
+    size_t             sent;     /* bytes of req written so far          */
+    size_t             received; /* response bytes read for this job     */
+    struct http_parser p;        /* response parser                      */
+    struct http_decoder dec;     /* inflates p's compressed bodies       */
+    struct neuro_buf  *body;     /* response body, from the client pool  */
+    unsigned char      key[NEURO_CACHE_KEY_LEN]; /* cache key of the job */
+    int                keyed;    /* key is valid for this job            */
+    struct h2_call     call;     /* the job's stream, over HTTP/2        */
+};
+
+/* The whole batch */
+struct batch {
+    struct neuro_client *c;        /* client (TLS context, pool, rbuf)  */
+    const char          *api_key;  /* OPENAI_API_KEY                    */
+    const char *const   *prompts;  /* the caller's prompts              */
+    size_t               n;        /* number of prompts                 */
+    size_t               next;     /* next prompt never started         */
+    size_t              *retry;    /* prompts to start again            */
+    size_t               nretry;   /* entries in retry                  */
+    unsigned char       *tries;    /* attempts so far, per prompt       */
+    struct neuro_cache  *cache;    /* response cache, or NULL           */
+    int                  good;     /* first address that connected, or -1 */
+    size_t               left;     /* prompts not yet delivered         */
+    int                  epfd;     /* epoll instance                    */
+    neuro_batch_cb       cb;       /* caller's result callback          */
+    void                *user;     /* caller's pointer for cb           */
+};
+
+/*
+ * bc_watch — Registers (or re-registers) the connection's socket with
+ * epoll for the given events.
+ */
+static void bc_watch(struct batch *b, struct batch_conn *bc,
+                     unsigned int events, int add)
+{
+    struct epoll_event ev; /* registration record */
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = events;
+    ev.data.ptr = bc;
+    epoll_ctl(b->epfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, bc->sock, &ev);
+}
+
+/*
+ * bc_close — Tears down the connection's socket and TLS state.
+ */
+static void bc_close(struct batch *b, struct batch_conn *bc, int clean)
+{
+    if (bc->sock == -1) {
+        return;
+    }
+    epoll_ctl(b->epfd, EPOLL_CTL_DEL, bc->sock, NULL);
+    if (bc->ssl != NULL) {
+        if (clean) {
+            SSL_shutdown(bc->ssl); /* best effort; may not complete */
+        }
+        SSL_free(bc->ssl);
+        bc->ssl = NULL;
+    }
+    close(bc->sock);
+    bc->sock = -1;
+}
+
+/*
+ * bc_take_job — Gives the connection the next prompt to send: first any
+ * prompt waiting for a retry, then the next one never started.  Prompts
+ * whose answer is in the cache are delivered on the spot and skipped.
+ * Returns 0 on success, -1 when there is nothing left to start.
+ */
+static int bc_take_job(struct batch *b, struct batch_conn *bc)
+{
+    char   *cached; /* answer found in the cache  */
+    size_t  len;
+    int     i;
+
+    for (;;) {
+        if (b->nretry > 0) {
+            bc->job = b->retry[--b->nretry];
+        } else if (b->next < b->n) {
+            bc->job = b->next++;
+        } else {
+            return -1;
+        }
+
+        b->tries[bc->job]++;
+        for (i = 0; i < NEURO_PHASE_COUNT; i++) {
+            bc->t.ms[i] = -1.0;
+        }
+        bc->t.reused = bc->reused;
+        bc->t.cached = 0;
+        bc->t_start  = mono_us();
+        bc->t_mark   = bc->t_start;
+        bc->req_ok = 0;
+        if (req_build_body(&bc->req, b->prompts[bc->job], 0) != 0) {
+            break; /* reported as failed by the caller */
+        }
+        bc->keyed = (b->cache != NULL &&
+                     neuro_cache_key(API_MODEL, bc->req.body.data,
+                                     bc->req.body.len, bc->key) == 0);
+        if (bc->keyed &&
+            (cached = neuro_cache_get(b->cache, bc->key, &len)) != NULL) {
+            bc->t.cached = 1;
+            timing_record(b->c, &bc->t, bc->t_start);
+            b->left--;
+            b->cb(bc->job, cached, b->user); /* hit: never sent */
+            continue;
+        }
+        bc->req_ok = (req_build_head(&bc->req, b->c, b->api_key, 0) == 0);
+        break;
+    }
+
+    bc->sent     = 0;
+    bc->admitted = 0;
+    bc->received = 0;
+    bc->body->len = 0;
+    http_init(&bc->p, &bc->dec, collect_body, bc->body);
+    return 0;
+}
+
+/*
+ * bc_deliver — Hands the result for the connection's current prompt to
+ * the caller: a heap copy of the body on a 2xx answer, NULL otherwise.
+ */
+static void bc_deliver(struct batch *b, struct batch_conn *bc, int ok)
+{
+    char *result; /* heap copy of the body, or NULL */
+
+    result = NULL;
+    if (ok && bc->p.status >= 200 && bc->p.status < 300) {
+        result = (char *)malloc(bc->body->len + 1);
+        if (result != NULL) {
+            memcpy(result, bc->body->data != NULL ? bc->body->data : "",
+                   bc->body->len);
+            result[bc->body->len] = '\0';
+            if (bc->keyed) {
+                neuro_cache_put(b->cache, bc->key, result, bc->body->len);
+            }
+            timing_record(b->c, &bc->t, bc->t_start);
+        }
+    }
+    b->left--;
+    b->cb(bc->job, result, b->user);
+}
+
+static void bc_open(struct batch *b, struct batch_conn *bc);
+
+/*
+ * bc_fail — The connection broke.  The prompt is retried when the failure
+ * happened on a reused keep-alive connection before any response byte
+ * arrived (the server had simply closed it); otherwise it is reported as
+ * failed.  A fresh connection is opened while prompts remain.
+ */
+static void bc_fail(struct batch *b, struct batch_conn *bc)
+{
+    bc_close(b, bc, 0);
+
+    if (bc->reused && bc->received == 0 && b->tries[bc->job] < 2) {
+        b->retry[b->nretry++] = bc->job;
+    } else {
+        bc_deliver(b, bc, 0);
+    }
+    bc->reused = 0;
+    bc_open(b, bc);
+}
+
+/*
+ * bc_connect — Starts a non-blocking connect to the first cached address,
+ * from index 'i' onwards, that accepts one.  Returns 0 when a connect is
+ * under way (bc->addr is that address), -1 when no address is left.
+ */
+static int bc_connect(struct batch *b, struct batch_conn *bc, int i)
+{
+    struct dns_cache *d = &b->c->dns; /* addresses, known-good first */
+
+    for (; i < d->count; i++) {
+        bc->sock = socket(d->addr[i].ss_family, SOCK_STREAM, 0);
+        if (bc->sock == -1) {
+            continue;
+        }
+        fcntl(bc->sock, F_SETFL, fcntl(bc->sock, F_GETFL, 0) | O_NONBLOCK);
+        set_nodelay(bc->sock);
+        if (connect(bc->sock, (struct sockaddr *)&d->addr[i],
+                    d->len[i]) == 0 || errno == EINPROGRESS) {
+            bc->addr    = i;
+            bc->started = mono_ms();
+            bc->state   = BC_CONNECTING;
+            bc_watch(b, bc, EPOLLOUT, 1); /* writable = connect finished */
+            return 0;
+        }
+        close(bc->sock);
+        bc->sock = -1;
+    }
+    return -1;
+}
+
+/*
+ * bc_open — Takes a prompt and starts a non-blocking connect for it,
+ * beginning with the address this connection last reached.
+ * Does nothing when all prompts have been started.
+ */
+static void bc_open(struct batch *b, struct batch_conn *bc)
+{
+    while (bc_take_job(b, bc) == 0) {
+        if (bc->req_ok &&
+            (bc_connect(b, bc, bc->addr) == 0 ||
+             (bc->addr != 0 && bc_connect(b, bc, 0) == 0))) {
+            return;
+        }
+        /* Could not even start: report this prompt and try the next */
+        bc_deliver(b, bc, 0);
+    }
+}
+
+/*
+ * bc_next_addr — The connect in progress failed or took too long: moves
+ * on to the next cached address, and fails the prompt only when none is
+ * left.
+ */
+static void bc_next_addr(struct batch *b, struct batch_conn *bc)
+{
+    bc_close(b, bc, 0);
+    if (bc_connect(b, bc, bc->addr + 1) != 0) {
+        bc->addr = 0;
+        bc_fail(b, bc);
+    }
+}
+
+/*
+ * bc_deadline — When the connection's timer runs out: for a paced one,
+ * when it may try sending again.  A connect attempt is given up after
+ * HE_ATTEMPT_DELAY_MS while another address remains (as in tcp_connect,
+ * a silent address must not hold up the batch), after
+ * CONNECT_TIMEOUT_MS for the last one.  -1 if there is no timer.
+ */
+static long long bc_deadline(struct batch *b, struct batch_conn *bc)
+{
+    if (bc->sock != -1 && bc->state == BC_PACED) {
+        return bc->started;
+    }
+    if (bc->sock == -1 || bc->state != BC_CONNECTING) {
+        return -1;
+    }
+    return bc->started + ((bc->addr + 1 < b->c->dns.count)
+                              ? HE_ATTEMPT_DELAY_MS : CONNECT_TIMEOUT_MS);
+}
+
+/*
+ * bc_wait — Maps an SSL_ERROR_WANT_* result to the epoll event to wait
+ * for.  Returns 0 if the connection should wait, -1 if the error is real.
+ */
+static int bc_wait(struct batch *b, struct batch_conn *bc, int ret)
+{
+    switch (SSL_get_error(bc->ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+            bc_watch(b, bc, EPOLLIN, 0);
+            return 0;
+        case SSL_ERROR_WANT_WRITE:
+            bc_watch(b, bc, EPOLLOUT, 0);
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+/*
+ * bc_step — Advances the connection's state machine as far as it can go
+ * without blocking.
+ */
+static void bc_step(struct batch *b, struct batch_conn *bc)
+{
+    struct neuro_client *c = b->c;
+    int                  err;  /* pending socket error        */
+    socklen_t            elen; /* size of err                 */
+    int                  n;    /* SSL_* return value          */
+    int                  rc;   /* http_feed / http_eof result */
+    long long            wait; /* pacing delay, us            */
+
+    for (;;) {
+        switch (bc->state) {
+        case BC_CONNECTING:
+            err  = 0;
+            elen = sizeof(err);
+            getsockopt(bc->sock, SOL_SOCKET, SO_ERROR, &err, &elen);
+            if (err != 0) {
+                bc_next_addr(b, bc); /* unreachable */
+                return;
+            }
+            if (b->good == -1) {
+                b->good = bc->addr; /* moved to the front afterwards */
+            }
+            bc->t_mark = timing_since(&bc->t, NEURO_PHASE_CONNECT,
+                                      bc->t_start);
+            bc->ssl = SSL_new(c->ctx);
+            if (bc->ssl == NULL) {
+                bc_fail(b, bc);
+                return;
+            }
+            SSL_set_fd(bc->ssl, bc->sock);
+            SSL_set_tlsext_host_name(bc->ssl, c->host);
+            SSL_set_mode(bc->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                                  SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+            if (c->session != NULL) {
+                SSL_set_session(bc->ssl, c->session);
+            }
+            bc->state = BC_HANDSHAKE;
+            break;
+
+        case BC_HANDSHAKE:
+            n = SSL_connect(bc->ssl);
+            if (n != 1) {
+                if (bc_wait(b, bc, n) != 0) {
+                    bc_fail(b, bc);
+                }
+                return;
+            }
+            bc->t_mark = timing_since(&bc->t, NEURO_PHASE_TLS, bc->t_mark);
+            bc->state  = BC_WRITING;
+            break;
+
+        case BC_PACED:
+            /* Woken by an error or hang-up while waiting: start over on
+             * a new connection, without counting it as an attempt */
+            bc_close(b, bc, 0);
+            b->tries[bc->job]--;
+            b->retry[b->nretry++] = bc->job;
+            bc->reused = 0;
+            bc_open(b, bc);
+            return;
+
+        case BC_WRITING:
+            if (!bc->admitted) {
+                wait = rate_reserve(rate_cost(&bc->req));
+                if (wait > 0) {
+                    bc->state   = BC_PACED;
+                    bc->started = mono_ms() + (wait + 999) / 1000;
+                    bc_watch(b, bc, 0, 0); /* only the timer, until then */
+                    return;
+                }
+                bc->admitted = 1;
+            }
+            n = req_send(bc->ssl, &bc->req, &bc->sent);
+            if (n <= 0) {
+                if (bc_wait(b, bc, n) != 0) {
+                    bc_fail(b, bc);
+                }
+                return;
+            }
+            bc->state = BC_READING;
+            break;
+
+        case BC_READING:
+            n = SSL_read(bc->ssl, c->rbuf, (int)sizeof(c->rbuf));
+            if (n > 0) {
+                if (bc->received == 0) {
+                    bc->t_mark = timing_since(&bc->t, NEURO_PHASE_TTFB,
+                                              bc->t_mark);
+                }
+                bc->received += (size_t)n;
+                rc = http_feed(&bc->p, c->rbuf, (size_t)n);
+            } else if (bc_wait(b, bc, n) == 0) {
+                return; /* nothing more to read right now */
+            } else {
+                rc = http_eof(&bc->p, bc->ssl, n); /* done if EOF-framed */
+            }
+
+            if (rc < 0) {
+                bc_fail(b, bc);
+                return;
+            }
+            if (rc == 0) {
+                break; /* keep reading */
+            }
+
+            /* Response complete */
+            timing_since(&bc->t, NEURO_PHASE_TRANSFER, bc->t_mark);
+            rate_update(&bc->p);
+            if (retryable_status(bc->p.status) &&
+                b->tries[bc->job] <= c->retries) {
+                /* Try again later; without Retry-After, back off */
+                if (bc->p.retry_after_ms < 0.0) {
+                    rate_hold(retry_backoff_ms(c, b->tries[bc->job] - 1) *
+                              1000);
+                }
+                b->retry[b->nretry++] = bc->job;
+            } else {
+                bc_deliver(b, bc, 1);
+            }
+            bc->reused = 1;
+            if (!bc->p.keep_alive) {
+                bc_close(b, bc, 1);
+                bc->reused = 0;
+                bc_open(b, bc);
+                return;
+            }
+            if (bc_take_job(b, bc) != 0) {
+                bc_close(b, bc, 1); /* nothing left for this connection */
+                return;
+            }
+            if (!bc->req_ok) {
+                bc_fail(b, bc);
+                return;
+            }
+            bc->state = BC_WRITING;
+            break;
+        }
+    }
+}
+
+/*
+ * bc_timer — The connection's deadline (see bc_deadline) has passed.
+ */
+static void bc_timer(struct batch *b, struct batch_conn *bc)
+{
+    if (bc->state == BC_PACED) {
+        bc->state  = BC_WRITING;
+        bc->t_mark = mono_us(); /* waiting is not time to first byte */
+        bc_step(b, bc);
+        return;
+    }
+    bc_next_addr(b, bc); /* connect attempt overdue */
+}
+
+/*
+ * Over HTTP/2 the client's own connection carries the batch: each
+ * batch_conn is a stream slot instead of a connection, and up to
+ * 'concurrency' prompts are in flight at once (fewer if the server's
+ * SETTINGS say so), for one handshake in all.  A slot goes
+ *
+ *   [PACED →] WRITING → READING → (next prompt) … → IDLE
+ *
+ * where WRITING waits for the stream to be opened and READING is the
+ * stream open.  The one socket is driven with poll.
+ *
+ * When the connection is lost, a prompt that had no answer yet is sent
+ * again once, as after a stale keep-alive connection; a stream the
+ * server refused (REFUSED_STREAM, or above the last stream a GOAWAY
+ * accepted) never reached it and is retried like a 503.  A new connection
+ * is opened, and should it not be HTTP/2 the prompts left over go to the
+ * HTTP/1.1 connections.
+ */
+
+/*
+ * bh_next — Gives a stream slot its next prompt, or makes it idle.
+ */
+static void bh_next(struct batch *b, struct batch_conn *bc)
+{
+    while (bc_take_job(b, bc) == 0) {
+        if (bc->req_ok) {
+            bc->state = BC_WRITING;
+            return;
+        }
+        bc_deliver(b, bc, 0);
+    }
+    bc->state = BC_IDLE;
+}
+
+/*
+ * bh_open — Opens the slot's stream, unless the rate limiter says to
+ * wait (the slot is then PACED).  On a connection that has not yet
+ * answered ('fresh'), the job's timing gets its connect phases.
+ * Returns 0, or -1 if the connection takes no new stream for now.
+ */
+static int bh_open(struct batch *b, struct batch_conn *bc, int fresh)
+{
+    struct neuro_client  *c = b->c;
+    struct neuro_h2_chunk body[3];
+    long long             wait; /* pacing delay, us */
+    int                   i;
+
+    if (!neuro_h2_can_open(c->h2)) {
+        return -1;
+    }
+    if (!bc->admitted) {
+        wait = rate_reserve(rate_cost(&bc->req));
+        if (wait > 0) {
+            bc->state   = BC_PACED;
+            bc->started = mono_ms() + (wait + 999) / 1000;
+            return 0;
+        }
+        bc->admitted = 1;
+    }
+    memset(&bc->call, 0, sizeof(bc->call));
+    bc->call.p = &bc->p;
+    h2_body(&bc->req, body);
+    if (neuro_h2_request(c->h2, bc->req.block.data, bc->req.block.len,
+                         body, 3, &bc->call) < 0) {
+        return -1;
+    }
+    for (i = NEURO_PHASE_DNS; i <= NEURO_PHASE_TLS; i++) {
+        bc->t.ms[i] = fresh ? c->timing.ms[i] : -1.0;
+    }
+    bc->t.reused = !fresh;
+    bc->t_mark   = mono_us();
+    bc->state    = BC_READING;
+    return 0;
+}
+
+/*
+ * bh_done — The slot's stream has closed: delivers the answer, or puts
+ * the prompt back in the queue, and takes the next one.
+ * Returns 1 if an answer was complete, 0 otherwise.
+ */
+static int bh_done(struct batch *b, struct batch_conn *bc)
+{
+    struct neuro_client *c  = b->c;
+    int                  ok = bc->call.ended && bc->call.error == 0;
+
+    if (ok) {
+        timing_since(&bc->t, NEURO_PHASE_TRANSFER, bc->t_mark);
+        rate_update(&bc->p);
+        if (retryable_status(bc->p.status) &&
+            b->tries[bc->job] <= c->retries) {
+            if (bc->p.retry_after_ms < 0.0) {
+                rate_hold(retry_backoff_ms(c, b->tries[bc->job] - 1) * 1000);
+            }
+            b->retry[b->nretry++] = bc->job;
+        } else {
+            bc_deliver(b, bc, 1);
+        }
+    } else if (bc->call.error == NEURO_H2_REFUSED &&
+               b->tries[bc->job] <= c->retries) {
+        b->retry[b->nretry++] = bc->job; /* it never reached the server */
+    } else if (bc->call.error == NEURO_H2_LOST && bc->call.received == 0 &&
+               b->tries[bc->job] < 2) {
+        b->retry[b->nretry++] = bc->job;
+    } else {
+        bc_deliver(b, bc, 0);
+    }
+    bh_next(b, bc);
+    return ok;
+}
+
+/*
+ * batch_h2 — Runs the batch over the client's HTTP/2 connection with
+ * nslot stream slots.  'fresh' says the connection was just opened.
+ * Returns when every prompt has been delivered, or when the connection
+ * is lost and no HTTP/2 connection can replace it; the prompts not
+ * delivered are then back in the queue, and the connection, if any,
+ * is blocking again.
+ */
+static void batch_h2(struct batch *b, struct batch_conn *slots, size_t nslot,
+                     int fresh)
+{
+    struct neuro_client *c = b->c;
+    struct batch_conn   *bc;
+    struct pollfd        pfd;
+    size_t               i, k;
+    size_t               first;   /* slot to try opening first         */
+    size_t               after;   /* the one after the last opened     */
+    int                  n;       /* SSL_* result                      */
+    int                  err;     /* its SSL_get_error                 */
+    int                  writing; /* flushing waits for POLLOUT        */
+    int                  active;  /* streams open                      */
+    int                  lost;    /* the connection failed             */
+    long long            now, due, wait; /* mono_ms values; -1 = none  */
+    long long            heard;   /* last time the server sent bytes   */
+
+    for (i = 0; i < nslot; i++) {
+        bh_next(b, &slots[i]);
+    }
+    set_blocking(c->sock, 0);
+    SSL_set_mode(c->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                         SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    heard = mono_ms();
+    first = 0;
+    while (b->left > 0) {
+        if (c->h2 == NULL) { /* lost: open another connection */
+            client_drop_conn(c, 0);
+            timing_begin(c);
+            if (client_connect(c) != 0 || c->h2 == NULL) {
+                break;
+            }
+            set_blocking(c->sock, 0);
+            SSL_set_mode(c->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                                 SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+            fresh = 1;
+            heard = mono_ms();
+        }
+
+        /* Open what may be opened, taking the slots in turn so that none
+         * waits for ever when there are more than the server's limit of
+         * streams; note the nearest pacing deadline */
+        now    = mono_ms();
+        wait   = -1;
+        active = 0;
+        after  = first;
+        for (k = 0; k < nslot; k++) {
+            i  = (first + k) % nslot;
+            bc = &slots[i];
+            if (bc->state == BC_IDLE && b->nretry > 0) {
+                bh_next(b, bc);
+            }
+            if (bc->state == BC_PACED && bc->started <= now) {
+                bc->state = BC_WRITING;
+            }
+            if (bc->state == BC_WRITING) {
+                if (bh_open(b, bc, fresh) != 0 &&
+                    neuro_h2_streams(c->h2) == 0) {
+                    client_drop_conn(c, 1); /* GOAWAY: it takes no more */
+                    break;
+                }
+                if (bc->state == BC_READING) {
+                    after = (i + 1) % nslot;
+                }
+            }
+            if (bc->state == BC_PACED) {
+                due  = bc->started - now;
+                wait = (wait < 0 || due < wait) ? due : wait;
+            }
+            active += (bc->state == BC_READING);
+        }
+        first = after;
+        if (c->h2 == NULL || b->left == 0) {
+            continue;
+        }
+
+        lost    = 0;
+        writing = 0;
+        n = h2_flush(c->ssl, c->h2);
+        if (n != 1) {
+            err     = SSL_get_error(c->ssl, n);
+            writing = (err == SSL_ERROR_WANT_WRITE);
+            lost    = !writing && err != SSL_ERROR_WANT_READ;
+        }
+
+        /* Wait for the server, a pacing deadline, or the I/O timeout */
+        if (!lost && active > 0 && c->timeout_ms > 0) {
+            due = heard + c->timeout_ms - now;
+            if (due <= 0) {
+                lost = 1; /* the server went quiet */
+            }
+            wait = (wait < 0 || due < wait) ? due : wait;
+        }
+        if (!lost) {
+            pfd.fd      = c->sock;
+            pfd.events  = POLLIN | (writing ? POLLOUT : 0);
+            pfd.revents = 0;
+            poll(&pfd, 1, (int)wait);
+        }
+
+        /* Read and process all that has arrived */
+        while (!lost) {
+            n = SSL_read(c->ssl, c->rbuf, (int)sizeof(c->rbuf));
+            if (n <= 0) {
+                err  = SSL_get_error(c->ssl, n);
+                lost = err != SSL_ERROR_WANT_READ &&
+                       err != SSL_ERROR_WANT_WRITE;
+                break;
+            }
+            heard = mono_ms();
+            if (neuro_h2_feed(c->h2, c->rbuf, (size_t)n) < 0) {
+                h2_flush(c->ssl, c->h2); /* the GOAWAY saying why */
+                lost = 1;
+            }
+        }
+        if (lost) {
+            client_drop_conn(c, 0); /* closes the streams still open */
+        }
+        for (i = 0; i < nslot; i++) {
+            bc = &slots[i];
+            if (bc->state != BC_READING) {
+                continue;
+            }
+            if (bc->received == 0 && bc->call.received > 0) {
+                bc->t_mark = timing_since(&bc->t, NEURO_PHASE_TTFB,
+                                          bc->t_mark);
+            }
+            bc->received = bc->call.received;
+            if (bc->call.closed && bh_done(b, bc)) {
+                fresh = 0;
+            }
+        }
+    }
+
+    /* Prompts not sent go back to the queue, as they were */
+    for (i = 0; i < nslot; i++) {
+        bc = &slots[i];
+        if (bc->state == BC_WRITING || bc->state == BC_PACED) {
+            b->tries[bc->job]--;
+            b->retry[b->nretry++] = bc->job;
+        }
+        bc->state = BC_IDLE;
+    }
+    if (c->sock != -1) {
+        set_blocking(c->sock, 1);
+    }
+}
+
+/*
+ * batch_api_call — Runs the whole batch over up to 'concurrency'
+ * connections, or streams of one connection when the server speaks
+ * HTTP/2.  Returns 0 once every prompt has been delivered, -1 if the
+ * batch could not be set up at all (then nothing was delivered).
+ */
+static int batch_api_call(struct neuro_client *c, const char *api_key,
+                          const char *const *prompts, size_t n,
+                          int concurrency, neuro_batch_cb cb, void *user)
+{
+    struct batch         b;          /* batch bookkeeping         */
+    struct batch_conn   *conns;      /* the connections           */
+    struct epoll_event   evs[64];    /* ready events              */
+    size_t               nconn;      /* number of connections     */
+    size_t               i;
+    int                  k;
+    int                  ready;      /* events returned by epoll  */
+    long long            now;        /* mono_ms()                 */
+    long long            due;        /* a connect deadline        */
+    long long            wait;       /* epoll timeout, -1 = none  */
+    int                  fresh;      /* HTTP/2 connection is new  */
+
+    if (client_init(c) != 0) {
+        return -1;
+    }
+
+    memset(&b, 0, sizeof(b));
+    b.c       = c;
+    b.api_key = api_key;
+    b.prompts = prompts;
+    b.n       = n;
+    b.left    = n;
+    b.cb      = cb;
+    b.user    = user;
+    b.cache   = client_cache(c);
+    b.good    = -1;
+
+    nconn = (concurrency < 1) ? 1 : (size_t)concurrency;
+    if (nconn > n) {
+        nconn = n;
+    }
+
+    /* Resolve (or reuse the cached answer) once for the whole batch */
+    if (resolve(c) != 0) {
+        return -1;
+    }
+
+    b.retry = (size_t *)malloc(n * sizeof(size_t));
+    b.tries = (unsigned char *)calloc(n, 1);
+    conns   = (struct batch_conn *)calloc(nconn, sizeof(struct batch_conn));
+    b.epfd  = epoll_create1(0);
+    if (b.retry == NULL || b.tries == NULL || conns == NULL || b.epfd == -1) {
+        free(b.retry);
+        free(b.tries);
+        free(conns);
+        if (b.epfd != -1) {
+            close(b.epfd);
+        }
+        return -1;
+    }
+
+    for (i = 0; i < nconn; i++) {
+        conns[i].sock = -1;
+        conns[i].addr = 0;
+        conns[i].body = pool_get(c);
+        if (conns[i].body == NULL) {
+            nconn = i; /* run with the connections we could set up */
+            break;
+        }
+    }
+
+    /* Offering HTTP/2: the client's connection may carry everything */
+    if (c->http2 && nconn > 0) {
+        if (c->h2 != NULL && !neuro_h2_can_open(c->h2)) {
+            client_drop_conn(c, 1);
+        }
+        timing_begin(c);
+        fresh = (c->ssl == NULL);
+        if ((!fresh || client_connect(c) == 0) && c->h2 != NULL) {
+            batch_h2(&b, conns, nconn, fresh);
+        }
+    }
+    for (i = 0; i < nconn; i++) {
+        conns[i].reused = 0;
+        bc_open(&b, &conns[i]);
+    }
+
+    /* Event loop: drive whichever connections are ready, and give up on
+     * connect attempts that are overdue */
+    while (b.left > 0 && nconn > 0) {
+        wait = -1;
+        now  = mono_ms();
+        for (i = 0; i < nconn; i++) {
+            due = bc_deadline(&b, &conns[i]);
+            if (due == -1) {
+                continue;
+            }
+            due = (due > now) ? due - now : 0; /* time left */
+            if (wait == -1 || due < wait) {
+                wait = due;
+            }
+        }
+        ready = epoll_wait(b.epfd, evs, (int)(sizeof(evs) / sizeof(evs[0])),
+                           (int)wait);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (k = 0; k < ready; k++) {
+            bc_step(&b, (struct batch_conn *)evs[k].data.ptr);
+        }
+        now = mono_ms();
+        for (i = 0; i < nconn; i++) {
+            due = bc_deadline(&b, &conns[i]);
+            if (due != -1 && due <= now) {
+                bc_timer(&b, &conns[i]);
+            }
+        }
+    }
+
+    /* If the loop gave up early, report everything still outstanding */
+    for (i = 0; i < nconn; i++) {
+        if (conns[i].sock != -1) {
+            bc_close(&b, &conns[i], 0);
+            bc_deliver(&b, &conns[i], 0);
+        }
+        req_free(&conns[i].req);
+        dec_free(&conns[i].dec);
+        pool_put(c, conns[i].body);
+    }
+    while (b.nretry > 0) {
+        b.left--;
+        cb(b.retry[--b.nretry], NULL, user);
+    }
+    while (b.next < n) {
+        b.left--;
+        cb(b.next++, NULL, user);
+    }
+    if (b.good >= 0) {
+        dns_promote(&c->dns, b.good); /* later calls start there */
+    }
+    close(b.epfd);
+    free(conns);
+    free(b.retry);
+    free(b.tries);
+    return 0;
+}
+
+/* =========================================================================
+ * Client set-up (shared by neuro_client_new and the neuro_set_* functions)
+ * ====================================================================== */
+
+/*
+ * client_set_endpoint — Changes host and port.  A pooled connection and
+ * the saved session belong to the old endpoint and are dropped.
+ * Returns 0, or -1 if either is missing or too long.
+ */
+static int client_set_endpoint(struct neuro_client *c, const char *host,
+                               const char *port)
+{
+    if (host == NULL || port == NULL ||
+        strlen(host) >= sizeof(c->host) ||
+        strlen(port) >= sizeof(c->port)) {
+        return -1; /* missing or too long */
+    }
+
+    /* A pooled connection to the old endpoint is no longer useful */
+    client_drop_conn(c, 1);
+    if (c->session != NULL) {
+        SSL_SESSION_free(c->session);
+        c->session = NULL;
+    }
+
+    strcpy(c->host, host);
+    strcpy(c->port, port);
+    c->endpoint_env = 1; /* explicit setting overrides NEURO_API_HOST */
+    return 0;
+}
+
+/*
+ * client_set_cache — Replaces the response cache (NULL path = none).
+ * Returns 0, or -1 if the file cannot be opened as a cache.
+ */
+static int client_set_cache(struct neuro_client *c, const char *path,
+                            size_t max_bytes, long ttl_seconds)
+{
+    neuro_cache_close(c->cache);
+    c->cache     = NULL;
+    c->cache_env = 1; /* explicit setting overrides NEURO_CACHE */
+
+    if (path == NULL) {
+        return 0; /* caching switched off */
+    }
+    c->cache = neuro_cache_open(path, max_bytes, ttl_seconds);
+    return (c->cache != NULL) ? 0 : -1;
+}
+
+static int client_set_retry(struct neuro_client *c, int max_retries,
+                            long base_delay_ms, long max_delay_ms)
+{
+    if (max_retries < 0 || base_delay_ms < 0 || max_delay_ms < base_delay_ms) {
+        return -1;
+    }
+    c->retries       = max_retries;
+    c->retry_base_ms = base_delay_ms;
+    c->retry_cap_ms  = max_delay_ms;
+    return 0;
+}
+
+static int client_set_timeout(struct neuro_client *c, long timeout_ms)
+{
+    if (timeout_ms < 0) {
+        return -1;
+    }
+    c->timeout_ms = timeout_ms;
+    if (c->sock != -1) {
+        set_io_timeout(c->sock, timeout_ms); /* the pooled connection */
+    }
+    return 0;
+}
+
+static int client_set_hedge(struct neuro_client *c, long delay_ms)
+{
+    if (delay_ms < -1) {
+        return -1;
+    }
+    c->hedge_ms = delay_ms;
+    return 0;
+}
+
+/*
+ * client_set_http2 — Offers HTTP/2 or not from now on.  A pooled
+ * connection negotiated the other way is dropped.
+ */
+static void client_set_http2(struct neuro_client *c, int on)
+{
+    on = (on != 0);
+    if (on != c->http2) {
+        client_drop_conn(c, 1);
+    }
+    c->http2     = on;
+    c->http2_env = 1; /* explicit setting overrides NEURO_HTTP2 */
+}
+
+/*
+ * client_release — Closes the connection and frees everything the
+ * client allocated; its settings stay, so it can be used again.
+ */
+static void client_release(struct neuro_client *c)
+{
+    client_drop_conn(c, 1);
+    if (c->session != NULL) {
+        SSL_SESSION_free(c->session);
+        c->session = NULL;
+    }
+    if (c->ctx != NULL) {
+        SSL_CTX_free(c->ctx);
+        c->ctx = NULL;
+    }
+    neuro_cache_close(c->cache);
+    c->cache     = NULL;
+    c->cache_env = 0;
+    while (c->pool_len > 0) {
+        c->pool_len--;
+        free(c->pool[c->pool_len]->data);
+        free(c->pool[c->pool_len]);
+    }
+    req_free(&c->req);
+    dec_free(&c->dec);
+    jason_parser_free(&c->json);
+}
+
+/*
+ * client_api_key — The key to send: the one given in neuro_opts, else
+ * OPENAI_API_KEY.  NULL or "" means answer with the mock.
+ */
+static const char *client_api_key(const struct neuro_client *c)
+{
+    if (c->api_key != NULL) {
+        return c->api_key;
+    }
+    return getenv("OPENAI_API_KEY");
+}
+
+/*
+ * client_mock_stream — Streams the next mock answer one word at a time.
+ * Returns 0, or -1 if the callback stopped it.
+ */
+static int client_mock_stream(struct neuro_client *c, neuro_stream_cb cb,
+                              void *user)
+{
+    const char *text; /* mock answer being streamed                  */
+    size_t      word; /* length of the next word (with leading space) */
+
+    text = next_mock_content(&c->mock_index);
+    while (*text != '\0') {
+        word = strcspn(text + 1, " ") + 1;
+        if (cb(text, word, user) != 0) {
+            return -1; /* caller asked to stop */
+        }
+        text += word;
+    }
+    return 0;
+}
+
+/* =========================================================================
+ * Public functions — client handles
+ * ====================================================================== */
+
+void neuro_opts_init(struct neuro_opts *opts)
+{
+    memset(opts, 0, sizeof(*opts));
+    opts->retries       = RETRY_MAX;
+    opts->retry_base_ms = RETRY_BASE_MS;
+    opts->retry_max_ms  = RETRY_CAP_MS;
+    opts->timeout_ms    = IO_TIMEOUT_MS;
+    opts->hedge_ms      = -1;
+    opts->http2         = -1;
+}
+
+neuro_client *neuro_client_new(const struct neuro_opts *opts)
+{
+    struct neuro_client *c;    /* the new client             */
+    struct neuro_opts    defs; /* used when opts is NULL      */
+
+    if (opts == NULL) {
+        neuro_opts_init(&defs);
+        opts = &defs;
+    }
+
+    c = (struct neuro_client *)malloc(sizeof(*c));
+    if (c == NULL) {
+        return NULL;
+    }
+    *c = (struct neuro_client)CLIENT_DEFAULTS;
+
+    /* An endpoint given in part is completed from the environment */
+    client_endpoint_env(c);
+    if ((opts->host != NULL && strlen(opts->host) >= sizeof(c->host)) ||
+        (opts->port != NULL && strlen(opts->port) >= sizeof(c->port))) {
+        goto fail; /* too long */
+    }
+    if (opts->host != NULL) {
+        strcpy(c->host, opts->host);
+    }
+    if (opts->port != NULL) {
+        strcpy(c->port, opts->port);
+    }
+    if (client_set_retry(c, opts->retries, opts->retry_base_ms,
+                         opts->retry_max_ms) != 0 ||
+        client_set_timeout(c, opts->timeout_ms) != 0 ||
+        client_set_hedge(c, opts->hedge_ms) != 0) {
+        goto fail;
+    }
+    if (opts->http2 >= 0) {
+        client_set_http2(c, opts->http2);
+    }
+    if (opts->cache_path != NULL &&
+        client_set_cache(c, opts->cache_path, opts->cache_max_bytes,
+                         opts->cache_ttl_seconds) != 0) {
+        goto fail;
+    }
+    if (opts->api_key != NULL) {
+        c->api_key = (char *)malloc(strlen(opts->api_key) + 1);
+        if (c->api_key == NULL) {
+            goto fail;
+        }
+        strcpy(c->api_key, opts->api_key);
+    }
+    c->timing_cb   = opts->timing_cb;
+    c->timing_user = opts->timing_user;
+    return c;
+
+fail:
+    neuro_client_free(c);
+    return NULL;
+}
+
+void neuro_client_free(neuro_client *c)
+{
+    if (c == NULL) {
+        return;
+    }
+    client_release(c);
+    free(c->api_key);
+    free(c);
+}
+
+char *neuro_client_ask(neuro_client *c, const char *prompt)
+{
+    const char *api_key; /* from the options or OPENAI_API_KEY */
+
+    api_key = client_api_key(c);
+
+    if (api_key == NULL || api_key[0] == '\0') {
+        /* No API key — return the next mock response from the list */
+        return build_mock_json(next_mock_content(&c->mock_index));
+    }
+
+    /* API key is present — make a real HTTPS request */
+    return real_api_call(c, api_key, prompt);
+}
+
+int neuro_client_ask_stream(neuro_client *c, const char *prompt,
+                            neuro_stream_cb cb, void *user)
+{
+    const char *api_key; /* from the options or OPENAI_API_KEY */
+
+    api_key = client_api_key(c);
+
+    if (api_key == NULL || api_key[0] == '\0') {
+        /* No API key — stream the next mock answer one word at a time */
+        return client_mock_stream(c, cb, user);
+    }
+
+    return stream_api_call(c, api_key, prompt, NULL, cb, user);
+}
+
+int neuro_client_ask_batch(neuro_client *c, const char *const *prompts,
+                           size_t n, int concurrency,
+                           neuro_batch_cb cb, void *user)
+{
+    const char *api_key; /* from the options or OPENAI_API_KEY */
+    size_t      i;
+
+    if (n == 0) {
+        return 0;
+    }
+
+    api_key = client_api_key(c);
+
+    if (api_key == NULL || api_key[0] == '\0') {
+        /* No API key — mock answers are instant, so just go in order */
+        for (i = 0; i < n; i++) {
+            cb(i, build_mock_json(next_mock_content(&c->mock_index)), user);
+        }
+        return 0;
+    }
+
+    return batch_api_call(c, api_key, prompts, n, concurrency, cb, user);
+}
+
+int neuro_client_ask_conv(neuro_client *c, neuro_conv *conv,
+                          const char *prompt, neuro_stream_cb cb, void *user)
+{
+    const char *api_key; /* from the options or OPENAI_API_KEY */
+    int         rc;
+
+    if (conv_add(conv, 1, prompt, strlen(prompt)) != 0) {
+        return -1;
+    }
+    conv_trim(conv);
+
+    conv->answer.len = 0;
+    conv->cb         = cb;
+    conv->user       = user;
+    api_key = client_api_key(c);
+    if (api_key == NULL || api_key[0] == '\0') {
+        rc = client_mock_stream(c, conv_capture, conv);
+    } else {
+        rc = stream_api_call(c, api_key, prompt, conv, conv_capture, conv);
+    }
+
+    /* Keep the exchange only if the answer arrived complete */
+    if (rc != 0 ||
+        conv_add(conv, 0, conv->answer.data, conv->answer.len) != 0) {
+        conv_drop_last(conv);
+        return -1;
+    }
+    return 0;
+}
+
+int neuro_client_last_timing(const neuro_client *c, struct neuro_timing *t)
+{
+    if (!c->have_last) {
+        return -1;
+    }
+    *t = c->last;
+    return 0;
+}
+
+unsigned long neuro_client_timing_count(const neuro_client *c,
+                                        enum neuro_phase phase)
+{
+    if ((int)phase < 0 || phase >= NEURO_PHASE_COUNT) {
+        return 0;
+    }
+    return c->hist[phase].count;
+}
+
+double neuro_client_timing_percentile(const neuro_client *c,
+                                      enum neuro_phase phase, double pct)
+{
+    if ((int)phase < 0 || phase >= NEURO_PHASE_COUNT) {
+        return -1.0;
+    }
+    return hist_percentile(&c->hist[phase], pct);
+}
+
+void neuro_client_timing_reset(neuro_client *c)
+{
+    memset(c->hist, 0, sizeof(c->hist));
+    c->have_last = 0;
+}
+
+/* =========================================================================
+ * Public functions — the default client
+ *
+ * Each one holds client_lock for the whole call, so concurrent callers
+ * take turns on the one connection.
+ * ====================================================================== */
+
+int neuro_set_endpoint(const char *host, const char *port)
+{
+    int rc;
+
+    pthread_mutex_lock(&client_lock);
+    rc = client_set_endpoint(&client, host, port);
+    pthread_mutex_unlock(&client_lock);
+    return rc;
+}
+
+int neuro_set_cache(const char *path, size_t max_bytes, long ttl_seconds)
+{
+    int rc;
+
+    pthread_mutex_lock(&client_lock);
+    rc = client_set_cache(&client, path, max_bytes, ttl_seconds);
+    pthread_mutex_unlock(&client_lock);
+    return rc;
+}
+
+int neuro_set_retry(int max_retries, long base_delay_ms, long max_delay_ms)
+{
+    int rc;
+
+    pthread_mutex_lock(&client_lock);
+    rc = client_set_retry(&client, max_retries, base_delay_ms, max_delay_ms);
+    pthread_mutex_unlock(&client_lock);
+    return rc;
+}
+
+int neuro_set_timeout(long timeout_ms)
+{
+    int rc;
+
+    pthread_mutex_lock(&client_lock);
+    rc = client_set_timeout(&client, timeout_ms);
+    pthread_mutex_unlock(&client_lock);
+    return rc;
+}
+
+int neuro_set_hedge(long delay_ms)
+{
+    int rc;
+
+    pthread_mutex_lock(&client_lock);
+    rc = client_set_hedge(&client, delay_ms);
+    pthread_mutex_unlock(&client_lock);
+    return rc;
+}
+
+void neuro_set_http2(int on)
+{
+    pthread_mutex_lock(&client_lock);
+    client_set_http2(&client, on);
+    pthread_mutex_unlock(&client_lock);
+}
+
+void neuro_set_pacing(int on)
+{
+    pthread_mutex_lock(&limiter.lock);
+    limiter.off = !on;
+    pthread_mutex_unlock(&limiter.lock);
+}
+
+void neuro_set_timing_cb(neuro_timing_cb cb, void *user)
+{
+    pthread_mutex_lock(&client_lock);
+    client.timing_cb   = cb;
+    client.timing_user = user;
+    pthread_mutex_unlock(&client_lock);
+}
+
+int neuro_last_timing(struct neuro_timing *t)
+{
+    int rc;
+
+    pthread_mutex_lock(&client_lock);
+    rc = neuro_client_last_timing(&client, t);
+    pthread_mutex_unlock(&client_lock);
+    return rc;
+}
+
+unsigned long neuro_timing_count(enum neuro_phase phase)
+{
+    unsigned long n;
+
+    pthread_mutex_lock(&client_lock);
+    n = neuro_client_timing_count(&client, phase);
+    pthread_mutex_unlock(&client_lock);
+    return n;
+}
+
+double neuro_timing_percentile(enum neuro_phase phase, double pct)
+{
+    double ms;
+
+    pthread_mutex_lock(&client_lock);
+    ms = neuro_client_timing_percentile(&client, phase, pct);
+    pthread_mutex_unlock(&client_lock);
+    return ms;
+}
+
+const char *neuro_phase_name(enum neuro_phase phase)
+{
+    static const char *const names[NEURO_PHASE_COUNT] = {
+        "dns", "connect", "tls", "ttfb", "transfer", "total"
+    };
+
+    if ((int)phase < 0 || phase >= NEURO_PHASE_COUNT) {
+        return "?";
+    }
+    return names[phase];
+}
+
+void neuro_timing_reset(void)
+{
+    pthread_mutex_lock(&client_lock);
+    neuro_client_timing_reset(&client);
+    pthread_mutex_unlock(&client_lock);
+}
+
+void neuro_cleanup(void)
+{
+    pthread_mutex_lock(&client_lock);
+    client_release(&client);
+    pthread_mutex_unlock(&client_lock);
+}
+
+char *neuro_ask(const char *prompt)
+{
+    char *answer; /* JSON response, or NULL */
+
+    pthread_mutex_lock(&client_lock);
+    answer = neuro_client_ask(&client, prompt);
+    pthread_mutex_unlock(&client_lock);
+    return answer;
+}
+
+int neuro_ask_stream(const char *prompt, neuro_stream_cb cb, void *user)
+{
+    int rc;
+
+    pthread_mutex_lock(&client_lock);
+    rc = neuro_client_ask_stream(&client, prompt, cb, user);
+    pthread_mutex_unlock(&client_lock);
+    return rc;
+}
+
+int neuro_ask_batch(const char *const *prompts, size_t n, int concurrency,
+                    neuro_batch_cb cb, void *user)
+{
+    int rc;
+
+    pthread_mutex_lock(&client_lock);
+    rc = neuro_client_ask_batch(&client, prompts, n, concurrency, cb, user);
+    pthread_mutex_unlock(&client_lock);
+    return rc;
+}
+
+int neuro_ask_conv(neuro_conv *conv, const char *prompt, neuro_stream_cb cb,
+                   void *user)
+{
+    int rc;
+
+    pthread_mutex_lock(&client_lock);
+    rc = neuro_client_ask_conv(&client, conv, prompt, cb, user);
+    pthread_mutex_unlock(&client_lock);
+    return rc;
+}
+
+/* =========================================================================
+ * Public functions — conversations
+ * ====================================================================== */
+
+neuro_conv *neuro_conv_new(long max_tokens)
+{
+    neuro_conv *conv;
+
+    conv = (neuro_conv *)calloc(1, sizeof(*conv));
+    if (conv != NULL) {
+        conv->budget = (max_tokens > 0) ? max_tokens : CONV_BUDGET;
+    }
+    return conv;
+}
+
+void neuro_conv_free(neuro_conv *conv)
+{
+    if (conv == NULL) {
+        return;
+    }
+    free(conv->arena.data);
+    free(conv->turns);
+    free(conv->answer.data);
+    free(conv);
+}
+
+void neuro_conv_clear(neuro_conv *conv)
+{
+    conv->arena.len = 0;
+    conv->nturns    = 0;
+    conv->first     = 0;
+    conv->tokens    = 0;
+}
+
+size_t neuro_conv_messages(const neuro_conv *conv)
+{
+    return conv->nturns - conv->first;
+}
+
+long neuro_conv_tokens(const neuro_conv *conv)
+{
+    return conv->tokens;
+}
+
+/* =========================================================================
+ * Public functions — token counting
+ * ====================================================================== */
+
+size_t neuro_count_tokens(const char *text, size_t len)
+{
+    pthread_once(&tokenizer_once, tokenizer_env);
+    if (tokenizer == NULL) {
+        return (len + 3) / 4;
+    }
+    return neuro_tok_count(tokenizer, text, len);
+}
+
+int neuro_set_tokenizer(const char *path)
+{
+    struct neuro_tok *tok = NULL;
+
+    pthread_once(&tokenizer_once, tokenizer_env);
+    if (path != NULL) {
+        tok = neuro_tok_open(path);
+        if (tok == NULL) {
+            return -1;
+        }
+    }
+    neuro_tok_close(tokenizer);
+    tokenizer = tok;
+    return 0;
 }
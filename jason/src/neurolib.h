@@ -2,19 +2,30 @@
  * neurolib.h — Public interface for the AI query library.
  *
  * This library sends a text question to an AI service (OpenAI) over HTTPS
- * and returns the raw JSON response body.  If the OPENAI_API_KEY
+ * and returns the raw JSON response body.  The TLS connection is kept
+ * open between calls and reused.  If the OPENAI_API_KEY
  * environment variable is not set it returns a pre-canned JSON response
  * so that the program still behaves sensibly without a real API key.
  *
  * Compilation (together with jason.c):
  *   gcc -Wall -Wextra -Werror -pedantic -c neurolib.c
+ *   gcc -Wall -Wextra -Werror -pedantic -c neurocache.c
+ *   gcc -Wall -Wextra -Werror -pedantic -c neurotok.c
+ *   gcc -Wall -Wextra -Werror -pedantic -c neuroh2.c
+ *   gcc -Wall -Wextra -Werror -pedantic -c jasonlib.c
  *   gcc -Wall -Wextra -Werror -pedantic -c jason.c
- *   gcc -o jason neurolib.o jason.o -lssl -lcrypto
+ *   gcc -o jason neurolib.o neurocache.o neurotok.o neuroh2.o jasonlib.o \
+ *       jason.o -lssl -lcrypto -lz -pthread
+ * Answers compressed with gzip or deflate are inflated transparently.
+ * Add -DNEURO_BROTLI (and -lbrotlidec) for br, -DNEURO_ZSTD (and
+ * -lzstd) for zstd.
  */
 
 #ifndef NEUROLIB_H
 #define NEUROLIB_H
 
+#include <stddef.h> /* size_t */
+
 /*
  * neuro_ask — Query the AI service with a natural-language question.
  *
@@ -32,4 +43,431 @@
  */
 char *neuro_ask(const char *prompt);
 
+/*
+ * neuro_stream_cb — Receives one fragment of a streamed answer.
+ *
+ * Parameters:
+ *   text  fragment of the answer (UTF-8, NOT NUL-terminated).
+ *   len   number of bytes in text.
+ *   user  the pointer passed to neuro_ask_stream().
+ *
+ * Returns:
+ *   0 to continue, any other value to stop the stream.
+ */
+typedef int (*neuro_stream_cb)(const char *text, size_t len, void *user);
+
+/*
+ * neuro_ask_stream — Like neuro_ask(), but requests a streamed answer
+ * ("stream": true) and calls 'cb' with each piece of the assistant's
+ * text as soon as it arrives, instead of returning the whole JSON at
+ * the end.
+ *
+ * Returns:
+ *   0 once the answer is complete, -1 on a network, TLS or HTTP error
+ *   or if the callback stopped the stream.
+ *
+ * Environment:
+ *   Same as neuro_ask(); without a key the mock answer is streamed
+ *   word by word.
+ */
+int neuro_ask_stream(const char *prompt, neuro_stream_cb cb, void *user);
+
+/*
+ * neuro_batch_cb — Receives the answer to one prompt of a batch.
+ *
+ * Parameters:
+ *   index     position of the prompt in the array given to
+ *             neuro_ask_batch().
+ *   response  raw JSON response, or NULL if that request failed.  The
+ *             CALLBACK owns it and must free() it.
+ *   user      the pointer passed to neuro_ask_batch().
+ *
+ * Answers arrive in completion order, not in prompt order.
+ */
+typedef void (*neuro_batch_cb)(size_t index, char *response, void *user);
+
+/*
+ * neuro_ask_batch — Asks many questions concurrently.
+ *
+ * Up to 'concurrency' TLS connections are kept busy at once from a
+ * single thread (non-blocking sockets driven by epoll); each one sends
+ * its next prompt as soon as its previous answer is complete.  When the
+ * server speaks HTTP/2 (see neuro_set_http2), up to 'concurrency'
+ * prompts are sent at once as streams of a single connection instead.
+ *
+ * Parameters:
+ *   prompts      array of n NUL-terminated questions.
+ *   n            number of prompts.
+ *   concurrency  maximum number of simultaneous connections (>= 1).
+ *   cb, user     called exactly once per prompt.
+ *
+ * Returns:
+ *   0 once every prompt has been answered (or reported as failed), -1
+ *   if the batch could not be started at all.
+ */
+int neuro_ask_batch(const char *const *prompts, size_t n, int concurrency,
+                    neuro_batch_cb cb, void *user);
+
+/*
+ * neuro_conv — A conversation: the questions and answers so far, sent
+ * along with every new question so the service sees the context.
+ *
+ * Messages are stored already JSON-escaped, and a request sends them
+ * without copying, so the cost of a turn depends on the new message
+ * only.  Before each question the oldest exchanges are dropped until
+ * the size of the history (see neuro_count_tokens) fits the token
+ * budget; the new question itself is always sent.
+ */
+typedef struct neuro_conv neuro_conv;
+
+/*
+ * neuro_conv_new — Starts an empty conversation whose history may use up
+ * to max_tokens tokens (<= 0 selects the default, 8000).
+ * Returns NULL if out of memory.
+ */
+neuro_conv *neuro_conv_new(long max_tokens);
+
+/*
+ * neuro_conv_free — Frees a conversation.  NULL is ignored.
+ */
+void neuro_conv_free(neuro_conv *conv);
+
+/*
+ * neuro_conv_clear — Forgets every message; the budget stays.
+ */
+void neuro_conv_clear(neuro_conv *conv);
+
+/*
+ * neuro_conv_messages, neuro_conv_tokens — Number of messages kept, and
+ * their estimated size in tokens.  They are trimmed to the budget when
+ * the next question is asked.
+ */
+size_t neuro_conv_messages(const neuro_conv *conv);
+long neuro_conv_tokens(const neuro_conv *conv);
+
+/*
+ * neuro_ask_conv — Asks the next question of a conversation and streams
+ * the answer to 'cb', as neuro_ask_stream() does.  When the answer is
+ * complete, the question and the answer are added to the conversation;
+ * after a failure it is left as it was (apart from trimming).
+ * Conversations bypass the response cache.
+ *
+ * Returns:
+ *   0 once the answer is complete, -1 on any error or if the callback
+ *   stopped the stream.
+ */
+int neuro_ask_conv(neuro_conv *conv, const char *prompt, neuro_stream_cb cb,
+                   void *user);
+
+/*
+ * neuro_count_tokens — Number of tokens 'len' bytes of UTF-8 text use.
+ *
+ * Exact for the default model once its vocabulary is loaded (see
+ * neuro_set_tokenizer); otherwise the usual estimate of one token per
+ * four bytes.  Counting runs locally at tens of MB/s, so a prompt can be
+ * measured before it is sent, to trim or batch it.  Safe to call from
+ * several threads.
+ */
+size_t neuro_count_tokens(const char *text, size_t len);
+
+/*
+ * neuro_set_tokenizer — Loads a tiktoken vocabulary file for
+ * neuro_count_tokens(), e.g. o200k_base.tiktoken for the gpt-4o models.
+ * NULL unloads it.  Must not be called while other threads count.
+ *
+ * Returns:
+ *   0 on success, -1 if the file cannot be read or is not a vocabulary
+ *   (the previous one, if any, stays loaded).
+ *
+ * Environment:
+ *   Without this call, NEURO_TOKENIZER names the file, loaded on the
+ *   first count.
+ */
+int neuro_set_tokenizer(const char *path);
+
+/*
+ * neuro_set_endpoint — Points real requests at another HTTPS server,
+ * e.g. a local stand-in for testing.  The default is api.openai.com:443.
+ *
+ * Parameters:
+ *   host  hostname or address (also sent as SNI and in the Host header).
+ *   port  port number as a string, e.g. "8443".
+ *
+ * Returns:
+ *   0 on success, -1 if either argument is missing or too long.
+ *   Any pooled connection and saved TLS session are discarded.
+ *
+ * Environment:
+ *   Without this call, NEURO_API_HOST and NEURO_API_PORT are read on the
+ *   first real request.
+ */
+int neuro_set_endpoint(const char *host, const char *port);
+
+/*
+ * neuro_set_cache — Turns on the on-disk response cache for neuro_ask(),
+ * neuro_ask_stream() and neuro_ask_batch().
+ *
+ * Requests are keyed by a hash of the model and the exact request body;
+ * a repeated request is answered from the cache file without any network
+ * traffic (neuro_ask_stream delivers a cached answer as one fragment).
+ * Only successful (2xx) answers are stored.  The file may be shared by
+ * several processes.
+ *
+ * Parameters:
+ *   path         cache file (created if missing), or NULL to turn the
+ *                cache off.
+ *   max_bytes    size bound; least recently used entries are evicted
+ *                beyond it.  0 selects the default (64 MB).
+ *   ttl_seconds  entry lifetime; 0 means entries never expire.
+ *
+ * Returns:
+ *   0 on success, -1 if the file cannot be opened as a cache.
+ *
+ * Environment:
+ *   Without this call, NEURO_CACHE (path), NEURO_CACHE_MAX_MB and
+ *   NEURO_CACHE_TTL are read on the first real request.
+ */
+int neuro_set_cache(const char *path, size_t max_bytes, long ttl_seconds);
+
+/*
+ * neuro_set_retry — Controls how neuro_ask() and neuro_ask_stream()
+ * retry.  A request is tried again after a network or TLS failure, a
+ * timeout, or a 408, 429, 500, 502, 503 or 504 answer; a stream only
+ * while none of its text has reached the callback.  Before retry number
+ * k (from 0) the client sleeps a random time between zero and
+ * base_delay_ms * 2^k, at most max_delay_ms.
+ *
+ * Parameters:
+ *   max_retries    retries after the first attempt (0 = none; default 2).
+ *   base_delay_ms  backoff bound for the first retry (default 250).
+ *   max_delay_ms   largest backoff bound (default 8000).
+ *
+ * Returns:
+ *   0 on success, -1 if a value is negative or max < base.
+ */
+int neuro_set_retry(int max_retries, long base_delay_ms, long max_delay_ms);
+
+/*
+ * neuro_set_timeout — Fails an attempt when the server accepts or sends
+ * nothing for timeout_ms milliseconds (0 = wait forever; default 60000).
+ * A timed-out attempt is retried like any other failure.
+ *
+ * Returns:
+ *   0 on success, -1 if timeout_ms is negative.
+ */
+int neuro_set_timeout(long timeout_ms);
+
+/*
+ * neuro_set_hedge — Hedged requests: when no response byte has arrived
+ * after a delay, the same request is also sent on a second connection
+ * and the first answer wins; the slower connection is closed.  This
+ * trims the latency tail at the price of occasional duplicate work on
+ * the server (which may bill for it).
+ *
+ * Parameters:
+ *   delay_ms  -1 turns hedging off (the default); 0 uses the p95 of the
+ *             time to first byte seen so far (once there are 20
+ *             samples); a positive value is a fixed delay.
+ *
+ * Returns:
+ *   0 on success, -1 if delay_ms is below -1.
+ */
+int neuro_set_hedge(long delay_ms);
+
+/*
+ * neuro_set_http2 — Offers HTTP/2 as well as HTTP/1.1 when connecting
+ * (on), or HTTP/1.1 only (off, the default).  The server chooses during
+ * the TLS handshake (ALPN), so one without HTTP/2 is still talked to
+ * over HTTP/1.1.
+ *
+ * Over HTTP/2 every request is a stream of one connection:
+ * neuro_ask_batch sends its prompts side by side on it instead of
+ * opening a connection (and a handshake) for each, and the other calls
+ * reuse it as they would a keep-alive connection.  Hedging (see
+ * neuro_set_hedge) is for HTTP/1.1 only.
+ *
+ * Environment:
+ *   Without this call, NEURO_HTTP2=1 turns it on at the first real
+ *   request.
+ */
+void neuro_set_http2(int on);
+
+/*
+ * neuro_set_pacing — Turns the rate limiter on (the default) or off.
+ *
+ * The library reads the x-ratelimit-limit-*, x-ratelimit-remaining-* and
+ * x-ratelimit-reset-* headers (for requests and tokens) of every answer,
+ * and Retry-After / retry-after-ms.  From them it keeps two token buckets
+ * that refill at 90% of the rate the server allows.  Each request, in
+ * every mode and every thread of the process, waits for its share
+ * before it is sent, and a Retry-After holds all of them back until it
+ * has passed.  Limits the server never mentions are not paced.
+ */
+void neuro_set_pacing(int on);
+
+/*
+ * Phases of a real request, in the order they happen.  Timestamps come
+ * from the monotonic clock.
+ */
+enum neuro_phase {
+    NEURO_PHASE_DNS,      /* name resolution                              */
+    NEURO_PHASE_CONNECT,  /* TCP connect (all Happy Eyeballs attempts)    */
+    NEURO_PHASE_TLS,      /* TLS handshake                                */
+    NEURO_PHASE_TTFB,     /* request write until the first response byte  */
+    NEURO_PHASE_TRANSFER, /* first response byte until the end            */
+    NEURO_PHASE_TOTAL,    /* the whole call                               */
+    NEURO_PHASE_COUNT
+};
+
+/*
+ * Latency breakdown of one request.  A phase that did not happen has a
+ * negative value: DNS when the resolver cache answered, connect and TLS
+ * on a kept-alive connection, everything but the total on a cache hit.
+ */
+struct neuro_timing {
+    double ms[NEURO_PHASE_COUNT]; /* duration of each phase, milliseconds */
+    int    reused;                /* sent over a kept-alive connection    */
+    int    cached;                /* answered from the response cache     */
+};
+
+/*
+ * neuro_timing_cb — Receives the breakdown of each successful real
+ * request (neuro_ask, neuro_ask_stream, and every prompt of
+ * neuro_ask_batch).  The struct is only valid during the call.
+ */
+typedef void (*neuro_timing_cb)(const struct neuro_timing *t, void *user);
+
+/*
+ * neuro_set_timing_cb — Installs (or, with NULL, removes) the timing
+ * callback.
+ */
+void neuro_set_timing_cb(neuro_timing_cb cb, void *user);
+
+/*
+ * neuro_last_timing — Copies the breakdown of the most recent successful
+ * real request into *t.  Returns 0, or -1 if there has been none.
+ */
+int neuro_last_timing(struct neuro_timing *t);
+
+/*
+ * neuro_timing_count — Number of samples recorded for a phase since the
+ * start (or the last neuro_timing_reset).
+ */
+unsigned long neuro_timing_count(enum neuro_phase phase);
+
+/*
+ * neuro_timing_percentile — Latency of a phase at percentile 'pct'
+ * (0-100; 100 gives the maximum), from a log-linear histogram with
+ * about 1.6% resolution.  Returns milliseconds, or -1 with no samples.
+ */
+double neuro_timing_percentile(enum neuro_phase phase, double pct);
+
+/*
+ * neuro_phase_name — Short lower-case name of a phase ("dns", "tls", ...).
+ */
+const char *neuro_phase_name(enum neuro_phase phase);
+
+/*
+ * neuro_timing_reset — Empties the histograms.
+ */
+void neuro_timing_reset(void);
+
+/*
+ * neuro_cleanup — Closes the pooled connection and frees the TLS
+ * context kept between neuro_ask() calls.  Optional; call it once
+ * before exiting.  The library may be used again afterwards.
+ */
+void neuro_cleanup(void);
+
+/* -------------------------------------------------------------------------
+ * Client handles
+ *
+ * The functions above all share one default client, which a mutex keeps
+ * consistent when several threads call them: the calls simply take
+ * turns.  A callback must not call back into the library's default
+ * client (it would wait for itself).
+ *
+ * A neuro_client is an independent client with its own TLS context,
+ * keep-alive connection, buffers, resolver and response caches,
+ * settings and latency statistics.  Separate handles can be used from
+ * separate threads at the same time without any locking; one handle
+ * must only be used by one thread at a time.  The rate limiter (see
+ * neuro_set_pacing) is shared by all of them, since the server's limits
+ * apply to the whole process.
+ * ---------------------------------------------------------------------- */
+
+typedef struct neuro_client neuro_client;
+
+/*
+ * Settings of a new client.  Fill in the defaults with neuro_opts_init()
+ * and change what you need; the meaning of each value is the same as for
+ * the neuro_set_* function of the same name.
+ */
+struct neuro_opts {
+    const char     *host;          /* NULL = NEURO_API_HOST or api.openai.com */
+    const char     *port;          /* NULL = NEURO_API_PORT or "443"          */
+    const char     *api_key;       /* NULL = OPENAI_API_KEY; "" = mock        */
+    const char     *cache_path;    /* NULL = NEURO_CACHE                      */
+    size_t          cache_max_bytes;   /* see neuro_set_cache                 */
+    long            cache_ttl_seconds; /* see neuro_set_cache                 */
+    int             retries;       /* see neuro_set_retry                     */
+    long            retry_base_ms;
+    long            retry_max_ms;
+    long            timeout_ms;    /* see neuro_set_timeout                   */
+    long            hedge_ms;      /* see neuro_set_hedge                     */
+    int             http2;         /* see neuro_set_http2; -1 = NEURO_HTTP2   */
+    neuro_timing_cb timing_cb;     /* see neuro_set_timing_cb                 */
+    void           *timing_user;
+};
+
+/*
+ * neuro_opts_init — Fills *opts with the defaults used by neuro_ask().
+ */
+void neuro_opts_init(struct neuro_opts *opts);
+
+/*
+ * neuro_client_new — Creates a client.  Strings in opts are copied;
+ * NULL opts means all defaults.  Nothing is connected until the first
+ * request.
+ *
+ * Returns:
+ *   The new client, or NULL if out of memory, a setting is out of range
+ *   or the cache file cannot be opened.
+ */
+neuro_client *neuro_client_new(const struct neuro_opts *opts);
+
+/*
+ * neuro_client_free — Closes the client's connection and frees it.
+ * NULL is ignored.
+ */
+void neuro_client_free(neuro_client *c);
+
+/*
+ * neuro_client_ask, neuro_client_ask_stream, neuro_client_ask_batch,
+ * neuro_client_ask_conv — Same as neuro_ask(), neuro_ask_stream(),
+ * neuro_ask_batch() and neuro_ask_conv(), on the given client.  A
+ * conversation is not tied to a client, but must not be used by two
+ * threads at once.
+ */
+char *neuro_client_ask(neuro_client *c, const char *prompt);
+int neuro_client_ask_stream(neuro_client *c, const char *prompt,
+                            neuro_stream_cb cb, void *user);
+int neuro_client_ask_batch(neuro_client *c, const char *const *prompts,
+                           size_t n, int concurrency,
+                           neuro_batch_cb cb, void *user);
+int neuro_client_ask_conv(neuro_client *c, neuro_conv *conv,
+                          const char *prompt, neuro_stream_cb cb, void *user);
+
+/*
+ * neuro_client_last_timing, neuro_client_timing_count,
+ * neuro_client_timing_percentile, neuro_client_timing_reset — The latency
+ * statistics of one client; see the functions without "client_".
+ */
+int neuro_client_last_timing(const neuro_client *c, struct neuro_timing *t);
+unsigned long neuro_client_timing_count(const neuro_client *c,
+                                        enum neuro_phase phase);
+double neuro_client_timing_percentile(const neuro_client *c,
+                                      enum neuro_phase phase, double pct);
+void neuro_client_timing_reset(neuro_client *c);
+
 #endif /* NEUROLIB_H */
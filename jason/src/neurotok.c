@@ -0,0 +1,838 @@
+/*
+ * neurotok.c — Implementation of the byte-pair-encoding tokenizer.
+ *
+ * Vocabulary file (tiktoken format, as published for o200k_base):
+ *
+ *   <base64 of the token bytes> <rank>\n
+ *
+ * Every line is decoded once at load time, and the tokens are indexed
+ * by an open-addressing table (linear probing, load factor at most 1/2).
+ * Tokens of up to 8 bytes, most of the vocabulary, are stored packed in
+ * their slot, so a lookup is one cache line and a word compare; longer
+ * ones keep a 64-bit hash in the slot and their bytes in a pool.  A
+ * separate 64K-entry table gives the rank of every two-byte string
+ * directly, for the first step of each merge.
+ *
+ * Counting happens in two steps, both without allocating for ordinary
+ * text:
+ *
+ *   1. The text is split into pieces with the o200k_base pattern,
+ *
+ *        [^\r\n\p{L}\p{N}]?[\p{Lu}\p{Lt}\p{Lm}\p{Lo}\p{M}]*
+ *                          [\p{Ll}\p{Lm}\p{Lo}\p{M}]+('s|'t|'re|...)?
+ *      | [^\r\n\p{L}\p{N}]?[\p{Lu}\p{Lt}\p{Lm}\p{Lo}\p{M}]+
+ *                          [\p{Ll}\p{Lm}\p{Lo}\p{M}]*('s|'t|'re|...)?
+ *      | \p{N}{1,3}
+ *      |  ?[^\s\p{L}\p{N}]+[\r\n/]*
+ *      | \s*[\r\n]+
+ *      | \s+(?!\S)
+ *      | \s+
+ *
+ *      hand-compiled into tok_piece() below; the alternatives are tried
+ *      in order, with the same backtracking a regex engine would do.
+ *
+ *   2. A piece that is a token by itself (most words) counts as one.
+ *      Otherwise it starts as single bytes, and the adjacent pair whose
+ *      concatenation has the lowest rank is merged until no pair is in
+ *      the vocabulary.  The candidate pairs sit in a binary heap ordered
+ *      by (rank, position), so ties go to the leftmost pair as in
+ *      tiktoken, and a merge costs O(log n) instead of a rescan of the
+ *      piece.  Heap entries made stale by a merge are skipped when
+ *      popped.
+ */
+
+/* MAP_* need the BSD/default feature set on glibc */
+#define _DEFAULT_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include "neurotok.h"
+
+#include <stdlib.h>     /* malloc, calloc, free                         */
+#include <string.h>     /* memcpy, memcmp                               */
+#include <stdint.h>     /* uint32_t, uint64_t                           */
+
+#include <fcntl.h>      /* open                                         */
+#include <unistd.h>     /* close                                        */
+#include <sys/mman.h>   /* mmap, munmap                                 */
+#include <sys/stat.h>   /* fstat                                        */
+
+/* -------------------------------------------------------------------------
+ * Constants and structures
+ * ---------------------------------------------------------------------- */
+
+#define TOK_NONE  UINT32_MAX /* rank of a byte string not in the vocabulary */
+#define TOK_STACK 128        /* pieces up to this long merge on the stack   */
+
+/*
+ * One index slot.  A token of up to 8 bytes is kept in the slot itself,
+ * so looking it up touches a single cache line; a longer one keeps its
+ * hash there and its bytes in the pool.  len == 0 marks an empty slot
+ * (no token is empty).
+ */
+struct tok_slot {
+    uint64_t key;  /* tok_key(): the packed bytes, or the hash     */
+    uint32_t len;  /* token length in bytes                        */
+    uint32_t rank; /* merge priority; lower merges first           */
+};
+
+struct neuro_tok {
+    unsigned char   *pool;  /* bytes of the tokens longer than 8        */
+    uint32_t        *offs;  /* per slot: a long token's place in pool   */
+    struct tok_slot *slots; /* open-addressing table (linear probing)   */
+    size_t           mask;  /* number of slots - 1 (power of two)       */
+    uint32_t        *pairs; /* rank of every two-byte string, by value  */
+};
+
+/* A candidate merge: the adjacent parts spanning [start, end).  The heap
+ * orders by key = rank << 32 | start, so ties go to the leftmost pair. */
+struct tok_pair {
+    uint64_t key;
+    uint32_t end;
+};
+
+/* Character classes of the split pattern, as bits so a test of several
+ * classes is one AND */
+enum {
+    C_UPPER  = 1,  /* Lu, Lt: only in the first letter class         */
+    C_LOWER  = 2,  /* Ll: only in the second letter class            */
+    C_LETTER = 4,  /* Lm, Lo, M: in both letter classes              */
+    C_NUM    = 8,  /* \p{N}                                          */
+    C_SPACE  = 16, /* \s other than \r and \n                        */
+    C_NL     = 32, /* \r, \n                                         */
+    C_PUNCT  = 64  /* everything else                                */
+};
+
+#define C_ALPHA (C_UPPER | C_LOWER | C_LETTER)
+#define C_FIRST (C_UPPER | C_LETTER)  /* [\p{Lu}\p{Lt}\p{Lm}\p{Lo}\p{M}] */
+#define C_REST  (C_LOWER | C_LETTER)  /* [\p{Ll}\p{Lm}\p{Lo}\p{M}]       */
+#define C_WHITE (C_SPACE | C_NL)      /* \s                              */
+
+/* Classes of the ASCII characters */
+#define U C_UPPER
+#define L C_LOWER
+#define N C_NUM
+#define S C_SPACE
+#define R C_NL
+#define X C_PUNCT
+static const unsigned char ascii_class[128] = {
+    X, X, X, X, X, X, X, X, X, S, R, S, S, R, X, X, /* \t \n \v \f \r   */
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,
+    S, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, /* space !"#...    */
+    N, N, N, N, N, N, N, N, N, N, X, X, X, X, X, X, /* 0-9 :;<=>?      */
+    X, U, U, U, U, U, U, U, U, U, U, U, U, U, U, U, /* @ A-O           */
+    U, U, U, U, U, U, U, U, U, U, U, X, X, X, X, X, /* P-Z [\]^_       */
+    X, L, L, L, L, L, L, L, L, L, L, L, L, L, L, L, /* ` a-o           */
+    L, L, L, L, L, L, L, L, L, L, L, X, X, X, X, X  /* p-z {|}~ DEL    */
+};
+#undef U
+#undef L
+#undef N
+#undef S
+#undef R
+#undef X
+
+/* -------------------------------------------------------------------------
+ * Index
+ * ---------------------------------------------------------------------- */
+
+/*
+ * tok_word — Up to 8 bytes packed into a word, differently for every
+ * string of a given length: read whole, as two overlapping halves, or
+ * as the first, middle and last byte.
+ */
+static uint64_t tok_word(const unsigned char *s, size_t len)
+{
+    uint64_t w;
+    uint32_t lo, hi;
+
+    if (len == 8) {
+        memcpy(&w, s, 8);
+        return w;
+    }
+    if (len >= 4) {
+        memcpy(&lo, s, 4);
+        memcpy(&hi, s + len - 4, 4);
+        return ((uint64_t)hi << 32) | lo;
+    }
+    return ((uint64_t)s[0] << 16) | ((uint64_t)s[len / 2] << 8) | s[len - 1];
+}
+
+/* Multiply-xorshift step of the hash */
+static uint64_t tok_mix(uint64_t h)
+{
+    h *= 0xFF51AFD7ED558CCDULL;
+    return h ^ (h >> 32);
+}
+
+/*
+ * tok_key — Key of a byte string: tok_word() itself up to 8 bytes,
+ * else a 64-bit hash of all of it.
+ */
+static uint64_t tok_key(const unsigned char *s, size_t len)
+{
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ (uint64_t)len;
+    uint64_t w;
+
+    if (len <= 8) {
+        return tok_word(s, len);
+    }
+    while (len > 8) {
+        memcpy(&w, s, 8);
+        h    = tok_mix(h ^ w);
+        s   += 8;
+        len -= 8;
+    }
+    return tok_mix(h ^ tok_word(s, len));
+}
+
+/*
+ * tok_slot_for — Returns the slot holding the token s[0..len), or the
+ * empty slot where it would go.
+ */
+static struct tok_slot *tok_slot_for(const struct neuro_tok *t,
+                                     const unsigned char *s, size_t len)
+{
+    uint64_t key = tok_key(s, len);
+    size_t   i   = (size_t)tok_mix(key ^ (uint64_t)len * 0xC4CEB9FE1A85EC53ULL)
+                   & t->mask;
+
+    while (t->slots[i].len != 0) {
+        if (t->slots[i].key == key && t->slots[i].len == len &&
+            (len <= 8 || memcmp(t->pool + t->offs[i], s, len) == 0)) {
+            break;
+        }
+        i = (i + 1) & t->mask;
+    }
+    return &t->slots[i];
+}
+
+/* tok_rank — Rank of s[0..len), or TOK_NONE */
+static uint32_t tok_rank(const struct neuro_tok *t, const unsigned char *s,
+                         size_t len)
+{
+    const struct tok_slot *slot = tok_slot_for(t, s, len);
+
+    return (slot->len != 0) ? slot->rank : TOK_NONE;
+}
+
+/* -------------------------------------------------------------------------
+ * Loading
+ * ---------------------------------------------------------------------- */
+
+/* Value of a base64 digit, or -1 */
+static int b64_value(unsigned char c)
+{
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+/*
+ * b64_decode — Decodes s[0..len) (padded with '=') into out.
+ * Returns the number of bytes written, or 0 if s is not base64.
+ */
+static size_t b64_decode(const unsigned char *s, size_t len,
+                         unsigned char *out)
+{
+    uint32_t acc  = 0; /* bits not yet written */
+    int      bits = 0;
+    size_t   n    = 0;
+    size_t   i;
+    int      v;
+
+    while (len > 0 && s[len - 1] == '=') {
+        len--;
+    }
+    for (i = 0; i < len; i++) {
+        v = b64_value(s[i]);
+        if (v < 0) {
+            return 0;
+        }
+        acc   = (acc << 6) | (uint32_t)v;
+        bits += 6;
+        if (bits >= 8) {
+            bits  -= 8;
+            out[n++] = (unsigned char)(acc >> bits);
+        }
+    }
+    return n;
+}
+
+/*
+ * tok_parse — Adds every line of the mapped file to the table.
+ * Returns 0 on success, -1 on a malformed line.
+ */
+static int tok_parse(struct neuro_tok *t, const unsigned char *p,
+                     const unsigned char *end)
+{
+    const unsigned char *b64;  /* start of the token on this line */
+    struct tok_slot     *slot;
+    size_t               used = 0; /* bytes of the pool filled */
+    size_t               len;
+    uint64_t             rank;
+
+    while (p < end) {
+        if (*p == '\n') { /* blank line */
+            p++;
+            continue;
+        }
+        b64 = p;
+        while (p < end && *p != ' ') {
+            p++;
+        }
+        len = b64_decode(b64, (size_t)(p - b64), t->pool + used);
+        if (len == 0 || p == end) {
+            return -1;
+        }
+        p++; /* the space */
+        rank = 0;
+        if (p == end || *p < '0' || *p > '9') {
+            return -1;
+        }
+        while (p < end && *p >= '0' && *p <= '9') {
+            rank = rank * 10 + (uint64_t)(*p++ - '0');
+            if (rank >= TOK_NONE) {
+                return -1;
+            }
+        }
+        if (p < end && *p == '\r') {
+            p++;
+        }
+        if (p < end && *p++ != '\n') {
+            return -1;
+        }
+
+        slot = tok_slot_for(t, t->pool + used, len);
+        if (slot->len == 0) { /* a repeated token keeps its first rank */
+            slot->key  = tok_key(t->pool + used, len);
+            slot->len  = (uint32_t)len;
+            slot->rank = (uint32_t)rank;
+            if (len > 8) {
+                t->offs[slot - t->slots] = (uint32_t)used;
+                used += len;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * tok_pairs — Fills the direct table of two-byte tokens, which every
+ * merge starts by looking up.  Returns 0 on success, -1 if out of memory.
+ */
+static int tok_pairs(struct neuro_tok *t)
+{
+    const struct tok_slot *slot;
+    size_t                 i;
+
+    t->pairs = (uint32_t *)malloc(65536 * sizeof(uint32_t));
+    if (t->pairs == NULL) {
+        return -1;
+    }
+    for (i = 0; i < 65536; i++) {
+        t->pairs[i] = TOK_NONE;
+    }
+    for (i = 0; i <= t->mask; i++) {
+        slot = &t->slots[i];
+        if (slot->len == 2) { /* key = first << 16 | second << 8 | second */
+            t->pairs[slot->key >> 8] = slot->rank;
+        }
+    }
+    return 0;
+}
+
+struct neuro_tok *neuro_tok_open(const char *path)
+{
+    struct neuro_tok    *t;
+    struct stat          st;
+    const unsigned char *map;
+    size_t               lines = 0;
+    size_t               cap;
+    size_t               i;
+    int                  fd;
+    int                  rc;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size <= 0 ||
+        (uint64_t)st.st_size >= TOK_NONE) {
+        close(fd);
+        return NULL;
+    }
+    map = (const unsigned char *)mmap(NULL, (size_t)st.st_size, PROT_READ,
+                                      MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    /* Size the table for the number of lines: at most half full */
+    for (i = 0; i < (size_t)st.st_size; i++) {
+        lines += (map[i] == '\n');
+    }
+    for (cap = 1024; cap < 2 * (lines + 1); cap *= 2) {
+    }
+
+    rc = -1;
+    t  = (struct neuro_tok *)calloc(1, sizeof(*t));
+    if (t != NULL) {
+        /* base64 is 4/3 of the bytes it encodes, so the file's size is
+         * plenty for the pool */
+        t->pool  = (unsigned char *)malloc((size_t)st.st_size);
+        t->slots = (struct tok_slot *)calloc(cap, sizeof(struct tok_slot));
+        t->offs  = (uint32_t *)malloc(cap * sizeof(uint32_t));
+        t->mask  = cap - 1;
+        if (t->pool != NULL && t->slots != NULL && t->offs != NULL) {
+            rc = tok_parse(t, map, map + st.st_size);
+        }
+        if (rc == 0) {
+            rc = tok_pairs(t);
+        }
+    }
+    munmap((void *)map, (size_t)st.st_size);
+
+    if (rc != 0) {
+        neuro_tok_close(t);
+        return NULL;
+    }
+    return t;
+}
+
+void neuro_tok_close(struct neuro_tok *tok)
+{
+    if (tok != NULL) {
+        free(tok->pool);
+        free(tok->slots);
+        free(tok->offs);
+        free(tok->pairs);
+        free(tok);
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * Character classes
+ * ---------------------------------------------------------------------- */
+
+/*
+ * class_of — Class of a code point above 0x7F.  Exact for Latin-1,
+ * Greek, Cyrillic and the common punctuation, space and symbol blocks;
+ * everything else in the letter-heavy planes counts as a caseless letter
+ * (right for CJK, kana, Arabic, Indic and most other scripts).
+ */
+static int class_of(uint32_t cp)
+{
+    /* Unicode White_Space */
+    if (cp == 0x85 || cp == 0xA0 || cp == 0x1680 ||
+        (cp >= 0x2000 && cp <= 0x200A) || cp == 0x2028 || cp == 0x2029 ||
+        cp == 0x202F || cp == 0x205F || cp == 0x3000) {
+        return C_SPACE;
+    }
+
+    if (cp < 0x100) {                              /* Latin-1 */
+        if (cp < 0xA0) return C_PUNCT;             /* C1 controls */
+        if (cp == 0xAA || cp == 0xBA) return C_LETTER;
+        if (cp == 0xB5) return C_LOWER;
+        if (cp == 0xB2 || cp == 0xB3 || cp == 0xB9 ||
+            (cp >= 0xBC && cp <= 0xBE)) return C_NUM;
+        if (cp < 0xC0 || cp == 0xD7 || cp == 0xF7) return C_PUNCT;
+        return (cp < 0xDF) ? C_UPPER : C_LOWER;
+    }
+    if (cp < 0x180) {                              /* Latin Extended-A */
+        if (cp == 0x138 || cp == 0x149 || cp == 0x17F) return C_LOWER;
+        if (cp == 0x178) return C_UPPER;
+        if ((cp >= 0x139 && cp <= 0x148) || cp >= 0x179) {
+            return (cp & 1) ? C_UPPER : C_LOWER;
+        }
+        return (cp & 1) ? C_LOWER : C_UPPER;
+    }
+    if (cp < 0x250) return C_LETTER;               /* Latin Extended-B */
+    if (cp < 0x2B0) return C_LOWER;                /* IPA */
+    if (cp < 0x370) return C_LETTER;               /* modifiers, marks */
+    if (cp < 0x400) {                              /* Greek */
+        if (cp == 0x386 || (cp >= 0x388 && cp <= 0x38F) ||
+            (cp >= 0x391 && cp <= 0x3AB)) return C_UPPER;
+        if (cp >= 0x3AC && cp <= 0x3CE) return C_LOWER;
+        if (cp == 0x37E || cp == 0x387) return C_PUNCT;
+        return C_LETTER;
+    }
+    if (cp < 0x530) {                              /* Cyrillic */
+        if (cp < 0x430) return C_UPPER;
+        if (cp < 0x460) return C_LOWER;
+        if (cp >= 0x482 && cp <= 0x489) return C_PUNCT;
+        return (cp & 1) ? C_LOWER : C_UPPER;
+    }
+    if (cp >= 0x531 && cp <= 0x556) return C_UPPER; /* Armenian */
+    if (cp >= 0x561 && cp <= 0x587) return C_LOWER;
+
+    /* Digits of other scripts and number forms */
+    if ((cp >= 0x660 && cp <= 0x669) || (cp >= 0x6F0 && cp <= 0x6F9) ||
+        (cp >= 0x966 && cp <= 0x96F) || cp == 0x2070 ||
+        (cp >= 0x2074 && cp <= 0x2079) || (cp >= 0x2080 && cp <= 0x2089) ||
+        (cp >= 0x2150 && cp <= 0x2189) || (cp >= 0x2460 && cp <= 0x249B) ||
+        (cp >= 0x24EA && cp <= 0x24FF) || (cp >= 0x2776 && cp <= 0x2793) ||
+        cp == 0x3007 || (cp >= 0x3021 && cp <= 0x3029) ||
+        (cp >= 0xFF10 && cp <= 0xFF19)) {
+        return C_NUM;
+    }
+
+    /* Punctuation and symbols */
+    if (cp == 0x60C || cp == 0x61B || cp == 0x61F ||
+        (cp >= 0x66A && cp <= 0x66D) || cp == 0x6D4 ||
+        cp == 0x964 || cp == 0x965 ||
+        (cp >= 0x2000 && cp <= 0x2BFF) ||          /* punctuation .. arrows */
+        (cp >= 0x2E00 && cp <= 0x2E7F) ||
+        (cp >= 0x3001 && cp <= 0x303F && cp != 0x3005 && cp != 0x3006 &&
+         !(cp >= 0x3031 && cp <= 0x3035) && cp != 0x303B && cp != 0x303C) ||
+        cp == 0x30A0 || cp == 0x30FB || cp == 0x309B || cp == 0x309C ||
+        (cp >= 0xE000 && cp <= 0xF8FF) ||          /* private use */
+        (cp >= 0xFE10 && cp <= 0xFE6F) ||
+        (cp >= 0xFF01 && cp <= 0xFF20) || (cp >= 0xFF3B && cp <= 0xFF40) ||
+        (cp >= 0xFF5B && cp <= 0xFF65) || cp == 0xFEFF ||
+        (cp >= 0x1F000 && cp <= 0x1FAFF) ||        /* emoji, symbols */
+        (cp >= 0xE0000 && cp <= 0xE007F)) {        /* tags */
+        return C_PUNCT;
+    }
+    if (cp >= 0x1E00 && cp <= 0x1EFF) {             /* Latin Ext. Additional */
+        if (cp >= 0x1E96 && cp <= 0x1E9F) return C_LETTER;
+        return (cp & 1) ? C_LOWER : C_UPPER;
+    }
+    if (cp >= 0x2C00 && cp <= 0x2C2F) return C_UPPER; /* Glagolitic */
+    if (cp >= 0xFF21 && cp <= 0xFF3A) return C_UPPER; /* fullwidth A-Z */
+    if (cp >= 0xFF41 && cp <= 0xFF5A) return C_LOWER; /* fullwidth a-z */
+    return C_LETTER;
+}
+
+/*
+ * class_utf8 — Class of the non-ASCII character at s[i] and its length
+ * in *n.  A byte that does not start valid UTF-8 is a one-byte C_PUNCT.
+ */
+static int class_utf8(const unsigned char *s, size_t len, size_t i,
+                      size_t *n)
+{
+    unsigned char c = s[i];
+    uint32_t      cp;
+    size_t        k, need;
+
+    if (c >= 0xC2 && c <= 0xDF) {
+        need = 1;
+        cp   = c & 0x1F;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        need = 2;
+        cp   = c & 0x0F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        need = 3;
+        cp   = c & 0x07;
+    } else {
+        *n = 1;
+        return C_PUNCT;
+    }
+    if (i + need >= len) {
+        *n = 1;
+        return C_PUNCT;
+    }
+    for (k = 1; k <= need; k++) {
+        if ((s[i + k] & 0xC0) != 0x80) {
+            *n = 1;
+            return C_PUNCT;
+        }
+        cp = (cp << 6) | (s[i + k] & 0x3F);
+    }
+    if ((need == 2 && (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF))) ||
+        (need == 3 && (cp < 0x10000 || cp > 0x10FFFF))) {
+        *n = 1;
+        return C_PUNCT;
+    }
+    *n = need + 1;
+    return class_of(cp);
+}
+
+/* class_at — The same, with ASCII (nearly all of most text) kept short
+ * enough for the compiler to inline */
+static int class_at(const unsigned char *s, size_t len, size_t i, size_t *n)
+{
+    if (s[i] < 0x80) {
+        *n = 1;
+        return ascii_class[s[i]];
+    }
+    return class_utf8(s, len, i, n);
+}
+
+/* -------------------------------------------------------------------------
+ * Splitting
+ * ---------------------------------------------------------------------- */
+
+/*
+ * contraction — Length of a ('s|'t|'re|'ve|'m|'ll|'d), matched without
+ * regard to case, at s[i], or 0.
+ */
+static size_t contraction(const unsigned char *s, size_t len, size_t i)
+{
+    int a, b;
+
+    if (i + 1 >= len || s[i] != '\'') {
+        return 0;
+    }
+    a = s[i + 1] | 0x20;
+    if (a == 's' || a == 't' || a == 'm' || a == 'd') {
+        return 2;
+    }
+    if (i + 2 >= len) {
+        return 0;
+    }
+    b = s[i + 2] | 0x20;
+    return ((a == 'r' && b == 'e') || (a == 'v' && b == 'e') ||
+            (a == 'l' && b == 'l')) ? 3 : 0;
+}
+
+/*
+ * tok_piece — End of the piece that starts at s[i] (i < len).
+ */
+static size_t tok_piece(const unsigned char *s, size_t len, size_t i)
+{
+    size_t n, m;     /* character lengths                          */
+    size_t j;        /* start of the letters                       */
+    size_t k;        /* end of the run of first-class letters      */
+    size_t back;     /* last caseless letter in that run, or SIZE_MAX */
+    size_t e, last;
+    int    c, d;
+
+    c = class_at(s, len, i, &n);
+
+    /* 1 and 2: an optional non-letter, non-digit, non-newline, then
+     * letters.  With a letter after the prefix one of the two always
+     * matches. */
+    j = i;
+    if (!(c & (C_ALPHA | C_NUM | C_NL)) && i + n < len &&
+        (class_at(s, len, i + n, &m) & C_ALPHA)) {
+        j = i + n;
+        c = class_at(s, len, j, &n);
+    }
+    if (c & C_ALPHA) {
+        /* [first]* greedily, remembering where it could back off to */
+        back = SIZE_MAX;
+        for (k = j; k < len; k += n) {
+            d = class_at(s, len, k, &n);
+            if (!(d & C_FIRST)) {
+                break;
+            }
+            if (d & C_LETTER) {
+                back = k;
+            }
+        }
+        if (k < len && (class_at(s, len, k, &n) & C_LOWER)) {
+            e = k;              /* 1: [rest]+ from the end of the run */
+        } else if (back != SIZE_MAX) {
+            e = back;           /* 1: back off to a caseless letter */
+        } else {
+            e = k;              /* 2: [first]+ then [rest]* (empty) */
+        }
+        while (e < len && (class_at(s, len, e, &n) & C_REST)) {
+            e += n;
+        }
+        return e + contraction(s, len, e);
+    }
+
+    /* 3: up to three digits */
+    if (c & C_NUM) {
+        e = i + n;
+        for (k = 1; k < 3 && e < len && (class_at(s, len, e, &n) & C_NUM);
+             k++) {
+            e += n;
+        }
+        return e;
+    }
+
+    /* 4: an optional space, punctuation, then newlines and slashes */
+    j = i;
+    if (s[i] == ' ' && i + 1 < len &&
+        (class_at(s, len, i + 1, &m) & C_PUNCT)) {
+        j = i + 1;
+        c = C_PUNCT;
+    }
+    if (c & C_PUNCT) {
+        for (e = j; e < len && (class_at(s, len, e, &n) & C_PUNCT); e += n) {
+        }
+        while (e < len && (s[e] == '\r' || s[e] == '\n' || s[e] == '/')) {
+            e++;
+        }
+        return e;
+    }
+
+    /* 5, 6 and 7: whitespace.  Up to the last newline in the run if it
+     * has one; else the whole run at the end of the text; else all but
+     * its last character, which goes with the word after it. */
+    last = SIZE_MAX;
+    k    = i;
+    for (e = i; e < len && (class_at(s, len, e, &n) & C_WHITE); e += n) {
+        if (s[e] == '\n' || s[e] == '\r') {
+            last = e + 1;
+        }
+        k = e;
+    }
+    if (last != SIZE_MAX) {
+        return last;
+    }
+    if (e == len || k == i) {
+        return e;
+    }
+    return k;
+}
+
+/* -------------------------------------------------------------------------
+ * Merging
+ * ---------------------------------------------------------------------- */
+
+static void heap_push(struct tok_pair *h, size_t *n, struct tok_pair p)
+{
+    size_t i = (*n)++;
+
+    while (i > 0 && p.key < h[(i - 1) / 2].key) {
+        h[i] = h[(i - 1) / 2];
+        i    = (i - 1) / 2;
+    }
+    h[i] = p;
+}
+
+static struct tok_pair heap_pop(struct tok_pair *h, size_t *n)
+{
+    struct tok_pair top  = h[0];
+    struct tok_pair last = h[--(*n)];
+    size_t          i    = 0;
+    size_t          c;
+
+    while ((c = 2 * i + 1) < *n) {
+        if (c + 1 < *n && h[c + 1].key < h[c].key) {
+            c++;
+        }
+        if (h[c].key >= last.key) {
+            break;
+        }
+        h[i] = h[c];
+        i    = c;
+    }
+    h[i] = last;
+    return top;
+}
+
+/* pair_push — Queues the merge of s[start..end) if it is a token */
+static void pair_push(struct tok_pair *h, size_t *n, uint32_t rank,
+                      size_t start, size_t end)
+{
+    struct tok_pair p;
+
+    if (rank != TOK_NONE) {
+        p.key = ((uint64_t)rank << 32) | start;
+        p.end = (uint32_t)end;
+        heap_push(h, n, p);
+    }
+}
+
+/*
+ * tok_merge — Tokens in the piece s[0..n), n >= 2, not itself a token.
+ * 'end[i]' is the end of the part that starts at byte i (0 once the part
+ * has been merged into the one before it), 'prev[i]' the start of the
+ * part before it.  'heap' has room for 3n entries: n - 1 initial pairs
+ * and at most two new ones per merge.
+ */
+static size_t tok_merge(const struct neuro_tok *t, const unsigned char *s,
+                        size_t n, uint32_t *end, uint32_t *prev,
+                        struct tok_pair *heap)
+{
+    struct tok_pair p;
+    size_t          hn    = 0;
+    size_t          parts = n;
+    size_t          i;
+    uint32_t        start, mid, next;
+
+    for (i = 0; i < n; i++) {
+        end[i]  = (uint32_t)(i + 1);
+        prev[i] = (uint32_t)(i - 1); /* unused for i == 0 */
+    }
+    for (i = 0; i + 1 < n; i++) {
+        pair_push(heap, &hn, t->pairs[(s[i] << 8) | s[i + 1]], i, i + 2);
+    }
+
+    while (hn > 0) {
+        p     = heap_pop(heap, &hn);
+        start = (uint32_t)p.key;
+
+        /* Still two adjacent parts spanning exactly [start, end)? */
+        mid = end[start];
+        if (mid == 0 || mid >= n || end[mid] != p.end) {
+            continue;
+        }
+        end[start] = p.end;
+        end[mid]   = 0;
+        parts--;
+
+        /* The new part's pairs with its neighbours */
+        if (start > 0) {
+            i = prev[start];
+            pair_push(heap, &hn, tok_rank(t, s + i, p.end - i), i, p.end);
+        }
+        if (p.end < n) {
+            prev[p.end] = start;
+            next        = end[p.end];
+            pair_push(heap, &hn, tok_rank(t, s + start, next - start),
+                      start, next);
+        }
+    }
+    return parts;
+}
+
+/*
+ * tok_bpe — Tokens in one piece.
+ */
+static size_t tok_bpe(const struct neuro_tok *t, const unsigned char *s,
+                      size_t n)
+{
+    uint32_t         end[TOK_STACK];
+    uint32_t         prev[TOK_STACK];
+    struct tok_pair  heap[3 * TOK_STACK];
+    uint32_t        *big;  /* end and prev for a long piece  */
+    struct tok_pair *bigh; /* heap for a long piece          */
+    size_t           count;
+
+    if (n == 1 || tok_rank(t, s, n) != TOK_NONE) {
+        return 1;
+    }
+    if (n <= TOK_STACK) {
+        return tok_merge(t, s, n, end, prev, heap);
+    }
+    if (n >= UINT32_MAX / 4) {
+        return (n + 3) / 4; /* positions would not fit: estimate */
+    }
+
+    big  = (uint32_t *)malloc(2 * n * sizeof(uint32_t));
+    bigh = (struct tok_pair *)malloc(3 * n * sizeof(struct tok_pair));
+    if (big == NULL || bigh == NULL) {
+        free(big);
+        free(bigh);
+        return (n + 3) / 4; /* out of memory: estimate */
+    }
+    count = tok_merge(t, s, n, big, big + n, bigh);
+    free(big);
+    free(bigh);
+    return count;
+}
+
+size_t neuro_tok_count(const struct neuro_tok *tok, const char *text,
+                       size_t len)
+{
+    const unsigned char *s     = (const unsigned char *)text;
+    size_t               count = 0;
+    size_t               i     = 0;
+    size_t               e;
+
+    while (i < len) {
+        e      = tok_piece(s, len, i);
+        count += tok_bpe(tok, s + i, e - i);
+        i      = e;
+    }
+    return count;
+}
@@ -0,0 +1,50 @@
+/*
+ * neurotok.h — Byte-pair-encoding tokenizer used by neurolib to count
+ * tokens locally.
+ *
+ * The vocabulary is a tiktoken file: one token per line, its bytes in
+ * base64 followed by a space and its rank (e.g. o200k_base.tiktoken, the
+ * vocabulary of the gpt-4o models).  The file is memory-mapped once to
+ * build an in-memory open-addressing table from token bytes to rank;
+ * after that the tokenizer is read-only and may be shared by threads.
+ *
+ * Text is split into pieces the way the o200k_base pattern splits it
+ * (words with their leading space, runs of up to three digits,
+ * punctuation, whitespace), and each piece is merged by rank with a
+ * priority queue.  Outside ASCII the character classes come from a small
+ * table of ranges, so counts for rarer scripts can be off by a token or
+ * two.
+ *
+ * Compilation: built together with neurolib.c (see neurolib.h).
+ */
+
+#ifndef NEUROTOK_H
+#define NEUROTOK_H
+
+#include <stddef.h> /* size_t */
+
+/* Opaque tokenizer handle */
+struct neuro_tok;
+
+/*
+ * neuro_tok_open — Loads the vocabulary file at 'path'.
+ *
+ * Returns:
+ *   A handle, or NULL if the file cannot be read or is not a tiktoken
+ *   vocabulary.
+ */
+struct neuro_tok *neuro_tok_open(const char *path);
+
+/*
+ * neuro_tok_close — Frees the tokenizer (NULL is ok).
+ */
+void neuro_tok_close(struct neuro_tok *tok);
+
+/*
+ * neuro_tok_count — Counts the tokens of 'len' bytes of UTF-8 text.
+ * Invalid UTF-8 is counted byte by byte rather than rejected.
+ */
+size_t neuro_tok_count(const struct neuro_tok *tok, const char *text,
+                       size_t len);
+
+#endif /* NEUROTOK_H */
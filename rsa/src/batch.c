@@ -0,0 +1,380 @@
+/*
+ * batch.c — Encryption or decryption of a stream of messages (see
+ * batch.h).
+ *
+ * Compilation: built together with rsa.c (see rsa.c), with -pthread.
+ */
+
+#include <ctype.h>   /* isdigit, isspace                    */
+#include <pthread.h> /* pthread_create, pthread_cond_wait    */
+#include <stdlib.h>  /* calloc, free                         */
+#include <string.h>  /* memchr, memcpy, memset               */
+
+#include "batch.h"
+
+/* Lines per block: enough to keep a worker busy between two locks */
+#define BLOCK_LINES 64
+
+/*
+ * Longest line kept, with its NUL: the digits of any struct bn and some
+ * blanks.  A longer line cannot hold a message smaller than N, leading
+ * zeros aside, and counts as too big.
+ */
+#define TEXT_MAX (BN_DEC_MAX + 30)
+
+/* Bytes read from the input at a time */
+#define READ_SIZE 65536
+
+/* Most worker threads */
+#define MAX_WORKERS 64
+
+/* One message, from its line to its result */
+struct slot {
+    long line;               /* line number in the input           */
+    int  status;             /* BATCH_OK, or why it failed         */
+    char text[TEXT_MAX];     /* the line                           */
+    char out[BN_DEC_MAX];    /* the result in decimal, if BATCH_OK */
+};
+
+/* A block of messages, processed by one worker at a time */
+struct block {
+    int         count;               /* slots in use           */
+    int         done;                /* the worker has finished */
+    struct slot slots[BLOCK_LINES];
+};
+
+/*
+ * The ring of blocks and the workers' queue.  Block number i (counting
+ * from the start of the input) lives in ring[i % size]; the workers
+ * take blocks in that order, and the main thread fills block i only
+ * once block i − size has been written out.
+ */
+struct pool {
+    const struct rsa_key *key;
+    int                   decrypt;
+    struct block         *ring;
+    int                   size;
+    pthread_mutex_t       lock;   /* guards the fields below          */
+    pthread_cond_t        work;   /* a block was filled, or quit set  */
+    pthread_cond_t        done;   /* a block was finished             */
+    long                  filled; /* blocks handed to the workers     */
+    long                  taken;  /* blocks taken by a worker         */
+    int                   quit;   /* no more blocks will be filled    */
+};
+
+/* The input, read in large pieces and cut into lines */
+struct reader {
+    FILE  *in;
+    char   buf[READ_SIZE];
+    size_t pos, len;  /* unread bytes are buf[pos] to buf[len - 1] */
+    long   line;      /* lines read                                */
+};
+
+/* -------------------------------------------------------------------------
+ * read_line — Copies the next line of the input, without its newline,
+ * into 'text' and sets 'over' if it had to be cut to TEXT_MAX − 1
+ * bytes.  Returns 0 at the end of the input.  Each piece of the buffer
+ * is searched with memchr and copied with memcpy, not a byte at a time.
+ * ---------------------------------------------------------------------- */
+static int read_line(struct reader *r, char *text, int *over)
+{
+    const char *nl;
+    size_t      n = 0, take, room;
+    int         any = 0;
+
+    *over = 0;
+    for (;;) {
+        if (r->pos == r->len) {
+            r->pos = 0;
+            r->len = fread(r->buf, 1, sizeof r->buf, r->in);
+            if (r->len == 0) {
+                break; /* end of input, maybe in an unterminated line */
+            }
+        }
+        any  = 1;
+        nl   = memchr(r->buf + r->pos, '\n', r->len - r->pos);
+        take = nl ? (size_t)(nl - (r->buf + r->pos)) : r->len - r->pos;
+        room = TEXT_MAX - 1 - n;
+        if (take > room) {
+            *over = 1;
+        }
+        memcpy(text + n, r->buf + r->pos, take < room ? take : room);
+        n      += take < room ? take : room;
+        r->pos += take;
+        if (nl != NULL) {
+            r->pos++;
+            break;
+        }
+    }
+    if (!any) {
+        return 0;
+    }
+    text[n] = '\0';
+    r->line++;
+    return 1;
+}
+
+/*
+ * blank — 1 if 's' holds only white space.
+ */
+static int blank(const char *s)
+{
+    while (isspace((unsigned char)*s)) {
+        s++;
+    }
+    return *s == '\0';
+}
+
+/* -------------------------------------------------------------------------
+ * fill_block — Reads up to BLOCK_LINES messages into 'b', skipping
+ * blank lines.  Returns how many.
+ * ---------------------------------------------------------------------- */
+static int fill_block(struct reader *r, struct block *b)
+{
+    struct slot *s;
+    int          over;
+
+    b->count = 0;
+    b->done  = 0;
+    while (b->count < BLOCK_LINES) {
+        s = &b->slots[b->count];
+        if (!read_line(r, s->text, &over)) {
+            break;
+        }
+        if (!over && blank(s->text)) {
+            continue;
+        }
+        s->line   = r->line;
+        s->status = over ? BATCH_TOO_BIG : BATCH_OK;
+        b->count++;
+    }
+    return b->count;
+}
+
+/* -------------------------------------------------------------------------
+ * parse_message — A line as a message: optional blanks, an optional
+ * sign, decimal digits and optional blanks (a '\r' included).  Returns
+ * BATCH_OK with the value in 'm', or BATCH_INVALID, BATCH_NEGATIVE or
+ * BATCH_TOO_BIG.  "-0" is zero, as for a single message.
+ *
+ * Up to 19 significant digits, the common case, are accumulated in one
+ * limb directly; longer numbers go through bn_from_dec, NUL-terminated
+ * in place.
+ * ---------------------------------------------------------------------- */
+static int parse_message(char *s, struct bn *m)
+{
+    char     *digits;
+    size_t    len, i;
+    uint64_t  v = 0;
+    int       neg = 0;
+
+    while (isspace((unsigned char)*s)) {
+        s++;
+    }
+    if (*s == '+' || *s == '-') {
+        neg = (*s == '-');
+        s++;
+    }
+    while (s[0] == '0' && isdigit((unsigned char)s[1])) {
+        s++; /* leading zeros, but not the last digit */
+    }
+    digits = s;
+    while (isdigit((unsigned char)*s)) {
+        s++;
+    }
+    len = (size_t)(s - digits);
+    while (isspace((unsigned char)*s)) {
+        s++;
+    }
+    if (len == 0 || *s != '\0') {
+        return BATCH_INVALID;
+    }
+    if (len == 1 && digits[0] == '0') {
+        bn_zero(m);
+        return BATCH_OK;
+    }
+    if (neg) {
+        return BATCH_NEGATIVE;
+    }
+
+    if (len <= 19) {
+        for (i = 0; i < len; i++) {
+            v = v * 10 + (uint64_t)(digits[i] - '0');
+        }
+        bn_set_u64(m, v);
+        return BATCH_OK;
+    }
+    digits[len] = '\0';
+    return bn_from_dec(m, digits) == 0 ? BATCH_OK : BATCH_TOO_BIG;
+}
+
+/* -------------------------------------------------------------------------
+ * run_slot — Parses, encrypts or decrypts, and converts one message.
+ * ---------------------------------------------------------------------- */
+static void run_slot(const struct pool *p, struct slot *s)
+{
+    struct bn m, r;
+
+    if (s->status == BATCH_OK) {
+        s->status = parse_message(s->text, &m);
+    }
+    if (s->status == BATCH_OK && bn_cmp(&m, &p->key->n) >= 0) {
+        s->status = BATCH_TOO_BIG;
+    }
+    if (s->status != BATCH_OK) {
+        return;
+    }
+    if (!p->decrypt) {
+        rsa_encrypt(p->key, &r, &m);
+    } else if (rsa_decrypt(p->key, &r, &m) < 0) {
+        s->status = BATCH_FAULT;
+        return;
+    }
+    bn_to_dec(&r, s->out);
+}
+
+/* -------------------------------------------------------------------------
+ * worker — Takes the oldest unprocessed block, runs its messages and
+ * marks it done, until the main thread quits and nothing is left.
+ * ---------------------------------------------------------------------- */
+static void *worker(void *arg)
+{
+    struct pool  *p = arg;
+    struct block *b;
+    int           i;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (p->taken == p->filled && !p->quit) {
+            pthread_cond_wait(&p->work, &p->lock);
+        }
+        if (p->taken == p->filled) {
+            break;
+        }
+        b = &p->ring[p->taken++ % p->size];
+        pthread_mutex_unlock(&p->lock);
+
+        for (i = 0; i < b->count; i++) {
+            run_slot(p, &b->slots[i]);
+        }
+
+        pthread_mutex_lock(&p->lock);
+        b->done = 1;
+        pthread_cond_broadcast(&p->done);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------
+ * write_block — Waits for block number 'i' and writes its results up
+ * to the first failed message.  Returns BATCH_OK or that failure.
+ * ---------------------------------------------------------------------- */
+static int write_block(struct pool *p, long i, FILE *out,
+                       struct batch_stats *st)
+{
+    struct block *b = &p->ring[i % p->size];
+    int           j;
+
+    pthread_mutex_lock(&p->lock);
+    while (!b->done) {
+        pthread_cond_wait(&p->done, &p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    for (j = 0; j < b->count; j++) {
+        if (b->slots[j].status != BATCH_OK) {
+            st->line = b->slots[j].line;
+            return b->slots[j].status;
+        }
+        fputs(b->slots[j].out, out);
+        putc('\n', out);
+        st->messages++;
+    }
+    return ferror(out) ? BATCH_SYSTEM : BATCH_OK;
+}
+
+/* -------------------------------------------------------------------------
+ * rsa_batch — The main thread reads block after block as long as the
+ * ring has room, and otherwise writes out the oldest block, which frees
+ * its place.  On a failure it withdraws the blocks no worker has taken
+ * yet, and the workers finish the ones they have.
+ * ---------------------------------------------------------------------- */
+int rsa_batch(const struct rsa_key *k, int decrypt, FILE *in, FILE *out,
+              int threads, struct batch_stats *st)
+{
+    pthread_t      tid[MAX_WORKERS];
+    struct pool    p;
+    struct reader *r;
+    long           written = 0;
+    int            i, started = 0, rc = BATCH_OK;
+
+    st->messages = 0;
+    st->line     = 0;
+    if (threads > MAX_WORKERS) {
+        threads = MAX_WORKERS;
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    memset(&p, 0, sizeof p);
+    p.key     = k;
+    p.decrypt = decrypt;
+    p.size    = 2 * threads + 2; /* one in work per thread, and more read */
+    p.ring    = calloc((size_t)p.size, sizeof *p.ring);
+    r         = calloc(1, sizeof *r);
+    if (p.ring == NULL || r == NULL) {
+        free(p.ring);
+        free(r);
+        return BATCH_SYSTEM;
+    }
+    r->in = in;
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.work, NULL);
+    pthread_cond_init(&p.done, NULL);
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&tid[started], NULL, worker, &p) == 0) {
+            started++;
+        }
+    }
+    if (started == 0) {
+        rc = BATCH_SYSTEM;
+    }
+
+    while (rc == BATCH_OK) {
+        if (p.filled - written == p.size) {
+            rc = write_block(&p, written++, out, st);
+            continue;
+        }
+        if (fill_block(r, &p.ring[p.filled % p.size]) == 0) {
+            break;
+        }
+        pthread_mutex_lock(&p.lock);
+        p.filled++;
+        pthread_cond_signal(&p.work);
+        pthread_mutex_unlock(&p.lock);
+    }
+    while (rc == BATCH_OK && written < p.filled) {
+        rc = write_block(&p, written++, out, st);
+    }
+
+    pthread_mutex_lock(&p.lock);
+    p.filled = p.taken;
+    p.quit   = 1;
+    pthread_cond_broadcast(&p.work);
+    pthread_mutex_unlock(&p.lock);
+    for (i = 0; i < started; i++) {
+        pthread_join(tid[i], NULL);
+    }
+
+    pthread_cond_destroy(&p.done);
+    pthread_cond_destroy(&p.work);
+    pthread_mutex_destroy(&p.lock);
+    free(p.ring);
+    free(r);
+    if (fflush(out) != 0 && rc == BATCH_OK) {
+        rc = BATCH_SYSTEM;
+    }
+    return rc;
+}
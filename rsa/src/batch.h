@@ -0,0 +1,47 @@
+/*
+ * batch.h — Encryption or decryption of a stream of messages.
+ *
+ * rsa_batch reads one message per line, encrypts or decrypts each with
+ * a key that has been validated and set up once, and writes the results
+ * one per line in the same order.  Blank lines are skipped.
+ *
+ * The main thread splits the input into blocks of lines and writes the
+ * finished blocks out; a pool of worker threads parses, exponentiates
+ * and converts each block's messages.  A ring of blocks lets the reader
+ * run ahead of the writer, so the workers never wait for I/O, while the
+ * writer still takes the blocks in the order they were read.
+ *
+ * Compilation: built together with rsa.c (see rsa.c), with -pthread.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdio.h> /* FILE */
+
+#include "rsakey.h"
+
+/* Why a batch stopped early */
+#define BATCH_OK        0
+#define BATCH_INVALID  -1  /* a line is not an integer                 */
+#define BATCH_NEGATIVE -2  /* a message is negative                    */
+#define BATCH_TOO_BIG  -3  /* a message is not smaller than N          */
+#define BATCH_FAULT    -4  /* a decryption failed its consistency check */
+#define BATCH_SYSTEM   -5  /* no memory or threads, or a write failed  */
+
+/* What a batch did */
+struct batch_stats {
+    long messages; /* results written                         */
+    long line;     /* the line of the failing message, if any */
+};
+
+/*
+ * rsa_batch — Encrypts (decrypt = 0) or decrypts every message of 'in'
+ * to 'out' with 'k', on 'threads' workers.  Returns BATCH_OK at the
+ * end of the input, or the first error in input order; the results of
+ * the messages before it have been written.
+ */
+int rsa_batch(const struct rsa_key *k, int decrypt, FILE *in, FILE *out,
+              int threads, struct batch_stats *st);
+
+#endif /* BATCH_H */
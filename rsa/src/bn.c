@@ -0,0 +1,1618 @@
+/*
+ * bn.c — Fixed-size arbitrary-precision unsigned integers (see bn.h).
+ *
+ * The work is done on bare limb arrays ("limbs_*" helpers) so that
+ * Karatsuba and Toom-3 can recurse on slices of their operands; struct
+ * bn is a length and an array around them.  Scratch space lives on the
+ * stack, sized for the largest operands a struct bn can hold.
+ *
+ * Compilation: built together with rsa.c (see rsa.c).
+ */
+
+#include <string.h>  /* memcpy, memset, strlen */
+
+#include "bn.h"
+
+/* 128-bit products of two limbs (a GCC extension, hence __extension__) */
+__extension__ typedef unsigned __int128 bn_dlimb;
+
+/* Limbs of scratch for one operand, and for one product, of bn_mul */
+#define HALF_MAX (BN_LIMBS + 4)
+#define FULL_MAX (2 * BN_LIMBS + 8)
+
+/*
+ * Below these sizes the simpler algorithm is faster (rsabench --tune on
+ * x86-64).  Toom-3 only just catches up with Karatsuba at 4096-bit
+ * operands, the largest whose product fits.
+ */
+int bn_karatsuba_threshold = 24;
+int bn_toom3_threshold     = 64;
+
+/* Window width of the exponentiations; 0 picks it from the exponent */
+int bn_pow_window = 0;
+
+/* =========================================================================
+ * Limb arrays
+ * ====================================================================== */
+
+/* -------------------------------------------------------------------------
+ * limbs_norm — Length of a[0..n) without its high zero limbs.
+ * ---------------------------------------------------------------------- */
+static int limbs_norm(const bn_limb *a, int n)
+{
+    while (n > 0 && a[n - 1] == 0) {
+        n--;
+    }
+    return n;
+}
+
+/* -------------------------------------------------------------------------
+ * limbs_add — r[0..an) = a + b, where an >= bn.  Returns the carry out.
+ * ---------------------------------------------------------------------- */
+static bn_limb limbs_add(bn_limb *r, const bn_limb *a, int an,
+                         const bn_limb *b, int bn)
+{
+    bn_limb carry = 0; /* 0 or 1 */
+    bn_limb s;
+    int     i;
+
+    for (i = 0; i < bn; i++) {
+        s     = a[i] + carry;
+        carry = (s < carry);
+        r[i]  = s + b[i];
+        carry += (r[i] < s);
+    }
+    for (; i < an; i++) {
+        r[i]  = a[i] + carry;
+        carry = (r[i] < carry);
+    }
+    return carry;
+}
+
+/* -------------------------------------------------------------------------
+ * limbs_sub — r[0..an) = a - b, where an >= bn.  Returns the borrow out.
+ * ---------------------------------------------------------------------- */
+static bn_limb limbs_sub(bn_limb *r, const bn_limb *a, int an,
+                         const bn_limb *b, int bn)
+{
+    bn_limb borrow = 0; /* 0 or 1 */
+    bn_limb x, y;
+    int     i;
+
+    for (i = 0; i < bn; i++) {
+        x      = a[i];
+        y      = b[i] + borrow;
+        borrow = (y < borrow) | (x < y);
+        r[i]   = x - y;
+    }
+    for (; i < an; i++) {
+        x      = a[i];
+        r[i]   = x - borrow;
+        borrow = (x < borrow);
+    }
+    return borrow;
+}
+
+/* -------------------------------------------------------------------------
+ * limbs_add_into — r[0..rn) += a[0..an), with an <= rn.  Returns the
+ * carry out of r.
+ * ---------------------------------------------------------------------- */
+static bn_limb limbs_add_into(bn_limb *r, int rn, const bn_limb *a, int an)
+{
+    return limbs_add(r, r, rn, a, an);
+}
+
+/* -------------------------------------------------------------------------
+ * limbs_cmp — Compares a[0..an) with b[0..bn): -1, 0 or 1.
+ * ---------------------------------------------------------------------- */
+static int limbs_cmp(const bn_limb *a, int an, const bn_limb *b, int bn)
+{
+    an = limbs_norm(a, an);
+    bn = limbs_norm(b, bn);
+    if (an != bn) {
+        return (an < bn) ? -1 : 1;
+    }
+    while (an-- > 0) {
+        if (a[an] != b[an]) {
+            return (a[an] < b[an]) ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ * limbs_mul_basecase — r[0..an+bn) = a * b, schoolbook: one row of
+ * 128-bit multiply-accumulates per limb of b.
+ * ---------------------------------------------------------------------- */
+static void limbs_mul_basecase(bn_limb *r, const bn_limb *a, int an,
+                               const bn_limb *b, int bn)
+{
+    bn_dlimb t;
+    bn_limb  carry;
+    int      i, j;
+
+    memset(r, 0, (size_t)(an + bn) * sizeof(bn_limb));
+    for (i = 0; i < bn; i++) {
+        carry = 0;
+        for (j = 0; j < an; j++) {
+            t        = (bn_dlimb)a[j] * b[i] + r[i + j] + carry;
+            r[i + j] = (bn_limb)t;
+            carry    = (bn_limb)(t >> 64);
+        }
+        r[i + an] = carry;
+    }
+}
+
+static void limbs_mul_n(bn_limb *r, const bn_limb *a, const bn_limb *b,
+                        int n);
+
+/* -------------------------------------------------------------------------
+ * limbs_mul_karatsuba — r[0..2n) = a * b for n-limb operands.
+ *
+ * With a = a1·X + a0 and b = b1·X + b0 (X = 2^(64·lo)):
+ *   a·b = z2·X² + z1·X + z0,  z0 = a0·b0,  z2 = a1·b1,
+ *   z1 = (a0 + a1)(b0 + b1) − z0 − z2
+ * which is three half-size products instead of four.
+ * ---------------------------------------------------------------------- */
+static void limbs_mul_karatsuba(bn_limb *r, const bn_limb *a,
+                                const bn_limb *b, int n)
+{
+    bn_limb sa[HALF_MAX]; /* a0 + a1            */
+    bn_limb sb[HALF_MAX]; /* b0 + b1            */
+    bn_limb z1[FULL_MAX]; /* the middle product */
+    int     lo = n / 2;   /* limbs in a0 and b0 */
+    int     hi = n - lo;  /* limbs in a1 and b1 */
+    int     len;
+
+    limbs_mul_n(r, a, b, lo);                       /* z0 */
+    limbs_mul_n(r + 2 * lo, a + lo, b + lo, hi);    /* z2 */
+
+    sa[hi] = limbs_add(sa, a + lo, hi, a, lo);
+    sb[hi] = limbs_add(sb, b + lo, hi, b, lo);
+    limbs_mul_n(z1, sa, sb, hi + 1);
+    limbs_sub(z1, z1, 2 * hi + 2, r, 2 * lo);
+    limbs_sub(z1, z1, 2 * hi + 2, r + 2 * lo, 2 * hi);
+
+    /* z1 < 2^(64·(n+1)); whatever lies past r's end is zero */
+    len = 2 * hi + 2;
+    if (len > 2 * n - lo) {
+        len = 2 * n - lo;
+    }
+    limbs_add_into(r + lo, 2 * n - lo, z1, len);
+}
+
+/* -------------------------------------------------------------------------
+ * Toom-3 helpers.  The interpolation goes through negative values, which
+ * are kept in two's complement over a fixed number of limbs.
+ * ---------------------------------------------------------------------- */
+
+/* tc_shr1 — Halves a two's complement value (arithmetic shift) */
+static void tc_shr1(bn_limb *a, int n)
+{
+    int i;
+
+    for (i = 0; i < n - 1; i++) {
+        a[i] = (a[i] >> 1) | (a[i + 1] << 63);
+    }
+    a[n - 1] = (bn_limb)((int64_t)a[n - 1] >> 1);
+}
+
+/* tc_shl — Multiplies a two's complement value by 2^k, k < 64 */
+static void tc_shl(bn_limb *r, const bn_limb *a, int n, int k)
+{
+    int i;
+
+    for (i = n - 1; i > 0; i--) {
+        r[i] = (a[i] << k) | (a[i - 1] >> (64 - k));
+    }
+    r[0] = a[0] << k;
+}
+
+/*
+ * tc_divexact3 — Divides by 3 a two's complement value known to be a
+ * multiple of 3: multiplication by the inverse of 3 modulo 2^64, limb by
+ * limb, carrying the high half of each quotient limb times 3.
+ */
+static void tc_divexact3(bn_limb *a, int n)
+{
+    const bn_limb inv3 = 0xAAAAAAAAAAAAAAABULL; /* 3 · inv3 ≡ 1 mod 2^64 */
+    bn_limb       c = 0, s, l, q;
+    int           i;
+
+    for (i = 0; i < n; i++) {
+        s    = a[i];
+        l    = s - c;
+        c    = (l > s);
+        q    = l * inv3;
+        a[i] = q;
+        c   += (bn_limb)(((bn_dlimb)q * 3) >> 64);
+    }
+}
+
+/*
+ * tc_load — Copies an[0..an) into a two's complement value of n limbs,
+ * negated if 'neg'.
+ */
+static void tc_load(bn_limb *r, int n, const bn_limb *a, int an, int neg)
+{
+    bn_limb carry = 1;
+    int     i;
+
+    memcpy(r, a, (size_t)an * sizeof(bn_limb));
+    memset(r + an, 0, (size_t)(n - an) * sizeof(bn_limb));
+    if (neg) {
+        for (i = 0; i < n; i++) {       /* −r = ~r + 1 */
+            r[i]   = ~r[i] + carry;
+            carry  = (carry && r[i] == 0);
+        }
+    }
+}
+
+/*
+ * toom_eval — Evaluates a0 + a1·x + a2·x² at x = 1, −1 and 2, where a0
+ * and a1 have k limbs and a2 has k2.  Each result has k + 1 limbs; the
+ * one at −1 is a magnitude, with its sign in *neg.
+ */
+static void toom_eval(const bn_limb *a, int k, int k2, bn_limb *p1,
+                      bn_limb *pm1, int *neg, bn_limb *p2)
+{
+    bn_limb t[HALF_MAX];
+    int     i;
+
+    /* a0 + a2, then ± a1 */
+    t[k] = limbs_add(t, a, k, a + 2 * k, k2);
+    p1[k] = t[k] + limbs_add(p1, t, k, a + k, k);
+    *neg = (limbs_cmp(t, k + 1, a + k, k) < 0);
+    if (*neg) {
+        limbs_sub(pm1, a + k, k, t, k);  /* t < a1 < X, so t[k] = 0 */
+        pm1[k] = 0;
+    } else {
+        pm1[k] = t[k] - limbs_sub(pm1, t, k, a + k, k);
+    }
+
+    /* ((2·a2 + a1)·2) + a0 */
+    memcpy(t, a + 2 * k, (size_t)k2 * sizeof(bn_limb));
+    memset(t + k2, 0, (size_t)(k + 1 - k2) * sizeof(bn_limb));
+    tc_shl(t, t, k + 1, 1);
+    limbs_add_into(t, k + 1, a + k, k);
+    tc_shl(t, t, k + 1, 1);
+    limbs_add_into(t, k + 1, a, k);
+    for (i = 0; i <= k; i++) {
+        p2[i] = t[i];
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * limbs_mul_toom3 — r[0..2n) = a * b for n-limb operands.
+ *
+ * Each operand is split in three, a = a2·X² + a1·X + a0, and seen as a
+ * polynomial in X.  The product polynomial has degree 4, so five point
+ * values determine it: at 0, 1, −1, 2 and ∞.  That is five products of
+ * a third of the size instead of nine, after which the coefficients are
+ * recovered (with r0 = v0 and r4 = v∞):
+ *   A  = (v1 − v−1) / 2                 = r1 + r3
+ *   r2 = (v1 + v−1) / 2 − r0 − r4
+ *   r3 = ((v2 − r0 − 16·r4) / 2 − A − 2·r2) / 3
+ *   r1 = A − r3
+ * ---------------------------------------------------------------------- */
+static void limbs_mul_toom3(bn_limb *r, const bn_limb *a, const bn_limb *b,
+                            int n)
+{
+    bn_limb a1[HALF_MAX], am1[HALF_MAX], a2[HALF_MAX];
+    bn_limb b1[HALF_MAX], bm1[HALF_MAX], b2[HALF_MAX];
+    bn_limb v1[FULL_MAX], vm1[FULL_MAX], v2[FULL_MAX];
+    bn_limb x[FULL_MAX], y[FULL_MAX];     /* interpolation scratch */
+    bn_limb r1[FULL_MAX] = {0}, r2[FULL_MAX] = {0}, r3[FULL_MAX] = {0};
+    int     k  = (n + 2) / 3;             /* limbs in a0, a1        */
+    int     k2 = n - 2 * k;               /* limbs in a2            */
+    int     L  = 2 * k + 3;               /* two's complement width */
+    int     na, nb;
+
+    /*
+     * r1..r3 are fully written before use; the initialisers only keep
+     * GCC's -Wmaybe-uninitialized quiet, as it cannot see that L > 0.
+     */
+    toom_eval(a, k, k2, a1, am1, &na, a2);
+    toom_eval(b, k, k2, b1, bm1, &nb, b2);
+
+    /* v0 and v∞ go straight to their places in r */
+    limbs_mul_n(r, a, b, k);
+    memset(r + 2 * k, 0, (size_t)(2 * k) * sizeof(bn_limb));
+    limbs_mul_n(r + 4 * k, a + 2 * k, b + 2 * k, k2);
+
+    limbs_mul_n(x, a1, b1, k + 1);
+    tc_load(v1, L, x, 2 * k + 2, 0);
+    limbs_mul_n(x, am1, bm1, k + 1);
+    tc_load(vm1, L, x, 2 * k + 2, na != nb);
+    limbs_mul_n(x, a2, b2, k + 1);
+    tc_load(v2, L, x, 2 * k + 2, 0);
+
+    /* x = r0 + r4, y = 16·r4, both as L-limb values */
+    tc_load(y, L, r + 4 * k, 2 * k2, 0);
+    tc_load(x, L, r, 2 * k, 0);
+    limbs_add_into(x, L, y, L);
+    tc_shl(y, y, L, 4);
+
+    /* A = (v1 − v−1) / 2, kept in r1 */
+    limbs_sub(r1, v1, L, vm1, L);
+    tc_shr1(r1, L);
+
+    /* r2 = (v1 + v−1) / 2 − r0 − r4 */
+    limbs_add(r2, v1, L, vm1, L);
+    tc_shr1(r2, L);
+    limbs_sub(r2, r2, L, x, L);
+
+    /* r3 = ((v2 − r0 − 16·r4) / 2 − A − 2·r2) / 3 */
+    limbs_sub(r3, v2, L, r, 2 * k);
+    limbs_sub(r3, r3, L, y, L);
+    tc_shr1(r3, L);
+    limbs_sub(r3, r3, L, r1, L);
+    tc_shl(x, r2, L, 1);
+    limbs_sub(r3, r3, L, x, L);
+    tc_divexact3(r3, L);
+
+    /* r1 = A − r3 */
+    limbs_sub(r1, r1, L, r3, L);
+
+    /* r += r1·X + r2·X² + r3·X³; each fits, so high limbs past r are 0 */
+    limbs_add_into(r + k, 2 * n - k, r1, L < 2 * n - k ? L : 2 * n - k);
+    limbs_add_into(r + 2 * k, 2 * n - 2 * k, r2,
+                   L < 2 * n - 2 * k ? L : 2 * n - 2 * k);
+    limbs_add_into(r + 3 * k, 2 * n - 3 * k, r3,
+                   L < 2 * n - 3 * k ? L : 2 * n - 3 * k);
+}
+
+/* -------------------------------------------------------------------------
+ * limbs_mul_n — r[0..2n) = a * b for n-limb operands, by the algorithm
+ * that suits n.
+ * ---------------------------------------------------------------------- */
+static void limbs_mul_n(bn_limb *r, const bn_limb *a, const bn_limb *b,
+                        int n)
+{
+    if (n < bn_karatsuba_threshold || n < 4) {
+        limbs_mul_basecase(r, a, n, b, n);
+    } else if (n < bn_toom3_threshold || n < 9) {
+        limbs_mul_karatsuba(r, a, b, n);
+    } else {
+        limbs_mul_toom3(r, a, b, n);
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * limbs_sqr_basecase — r[0..2n) = a², schoolbook with each cross product
+ * a[i]·a[j] (i < j) formed once and doubled, then the squares a[i]²
+ * added on the diagonal: about half the multiplications of a·b.
+ * ---------------------------------------------------------------------- */
+static void limbs_sqr_basecase(bn_limb *r, const bn_limb *a, int n)
+{
+    bn_dlimb t;
+    bn_limb  carry, hi;
+    int      i, j;
+
+    memset(r, 0, (size_t)(2 * n) * sizeof(bn_limb));
+    for (i = 0; i < n - 1; i++) {
+        carry = 0;
+        for (j = i + 1; j < n; j++) {
+            t        = (bn_dlimb)a[i] * a[j] + r[i + j] + carry;
+            r[i + j] = (bn_limb)t;
+            carry    = (bn_limb)(t >> 64);
+        }
+        r[i + n] = carry;
+    }
+
+    /* double the cross products, then add the diagonal */
+    hi = 0;
+    for (i = 0; i < 2 * n; i++) {
+        carry = r[i] >> 63;
+        r[i]  = (r[i] << 1) | hi;
+        hi    = carry;
+    }
+    carry = 0;
+    for (i = 0; i < n; i++) {
+        t            = (bn_dlimb)a[i] * a[i] + r[2 * i] + carry;
+        r[2 * i]     = (bn_limb)t;
+        t            = (bn_dlimb)r[2 * i + 1] + (bn_limb)(t >> 64);
+        r[2 * i + 1] = (bn_limb)t;
+        carry        = (bn_limb)(t >> 64);
+    }
+}
+
+static void limbs_sqr_n(bn_limb *r, const bn_limb *a, int n);
+
+/* -------------------------------------------------------------------------
+ * limbs_sqr_karatsuba — r[0..2n) = a², as limbs_mul_karatsuba with both
+ * operands the same, so that its three products are squares too.
+ * ---------------------------------------------------------------------- */
+static void limbs_sqr_karatsuba(bn_limb *r, const bn_limb *a, int n)
+{
+    bn_limb sa[HALF_MAX]; /* a0 + a1            */
+    bn_limb z1[FULL_MAX]; /* the middle product */
+    int     lo = n / 2;
+    int     hi = n - lo;
+    int     len;
+
+    limbs_sqr_n(r, a, lo);
+    limbs_sqr_n(r + 2 * lo, a + lo, hi);
+
+    sa[hi] = limbs_add(sa, a + lo, hi, a, lo);
+    limbs_sqr_n(z1, sa, hi + 1);
+    limbs_sub(z1, z1, 2 * hi + 2, r, 2 * lo);
+    limbs_sub(z1, z1, 2 * hi + 2, r + 2 * lo, 2 * hi);
+
+    len = 2 * hi + 2;
+    if (len > 2 * n - lo) {
+        len = 2 * n - lo;
+    }
+    limbs_add_into(r + lo, 2 * n - lo, z1, len);
+}
+
+/* -------------------------------------------------------------------------
+ * limbs_sqr_n — r[0..2n) = a², by the algorithm that suits n.
+ * ---------------------------------------------------------------------- */
+static void limbs_sqr_n(bn_limb *r, const bn_limb *a, int n)
+{
+    if (n < bn_karatsuba_threshold || n < 4) {
+        limbs_sqr_basecase(r, a, n);
+    } else if (n < bn_toom3_threshold || n < 9) {
+        limbs_sqr_karatsuba(r, a, n);
+    } else {
+        limbs_mul_toom3(r, a, a, n);
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * limbs_mul — r[0..an+bn) = a * b, where an >= bn >= 1.  Unbalanced
+ * operands are multiplied a slice of bn limbs of a at a time.
+ * ---------------------------------------------------------------------- */
+static void limbs_mul(bn_limb *r, const bn_limb *a, int an, const bn_limb *b,
+                      int bn)
+{
+    bn_limb t[FULL_MAX]; /* product of one slice */
+    int     off, len;
+
+    if (bn < bn_karatsuba_threshold) {
+        limbs_mul_basecase(r, a, an, b, bn);
+        return;
+    }
+    if (an == bn) {
+        limbs_mul_n(r, a, b, bn);
+        return;
+    }
+    memset(r, 0, (size_t)(an + bn) * sizeof(bn_limb));
+    for (off = 0; off < an; off += bn) {
+        len = an - off;
+        if (len >= bn) {
+            limbs_mul_n(t, a + off, b, bn);
+            len = bn;
+        } else {
+            limbs_mul(t, b, bn, a + off, len);
+        }
+        limbs_add_into(r + off, an + bn - off, t, len + bn);
+    }
+}
+
+/* =========================================================================
+ * struct bn
+ * ====================================================================== */
+
+void bn_zero(struct bn *r)
+{
+    r->n = 0;
+}
+
+void bn_set_u64(struct bn *r, uint64_t v)
+{
+    r->d[0] = v;
+    r->n    = (v != 0);
+}
+
+void bn_copy(struct bn *r, const struct bn *a)
+{
+    if (r != a) {
+        r->n = a->n;
+        memcpy(r->d, a->d, (size_t)a->n * sizeof(bn_limb));
+    }
+}
+
+int bn_is_zero(const struct bn *a)
+{
+    return a->n == 0;
+}
+
+int bn_is_odd(const struct bn *a)
+{
+    return a->n > 0 && (a->d[0] & 1);
+}
+
+int bn_bits(const struct bn *a)
+{
+    bn_limb top;
+    int     bits;
+
+    if (a->n == 0) {
+        return 0;
+    }
+    top  = a->d[a->n - 1];
+    bits = (a->n - 1) * BN_LIMB_BITS;
+    while (top != 0) {
+        bits++;
+        top >>= 1;
+    }
+    return bits;
+}
+
+int bn_bit(const struct bn *a, int i)
+{
+    if (i < 0 || i / BN_LIMB_BITS >= a->n) {
+        return 0;
+    }
+    return (int)((a->d[i / BN_LIMB_BITS] >> (i % BN_LIMB_BITS)) & 1);
+}
+
+int bn_cmp(const struct bn *a, const struct bn *b)
+{
+    return limbs_cmp(a->d, a->n, b->d, b->n);
+}
+
+int bn_cmp_u64(const struct bn *a, uint64_t v)
+{
+    if (a->n > 1) {
+        return 1;
+    }
+    if (a->n == 0) {
+        return (v == 0) ? 0 : -1;
+    }
+    return (a->d[0] == v) ? 0 : (a->d[0] < v) ? -1 : 1;
+}
+
+int bn_add(struct bn *r, const struct bn *a, const struct bn *b)
+{
+    bn_limb carry;
+
+    if (a->n < b->n) {
+        const struct bn *t = a;
+        a = b;
+        b = t;
+    }
+    carry = limbs_add(r->d, a->d, a->n, b->d, b->n);
+    r->n  = a->n;
+    if (carry) {
+        if (r->n == BN_LIMBS) {
+            return -1;
+        }
+        r->d[r->n++] = carry;
+    }
+    return 0;
+}
+
+int bn_sub(struct bn *r, const struct bn *a, const struct bn *b)
+{
+    if (bn_cmp(a, b) < 0) {
+        return -1;
+    }
+    limbs_sub(r->d, a->d, a->n, b->d, b->n);
+    r->n = limbs_norm(r->d, a->n);
+    return 0;
+}
+
+int bn_sub_u64(struct bn *r, const struct bn *a, uint64_t v)
+{
+    struct bn b;
+
+    bn_set_u64(&b, v);
+    return bn_sub(r, a, &b);
+}
+
+int bn_mul(struct bn *r, const struct bn *a, const struct bn *b)
+{
+    bn_limb t[2 * BN_LIMBS]; /* r may alias a or b */
+    int     n;
+
+    if (a->n == 0 || b->n == 0) {
+        r->n = 0;
+        return 0;
+    }
+    if (a->n + b->n > BN_LIMBS + 1) {
+        return -1;
+    }
+    if (a == b) {
+        limbs_sqr_n(t, a->d, a->n);
+    } else if (a->n >= b->n) {
+        limbs_mul(t, a->d, a->n, b->d, b->n);
+    } else {
+        limbs_mul(t, b->d, b->n, a->d, a->n);
+    }
+    n = limbs_norm(t, a->n + b->n);
+    if (n > BN_LIMBS) {
+        return -1;
+    }
+    memcpy(r->d, t, (size_t)n * sizeof(bn_limb));
+    r->n = n;
+    return 0;
+}
+
+void bn_shr(struct bn *r, const struct bn *a, int bits)
+{
+    int limbs = bits / BN_LIMB_BITS;
+    int s     = bits % BN_LIMB_BITS;
+    int i, n;
+
+    if (limbs >= a->n) {
+        r->n = 0;
+        return;
+    }
+    n = a->n - limbs;
+    for (i = 0; i < n; i++) {
+        r->d[i] = a->d[i + limbs] >> s;
+        if (s != 0 && i + limbs + 1 < a->n) {
+            r->d[i] |= a->d[i + limbs + 1] << (BN_LIMB_BITS - s);
+        }
+    }
+    r->n = limbs_norm(r->d, n);
+}
+
+uint64_t bn_mod_u64(const struct bn *a, uint64_t m)
+{
+    bn_dlimb rem = 0;
+    int      i;
+
+    for (i = a->n - 1; i >= 0; i--) {
+        rem = ((rem << 64) | a->d[i]) % m;
+    }
+    return (uint64_t)rem;
+}
+
+/* -------------------------------------------------------------------------
+ * bn_divmod — Schoolbook long division (Knuth, TAOCP vol. 2, 4.3.1,
+ * algorithm D).
+ *
+ * Both operands are shifted left until the divisor's top bit is set,
+ * which makes each estimated quotient limb (from the top two limbs of
+ * the remainder over the top limb of the divisor) at most two too big.
+ * The estimate is refined with the divisor's second limb, the divisor
+ * times it is subtracted, and in the rare case that goes negative the
+ * divisor is added back once.
+ * ---------------------------------------------------------------------- */
+int bn_divmod(struct bn *q, struct bn *r, const struct bn *a,
+              const struct bn *b)
+{
+    bn_limb  u[BN_LIMBS + 1]; /* remainder, normalised   */
+    bn_limb  v[BN_LIMBS];     /* divisor, normalised     */
+    bn_limb  qd[BN_LIMBS];    /* quotient limbs          */
+    bn_dlimb qhat, rhat, p;
+    bn_limb  borrow, carry, top, sub;
+    int      un = a->n, vn = b->n;
+    int      s, i, j;
+
+    if (vn == 0) {
+        return -1;
+    }
+    if (bn_cmp(a, b) < 0) {
+        if (r != NULL) {
+            bn_copy(r, a);
+        }
+        if (q != NULL) {
+            q->n = 0;
+        }
+        return 0;
+    }
+
+    if (vn == 1) {                               /* one-limb divisor */
+        rhat = 0;
+        for (i = un - 1; i >= 0; i--) {
+            rhat  = (rhat << 64) | a->d[i];
+            qd[i] = (bn_limb)(rhat / b->d[0]);
+            rhat %= b->d[0];
+        }
+        if (q != NULL) {
+            memcpy(q->d, qd, (size_t)un * sizeof(bn_limb));
+            q->n = limbs_norm(q->d, un);
+        }
+        if (r != NULL) {
+            bn_set_u64(r, (uint64_t)rhat);
+        }
+        return 0;
+    }
+
+    /* Normalise: shift so that the divisor's top bit is set */
+    s   = 0;
+    top = b->d[vn - 1];
+    while (!(top & (1ULL << 63))) {
+        top <<= 1;
+        s++;
+    }
+    for (i = vn - 1; i > 0; i--) {
+        v[i] = (b->d[i] << s) | (s ? b->d[i - 1] >> (64 - s) : 0);
+    }
+    v[0]  = b->d[0] << s;
+    u[un] = s ? a->d[un - 1] >> (64 - s) : 0;
+    for (i = un - 1; i > 0; i--) {
+        u[i] = (a->d[i] << s) | (s ? a->d[i - 1] >> (64 - s) : 0);
+    }
+    u[0] = a->d[0] << s;
+
+    for (j = un - vn; j >= 0; j--) {
+        /* Estimate the quotient limb and correct it */
+        p    = ((bn_dlimb)u[j + vn] << 64) | u[j + vn - 1];
+        qhat = p / v[vn - 1];
+        rhat = p % v[vn - 1];
+        while ((qhat >> 64) != 0 ||
+               qhat * v[vn - 2] > ((rhat << 64) | u[j + vn - 2])) {
+            qhat--;
+            rhat += v[vn - 1];
+            if ((rhat >> 64) != 0) {
+                break;
+            }
+        }
+
+        /* Multiply and subtract */
+        borrow = 0;
+        carry  = 0;
+        for (i = 0; i < vn; i++) {
+            p        = qhat * v[i] + carry;
+            carry    = (bn_limb)(p >> 64);
+            sub      = u[i + j] - (bn_limb)p;
+            top      = sub - borrow;
+            borrow   = (sub > u[i + j]) | (top > sub);
+            u[i + j] = top;
+        }
+        sub       = u[j + vn] - carry;
+        top       = sub - borrow;
+        borrow    = (sub > u[j + vn]) | (top > sub);
+        u[j + vn] = top;
+
+        /* Add back if the estimate was still one too big */
+        if (borrow) {
+            qhat--;
+            u[j + vn] += limbs_add(u + j, u + j, vn, v, vn);
+        }
+        qd[j] = (bn_limb)qhat;
+    }
+
+    if (q != NULL) {
+        memcpy(q->d, qd, (size_t)(un - vn + 1) * sizeof(bn_limb));
+        q->n = limbs_norm(q->d, un - vn + 1);
+    }
+    if (r != NULL) {
+        for (i = 0; i < vn; i++) {
+            r->d[i] = (u[i] >> s) | (s ? u[i + 1] << (64 - s) : 0);
+        }
+        r->n = limbs_norm(r->d, vn);
+    }
+    return 0;
+}
+
+int bn_mod(struct bn *r, const struct bn *a, const struct bn *m)
+{
+    return bn_divmod(NULL, r, a, m);
+}
+
+/* -------------------------------------------------------------------------
+ * bn_gcd — Greatest common divisor by the Euclidean algorithm.
+ * ---------------------------------------------------------------------- */
+void bn_gcd(struct bn *r, const struct bn *a, const struct bn *b)
+{
+    struct bn x, y, t;
+
+    bn_copy(&x, a);
+    bn_copy(&y, b);
+    while (!bn_is_zero(&y)) {
+        bn_mod(&t, &x, &y);
+        bn_copy(&x, &y);
+        bn_copy(&y, &t);
+    }
+    bn_copy(r, &x);
+}
+
+/* -------------------------------------------------------------------------
+ * bn_mod_inv — Extended Euclidean algorithm.
+ *
+ * Runs Euclid on (m, a mod m) while tracking, for each remainder, the
+ * multiplier s with remainder ≡ s·a (mod m).  When the remainders reach
+ * gcd = 1, its multiplier is the inverse.  The multipliers alternate
+ * in sign, so they are kept reduced modulo m instead, which keeps them
+ * unsigned.
+ * ---------------------------------------------------------------------- */
+int bn_mod_inv(struct bn *r, const struct bn *a, const struct bn *m)
+{
+    struct bn x, y, q, t; /* remainders, quotient, scratch  */
+    struct bn s0, s1;     /* multipliers of x and y          */
+
+    if (bn_is_zero(m)) {
+        return -1;
+    }
+    bn_copy(&x, m);
+    bn_mod(&y, a, m);
+    bn_zero(&s0);
+    bn_set_u64(&s1, 1);
+    while (!bn_is_zero(&y)) {
+        bn_divmod(&q, &t, &x, &y);
+        bn_copy(&x, &y);
+        bn_copy(&y, &t);
+
+        /* (s0, s1) = (s1, s0 − q·s1 mod m) */
+        if (bn_mul(&t, &q, &s1) < 0) {
+            return -1;
+        }
+        bn_mod(&t, &t, m);
+        if (bn_cmp(&s0, &t) < 0) {
+            bn_add(&s0, &s0, m);
+        }
+        bn_sub(&t, &s0, &t);
+        bn_copy(&s0, &s1);
+        bn_copy(&s1, &t);
+    }
+    if (bn_cmp_u64(&x, 1) != 0) {
+        return -1;
+    }
+    bn_mod(r, &s0, m); /* s0 = 1 when m = 1 and a = 0 */
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ * bn_mod_pow_div — Modular exponentiation by repeated squaring, from the
+ * lowest bit of the exponent up, reducing after every product.
+ * ---------------------------------------------------------------------- */
+int bn_mod_pow_div(struct bn *r, const struct bn *base, const struct bn *exp,
+                   const struct bn *m)
+{
+    struct bn result; /* accumulated result       */
+    struct bn b;      /* base^(2^i) mod m         */
+    int       bits, i;
+
+    if (bn_is_zero(m)) {
+        return -1;
+    }
+    bn_set_u64(&result, 1);
+    bn_mod(&result, &result, m);       /* 0 when m = 1 */
+    bn_mod(&b, base, m);
+    bits = bn_bits(exp);
+    for (i = 0; i < bits; i++) {
+        if (bn_bit(exp, i)) {
+            if (bn_mul(&result, &result, &b) < 0) {
+                return -1;              /* m too wide to square mod it */
+            }
+            bn_mod(&result, &result, m);
+        }
+        if (i + 1 < bits) {
+            if (bn_mul(&b, &b, &b) < 0) {
+                return -1;
+            }
+            bn_mod(&b, &b, m);
+        }
+    }
+    bn_copy(r, &result);
+    return 0;
+}
+
+/* =========================================================================
+ * Montgomery arithmetic
+ * ====================================================================== */
+
+/* -------------------------------------------------------------------------
+ * mont_redc — r = t·R⁻¹ mod m for a 2n-limb t < m·R (REDC), destroying t.
+ *
+ * Limb by limb from the bottom, adds the multiple q·m, q = t[i]·n0 mod
+ * 2^64, that clears limb i.  After n limbs the low half of t is zero
+ * and the high half is t·R⁻¹ mod m, plus m at most once.  'top' is the
+ * carry out of the limb above the row, which moves up with it.
+ * ---------------------------------------------------------------------- */
+static void mont_redc(const struct bn_mont *mt, bn_limb *r, bn_limb *t)
+{
+    const bn_limb *m = mt->m.d;
+    int            n = mt->n;
+    bn_dlimb       p;
+    bn_limb        c, q, top = 0;
+    int            i, j;
+
+    for (i = 0; i < n; i++) {
+        q = t[i] * mt->n0;
+        c = 0;
+        for (j = 0; j < n; j++) {
+            p        = (bn_dlimb)q * m[j] + t[i + j] + c;
+            t[i + j] = (bn_limb)p;
+            c        = (bn_limb)(p >> 64);
+        }
+        p         = (bn_dlimb)t[i + n] + c + top;
+        t[i + n]  = (bn_limb)p;
+        top       = (bn_limb)(p >> 64);
+    }
+    if (top != 0 || limbs_cmp(t + n, n, m, n) >= 0) {
+        limbs_sub(r, t + n, n, m, n);
+    } else {
+        memcpy(r, t + n, (size_t)n * sizeof(bn_limb));
+    }
+}
+
+/*
+ * mont_mul, mont_sqr — r = a·b·R⁻¹ mod m and r = a²·R⁻¹ mod m for n-limb
+ * residues: the product by the usual algorithms, then REDC.  r may
+ * alias the operands.
+ */
+static void mont_mul(const struct bn_mont *mt, bn_limb *r, const bn_limb *a,
+                     const bn_limb *b)
+{
+    bn_limb t[BN_LIMBS + 8];
+
+    limbs_mul_n(t, a, b, mt->n);
+    mont_redc(mt, r, t);
+}
+
+static void mont_sqr(const struct bn_mont *mt, bn_limb *r, const bn_limb *a)
+{
+    bn_limb t[BN_LIMBS + 8];
+
+    limbs_sqr_n(t, a, mt->n);
+    mont_redc(mt, r, t);
+}
+
+/* -------------------------------------------------------------------------
+ * bn_mont_init — n0 by Newton's iteration for the inverse modulo 2^64:
+ * an odd m is its own inverse modulo 8, and each step x·(2 − m·x)
+ * doubles the correct bits (3, 6, 12, 24, 48, 96).  R² mod m is the
+ * square of R mod m, which keeps every intermediate value within a
+ * struct bn.
+ * ---------------------------------------------------------------------- */
+int bn_mont_init(struct bn_mont *mt, const struct bn *m)
+{
+    struct bn r; /* R, then R mod m */
+    bn_limb   inv;
+    int       i;
+
+    if (!bn_is_odd(m) || m->n > BN_LIMBS / 2) {
+        return -1;
+    }
+    mt->n = m->n;
+    bn_copy(&mt->m, m);
+
+    inv = m->d[0];
+    for (i = 0; i < 5; i++) {
+        inv *= 2 - m->d[0] * inv;
+    }
+    mt->n0 = 0 - inv;
+
+    memset(r.d, 0, (size_t)(m->n + 1) * sizeof(bn_limb));
+    r.d[m->n] = 1;
+    r.n       = m->n + 1;
+    bn_mod(&r, &r, m);
+    bn_mul(&mt->rr, &r, &r);
+    bn_mod(&mt->rr, &mt->rr, m);
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ * redc_1 — REDC for a one-limb modulus: t·2^−64 mod m for t < m², all
+ * in registers.  The low halves of t and q·m cancel, leaving a carry
+ * exactly when t's low half is not zero; the high halves add up to
+ * less than 2m, which may take a 65th bit.
+ * ---------------------------------------------------------------------- */
+static bn_limb redc_1(bn_dlimb t, bn_limb m, bn_limb n0)
+{
+    bn_limb  q  = (bn_limb)t * n0;
+    bn_dlimb qm = (bn_dlimb)q * m;
+    bn_limb  hi = (bn_limb)(t >> 64);
+    bn_limb  s  = hi + (bn_limb)(qm >> 64);
+    bn_limb  r  = s + ((bn_limb)t != 0);
+    int      over = (s < hi) | (r < s);
+
+    return (over || r >= m) ? r - m : r;
+}
+
+/* -------------------------------------------------------------------------
+ * pow_window — Window width for an exponent of 'bits' bits.
+ *
+ * A window of w bits needs a table of the 2^(w−1) odd powers x, x³, …,
+ * x^(2^w − 1), one product each, and then saves products: the ladder
+ * multiplies once per window, about every w + 1 bits, instead of once
+ * per set bit.  Wider windows pay off for longer exponents.  The
+ * cut-offs come from rsabench --window on x86-64.
+ * ---------------------------------------------------------------------- */
+static int pow_window(int bits)
+{
+    if (bn_pow_window > 0) {
+        return bn_pow_window < BN_WINDOW_MAX ? bn_pow_window
+                                             : BN_WINDOW_MAX;
+    }
+    return bits > 768 ? 6
+         : bits > 256 ? 5
+         : bits > 80  ? 4
+         : bits > 24  ? 3
+         : bits > 6   ? 2
+         : 1;
+}
+
+/*
+ * window_at — The window whose top bit is bit i of 'exp' (a set bit):
+ * bits i down to i − w + 1 at most, shortened so that it ends on a set
+ * bit and is odd.  Returns its value and sets 'len' to its length.
+ */
+static int window_at(const struct bn *exp, int i, int w, int *len)
+{
+    int lo = i - w + 1 > 0 ? i - w + 1 : 0;
+    int v = 0, k;
+
+    while (!bn_bit(exp, lo)) {
+        lo++;
+    }
+    for (k = i; k >= lo; k--) {
+        v = 2 * v + bn_bit(exp, k);
+    }
+    *len = i - lo + 1;
+    return v;
+}
+
+/* -------------------------------------------------------------------------
+ * mod_pow_1 — bn_mod_pow_mont for a one-limb modulus, where the limb
+ * arrays and loops of mont_mul would cost more than the arithmetic.
+ * The ladder is mont_pow's, on single limbs.
+ * ---------------------------------------------------------------------- */
+static bn_limb mod_pow_1(bn_limb b, const struct bn *exp,
+                         const struct bn_mont *mt)
+{
+    bn_limb tab[1 << (BN_WINDOW_MAX - 1)]; /* odd powers of b, in form */
+    bn_limb m   = mt->m.d[0];
+    bn_limb rr  = mt->rr.n ? mt->rr.d[0] : 0; /* 0 when m = 1 */
+    bn_limb acc = redc_1(rr, m, mt->n0);      /* 1, in form   */
+    bn_limb x2;
+    int     bits = bn_bits(exp), w = pow_window(bits);
+    int     i, k, v, len;
+
+    tab[0] = redc_1((bn_dlimb)b * rr, m, mt->n0);
+    x2     = redc_1((bn_dlimb)tab[0] * tab[0], m, mt->n0);
+    for (k = 1; k < 1 << (w - 1); k++) {
+        tab[k] = redc_1((bn_dlimb)tab[k - 1] * x2, m, mt->n0);
+    }
+
+    for (i = bits - 1; i >= 0; i -= len) {
+        if (!bn_bit(exp, i)) {
+            acc = redc_1((bn_dlimb)acc * acc, m, mt->n0);
+            len = 1;
+            continue;
+        }
+        v = window_at(exp, i, w, &len);
+        if (i == bits - 1) {
+            acc = tab[v >> 1]; /* the first window: no squares yet */
+            continue;
+        }
+        for (k = 0; k < len; k++) {
+            acc = redc_1((bn_dlimb)acc * acc, m, mt->n0);
+        }
+        acc = redc_1((bn_dlimb)acc * tab[v >> 1], m, mt->n0);
+    }
+    return redc_1(acc, m, mt->n0);
+}
+
+/*
+ * mont_enter — x = a·R mod m, padded to n limbs, for a < m.
+ */
+static void mont_enter(const struct bn_mont *mt, bn_limb *x,
+                       const struct bn *a)
+{
+    bn_limb rr[BN_LIMBS / 2]; /* R² mod m, n limbs */
+    int     n = mt->n;
+
+    memset(x, 0, (size_t)n * sizeof(bn_limb));
+    memcpy(x, a->d, (size_t)a->n * sizeof(bn_limb));
+    memset(rr, 0, (size_t)n * sizeof(bn_limb));
+    memcpy(rr, mt->rr.d, (size_t)mt->rr.n * sizeof(bn_limb));
+    mont_mul(mt, x, x, rr);
+}
+
+/* -------------------------------------------------------------------------
+ * mont_pow — acc = x^exp for Montgomery residues, left to right over
+ * sliding windows of pow_window bits.  A zero bit costs one square; a
+ * window of value v (odd) and length l costs l squares and one product
+ * by x^v from the table.  The first window loads the table entry
+ * instead of squaring 1.  'one' is R mod m, the form of 1, which is the
+ * result for a zero exponent.  acc may alias x.
+ * ---------------------------------------------------------------------- */
+static void mont_pow(const struct bn_mont *mt, bn_limb *acc,
+                     const bn_limb *x, const bn_limb *one,
+                     const struct bn *exp)
+{
+    bn_limb tab[1 << (BN_WINDOW_MAX - 1)][BN_LIMBS / 2]; /* odd powers */
+    bn_limb x2[BN_LIMBS / 2];                            /* x²         */
+    size_t  size = (size_t)mt->n * sizeof(bn_limb);
+    int     bits = bn_bits(exp), w = pow_window(bits);
+    int     i, k, v, len;
+
+    memcpy(tab[0], x, size);
+    if (w > 1) {
+        mont_sqr(mt, x2, x);
+        for (k = 1; k < 1 << (w - 1); k++) {
+            mont_mul(mt, tab[k], tab[k - 1], x2);
+        }
+    }
+
+    memcpy(acc, one, size);
+    for (i = bits - 1; i >= 0; i -= len) {
+        if (!bn_bit(exp, i)) {
+            mont_sqr(mt, acc, acc);
+            len = 1;
+            continue;
+        }
+        v = window_at(exp, i, w, &len);
+        if (i == bits - 1) {
+            memcpy(acc, tab[v >> 1], size);
+            continue;
+        }
+        for (k = 0; k < len; k++) {
+            mont_sqr(mt, acc, acc);
+        }
+        mont_mul(mt, acc, acc, tab[v >> 1]);
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * bn_mod_pow_mont — The base enters Montgomery form by one product with
+ * R², the ladder runs on residues, and one product with plain 1 takes
+ * the result out again at the end.
+ * ---------------------------------------------------------------------- */
+void bn_mod_pow_mont(struct bn *r, const struct bn *base,
+                     const struct bn *exp, const struct bn_mont *mt)
+{
+    bn_limb   x[BN_LIMBS / 2];   /* base, Montgomery form       */
+    bn_limb   one[BN_LIMBS / 2]; /* 1, Montgomery form          */
+    bn_limb   acc[BN_LIMBS / 2]; /* result, Montgomery form     */
+    struct bn b;
+    int       n = mt->n;
+
+    bn_mod(&b, base, &mt->m);
+    if (n == 1) {
+        bn_set_u64(r, mod_pow_1(b.n ? b.d[0] : 0, exp, mt));
+        return;
+    }
+    mont_enter(mt, x, &b);
+    bn_set_u64(&b, 1);
+    mont_enter(mt, one, &b);
+    mont_pow(mt, acc, x, one, exp);
+
+    memset(x, 0, (size_t)n * sizeof(bn_limb));
+    x[0] = 1;
+    mont_mul(mt, acc, acc, x);
+    memcpy(r->d, acc, (size_t)n * sizeof(bn_limb));
+    r->n = limbs_norm(r->d, n);
+}
+
+/* -------------------------------------------------------------------------
+ * bn_mod_pow — Montgomery for odd moduli, long division for the rest.
+ * ---------------------------------------------------------------------- */
+int bn_mod_pow(struct bn *r, const struct bn *base, const struct bn *exp,
+               const struct bn *m)
+{
+    struct bn_mont mt;
+
+    if (bn_mont_init(&mt, m) < 0) {
+        return bn_mod_pow_div(r, base, exp, m);
+    }
+    bn_mod_pow_mont(r, base, exp, &mt);
+    return 0;
+}
+
+/* =========================================================================
+ * Primality
+ * ====================================================================== */
+
+/* The primes below 256: trial divisors, and the first few MR bases */
+static const unsigned char small_primes[] = {
+      2,   3,   5,   7,  11,  13,  17,  19,  23,  29,  31,  37,  41,  43,
+     47,  53,  59,  61,  67,  71,  73,  79,  83,  89,  97, 101, 103, 107,
+    109, 113, 127, 131, 137, 139, 149, 151, 157, 163, 167, 173, 179, 181,
+    191, 193, 197, 199, 211, 223, 227, 229, 233, 239, 241, 251
+};
+#define SMALL_PRIMES ((int)sizeof small_primes)
+
+/* Bases that make Miller–Rabin exact below 3.18·10^23 (Sorenson and
+ * Webster), so for every 64-bit n */
+#define MR_U64_BASES 12
+
+/* -------------------------------------------------------------------------
+ * bn_is_prime_u64 — Deterministic Miller–Rabin for 64-bit n.
+ *
+ * Write n − 1 = 2^s·t with t odd.  For a prime n, every base a has
+ * a^t ≡ 1 or a^(2^i·t) ≡ −1 (mod n) for some i < s; a base for which
+ * neither holds proves n composite.  For n < 2^64, the bases 2 to 37
+ * find every composite.  The arithmetic is Montgomery's (redc_1), whose
+ * 128-bit products cannot overflow, and ±1 are compared in that form.
+ * Small factors are divided out first, which settles most composites
+ * and every n below 256².
+ * ---------------------------------------------------------------------- */
+int bn_is_prime_u64(uint64_t n)
+{
+    bn_limb  n0, one, minus_one, rr; /* Montgomery constants      */
+    bn_limb  t, e, x, b;             /* (n − 1) / 2^s, a^t, a^2^k */
+    int      s, i, j;
+
+    if (n < 2) {
+        return 0;
+    }
+    for (i = 0; i < SMALL_PRIMES; i++) {
+        if (n % small_primes[i] == 0) {
+            return n == small_primes[i];
+        }
+    }
+    if (n < 256 * 256) {
+        return 1; /* no factor up to √n */
+    }
+
+    n0 = n;                              /* −n⁻¹ mod 2^64, as in */
+    for (i = 0; i < 5; i++) {            /* bn_mont_init         */
+        n0 *= 2 - n * n0;
+    }
+    n0        = 0 - n0;
+    one       = (0 - n) % n;             /* R mod n = 2^64 mod n */
+    minus_one = n - one;
+    rr        = (bn_limb)((bn_dlimb)one * one % n);
+
+    t = n - 1;
+    for (s = 0; !(t & 1); s++) {
+        t >>= 1;
+    }
+
+    for (i = 0; i < MR_U64_BASES; i++) {
+        /* x = a^t, right to left, with b = a^(2^k) */
+        x = one;
+        b = redc_1((bn_dlimb)small_primes[i] * rr, n, n0);
+        for (e = t; ; ) {
+            if (e & 1) {
+                x = redc_1((bn_dlimb)x * b, n, n0);
+            }
+            e >>= 1;
+            if (e == 0) {
+                break;
+            }
+            b = redc_1((bn_dlimb)b * b, n, n0);
+        }
+
+        if (x == one || x == minus_one) {
+            continue;
+        }
+        for (j = 1; j < s && x != minus_one; j++) {
+            x = redc_1((bn_dlimb)x * x, n, n0);
+        }
+        if (x != minus_one) {
+            return 0; /* a witness */
+        }
+    }
+    return 1;
+}
+
+/*
+ * jacobi_u64 — The Jacobi symbol (a/n) for odd n: 1, -1 or 0.
+ */
+static int jacobi_u64(uint64_t a, uint64_t n)
+{
+    uint64_t t;
+    int      j = 1;
+
+    a %= n;
+    while (a != 0) {
+        while (!(a & 1)) {
+            a >>= 1;
+            if ((n & 7) == 3 || (n & 7) == 5) {
+                j = -j; /* (2/n) = −1 for n ≡ ±3 (mod 8) */
+            }
+        }
+        t = a;
+        a = n;
+        n = t;
+        if ((a & 3) == 3 && (n & 3) == 3) {
+            j = -j; /* reciprocity */
+        }
+        a %= n;
+    }
+    return n == 1 ? j : 0;
+}
+
+/*
+ * is_square — 1 if n is a perfect square: Newton's iteration for ⌊√n⌋
+ * from above, x ← (x + n/x)/2 while it decreases.
+ */
+static int is_square(const struct bn *n)
+{
+    struct bn x, y, q;
+
+    bn_zero(&x);
+    x.n = (bn_bits(n) + 1) / 2 / BN_LIMB_BITS + 1;
+    x.d[x.n - 1] = 1ULL << ((bn_bits(n) + 1) / 2 % BN_LIMB_BITS);
+    for (;;) {
+        bn_divmod(&q, NULL, n, &x);
+        bn_add(&y, &x, &q);
+        bn_shr(&y, &y, 1);
+        if (bn_cmp(&y, &x) >= 0) {
+            break;
+        }
+        bn_copy(&x, &y);
+    }
+    bn_mul(&y, &x, &x);
+    return bn_cmp(&y, n) == 0;
+}
+
+/*
+ * mod_add, mod_sub, mod_half — r = a + b, a − b and a/2 modulo m for
+ * n-limb residues (in Montgomery form or not: all three are linear).
+ * r may alias the operands.
+ */
+static void mod_add(const struct bn_mont *mt, bn_limb *r, const bn_limb *a,
+                    const bn_limb *b)
+{
+    if (limbs_add(r, a, mt->n, b, mt->n) != 0
+        || limbs_cmp(r, mt->n, mt->m.d, mt->n) >= 0) {
+        limbs_sub(r, r, mt->n, mt->m.d, mt->n);
+    }
+}
+
+static void mod_sub(const struct bn_mont *mt, bn_limb *r, const bn_limb *a,
+                    const bn_limb *b)
+{
+    if (limbs_sub(r, a, mt->n, b, mt->n) != 0) {
+        limbs_add(r, r, mt->n, mt->m.d, mt->n);
+    }
+}
+
+static void mod_half(const struct bn_mont *mt, bn_limb *r, const bn_limb *a)
+{
+    bn_limb top = 0;
+    int     i;
+
+    if (a[0] & 1) {
+        top = limbs_add(r, a, mt->n, mt->m.d, mt->n); /* a + m is even */
+    } else if (r != a) {
+        memcpy(r, a, (size_t)mt->n * sizeof(bn_limb));
+    }
+    for (i = 0; i < mt->n - 1; i++) {
+        r[i] = (r[i] >> 1) | (r[i + 1] << (BN_LIMB_BITS - 1));
+    }
+    r[mt->n - 1] = (r[mt->n - 1] >> 1) | (top << (BN_LIMB_BITS - 1));
+}
+
+/*
+ * mont_small — x = v·R mod m for a small signed v, in Montgomery form.
+ */
+static void mont_small(const struct bn_mont *mt, bn_limb *x, long v)
+{
+    struct bn a;
+
+    if (v >= 0) {
+        bn_set_u64(&a, (uint64_t)v);
+    } else {
+        bn_sub_u64(&a, &mt->m, (uint64_t)-v);
+    }
+    mont_enter(mt, x, &a);
+}
+
+/* -------------------------------------------------------------------------
+ * lucas_strong — The strong Lucas probable-prime test, for an odd n of
+ * two limbs or more with no factor below 256 and the constants 'mt'.
+ * Returns 1 if n passes, 0 if it is composite.
+ *
+ * The parameters are Selfridge's: D is the first of 5, −7, 9, −11, ...
+ * with (D/n) = −1, P = 1 and Q = (1 − D)/4.  A square n has no such D,
+ * so the search checks for one after a few tries.  With n + 1 = 2^s·d,
+ * d odd, a prime n has U_d ≡ 0 or V_(d·2^r) ≡ 0 (mod n) for some r < s.
+ *
+ * U_d and V_d come from the bits of d, top first: from k, the doubling
+ * U_2k = U_k·V_k, V_2k = V_k² − 2Q^k, and for a set bit the step to
+ * 2k + 1, U' = (U + V)/2, V' = (D·U + V)/2.  Q^k follows along.  All of
+ * it is in Montgomery form, where zero is still zero.
+ * ---------------------------------------------------------------------- */
+static int lucas_strong(const struct bn *n, const struct bn_mont *mt)
+{
+    bn_limb   u[BN_LIMBS / 2], v[BN_LIMBS / 2], qk[BN_LIMBS / 2];
+    bn_limb   dm[BN_LIMBS / 2], qm[BN_LIMBS / 2], t[BN_LIMBS / 2];
+    struct bn d, one;
+    long      dd = 5;
+    uint64_t  r;
+    int       j, s, i, tries = 0, len = mt->n;
+
+    for (;;) {
+        r = bn_mod_u64(n, (uint64_t)(dd < 0 ? -dd : dd));
+        j = jacobi_u64(r, (uint64_t)(dd < 0 ? -dd : dd));
+        if (j != 0 && (dd < 0 ? -dd : dd) % 4 == 3 && (n->d[0] & 3) == 3) {
+            j = -j; /* (|D|/n) by reciprocity from (n/|D|) */
+        }
+        if (dd < 0 && (n->d[0] & 3) == 3) {
+            j = -j; /* (−1/n) */
+        }
+        if (j == -1) {
+            break;
+        }
+        if (j == 0) {
+            return 0; /* |D| < n shares a factor with it */
+        }
+        if (++tries == 8 && is_square(n)) {
+            return 0;
+        }
+        dd = dd < 0 ? 2 - dd : -dd - 2;
+    }
+
+    bn_set_u64(&one, 1);
+    bn_add(&d, n, &one);
+    for (s = 0; !bn_bit(&d, s); s++) {
+        /* count the factors of 2 in n + 1 */
+    }
+    bn_shr(&d, &d, s);
+
+    mont_small(mt, dm, dd);
+    mont_small(mt, qm, (1 - dd) / 4);
+    mont_enter(mt, u, &one);                             /* U_1 = 1 */
+    memcpy(v, u, (size_t)len * sizeof(bn_limb));         /* V_1 = P */
+    memcpy(qk, qm, (size_t)len * sizeof(bn_limb));       /* Q^1     */
+    for (i = bn_bits(&d) - 2; i >= 0; i--) {
+        mont_mul(mt, u, u, v);
+        mont_sqr(mt, v, v);
+        mod_sub(mt, v, v, qk);
+        mod_sub(mt, v, v, qk);
+        mont_sqr(mt, qk, qk);
+        if (bn_bit(&d, i)) {
+            mont_mul(mt, t, dm, u);
+            mod_add(mt, u, u, v);
+            mod_half(mt, u, u);
+            mod_add(mt, v, v, t);
+            mod_half(mt, v, v);
+            mont_mul(mt, qk, qk, qm);
+        }
+    }
+
+    if (limbs_norm(u, len) == 0 || limbs_norm(v, len) == 0) {
+        return 1;
+    }
+    for (i = 1; i < s; i++) {
+        mont_sqr(mt, v, v);
+        mod_sub(mt, v, v, qk);
+        mod_sub(mt, v, v, qk);
+        if (limbs_norm(v, len) == 0) {
+            return 1;
+        }
+        mont_sqr(mt, qk, qk);
+    }
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ * bn_is_probable_prime — Miller–Rabin as in bn_is_prime_u64, for any
+ * size: numbers of one limb go there; wider ones are divided by the
+ * small primes, tested to the first 'rounds' primes as bases, in
+ * Montgomery form with constants computed once, and then by
+ * lucas_strong.
+ *
+ * Base 2 and the strong Lucas test together are the Baillie–PSW test.
+ * The fixed bases alone could be fooled by a composite built for them,
+ * and n may come from the command line; no composite is known to pass
+ * both kinds of test, though none is proven not to exist.
+ * ---------------------------------------------------------------------- */
+int bn_is_probable_prime(const struct bn *n, int rounds)
+{
+    struct bn_mont mt;
+    bn_limb        one[BN_LIMBS / 2], minus_one[BN_LIMBS / 2];
+    bn_limb        x[BN_LIMBS / 2];
+    struct bn      t, a;
+    int            s, i, j, len;
+
+    if (n->n <= 1) {
+        return bn_is_prime_u64(n->n ? n->d[0] : 0);
+    }
+    for (i = 0; i < SMALL_PRIMES; i++) {
+        if (bn_mod_u64(n, small_primes[i]) == 0) {
+            return 0; /* n > 2^64 is not the small prime itself */
+        }
+    }
+    if (bn_mont_init(&mt, n) < 0) {
+        return -1;
+    }
+    len = mt.n;
+
+    bn_set_u64(&a, 1);
+    mont_enter(&mt, one, &a);
+    limbs_sub(minus_one, n->d, len, one, len);
+
+    bn_sub_u64(&t, n, 1);
+    for (s = 0; !bn_bit(&t, s); s++) {
+        /* count the factors of 2 in n − 1 */
+    }
+    bn_shr(&t, &t, s);
+
+    if (rounds > SMALL_PRIMES) {
+        rounds = SMALL_PRIMES;
+    }
+    if (rounds < 1) {
+        rounds = 1; /* base 2, for Baillie–PSW */
+    }
+    for (i = 0; i < rounds; i++) {
+        bn_set_u64(&a, small_primes[i]);
+        mont_enter(&mt, x, &a);
+        mont_pow(&mt, x, x, one, &t);
+        if (limbs_cmp(x, len, one, len) == 0) {
+            continue;
+        }
+        for (j = 1; j < s && limbs_cmp(x, len, minus_one, len) != 0; j++) {
+            mont_sqr(&mt, x, x);
+        }
+        if (limbs_cmp(x, len, minus_one, len) != 0) {
+            return 0; /* a witness */
+        }
+    }
+    return lucas_strong(n, &mt);
+}
+
+/* =========================================================================
+ * Decimal conversion, 19 digits (one limb's worth) at a time
+ * ====================================================================== */
+
+#define DEC_CHUNK      19
+#define DEC_CHUNK_BASE 10000000000000000000ULL /* 10^19 */
+
+int bn_from_dec(struct bn *r, const char *s)
+{
+    size_t   len = strlen(s), i;
+    size_t   digits;          /* digits in this chunk */
+    bn_limb  chunk, mul, carry;
+    bn_dlimb t;
+    int      j;
+
+    if (len == 0) {
+        return -1;
+    }
+    for (i = 0; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9') {
+            return -1;
+        }
+    }
+    r->n  = 0;
+    digits = len % DEC_CHUNK ? len % DEC_CHUNK : DEC_CHUNK;
+    for (i = 0; i < len; digits = DEC_CHUNK) {
+        chunk = 0;
+        mul   = 1;
+        for (j = 0; j < (int)digits; j++, i++) {
+            chunk = chunk * 10 + (bn_limb)(s[i] - '0');
+            mul  *= 10;
+        }
+        /* r = r · 10^j + chunk */
+        carry = chunk;
+        for (j = 0; j < r->n; j++) {
+            t       = (bn_dlimb)r->d[j] * mul + carry;
+            r->d[j] = (bn_limb)t;
+            carry   = (bn_limb)(t >> 64);
+        }
+        if (carry != 0) {
+            if (r->n == BN_LIMBS) {
+                return -2;
+            }
+            r->d[r->n++] = carry;
+        }
+    }
+    return 0;
+}
+
+char *bn_to_dec(const struct bn *a, char *buf)
+{
+    struct bn x;
+    bn_limb   chunk;
+    char     *p = buf + BN_DEC_MAX - 1; /* digits go right to left */
+    int       j;
+
+    *p = '\0';
+    bn_copy(&x, a);
+    do {
+        chunk = (bn_limb)bn_mod_u64(&x, DEC_CHUNK_BASE);
+        {
+            /* x /= 10^19 */
+            bn_dlimb rem = 0;
+            int      i;
+
+            for (i = x.n - 1; i >= 0; i--) {
+                rem     = (rem << 64) | x.d[i];
+                x.d[i]  = (bn_limb)(rem / DEC_CHUNK_BASE);
+                rem    %= DEC_CHUNK_BASE;
+            }
+            x.n = limbs_norm(x.d, x.n);
+        }
+        for (j = 0; j < DEC_CHUNK && (chunk != 0 || x.n != 0 || j == 0);
+             j++) {
+            *--p   = (char)('0' + chunk % 10);
+            chunk /= 10;
+        }
+    } while (x.n != 0);
+    memmove(buf, p, (size_t)(buf + BN_DEC_MAX - p));
+    return buf;
+}
@@ -0,0 +1,164 @@
+/*
+ * bn.h — Fixed-size arbitrary-precision unsigned integers for rsa.
+ *
+ * A struct bn holds an unsigned integer of up to BN_MAX_BITS bits as an
+ * array of 64-bit limbs, least significant first.  There is no heap
+ * allocation: every value has room for the product of two 4096-bit
+ * numbers, which is the largest thing the RSA code ever builds.
+ *
+ * Products of two limbs are formed in 128 bits (unsigned __int128).
+ * Multiplication is schoolbook for short operands and switches to
+ * Karatsuba and then Toom-3 above tunable thresholds (in limbs).
+ *
+ * Functions that can fail return 0 on success and -1 when the result
+ * does not fit or an argument is invalid; the output is then undefined.
+ * Outputs may alias inputs.
+ *
+ * Compilation: built together with rsa.c (see rsa.c).
+ */
+
+#ifndef BN_H
+#define BN_H
+
+#include <stddef.h> /* size_t   */
+#include <stdint.h> /* uint64_t */
+
+/* Limb size, and the largest value a struct bn can hold */
+#define BN_LIMB_BITS 64
+#define BN_MAX_BITS  8192
+#define BN_LIMBS     (BN_MAX_BITS / BN_LIMB_BITS)
+
+/* Buffer size for bn_to_dec: the digits of 2^8192, and a NUL */
+#define BN_DEC_MAX 2470
+
+typedef uint64_t bn_limb;
+
+struct bn {
+    int     n;            /* limbs in use; d[n - 1] != 0, n = 0 for zero */
+    bn_limb d[BN_LIMBS];  /* limbs, least significant first              */
+};
+
+/*
+ * Operand sizes (in limbs) from which bn_mul uses Karatsuba and Toom-3.
+ * Defaults come from rsabench --tune on x86-64; a program may change
+ * them before multiplying.
+ */
+extern int bn_karatsuba_threshold;
+extern int bn_toom3_threshold;
+
+/*
+ * Window width, in exponent bits, of the sliding-window exponentiation
+ * in bn_mod_pow and bn_mod_pow_mont: 1 to BN_WINDOW_MAX, or 0 (the
+ * default) to choose it from the length of each exponent.
+ */
+#define BN_WINDOW_MAX 6
+extern int bn_pow_window;
+
+/* Setting, copying and inspecting */
+void bn_zero(struct bn *r);
+void bn_set_u64(struct bn *r, uint64_t v);
+void bn_copy(struct bn *r, const struct bn *a);
+int  bn_is_zero(const struct bn *a);
+int  bn_is_odd(const struct bn *a);
+int  bn_bits(const struct bn *a);               /* 0 for zero           */
+int  bn_bit(const struct bn *a, int i);         /* bit i, 0 or 1        */
+int  bn_cmp(const struct bn *a, const struct bn *b); /* -1, 0 or 1     */
+int  bn_cmp_u64(const struct bn *a, uint64_t v);
+
+/* Arithmetic */
+int  bn_add(struct bn *r, const struct bn *a, const struct bn *b);
+int  bn_sub(struct bn *r, const struct bn *a, const struct bn *b); /* a>=b */
+int  bn_sub_u64(struct bn *r, const struct bn *a, uint64_t v);
+int  bn_mul(struct bn *r, const struct bn *a, const struct bn *b);
+void bn_shr(struct bn *r, const struct bn *a, int bits);
+
+/*
+ * bn_divmod — q = a / b and r = a mod b.  Either output may be NULL.
+ * Returns -1 if b is zero.
+ */
+int bn_divmod(struct bn *q, struct bn *r, const struct bn *a,
+              const struct bn *b);
+int bn_mod(struct bn *r, const struct bn *a, const struct bn *m);
+uint64_t bn_mod_u64(const struct bn *a, uint64_t m);  /* m != 0 */
+
+/* Number theory */
+void bn_gcd(struct bn *r, const struct bn *a, const struct bn *b);
+
+/*
+ * bn_mod_inv — r = a⁻¹ mod m, the x in [0, m) with a·x ≡ 1 (mod m).
+ * Returns -1 if there is none (gcd(a, m) ≠ 1, or m is zero) or m is
+ * wider than BN_MAX_BITS / 2.
+ */
+int bn_mod_inv(struct bn *r, const struct bn *a, const struct bn *m);
+
+/*
+ * bn_is_prime_u64 — 1 if n is prime, else 0.  Exact (deterministic
+ * Miller–Rabin) for every 64-bit n.
+ */
+int bn_is_prime_u64(uint64_t n);
+
+/*
+ * bn_is_probable_prime — 1 if n is prime, 0 if it is composite, for n
+ * of up to 64 bits exactly.  Wider n are tested by Miller–Rabin to the
+ * first 'rounds' primes as bases (1 to 54) and then by a strong Lucas
+ * test, which with base 2 is Baillie–PSW: no composite is known to
+ * pass, but that is not proven.  Returns -1 if n is wider than
+ * BN_MAX_BITS / 2.
+ */
+int bn_is_probable_prime(const struct bn *n, int rounds);
+
+/*
+ * bn_mod_pow — r = base^exp mod m.  Returns -1 if m is zero or wider
+ * than BN_MAX_BITS / 2.  Odd moduli (every RSA modulus and prime) go
+ * through Montgomery multiplication; even ones through bn_mod_pow_div.
+ */
+int bn_mod_pow(struct bn *r, const struct bn *base, const struct bn *exp,
+               const struct bn *m);
+
+/*
+ * bn_mod_pow_div — bn_mod_pow by plain multiplication and long
+ * division after every step, for any modulus.
+ */
+int bn_mod_pow_div(struct bn *r, const struct bn *base,
+                   const struct bn *exp, const struct bn *m);
+
+/*
+ * Montgomery arithmetic modulo an odd m of n limbs, with R = 2^(64·n).
+ * A residue x is represented as x·R mod m, in which form the product
+ * of two residues can be reduced without division (REDC).  The
+ * constants depend only on m and can be computed once and kept.
+ */
+struct bn_mont {
+    int       n;    /* limbs in m                  */
+    bn_limb   n0;   /* −m⁻¹ mod 2^64               */
+    struct bn m;    /* the modulus                 */
+    struct bn rr;   /* R² mod m, to enter the form */
+};
+
+/*
+ * bn_mont_init — Computes the constants for 'm'.  Returns -1 if m is
+ * even, or wider than BN_MAX_BITS / 2.
+ */
+int bn_mont_init(struct bn_mont *mt, const struct bn *m);
+
+/*
+ * bn_mod_pow_mont — r = base^exp mod mt->m, staying in Montgomery form
+ * from the first step to the last, over sliding windows of odd powers
+ * of the base.
+ */
+void bn_mod_pow_mont(struct bn *r, const struct bn *base,
+                     const struct bn *exp, const struct bn_mont *mt);
+
+/*
+ * bn_from_dec — Parses a string of decimal digits.  Returns 0, -1 if it
+ * holds anything else (or nothing), or -2 if the value does not fit.
+ */
+int bn_from_dec(struct bn *r, const char *s);
+
+/*
+ * bn_to_dec — Writes a in decimal into buf (BN_DEC_MAX bytes) and
+ * returns buf.
+ */
+char *bn_to_dec(const struct bn *a, char *buf);
+
+#endif /* BN_H */
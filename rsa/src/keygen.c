@@ -0,0 +1,271 @@
+/*
+ * keygen.c — Generation of RSA keys (see keygen.h).
+ *
+ * Compilation: built together with rsa.c (see rsa.c), with -pthread.
+ */
+
+#include <pthread.h> /* pthread_create, pthread_mutex_lock */
+#include <stdio.h>   /* fopen, fread                       */
+#include <string.h>  /* memset                             */
+#include <unistd.h>  /* sysconf                            */
+
+#include "keygen.h"
+
+/* The sieve strikes out multiples of the odd primes below SIEVE_LIMIT */
+#define SIEVE_LIMIT 32768
+
+/* Candidates per sieve window: start + 2k for k < SIEVE_LEN */
+#define SIEVE_LEN 4096
+
+/*
+ * Miller–Rabin bases per candidate: as many as rsa's own check, and
+ * the same ones, so that no generated prime is later rejected.
+ */
+#define KEYGEN_ROUNDS 16
+
+/* Most threads a search runs */
+#define MAX_THREADS 64
+
+/* The odd primes below SIEVE_LIMIT (3511 of them), filled once */
+static unsigned short sieve_primes[SIEVE_LIMIT / 4];
+static int            sieve_count;
+
+/* A search for one prime, shared by its threads */
+struct search {
+    int             bits;   /* size of the prime                   */
+    pthread_mutex_t lock;   /* guards the fields below             */
+    int             done;   /* set by the first thread to finish   */
+    int             failed; /* it finished for lack of random data */
+    struct bn       found;  /* the prime, if it did not fail       */
+};
+
+/* -------------------------------------------------------------------------
+ * init_primes — Fills sieve_primes by the sieve of Eratosthenes over
+ * the odd numbers; comp[i] stands for 2i + 1.
+ * ---------------------------------------------------------------------- */
+static void init_primes(void)
+{
+    static unsigned char comp[SIEVE_LIMIT / 2];
+    int                  i, j;
+
+    if (sieve_count > 0) {
+        return;
+    }
+    for (i = 1; i < SIEVE_LIMIT / 2; i++) {
+        if (comp[i]) {
+            continue;
+        }
+        sieve_primes[sieve_count++] = (unsigned short)(2 * i + 1);
+        for (j = 2 * i * (i + 1); j < SIEVE_LIMIT / 2; j += 2 * i + 1) {
+            comp[j] = 1; /* from (2i + 1)², odd multiples only */
+        }
+    }
+}
+
+/* -------------------------------------------------------------------------
+ * random_start — Sets 'a' to a random odd number of exactly 'bits'
+ * bits with the top two set, so that the product of two such numbers
+ * has all the bits of theirs together.  Returns -1 if 'rnd' runs dry.
+ * ---------------------------------------------------------------------- */
+static int random_start(struct bn *a, int bits, FILE *rnd)
+{
+    int top = (bits - 1) % BN_LIMB_BITS; /* the top bit, in its limb */
+
+    a->n = (bits + BN_LIMB_BITS - 1) / BN_LIMB_BITS;
+    if (fread(a->d, sizeof(bn_limb), (size_t)a->n, rnd) != (size_t)a->n) {
+        return -1;
+    }
+    if (top < BN_LIMB_BITS - 1) {
+        a->d[a->n - 1] &= (2ULL << top) - 1;
+    }
+    a->d[a->n - 1] |= 1ULL << top;
+    if (top > 0) {
+        a->d[a->n - 1] |= 1ULL << (top - 1);
+    } else {
+        a->d[a->n - 2] |= 1ULL << (BN_LIMB_BITS - 1);
+    }
+    a->d[0] |= 1;
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ * sieve_window — Marks in 'sieve' each k < SIEVE_LEN for which
+ * start + 2k has a factor among sieve_primes.
+ *
+ * For the prime f, with r = start mod f, the multiples are the k with
+ * 2k ≡ −r (mod f), that is k ≡ (f − r)·(f + 1)/2, as (f + 1)/2 is the
+ * inverse of 2; from there every f-th k is one too.  One remainder per
+ * prime replaces a division per candidate.
+ * ---------------------------------------------------------------------- */
+static void sieve_window(unsigned char *sieve, const struct bn *start)
+{
+    unsigned long f, r, k;
+    int           i;
+
+    memset(sieve, 0, SIEVE_LEN);
+    for (i = 0; i < sieve_count; i++) {
+        f = sieve_primes[i];
+        r = (unsigned long)bn_mod_u64(start, f);
+        for (k = (f - r) % f * ((f + 1) / 2) % f; k < SIEVE_LEN; k += f) {
+            sieve[k] = 1;
+        }
+    }
+}
+
+/*
+ * stopped — 1 once some thread has finished the search.
+ */
+static int stopped(struct search *s)
+{
+    int done;
+
+    pthread_mutex_lock(&s->lock);
+    done = s->done;
+    pthread_mutex_unlock(&s->lock);
+    return done;
+}
+
+/*
+ * finish — Ends the search with 'p', or as failed if it is NULL, unless
+ * another thread got there first.
+ */
+static void finish(struct search *s, const struct bn *p)
+{
+    pthread_mutex_lock(&s->lock);
+    if (!s->done) {
+        s->done = 1;
+        if (p != NULL) {
+            bn_copy(&s->found, p);
+        } else {
+            s->failed = 1;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+/* -------------------------------------------------------------------------
+ * search_thread — One thread of a search: sieves a window from a random
+ * start and tests its surviving candidates until a prime turns up or
+ * another thread has one.  The flag is checked before every
+ * Miller–Rabin test, the only slow step, so the losing threads stop
+ * within one exponentiation.
+ *
+ * A candidate p with p mod e = 1 is passed over: e would then divide
+ * p − 1 and so φ(N), and have no inverse.
+ * ---------------------------------------------------------------------- */
+static void *search_thread(void *arg)
+{
+    struct search *s = arg;
+    unsigned char  sieve[SIEVE_LEN];
+    struct bn      start, cand, off;
+    FILE          *rnd;
+    int            k;
+
+    rnd = fopen("/dev/urandom", "rb");
+    if (rnd == NULL) {
+        finish(s, NULL);
+        return NULL;
+    }
+    while (!stopped(s)) {
+        if (random_start(&start, s->bits, rnd) < 0) {
+            finish(s, NULL);
+            break;
+        }
+        sieve_window(sieve, &start);
+        for (k = 0; k < SIEVE_LEN && !stopped(s); k++) {
+            if (sieve[k]) {
+                continue;
+            }
+            bn_set_u64(&off, 2 * (uint64_t)k);
+            bn_add(&cand, &start, &off);
+            if (bn_bits(&cand) != s->bits) {
+                break; /* ran past the top: start again */
+            }
+            if (bn_mod_u64(&cand, KEYGEN_E) == 1) {
+                continue;
+            }
+            if (bn_is_probable_prime(&cand, KEYGEN_ROUNDS) == 1) {
+                finish(s, &cand);
+                break;
+            }
+        }
+    }
+    fclose(rnd);
+    return NULL;
+}
+
+/* -------------------------------------------------------------------------
+ * find_prime — A random 'bits'-bit prime by a search on 'threads'
+ * threads.  Returns -1 if no thread could start or the random data ran
+ * out.
+ * ---------------------------------------------------------------------- */
+static int find_prime(struct bn *p, int bits, int threads)
+{
+    pthread_t     tid[MAX_THREADS];
+    struct search s;
+    int           i, started = 0;
+
+    memset(&s, 0, sizeof s);
+    s.bits = bits;
+    pthread_mutex_init(&s.lock, NULL);
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&tid[started], NULL, search_thread, &s) == 0) {
+            started++;
+        }
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    pthread_mutex_destroy(&s.lock);
+    if (started == 0 || s.failed) {
+        return -1;
+    }
+    bn_copy(p, &s.found);
+    return 0;
+}
+
+int rsa_keygen_cores(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n < 1 ? 1 : n > MAX_THREADS ? MAX_THREADS : (int)n;
+}
+
+/* -------------------------------------------------------------------------
+ * rsa_keygen — p takes the larger half of the bits when they are odd.
+ * A q equal to p is drawn again; with primes of 32 bits or more it
+ * practically never is.
+ * ---------------------------------------------------------------------- */
+int rsa_keygen(struct bn *e, struct bn *d, struct bn *p, struct bn *q,
+               int bits, int threads)
+{
+    struct bn phi, t;
+
+    if (bits < KEYGEN_MIN_BITS || bits > BN_MAX_BITS / 2) {
+        return -1;
+    }
+    if (threads <= 0) {
+        threads = rsa_keygen_cores();
+    }
+    if (threads > MAX_THREADS) {
+        threads = MAX_THREADS;
+    }
+    init_primes();
+
+    if (find_prime(p, bits - bits / 2, threads) < 0) {
+        return -2;
+    }
+    do {
+        if (find_prime(q, bits / 2, threads) < 0) {
+            return -2;
+        }
+    } while (bn_cmp(p, q) == 0);
+
+    bn_set_u64(e, KEYGEN_E);
+    bn_sub_u64(&phi, p, 1);
+    bn_sub_u64(&t, q, 1);
+    bn_mul(&phi, &phi, &t);
+    /* e is prime and divides neither p − 1 nor q − 1: the inverse exists */
+    bn_mod_inv(d, e, &phi);
+    return 0;
+}
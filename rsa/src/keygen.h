@@ -0,0 +1,47 @@
+/*
+ * keygen.h — Generation of RSA keys.
+ *
+ * rsa_keygen draws two random primes p and q whose product N has
+ * exactly the requested number of bits, with the public exponent
+ * e = 65537, and derives d = e⁻¹ mod φ(N) by the extended Euclidean
+ * algorithm (bn_mod_inv).  The result passes every check rsa makes on
+ * a key given on its command line.
+ *
+ * Each prime is found by an incremental search: from a random odd
+ * start, the candidates start + 2k are first sieved against the small
+ * primes, and only those without a small factor go through
+ * Miller–Rabin.  The search runs on several threads at once, each from
+ * its own start, and the first thread to find a prime stops the others.
+ *
+ * Random numbers come from /dev/urandom.
+ *
+ * Compilation: built together with rsa.c (see rsa.c), with -pthread.
+ */
+
+#ifndef KEYGEN_H
+#define KEYGEN_H
+
+#include "bn.h"
+
+/* The public exponent of generated keys */
+#define KEYGEN_E 65537
+
+/* Smallest key, in bits of N: the primes must be above the sieve's */
+#define KEYGEN_MIN_BITS 64
+
+/*
+ * rsa_keygen_cores — The number of threads rsa_keygen runs when asked
+ * for 0: one per online processor.
+ */
+int rsa_keygen_cores(void);
+
+/*
+ * rsa_keygen — Generates a key with a 'bits'-bit N on 'threads' threads
+ * (0 for one per processor).  Returns 0, -1 if 'bits' is outside
+ * KEYGEN_MIN_BITS to BN_MAX_BITS / 2, or -2 if /dev/urandom cannot be
+ * read or a thread cannot be started.
+ */
+int rsa_keygen(struct bn *e, struct bn *d, struct bn *p, struct bn *q,
+               int bits, int threads);
+
+#endif /* KEYGEN_H */
@@ -1,13 +1,23 @@
 /*
  * rsa.c — RSA encryption and decryption tool
  *
- * Usage: ./rsa enc|dec <pub_exp> <priv_exp> <prime1> <prime2>
+ * Usage: ./rsa [--batch] enc|dec <pub_exp> <priv_exp> <prime1> <prime2>
+ *        ./rsa [--batch] enc|dec --key <keyfile>
+ *        ./rsa keycompile <pub_exp> <priv_exp> <prime1> <prime2> <keyfile>
+ *        ./rsa keygen <bits> <keyfile>
  *
  * Reads a single integer message from stdin and encrypts or decrypts it
- * using the RSA algorithm.
+ * using the RSA algorithm.  With --batch it reads one message per line
+ * until the end of stdin instead, validating the key only once, and
+ * reports the throughput on stderr (see batch.h).  "keygen" generates
+ * a key with a 'bits'-bit N (see keygen.h) and writes e, d, p and q to
+ * 'keyfile', one per line, so that "./rsa enc $(cat keyfile)" uses it.
+ * "keycompile" checks a key as enc and dec do and saves it with all its
+ * constants in a binary file (see rsakey.h); "--key" maps that file
+ * instead of taking the key's numbers, and skips the checks.
  *
  *   Encryption:  c = m^e mod N   (where N = p * q)
- *   Decryption:  m = c^d mod N
+ *   Decryption:  m = c^d mod N   (computed mod p and mod q, see rsakey.h)
  *
  * The program validates all RSA constraints before proceeding:
  *   - All parameters must be positive
@@ -16,194 +26,475 @@
  *   - e * d mod phi(N) must equal 1
  *   - The message must be smaller than N
  *
- * Uses modular exponentiation (repeated squaring) for efficiency.
+ * All numbers are arbitrary-precision integers from bn.c, so real key
+ * sizes work: N may be up to 4096 bits.  Uses modular exponentiation
+ * (repeated squaring, in Montgomery form) for efficiency.
  *
  * Compilation:
- *   gcc -O3 -Wall -Wextra -Werror -pedantic -o rsa rsa.c
+ *   gcc -O3 -Wall -Wextra -Werror -pedantic -o rsa rsa.c rsakey.c \
+ *       keygen.c batch.c bn.c -pthread
  */
 
-#include <stdio.h>   /* printf, fprintf, scanf */
-#include <stdlib.h>  /* strtoll, exit */
+#include <ctype.h>   /* isdigit, isspace */
+#include <fcntl.h>   /* open */
+#include <stdio.h>   /* printf, fprintf, getchar, fdopen */
 #include <string.h>  /* strcmp */
+#include <time.h>    /* clock_gettime */
+#include <unistd.h>  /* close */
+
+#include "batch.h"
+#include "bn.h"
+#include "keygen.h"
+#include "rsakey.h"
+
+/* Largest modulus: bn_mod_pow needs room for the square of a residue */
+#define MAX_N_BITS (BN_MAX_BITS / 2)
+
+/* Results of parse_number */
+#define NUM_OK        0
+#define NUM_INVALID  -1  /* not an integer                   */
+#define NUM_NEGATIVE -2  /* negative, or zero                */
+#define NUM_TOO_BIG  -3  /* does not fit in BN_MAX_BITS bits */
 
 /* -------------------------------------------------------------------------
- * is_prime — Primality test by trial division.
+ * parse_number — Parses a command-line parameter.
  *
- * Returns 1 if 'n' is prime, 0 otherwise.
- * Works for all values in the 64-bit positive range.
- * Optimises by testing 2 and 3 first, then only 6k ± 1.
+ * Accepts optional leading white space, an optional sign and decimal
+ * digits, like strtoll did; an empty string reads as zero.  Returns
+ * NUM_OK with the value in 'r', or one of the NUM_* errors.  Zero is
+ * reported as NUM_NEGATIVE since every parameter must be positive.
  * ---------------------------------------------------------------------- */
-static int is_prime(long long n)
+static int parse_number(const char *s, struct bn *r)
 {
-    long long i; /* trial divisor */
+    int neg = 0; /* a '-' was given */
 
-    if (n < 2) {
-        return 0; /* 0 and 1 are not prime */
+    while (isspace((unsigned char)*s)) {
+        s++;
     }
-    if (n < 4) {
-        return 1; /* 2 and 3 are prime */
+    if (*s == '+' || *s == '-') {
+        neg = (*s == '-');
+        s++;
+        if (*s == '\0') {
+            return NUM_INVALID; /* a sign and nothing after it */
+        }
     }
-    if (n % 2 == 0 || n % 3 == 0) {
-        return 0; /* divisible by 2 or 3 → composite */
+    if (*s == '\0') {
+        return NUM_NEGATIVE; /* "" is 0 */
     }
 
-    /*
-     * Every prime > 3 can be written as 6k ± 1.
-     * Test divisors of that form up to √n.
-     * i*i <= n avoids computing the square root explicitly.
-     */
-    for (i = 5; i * i <= n; i += 6) {
-        if (n % i == 0 || n % (i + 2) == 0) {
-            return 0; /* found a divisor → composite */
-        }
+    switch (bn_from_dec(r, s)) {
+    case -1:
+        return NUM_INVALID;
+    case -2:
+        return neg ? NUM_NEGATIVE : NUM_TOO_BIG;
+    default:
+        break;
     }
-
-    return 1; /* no divisor found → prime */
+    if (neg || bn_is_zero(r)) {
+        return NUM_NEGATIVE;
+    }
+    return NUM_OK;
 }
 
 /* -------------------------------------------------------------------------
- * gcd — Greatest Common Divisor via the Euclidean algorithm.
+ * is_prime — Primality test for parameters of any size.
+ *
+ * Returns 1 if 'n' is prime, 0 otherwise.
  *
- * Returns gcd(a, b).  Both inputs must be non-negative.
+ * Both paths are Miller–Rabin (see bn.c), after trial division by the
+ * primes below 256.  For values that fit in 64 bits a fixed set of 12
+ * bases is known to catch every composite, so the answer is exact —
+ * in microseconds, where trial division up to √n took seconds near
+ * 2^64.  Wider values are tested to MR_BASES bases and then by a
+ * strong Lucas test.  The bases are fixed, so they alone could be
+ * fooled by a p or q built for them; the Lucas test makes it
+ * Baillie–PSW, which no known composite passes.  Values too wide to
+ * test count as prime here; the limit on N rejects them right after.
  * ---------------------------------------------------------------------- */
-static long long gcd(long long a, long long b)
+#define MR_BASES 16
+
+static int is_prime(const struct bn *n)
 {
-    long long temp; /* holds the remainder during the swap */
+    return bn_is_probable_prime(n, MR_BASES) != 0;
+}
 
-    while (b != 0) {
-        temp = b;       /* save divisor */
-        b    = a % b;   /* remainder becomes the new divisor */
-        a    = temp;     /* old divisor becomes the new dividend */
+/* -------------------------------------------------------------------------
+ * read_message — Reads the message from stdin.
+ *
+ * Like scanf("%lld"): skips white space, takes an optional sign, then
+ * decimal digits up to the first non-digit.  Returns NUM_OK, NUM_INVALID
+ * if there are no digits, NUM_NEGATIVE for a negative value, or
+ * NUM_TOO_BIG if it has more digits than any N can.
+ * ---------------------------------------------------------------------- */
+static int read_message(struct bn *m)
+{
+    char digits[BN_DEC_MAX]; /* significant digits, NUL-terminated */
+    int  len = 0;            /* digits stored                      */
+    int  any = 0;            /* saw at least one digit             */
+    int  neg = 0;            /* a '-' was given                    */
+    int  c;
+
+    do {
+        c = getchar();
+    } while (c != EOF && isspace(c));
+    if (c == '+' || c == '-') {
+        neg = (c == '-');
+        c   = getchar();
+    }
+    for (; c != EOF && isdigit(c); c = getchar()) {
+        any = 1;
+        if (len == 0 && c == '0') {
+            continue; /* leading zeros */
+        }
+        if (len == BN_DEC_MAX - 1) {
+            return NUM_TOO_BIG;
+        }
+        digits[len++] = (char)c;
+    }
+    if (!any) {
+        return NUM_INVALID;
+    }
+    if (len == 0) {
+        bn_zero(m);
+        return NUM_OK; /* "-0" is zero too */
     }
+    if (neg) {
+        return NUM_NEGATIVE;
+    }
+    digits[len] = '\0';
+    return bn_from_dec(m, digits) == 0 ? NUM_OK : NUM_TOO_BIG;
+}
+
+/* -------------------------------------------------------------------------
+ * seconds_since — Seconds on the monotonic clock since 't0'.
+ * ---------------------------------------------------------------------- */
+static double seconds_since(const struct timespec *t0)
+{
+    struct timespec t1;
 
-    return a; /* when b reaches 0, a holds the GCD */
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double)(t1.tv_sec - t0->tv_sec)
+           + (double)(t1.tv_nsec - t0->tv_nsec) / 1e9;
 }
 
 /* -------------------------------------------------------------------------
- * mod_pow — Modular exponentiation by repeated squaring.
+ * write_key — Writes e, d, p and q to 'path', one per line in decimal.
  *
- * Computes (base^exp) mod mod efficiently in O(log exp) multiplications.
- * All intermediate products are kept below mod^2 by reducing after each
- * multiplication, which fits in a 64-bit unsigned long long as long as
- * mod < 2^32.
- *
- * Uses unsigned long long internally to avoid signed overflow when
- * multiplying two values that are each less than mod.
+ * The file holds a private key, so it is created readable by its owner
+ * only.  Returns 0, or -1 if it cannot be written.
  * ---------------------------------------------------------------------- */
-static long long mod_pow(long long base, long long exp, long long mod)
+static int write_key(const char *path, const struct bn *e,
+                     const struct bn *d, const struct bn *p,
+                     const struct bn *q)
 {
-    unsigned long long result; /* accumulated result */
-    unsigned long long b;     /* working copy of the base */
-    long long e;              /* working copy of the exponent */
+    char  out[BN_DEC_MAX]; /* a number in decimal */
+    FILE *f;
+    int   fd, ok;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    f = fdopen(fd, "w");
+    if (f == NULL) {
+        close(fd);
+        return -1;
+    }
+    fprintf(f, "%s\n", bn_to_dec(e, out));
+    fprintf(f, "%s\n", bn_to_dec(d, out));
+    fprintf(f, "%s\n", bn_to_dec(p, out));
+    fprintf(f, "%s\n", bn_to_dec(q, out));
+    ok = !ferror(f);
+    return (fclose(f) == 0 && ok) ? 0 : -1;
+}
 
-    if (mod == 1) {
-        return 0; /* anything mod 1 is 0 */
+/* -------------------------------------------------------------------------
+ * keygen — The "keygen <bits> <keyfile>" mode: generates a key, writes
+ * it and reports how long the generation took.  Returns the exit
+ * status.
+ * ---------------------------------------------------------------------- */
+static int keygen(int argc, char *argv[])
+{
+    struct bn       e, d, p, q; /* the new key               */
+    struct bn       bits;       /* size of N, as given       */
+    struct timespec t0;         /* start of the generation   */
+    double          secs;
+    int             threads = rsa_keygen_cores();
+
+    if (argc != 4) {
+        fprintf(stderr, "Usage: %s keygen <bits> <keyfile>\n", argv[0]);
+        return 1;
+    }
+    if (parse_number(argv[2], &bits) != NUM_OK
+        || bn_cmp_u64(&bits, KEYGEN_MIN_BITS) < 0
+        || bn_cmp_u64(&bits, MAX_N_BITS) > 0) {
+        fprintf(stderr, "Key size must be from %d to %d bits\n",
+                KEYGEN_MIN_BITS, MAX_N_BITS);
+        return 1;
     }
 
-    result = 1;
-    b      = (unsigned long long)(base % mod); /* reduce base first */
-    e      = exp;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (rsa_keygen(&e, &d, &p, &q, (int)bits.d[0], threads) < 0) {
+        fprintf(stderr, "Cannot read random numbers or start threads\n");
+        return 1;
+    }
+    secs = seconds_since(&t0);
 
-    /*
-     * Repeated squaring: examine each bit of the exponent from LSB to MSB.
-     * If the current bit is 1, multiply result by the current power of base.
-     * Then square the base for the next bit position.
-     */
-    while (e > 0) {
-        if (e % 2 == 1) {
-            result = (result * b) % (unsigned long long)mod; /* odd bit → multiply */
-        }
-        e = e / 2;                                             /* shift exponent right */
-        b = (b * b) % (unsigned long long)mod;                 /* square the base */
+    if (write_key(argv[3], &e, &d, &p, &q) < 0) {
+        fprintf(stderr, "Cannot write %s\n", argv[3]);
+        return 1;
     }
+    printf("%d-bit key written to %s in %.3f s (%d thread%s)\n",
+           (int)bits.d[0], argv[3], secs, threads,
+           threads == 1 ? "" : "s");
+    return 0;
+}
 
-    return (long long)result;
+/* -------------------------------------------------------------------------
+ * batch — The --batch mode, once the key is validated: streams stdin
+ * through rsa_batch on one worker per core and reports the throughput.
+ * A failing message is reported with its line number, as a single
+ * message would be.  Returns the exit status.
+ * ---------------------------------------------------------------------- */
+static int batch(const struct rsa_key *key, int decrypt)
+{
+    struct batch_stats st;      /* messages done, failing line */
+    struct timespec    t0;      /* start of the batch          */
+    double             secs;
+    int                threads = rsa_keygen_cores();
+    int                rc;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    rc   = rsa_batch(key, decrypt, stdin, stdout, threads, &st);
+    secs = seconds_since(&t0);
+
+    switch (rc) {
+    case BATCH_OK:
+        break;
+    case BATCH_INVALID:
+        fprintf(stderr, "Line %ld: Failed to read message\n", st.line);
+        return 1;
+    case BATCH_NEGATIVE:
+        fprintf(stderr, "Line %ld: Negative numbers are not allowed\n",
+                st.line);
+        return 1;
+    case BATCH_TOO_BIG:
+        fprintf(stderr, "Line %ld: Message is larger than N\n", st.line);
+        return 1;
+    case BATCH_FAULT:
+        fprintf(stderr, "Line %ld: Decryption failed its consistency "
+                "check\n", st.line);
+        return 1;
+    default:
+        fprintf(stderr, "Cannot start threads or write the results\n");
+        return 1;
+    }
+    fprintf(stderr, "%ld message%s in %.3f s: %.0f messages/s "
+            "(%d thread%s)\n", st.messages, st.messages == 1 ? "" : "s",
+            secs, secs > 0 ? (double)st.messages / secs : 0.0, threads,
+            threads == 1 ? "" : "s");
+    return 0;
 }
 
-/* =========================================================================
- * main
- * ====================================================================== */
-int main(int argc, char *argv[])
+/* -------------------------------------------------------------------------
+ * single — Steps 9 to 12 for one message from stdin, once the key is
+ * ready.  Returns the exit status.
+ * ---------------------------------------------------------------------- */
+static int single(const struct rsa_key *key, int decrypt)
 {
-    long long e, d, p, q;   /* RSA parameters from command line */
-    long long m;             /* message read from stdin */
-    long long n_val;         /* N = p * q (the RSA modulus) */
-    long long phi;           /* phi(N) = (p - 1) * (q - 1) */
-    long long result;        /* encrypted or decrypted output */
-    char *endptr;            /* used by strtoll for validation */
+    struct bn m;             /* message read from stdin */
+    struct bn result;        /* encrypted or decrypted output */
+    char out[BN_DEC_MAX];    /* result in decimal */
 
     /* ------------------------------------------------------------------ */
-    /* 1. Validate argument count                                          */
+    /* 9. Read the message from standard input                             */
+    /* 10. The message must be positive and smaller than N                  */
     /* ------------------------------------------------------------------ */
 
-    if (argc != 6) {
-        /* Exactly 5 arguments required: op, e, d, p, q */
-        fprintf(stderr,
-                "Usage: %s enc|dec <exp_exp> <priv_exp> <prime1> <prime2>\n",
-                argv[0]);
+    switch (read_message(&m)) {
+    case NUM_INVALID:
+        /* Could not read an integer from stdin */
+        fprintf(stderr, "Failed to read message\n");
+        return 1;
+    case NUM_NEGATIVE:
+        fprintf(stderr, "Negative numbers are not allowed\n");
+        return 1;
+    case NUM_TOO_BIG:
+        fprintf(stderr, "Message is larger than N\n");
+        return 1;
+    default:
+        break;
+    }
+
+    if (bn_cmp(&m, &key->n) >= 0) {
+        /* RSA can only encrypt messages in the range [0, N-1] */
+        fprintf(stderr, "Message is larger than N\n");
         return 1;
     }
 
     /* ------------------------------------------------------------------ */
-    /* 2. Check the operation flag                                         */
+    /* 11. Perform encryption or decryption                                */
     /* ------------------------------------------------------------------ */
 
-    if (strcmp(argv[1], "enc") != 0 && strcmp(argv[1], "dec") != 0) {
-        /* First argument must be either "enc" or "dec" */
-        fprintf(stderr, "First argument must be 'enc' or 'dec'\n");
+    if (!decrypt) {
+        /* Encrypt: c = m^e mod N */
+        rsa_encrypt(key, &result, &m);
+    } else if (rsa_decrypt(key, &result, &m) < 0) {
+        /* Decrypt: m = c^d mod N, by the CRT modulo p and q */
+        fprintf(stderr, "Decryption failed its consistency check\n");
         return 1;
     }
 
     /* ------------------------------------------------------------------ */
-    /* 3. Parse numeric arguments from the command line                     */
+    /* 12. Print the result and exit                                        */
     /* ------------------------------------------------------------------ */
 
-    e = strtoll(argv[2], &endptr, 10); /* public exponent */
-    if (*endptr != '\0') {
-        fprintf(stderr,
-                "Usage: %s enc|dec <exp_exp> <priv_exp> <prime1> <prime2>\n",
-                argv[0]);
+    printf("%s\n", bn_to_dec(&result, out));
+
+    return 0; /* success */
+}
+
+/* -------------------------------------------------------------------------
+ * keyfile — The "enc|dec --key <keyfile>" mode: maps a key compiled by
+ * "keycompile", which was checked then, and goes straight to the
+ * message or messages.  Returns the exit status.
+ * ---------------------------------------------------------------------- */
+static int keyfile(const char *op, const char *path, int batch_mode)
+{
+    const struct rsa_key *key = rsa_key_map(path);
+    int                   decrypt = (strcmp(op, "dec") == 0);
+    int                   rc;
+
+    if (key == NULL) {
+        fprintf(stderr, "%s is not a compiled key\n", path);
         return 1;
     }
+    rc = batch_mode ? batch(key, decrypt) : single(key, decrypt);
+    rsa_key_unmap(key);
+    return rc;
+}
 
-    d = strtoll(argv[3], &endptr, 10); /* private exponent */
-    if (*endptr != '\0') {
-        fprintf(stderr,
-                "Usage: %s enc|dec <exp_exp> <priv_exp> <prime1> <prime2>\n",
-                argv[0]);
-        return 1;
+/* =========================================================================
+ * main
+ * ====================================================================== */
+int main(int argc, char *argv[])
+{
+    struct bn e, d, p, q;    /* RSA parameters from command line */
+    struct rsa_key key;      /* N = p * q and the precomputed values */
+    struct bn phi;           /* phi(N) = (p - 1) * (q - 1) */
+    struct bn t1, t2;        /* scratch for the checks */
+    struct bn *params[4];    /* e, d, p, q in argument order */
+    const char *compile_to = NULL; /* keycompile: the key file */
+    int batch_mode = 0;      /* --batch: every line of stdin */
+    int i;
+
+    if (argc >= 2 && strcmp(argv[1], "keygen") == 0) {
+        return keygen(argc, argv);
     }
 
-    p = strtoll(argv[4], &endptr, 10); /* first prime */
-    if (*endptr != '\0') {
+    /*
+     * --batch comes before the usual arguments; dropping it leaves them
+     * where the checks below expect them.  It only applies to enc and
+     * dec, and is refused with anything else rather than ignored.
+     */
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) {
+        if (argc < 3
+            || (strcmp(argv[2], "enc") != 0 && strcmp(argv[2], "dec") != 0)) {
+            fprintf(stderr,
+                    "Usage: %s --batch enc|dec <pub_exp> <priv_exp> "
+                    "<prime1> <prime2>\n"
+                    "       %s --batch enc|dec --key <keyfile>\n",
+                    argv[0], argv[0]);
+            return 1;
+        }
+        batch_mode = 1;
+        argv[1]    = argv[0];
+        argv++;
+        argc--;
+    }
+
+    if (argc == 4 && strcmp(argv[2], "--key") == 0
+        && (strcmp(argv[1], "enc") == 0 || strcmp(argv[1], "dec") == 0)) {
+        return keyfile(argv[1], argv[3], batch_mode);
+    }
+
+    /*
+     * keycompile takes the key as enc and dec do, and the file after
+     * it: set that aside, and the key goes through the same checks.
+     */
+    if (argc >= 2 && strcmp(argv[1], "keycompile") == 0) {
+        if (argc != 7) {
+            fprintf(stderr, "Usage: %s keycompile <pub_exp> <priv_exp> "
+                    "<prime1> <prime2> <keyfile>\n", argv[0]);
+            return 1;
+        }
+        compile_to = argv[6];
+        argc--;
+    }
+
+    /* ------------------------------------------------------------------ */
+    /* 1. Validate argument count                                          */
+    /* ------------------------------------------------------------------ */
+
+    if (argc != 6) {
+        /* Exactly 5 arguments required: op, e, d, p, q */
         fprintf(stderr,
                 "Usage: %s enc|dec <exp_exp> <priv_exp> <prime1> <prime2>\n",
                 argv[0]);
         return 1;
     }
 
-    q = strtoll(argv[5], &endptr, 10); /* second prime */
-    if (*endptr != '\0') {
-        fprintf(stderr,
-                "Usage: %s enc|dec <exp_exp> <priv_exp> <prime1> <prime2>\n",
-                argv[0]);
+    /* ------------------------------------------------------------------ */
+    /* 2. Check the operation flag                                         */
+    /* ------------------------------------------------------------------ */
+
+    if (compile_to == NULL && strcmp(argv[1], "enc") != 0
+        && strcmp(argv[1], "dec") != 0) {
+        /* First argument must be either "enc" or "dec" */
+        fprintf(stderr, "First argument must be 'enc' or 'dec'\n");
         return 1;
     }
 
     /* ------------------------------------------------------------------ */
+    /* 3. Parse numeric arguments from the command line                     */
     /* 4. All parameters must be positive                                  */
     /* ------------------------------------------------------------------ */
 
-    if (e <= 0 || d <= 0 || p <= 0 || q <= 0) {
-        fprintf(stderr, "Negative numbers are not allowed\n");
-        return 1;
+    /*
+     * Every argument is checked for being a number before any is
+     * checked for its sign, as when each went through strtoll first.
+     */
+    params[0] = &e; /* public exponent */
+    params[1] = &d; /* private exponent */
+    params[2] = &p; /* first prime */
+    params[3] = &q; /* second prime */
+    for (i = 0; i < 4; i++) {
+        if (parse_number(argv[i + 2], params[i]) == NUM_INVALID) {
+            fprintf(stderr,
+                    "Usage: %s enc|dec <exp_exp> <priv_exp> <prime1> "
+                    "<prime2>\n", argv[0]);
+            return 1;
+        }
+    }
+    for (i = 0; i < 4; i++) {
+        switch (parse_number(argv[i + 2], params[i])) {
+        case NUM_NEGATIVE:
+            fprintf(stderr, "Negative numbers are not allowed\n");
+            return 1;
+        case NUM_TOO_BIG:
+            fprintf(stderr, "Parameters must be at most %d bits\n",
+                    BN_MAX_BITS);
+            return 1;
+        default:
+            break;
+        }
     }
 
     /* ------------------------------------------------------------------ */
     /* 5. p and q must be prime numbers                                    */
     /* ------------------------------------------------------------------ */
 
-    if (!is_prime(p) || !is_prime(q)) {
+    if (!is_prime(&p) || !is_prime(&q)) {
         fprintf(stderr, "p and q must be prime\n");
         return 1;
     }
@@ -212,14 +503,21 @@ int main(int argc, char *argv[])
     /* 6. Compute N = p * q and phi(N) = (p-1) * (q-1)                    */
     /* ------------------------------------------------------------------ */
 
-    n_val = p * q;                /* the RSA modulus */
-    phi   = (p - 1) * (q - 1);   /* Euler's totient of N */
+    if (rsa_key_init(&key, &e, &d, &p, &q) < 0) {
+        /* the modulus is limited by what bn_mod_pow can square */
+        fprintf(stderr, "N = p * q must be at most %d bits\n", MAX_N_BITS);
+        return 1;
+    }
+    bn_sub_u64(&t1, &p, 1);
+    bn_sub_u64(&t2, &q, 1);
+    bn_mul(&phi, &t1, &t2);      /* Euler's totient of N */
 
     /* ------------------------------------------------------------------ */
     /* 7. e must be coprime with phi(N)                                    */
     /* ------------------------------------------------------------------ */
 
-    if (gcd(e, phi) != 1) {
+    bn_gcd(&t1, &e, &phi);
+    if (bn_cmp_u64(&t1, 1) != 0) {
         /* e shares a factor with phi(N) → RSA keys are invalid */
         fprintf(stderr, "e is not coprime with phi(N)\n");
         return 1;
@@ -229,54 +527,29 @@ int main(int argc, char *argv[])
     /* 8. e * d mod phi(N) must equal 1 (modular inverse relationship)     */
     /* ------------------------------------------------------------------ */
 
-    if ((e * d) % phi != 1) {
+    /* reduce e and d first so that their product always fits */
+    bn_mod(&t1, &e, &phi);
+    bn_mod(&t2, &d, &phi);
+    bn_mul(&t1, &t1, &t2);
+    bn_mod(&t1, &t1, &phi);
+    if (bn_cmp_u64(&t1, 1) != 0) {
         /* d is not the modular inverse of e under phi(N) */
         fprintf(stderr, "e * d mod phi(N) is not 1\n");
         return 1;
     }
 
-    /* ------------------------------------------------------------------ */
-    /* 9. Read the message from standard input                             */
-    /* ------------------------------------------------------------------ */
-
-    if (scanf("%lld", &m) != 1) {
-        /* Could not read an integer from stdin */
-        fprintf(stderr, "Failed to read message\n");
-        return 1;
-    }
-
-    /* ------------------------------------------------------------------ */
-    /* 10. The message must be positive and smaller than N                  */
-    /* ------------------------------------------------------------------ */
-
-    if (m < 0) {
-        fprintf(stderr, "Negative numbers are not allowed\n");
-        return 1;
-    }
-
-    if (m >= n_val) {
-        /* RSA can only encrypt messages in the range [0, N-1] */
-        fprintf(stderr, "Message is larger than N\n");
-        return 1;
+    /* keycompile: the checked key and its constants go to the file */
+    if (compile_to != NULL) {
+        if (rsa_key_save(&key, compile_to) < 0) {
+            fprintf(stderr, "Cannot write %s\n", compile_to);
+            return 1;
+        }
+        return 0;
     }
 
-    /* ------------------------------------------------------------------ */
-    /* 11. Perform encryption or decryption                                */
-    /* ------------------------------------------------------------------ */
-
-    if (strcmp(argv[1], "enc") == 0) {
-        /* Encrypt: c = m^e mod N */
-        result = mod_pow(m, e, n_val);
-    } else {
-        /* Decrypt: m = c^d mod N */
-        result = mod_pow(m, d, n_val);
+    /* Steps 9 to 12, for one message or for every line of stdin */
+    if (batch_mode) {
+        return batch(&key, strcmp(argv[1], "dec") == 0);
     }
-
-    /* ------------------------------------------------------------------ */
-    /* 12. Print the result and exit                                        */
-    /* ------------------------------------------------------------------ */
-
-    printf("%lld\n", result);
-
-    return 0; /* success */
+    return single(&key, strcmp(argv[1], "dec") == 0);
 }
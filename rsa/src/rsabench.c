@@ -0,0 +1,809 @@
+/*
+ * rsabench.c — Benchmark for the bignum arithmetic in bn.c.
+ *
+ * Times bn.c against OpenSSL's BN on the same random operands, so the
+ * ratio is measured on the machine at hand.  Each measurement repeats
+ * one operation for about a second.
+ *
+ *   --mul     products of two equal-size numbers, 256 to 4096 bits
+ *   --modexp  base^exp mod N with a full-size odd N and exponent (as in
+ *             decryption) and with exp = 65537 (as in encryption), for
+ *             64-, 1024-, 2048- and 4096-bit N, in operations per
+ *             second, by Montgomery multiplication (bn_mod_pow) and by
+ *             long division (bn_mod_pow_div)
+ *   --window  bn_mod_pow with each window width from 1 (plain binary)
+ *             to BN_WINDOW_MAX and with the width bn.c chooses, for
+ *             exponents of 64 to 4096 bits, in microseconds
+ *   --crt     decryptions per second with the CRT (rsa_decrypt) and
+ *             without (rsa_decrypt_plain), for 1024-, 2048- and
+ *             4096-bit keys generated at start-up
+ *   --prime   time to test 64-bit primes by the trial division rsa used
+ *             to do and by bn_is_prime_u64 (Miller–Rabin)
+ *   --keyfile microseconds from a key's numbers to a key ready to use,
+ *             by rsa's checks and rsa_key_init, and by mapping the
+ *             file "rsa keycompile" writes (rsa_key_map)
+ *   --keygen  seconds to generate 512- to 4096-bit keys with rsa_keygen
+ *             on every core: mean, fastest and slowest of a few keys
+ *   --tune    sweeps bn_karatsuba_threshold and then bn_toom3_threshold
+ *             and prints the fastest values, the defaults in bn.c
+ *
+ * Usage:
+ *   rsabench --mul | --modexp | --window | --crt | --prime | --keyfile
+ *          | --keygen | --tune
+ *
+ * Compilation (with rsakey.c, keygen.c and bn.c):
+ *   gcc -O3 -Wall -Wextra -Werror -pedantic -o rsabench rsabench.c \
+ *       rsakey.c keygen.c bn.c -lcrypto -pthread
+ */
+
+#include <stdio.h>           /* printf, fprintf, snprintf           */
+#include <stdlib.h>          /* mkstemp                             */
+#include <string.h>          /* strcmp, memset                      */
+#include <time.h>            /* clock_gettime                       */
+#include <unistd.h>          /* close, unlink                       */
+
+#include <openssl/bn.h>      /* BN_mul, BN_mod_exp, BN_lebin2bn     */
+
+#include "bn.h"
+#include "keygen.h"
+#include "rsakey.h"
+
+/* Smallest time a measurement runs for, in seconds */
+#define RUN_SECONDS 1.0
+
+/* Largest operands of a product that fits in a struct bn, in limbs */
+#define TUNE_MAX 64
+
+/*
+ * now_sec — Seconds on the monotonic clock.
+ */
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * random_bn — Sets 'a' to a random number of exactly 'bits' bits
+ * (xorshift64*, so every run uses the same operands).
+ */
+static void random_bn(struct bn *a, int bits)
+{
+    static uint64_t state = 0x9E3779B97F4A7C15ULL;
+    int             i;
+
+    a->n = (bits + BN_LIMB_BITS - 1) / BN_LIMB_BITS;
+    for (i = 0; i < a->n; i++) {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        a->d[i] = state * 0x2545F4914F6CDD1DULL;
+    }
+    if (bits % BN_LIMB_BITS != 0) {
+        a->d[a->n - 1] &= (1ULL << (bits % BN_LIMB_BITS)) - 1;
+    }
+    a->d[a->n - 1] |= 1ULL << ((bits - 1) % BN_LIMB_BITS);
+}
+
+/*
+ * to_openssl — Converts 'a' to a new BIGNUM.  On x86-64 the limbs are
+ * already little-endian bytes.
+ */
+static BIGNUM *to_openssl(const struct bn *a)
+{
+    unsigned char bytes[BN_LIMBS * 8];
+    int           i, j;
+
+    for (i = 0; i < a->n; i++) {
+        for (j = 0; j < 8; j++) {
+            bytes[i * 8 + j] = (unsigned char)(a->d[i] >> (8 * j));
+        }
+    }
+    return BN_lebin2bn(bytes, a->n * 8, NULL);
+}
+
+/*
+ * same — 1 if 'a' and 'b' hold the same value.
+ */
+static int same(const struct bn *a, const BIGNUM *b)
+{
+    BIGNUM *t = to_openssl(a);
+    int     eq = (BN_cmp(t, b) == 0);
+
+    BN_free(t);
+    return eq;
+}
+
+/*
+ * prime_trial — 1 if 'n' is prime, by trial division by 2, 3 and the
+ * numbers 6k ± 1 up to √n: rsa's test for 64-bit values before
+ * bn_is_prime_u64, kept as the baseline for --prime.
+ */
+static int prime_trial(uint64_t n)
+{
+    uint64_t i;
+
+    if (n < 4) {
+        return n >= 2;
+    }
+    if (n % 2 == 0 || n % 3 == 0) {
+        return 0;
+    }
+    for (i = 5; i <= n / i; i += 6) {
+        if (n % i == 0 || n % (i + 2) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * check_key — What rsa does with a key on its command line before the
+ * message: Miller–Rabin on p and q to 16 bases, gcd(e, φ(N)), the
+ * check of e·d mod φ(N), and rsa_key_init for N and the constants.
+ * Returns 1 if the key passes.
+ */
+static int check_key(const struct rsa_key *k)
+{
+    static struct rsa_key fresh; /* large: keep it off the stack */
+    struct bn             phi, t, u;
+
+    if (bn_is_probable_prime(&k->p, 16) == 0
+        || bn_is_probable_prime(&k->q, 16) == 0
+        || rsa_key_init(&fresh, &k->e, &k->d, &k->p, &k->q) < 0) {
+        return 0;
+    }
+    bn_sub_u64(&phi, &k->p, 1);
+    bn_sub_u64(&t, &k->q, 1);
+    bn_mul(&phi, &phi, &t);
+    bn_gcd(&t, &k->e, &phi);
+    if (bn_cmp_u64(&t, 1) != 0) {
+        return 0;
+    }
+    bn_mod(&t, &k->e, &phi);
+    bn_mod(&u, &k->d, &phi);
+    bn_mul(&t, &t, &u);
+    bn_mod(&t, &t, &phi);
+    return bn_cmp_u64(&t, 1) == 0;
+}
+
+/* What a timed job does */
+enum job_kind {
+    JOB_MUL,           /* bn_mul(a, b)               */
+    JOB_MOD_POW,       /* bn_mod_pow(a, b, m)        */
+    JOB_MOD_POW_DIV,   /* bn_mod_pow_div(a, b, m)    */
+    JOB_MOD_POW_WIN,   /* bn_mod_pow, window fixed   */
+    JOB_DECRYPT,       /* rsa_decrypt(key, a)        */
+    JOB_DECRYPT_PLAIN, /* rsa_decrypt_plain(key, a)  */
+    JOB_PRIME_TRIAL,   /* prime_trial(v)             */
+    JOB_PRIME_MR,      /* bn_is_prime_u64(v)         */
+    JOB_KEY_CHECK,     /* check_key(key)             */
+    JOB_KEY_MAP,       /* rsa_key_map(path)          */
+    JOB_SSL_MUL,       /* BN_mul(oa, ob)             */
+    JOB_SSL_MOD_EXP    /* BN_mod_exp(oa, ob, om)     */
+};
+
+/* One operation to time, with its operands in both representations */
+struct job {
+    enum job_kind         kind;
+    const struct bn      *a, *b, *m;
+    const struct rsa_key *key;
+    const char           *path;
+    uint64_t              v;
+    int                   window;
+    struct bn             r;
+    int                   prime;
+    BIGNUM               *oa, *ob, *om, *or_;
+    BN_CTX               *ctx;
+};
+
+/*
+ * job_run — Performs the job's operation once.
+ */
+static void job_run(struct job *j)
+{
+    switch (j->kind) {
+    case JOB_MUL:
+        bn_mul(&j->r, j->a, j->b);
+        break;
+    case JOB_MOD_POW:
+        bn_mod_pow(&j->r, j->a, j->b, j->m);
+        break;
+    case JOB_MOD_POW_DIV:
+        bn_mod_pow_div(&j->r, j->a, j->b, j->m);
+        break;
+    case JOB_MOD_POW_WIN:
+        bn_pow_window = j->window;
+        bn_mod_pow(&j->r, j->a, j->b, j->m);
+        bn_pow_window = 0;
+        break;
+    case JOB_DECRYPT:
+        rsa_decrypt(j->key, &j->r, j->a);
+        break;
+    case JOB_DECRYPT_PLAIN:
+        rsa_decrypt_plain(j->key, &j->r, j->a);
+        break;
+    case JOB_PRIME_TRIAL:
+        j->prime = prime_trial(j->v);
+        break;
+    case JOB_PRIME_MR:
+        j->prime = bn_is_prime_u64(j->v);
+        break;
+    case JOB_KEY_CHECK:
+        check_key(j->key);
+        break;
+    case JOB_KEY_MAP:
+        rsa_key_unmap(rsa_key_map(j->path));
+        break;
+    case JOB_SSL_MUL:
+        BN_mul(j->or_, j->oa, j->ob, j->ctx);
+        break;
+    case JOB_SSL_MOD_EXP:
+        BN_mod_exp(j->or_, j->oa, j->ob, j->om, j->ctx);
+        break;
+    }
+}
+
+/*
+ * time_job — Seconds per run of 'j', measured for about 'seconds'.  The
+ * runs go in batches of at least 100 us and the fastest batch counts: a
+ * batch that another process interrupted is only ever slower.
+ */
+static double time_job(struct job *j, double seconds)
+{
+    long   batch = 1, i;
+    double t0, t, best = 0, start = now_sec();
+
+    do {
+        t0 = now_sec();
+        for (i = 0; i < batch; i++) {
+            job_run(j);
+        }
+        t = (now_sec() - t0) / (double)batch;
+        if (best == 0 || t < best) {
+            best = t;
+        }
+        if (t * (double)batch < 100e-6) {
+            batch *= 2;
+        }
+    } while (now_sec() - start < seconds);
+    return best;
+}
+
+/*
+ * time_jobs — Times 'count' jobs side by side: ROUNDS rounds, each
+ * giving every job an equal share of about RUN_SECONDS in total, so
+ * that a slow spell of the machine hits all of them.  Each job's
+ * fastest time goes to 'secs'.
+ */
+#define ROUNDS 5
+
+static void time_jobs(struct job **jobs, int count, double *secs)
+{
+    double t;
+    int    round, i;
+
+    for (i = 0; i < count; i++) {
+        secs[i] = 0;
+    }
+    for (round = 0; round < ROUNDS; round++) {
+        for (i = 0; i < count; i++) {
+            t = time_job(jobs[i], RUN_SECONDS / ROUNDS);
+            if (secs[i] == 0 || t < secs[i]) {
+                secs[i] = t;
+            }
+        }
+    }
+}
+
+/*
+ * compare — Checks that the bn and OpenSSL jobs agree, then times both
+ * and prints one table row: 'label', both times in 'unit' (1e9 for ns,
+ * 1e6 for us) and their ratio.  Returns 0, or -1 if the results differ.
+ */
+static int compare(struct job *mine, struct job *ssl, const char *label,
+                   double unit)
+{
+    struct job *jobs[2];
+    double      secs[2];
+
+    job_run(mine);
+    job_run(ssl);
+    if (!same(&mine->r, ssl->or_)) {
+        fprintf(stderr, "rsabench: %s: results differ from OpenSSL\n",
+                label);
+        return -1;
+    }
+    jobs[0] = mine;
+    jobs[1] = ssl;
+    time_jobs(jobs, 2, secs);
+    printf("%-15s %12.1f %12.1f %7.2fx\n", label, secs[0] * unit,
+           secs[1] * unit, secs[0] / secs[1]);
+    return 0;
+}
+
+/*
+ * run_mul — The --mul benchmark.  Returns the exit status.
+ */
+static int run_mul(void)
+{
+    static const int sizes[] = { 256, 512, 1024, 2048, 4096 };
+    struct bn        a, b;
+    struct job       mine, ssl;
+    char             label[32];
+    size_t           i;
+    int              rc = 0;
+
+    printf("karatsuba from %d limbs, toom-3 from %d limbs\n",
+           bn_karatsuba_threshold, bn_toom3_threshold);
+    printf("%-15s %12s %12s %8s\n", "bits", "bn ns/op", "openssl",
+           "ratio");
+    memset(&ssl, 0, sizeof ssl);
+    ssl.kind = JOB_SSL_MUL;
+    ssl.ctx  = BN_CTX_new();
+    ssl.or_  = BN_new();
+    for (i = 0; i < sizeof sizes / sizeof sizes[0] && rc == 0; i++) {
+        random_bn(&a, sizes[i]);
+        random_bn(&b, sizes[i]);
+        mine.kind = JOB_MUL;
+        mine.a    = &a;
+        mine.b    = &b;
+        ssl.oa    = to_openssl(&a);
+        ssl.ob    = to_openssl(&b);
+        snprintf(label, sizeof label, "%d", sizes[i]);
+        rc = compare(&mine, &ssl, label, 1e9);
+        BN_free(ssl.oa);
+        BN_free(ssl.ob);
+    }
+    BN_free(ssl.or_);
+    BN_CTX_free(ssl.ctx);
+    return rc == 0 ? 0 : 1;
+}
+
+/*
+ * run_modexp — The --modexp benchmark: operations per second of
+ * bn_mod_pow (Montgomery), bn_mod_pow_div and BN_mod_exp, and the
+ * speed of the first relative to the other two.  Returns the exit
+ * status.
+ */
+static int run_modexp(void)
+{
+    static const int sizes[] = { 64, 1024, 2048, 4096 };
+    struct bn        base, exp, m;
+    struct job       mine, div, ssl, *jobs[3];
+    char             label[32];
+    double           secs[3];
+    size_t           i;
+    int              pub;
+
+    printf("%-15s %11s %11s %11s %8s %8s\n", "bits, exponent",
+           "montgomery", "division", "openssl", "vs div", "vs ossl");
+    memset(&ssl, 0, sizeof ssl);
+    ssl.kind = JOB_SSL_MOD_EXP;
+    ssl.ctx  = BN_CTX_new();
+    ssl.or_  = BN_new();
+    for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+        for (pub = 1; pub >= 0; pub--) {
+            random_bn(&m, sizes[i]);
+            m.d[0] |= 1; /* RSA moduli are odd */
+            random_bn(&base, sizes[i] - 1);
+            if (pub) {
+                bn_set_u64(&exp, 65537);
+            } else {
+                random_bn(&exp, sizes[i]);
+            }
+            mine.kind = JOB_MOD_POW;
+            mine.a    = &base;
+            mine.b    = &exp;
+            mine.m    = &m;
+            div       = mine;
+            div.kind  = JOB_MOD_POW_DIV;
+            ssl.oa    = to_openssl(&base);
+            ssl.ob    = to_openssl(&exp);
+            ssl.om    = to_openssl(&m);
+            snprintf(label, sizeof label, "%d, %s", sizes[i],
+                     pub ? "65537" : "full");
+
+            job_run(&mine);
+            job_run(&div);
+            job_run(&ssl);
+            if (!same(&mine.r, ssl.or_) || !same(&div.r, ssl.or_)) {
+                fprintf(stderr, "rsabench: %s: results differ\n", label);
+                return 1;
+            }
+            jobs[0] = &mine;
+            jobs[1] = &div;
+            jobs[2] = &ssl;
+            time_jobs(jobs, 3, secs);
+            printf("%-15s %11.0f %11.0f %11.0f %7.2fx %7.2fx\n", label,
+                   1 / secs[0], 1 / secs[1], 1 / secs[2],
+                   secs[1] / secs[0], secs[2] / secs[0]);
+
+            BN_free(ssl.oa);
+            BN_free(ssl.ob);
+            BN_free(ssl.om);
+        }
+    }
+    BN_free(ssl.or_);
+    BN_CTX_free(ssl.ctx);
+    return 0;
+}
+
+/*
+ * run_window — The --window benchmark: microseconds per bn_mod_pow for
+ * a full-size exponent and odd modulus, with the window fixed at each
+ * width and with bn.c's own choice ("auto", which runs as width 0),
+ * after checking that all of them agree.  "vs w=1" is the gain of the
+ * chosen width over plain binary exponentiation.  Returns the exit
+ * status.
+ */
+static int run_window(void)
+{
+    static const int sizes[] = { 64, 256, 512, 1024, 2048, 4096 };
+    struct bn        base, exp, m;
+    struct job       win[BN_WINDOW_MAX + 1], *jobs[BN_WINDOW_MAX + 1];
+    double           secs[BN_WINDOW_MAX + 1];
+    size_t           i;
+    int              w;
+
+    printf("%-5s", "bits");
+    for (w = 1; w <= BN_WINDOW_MAX; w++) {
+        printf("       w=%d", w);
+    }
+    printf("      auto  vs w=1\n");
+    for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+        random_bn(&m, sizes[i]);
+        m.d[0] |= 1;
+        random_bn(&base, sizes[i] - 1);
+        random_bn(&exp, sizes[i]);
+        for (w = 0; w <= BN_WINDOW_MAX; w++) {
+            memset(&win[w], 0, sizeof win[w]);
+            win[w].kind   = JOB_MOD_POW_WIN;
+            win[w].a      = &base;
+            win[w].b      = &exp;
+            win[w].m      = &m;
+            win[w].window = w;
+            job_run(&win[w]);
+            if (w > 0 && bn_cmp(&win[w].r, &win[0].r) != 0) {
+                fprintf(stderr, "rsabench: %d bits: window %d differs\n",
+                        sizes[i], w);
+                return 1;
+            }
+            jobs[w] = &win[w];
+        }
+
+        time_jobs(jobs, BN_WINDOW_MAX + 1, secs);
+        printf("%-5d", sizes[i]);
+        for (w = 1; w <= BN_WINDOW_MAX; w++) {
+            printf(" %9.1f", secs[w] * 1e6);
+        }
+        printf(" %9.1f %6.2fx\n", secs[0] * 1e6, secs[1] / secs[0]);
+    }
+    return 0;
+}
+
+/*
+ * random_prime — Sets 'p' to a random prime of exactly 'bits' bits with
+ * the top two bits set, so that the product of two has 2·bits bits.
+ * Four rounds of Miller–Rabin are plenty for benchmark keys.
+ */
+static void random_prime(struct bn *p, int bits)
+{
+    do {
+        random_bn(p, bits);
+        p->d[p->n - 1] |= 1ULL << ((bits - 2) % BN_LIMB_BITS);
+        p->d[0] |= 1;
+    } while (bn_is_probable_prime(p, 4) != 1);
+}
+
+/*
+ * random_key — Sets 'key' to a random 'bits'-bit key with e = 65537.
+ */
+static void random_key(struct rsa_key *key, int bits)
+{
+    struct bn e, d, p, q, phi, t;
+
+    bn_set_u64(&e, 65537);
+    do {
+        random_prime(&p, bits / 2);
+        random_prime(&q, bits / 2);
+        bn_sub_u64(&phi, &p, 1);
+        bn_sub_u64(&t, &q, 1);
+        bn_mul(&phi, &phi, &t);
+    } while (bn_cmp(&p, &q) == 0 || bn_mod_inv(&d, &e, &phi) < 0);
+    rsa_key_init(key, &e, &d, &p, &q);
+}
+
+/*
+ * run_crt — The --crt benchmark: decryptions per second by the CRT and
+ * over the full modulus, for random 1024-, 2048- and 4096-bit keys with
+ * e = 65537, after checking that both give the same message.  Returns
+ * the exit status.
+ */
+static int run_crt(void)
+{
+    static const int sizes[] = { 1024, 2048, 4096 };
+    static struct rsa_key key;  /* large: keep it off the stack */
+    struct bn        msg, c;
+    struct job       crt, plain, *jobs[2];
+    char             label[32];
+    double           secs[2];
+    size_t           i;
+
+    printf("%-15s %11s %11s %8s\n", "bits", "crt", "plain", "speedup");
+    for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+        random_key(&key, sizes[i]);
+
+        random_bn(&msg, sizes[i] - 1);
+        rsa_encrypt(&key, &c, &msg);
+        crt.kind    = JOB_DECRYPT;
+        crt.key     = &key;
+        crt.a       = &c;
+        plain       = crt;
+        plain.kind  = JOB_DECRYPT_PLAIN;
+        job_run(&crt);
+        job_run(&plain);
+        if (bn_cmp(&crt.r, &msg) != 0 || bn_cmp(&plain.r, &msg) != 0) {
+            fprintf(stderr, "rsabench: %d-bit key: decryption differs\n",
+                    sizes[i]);
+            return 1;
+        }
+
+        jobs[0] = &crt;
+        jobs[1] = &plain;
+        time_jobs(jobs, 2, secs);
+        snprintf(label, sizeof label, "%d", sizes[i]);
+        printf("%-15s %11.1f %11.1f %7.2fx\n", label, 1 / secs[0],
+               1 / secs[1], secs[1] / secs[0]);
+    }
+    return 0;
+}
+
+/*
+ * run_keyfile — The --keyfile benchmark: microseconds to get from a
+ * key's numbers to a key ready to use, by checking and setting it up
+ * as rsa does from its command line, and by mapping the compiled key
+ * file of rsa_key_save, for random 1024-, 2048- and 4096-bit keys.
+ * The file goes to a temporary name and is removed.  Returns the exit
+ * status.
+ */
+static int run_keyfile(void)
+{
+    static const int      sizes[] = { 1024, 2048, 4096 };
+    static struct rsa_key key;  /* large: keep it off the stack */
+    const struct rsa_key *mapped;
+    struct job            check, map, *jobs[2];
+    char                  path[] = "/tmp/rsabenchXXXXXX";
+    double                secs[2];
+    size_t                i;
+    int                   fd, rc = 0;
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "rsabench: cannot create %s\n", path);
+        return 1;
+    }
+    close(fd);
+
+    printf("%-5s %12s %12s %10s\n", "bits", "check us", "map us",
+           "speedup");
+    for (i = 0; i < sizeof sizes / sizeof sizes[0] && rc == 0; i++) {
+        random_key(&key, sizes[i]);
+        if (rsa_key_save(&key, path) < 0
+            || (mapped = rsa_key_map(path)) == NULL) {
+            fprintf(stderr, "rsabench: cannot save and map %s\n", path);
+            rc = 1;
+            break;
+        }
+        if (!check_key(mapped) || bn_cmp(&mapped->d, &key.d) != 0
+            || bn_cmp(&mapped->mn.rr, &key.mn.rr) != 0) {
+            fprintf(stderr, "rsabench: %d-bit key: mapped key differs\n",
+                    sizes[i]);
+            rc = 1;
+        }
+        rsa_key_unmap(mapped);
+
+        memset(&check, 0, sizeof check);
+        check.kind = JOB_KEY_CHECK;
+        check.key  = &key;
+        map        = check;
+        map.kind   = JOB_KEY_MAP;
+        map.path   = path;
+        jobs[0]    = &check;
+        jobs[1]    = &map;
+        time_jobs(jobs, 2, secs);
+        printf("%-5d %12.1f %12.1f %9.0fx\n", sizes[i], secs[0] * 1e6,
+               secs[1] * 1e6, secs[0] / secs[1]);
+    }
+    unlink(path);
+    return rc;
+}
+
+/*
+ * run_prime — The --prime benchmark: microseconds to establish that
+ * each of a few large 64-bit primes is prime, by trial division and by
+ * bn_is_prime_u64.  Primes are the worst case for both: trial division
+ * runs all the way to √n, and Miller–Rabin tries every base.  A trial
+ * division that takes longer than a measurement is timed once.
+ * Returns the exit status.
+ */
+static int run_prime(void)
+{
+    static const uint64_t primes[] = {
+        1000000007ULL,            /* about 2^30 */
+        4294967291ULL,            /* 2^32 − 5   */
+        999999999989ULL,          /* about 2^40 */
+        1000000000000000003ULL,   /* about 2^60 */
+        18446744073709551557ULL   /* 2^64 − 59  */
+    };
+    struct job trial, mr;
+    double     t_trial, t_mr;
+    int        i;
+
+    printf("%-21s %14s %11s %9s\n", "n", "trial us", "MR us",
+           "speedup");
+    for (i = 0; i < (int)(sizeof primes / sizeof primes[0]); i++) {
+        memset(&trial, 0, sizeof trial);
+        trial.kind = JOB_PRIME_TRIAL;
+        trial.v    = primes[i];
+        mr         = trial;
+        mr.kind    = JOB_PRIME_MR;
+        job_run(&mr);
+        if (!mr.prime) {
+            fprintf(stderr, "rsabench: %llu: not found prime\n",
+                    (unsigned long long)primes[i]);
+            return 1;
+        }
+
+        t_trial = time_job(&trial, RUN_SECONDS);
+        t_mr    = time_job(&mr, RUN_SECONDS);
+        printf("%-21llu %14.2f %11.3f %8.0fx\n",
+               (unsigned long long)primes[i], t_trial * 1e6, t_mr * 1e6,
+               t_trial / t_mr);
+    }
+    return 0;
+}
+
+/*
+ * run_keygen — The --keygen benchmark: seconds per rsa_keygen on every
+ * core, over a few keys per size since the distance to the next prime
+ * varies widely from one random start to another.  Each key is checked
+ * by encrypting and decrypting a message.  Returns the exit status.
+ */
+static int run_keygen(void)
+{
+    static const int sizes[] = { 512, 1024, 2048, 3072, 4096 };
+    static const int keys[]  = { 20, 10, 5, 3, 2 };
+    struct bn        e, d, p, q, msg, c, m;
+    struct rsa_key   key;
+    double           t, sum, lo, hi;
+    size_t           i;
+    int              k;
+
+    printf("%d thread(s)\n", rsa_keygen_cores());
+    printf("%-5s %5s %10s %10s %10s\n", "bits", "keys", "mean s",
+           "min s", "max s");
+    for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+        sum = hi = 0;
+        lo  = -1;
+        for (k = 0; k < keys[i]; k++) {
+            t = now_sec();
+            if (rsa_keygen(&e, &d, &p, &q, sizes[i], 0) < 0) {
+                fprintf(stderr, "rsabench: rsa_keygen failed\n");
+                return 1;
+            }
+            t = now_sec() - t;
+
+            rsa_key_init(&key, &e, &d, &p, &q);
+            random_bn(&msg, sizes[i] - 1);
+            rsa_encrypt(&key, &c, &msg);
+            if (rsa_decrypt(&key, &m, &c) < 0 || bn_cmp(&m, &msg) != 0) {
+                fprintf(stderr, "rsabench: %d-bit key does not work\n",
+                        sizes[i]);
+                return 1;
+            }
+            sum += t;
+            lo   = (lo < 0 || t < lo) ? t : lo;
+            hi   = t > hi ? t : hi;
+        }
+        printf("%-5d %5d %10.3f %10.3f %10.3f\n", sizes[i], keys[i],
+               sum / keys[i], lo, hi);
+    }
+    return 0;
+}
+
+/*
+ * sweep — Sets 'threshold' to each candidate from 'from' to 'to' in
+ * steps of 'step', and returns the one that multiplies fastest.  The
+ * score is the total time over operands from 8 limbs up to TUNE_MAX, so
+ * that every depth the recursion can stop at counts.
+ */
+static int sweep(int *threshold, const char *name, int from, int to,
+                 int step)
+{
+    struct bn  a[TUNE_MAX / 8], b[TUNE_MAX / 8];
+    struct job job;
+    double     ns, best_ns = 0;
+    int        t, i, best = to;
+
+    job.kind = JOB_MUL;
+
+    for (i = 0; i < TUNE_MAX / 8; i++) {
+        random_bn(&a[i], (i + 1) * 8 * BN_LIMB_BITS);
+        random_bn(&b[i], (i + 1) * 8 * BN_LIMB_BITS);
+    }
+    printf("%s (total for 8 to %d limbs):\n", name, TUNE_MAX);
+    for (t = from; t <= to; t += step) {
+        *threshold = t;
+        ns = 0;
+        for (i = 0; i < TUNE_MAX / 8; i++) {
+            job.a = &a[i];
+            job.b = &b[i];
+            ns += time_job(&job, RUN_SECONDS / 20) * 1e9;
+        }
+        printf("  %3d  %8.0f ns\n", t, ns);
+        if (best_ns == 0 || ns < best_ns) {
+            best_ns = ns;
+            best    = t;
+        }
+    }
+    *threshold = best;
+    return best;
+}
+
+/*
+ * run_tune — The --tune benchmark.  Karatsuba is swept first with
+ * Toom-3 out of the way, then Toom-3 on top of the best Karatsuba
+ * threshold.  A threshold above TUNE_MAX means "never".  Returns the
+ * exit status.
+ */
+static int run_tune(void)
+{
+    int kara, toom;
+
+    bn_toom3_threshold = TUNE_MAX + 1;
+    kara = sweep(&bn_karatsuba_threshold, "karatsuba threshold", 4,
+                 TUNE_MAX + 1, 2);
+    toom = sweep(&bn_toom3_threshold, "toom-3 threshold", 9,
+                 TUNE_MAX + 1, 4);
+    printf("fastest: bn_karatsuba_threshold = %d, "
+           "bn_toom3_threshold = %d\n", kara, toom);
+    return 0;
+}
+
+/* =========================================================================
+ * main
+ * ====================================================================== */
+int main(int argc, char *argv[])
+{
+    if (argc == 2 && strcmp(argv[1], "--mul") == 0) {
+        return run_mul();
+    }
+    if (argc == 2 && strcmp(argv[1], "--modexp") == 0) {
+        return run_modexp();
+    }
+    if (argc == 2 && strcmp(argv[1], "--window") == 0) {
+        return run_window();
+    }
+    if (argc == 2 && strcmp(argv[1], "--crt") == 0) {
+        return run_crt();
+    }
+    if (argc == 2 && strcmp(argv[1], "--prime") == 0) {
+        return run_prime();
+    }
+    if (argc == 2 && strcmp(argv[1], "--keyfile") == 0) {
+        return run_keyfile();
+    }
+    if (argc == 2 && strcmp(argv[1], "--keygen") == 0) {
+        return run_keygen();
+    }
+    if (argc == 2 && strcmp(argv[1], "--tune") == 0) {
+        return run_tune();
+    }
+    fprintf(stderr,
+            "Usage: %s --mul | --modexp | --window | --crt | --prime "
+            "| --keyfile | --keygen | --tune\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,253 @@
+/*
+ * rsakey.c — RSA keys and their operations (see rsakey.h).
+ *
+ * Compilation: built together with rsa.c (see rsa.c).
+ */
+
+#include <fcntl.h>    /* open                   */
+#include <stddef.h>   /* offsetof               */
+#include <stdio.h>    /* fdopen, fwrite         */
+#include <string.h>   /* memcmp, memcpy, memset */
+#include <sys/mman.h> /* mmap, munmap           */
+#include <sys/stat.h> /* fstat                  */
+#include <unistd.h>   /* close                  */
+
+#include "rsakey.h"
+
+/* -------------------------------------------------------------------------
+ * rsa_key_init — Derives N, the Montgomery constants and, when p and q
+ * are distinct odd primes, the CRT values.
+ * ---------------------------------------------------------------------- */
+int rsa_key_init(struct rsa_key *k, const struct bn *e, const struct bn *d,
+                 const struct bn *p, const struct bn *q)
+{
+    struct bn t; /* p − 1 or q − 1 */
+
+    if (bn_mul(&k->n, p, q) < 0 || bn_bits(&k->n) > BN_MAX_BITS / 2) {
+        return -1;
+    }
+    bn_copy(&k->e, e);
+    bn_copy(&k->d, d);
+    bn_copy(&k->p, p);
+    bn_copy(&k->q, q);
+    k->odd = (bn_mont_init(&k->mn, &k->n) == 0);
+
+    k->crt = 0;
+    if (k->odd && bn_cmp(p, q) != 0) {
+        bn_mont_init(&k->mp, p);
+        bn_mont_init(&k->mq, q);
+        bn_sub_u64(&t, p, 1);
+        bn_mod(&k->dp, d, &t);
+        bn_sub_u64(&t, q, 1);
+        bn_mod(&k->dq, d, &t);
+        /* distinct primes are coprime, so q has an inverse mod p */
+        k->crt = (bn_mod_inv(&k->qinv, q, p) == 0);
+    }
+    return 0;
+}
+
+/* -------------------------------------------------------------------------
+ * pow_n — base^exp mod N, with the key's Montgomery constants if it has
+ * them.
+ * ---------------------------------------------------------------------- */
+static void pow_n(const struct rsa_key *k, struct bn *r,
+                  const struct bn *base, const struct bn *exp)
+{
+    if (k->odd) {
+        bn_mod_pow_mont(r, base, exp, &k->mn);
+    } else {
+        bn_mod_pow(r, base, exp, &k->n);
+    }
+}
+
+void rsa_encrypt(const struct rsa_key *k, struct bn *c, const struct bn *m)
+{
+    pow_n(k, c, m, &k->e);
+}
+
+void rsa_decrypt_plain(const struct rsa_key *k, struct bn *m,
+                       const struct bn *c)
+{
+    pow_n(k, m, c, &k->d);
+}
+
+/* -------------------------------------------------------------------------
+ * rsa_decrypt — Garner's recombination (see rsakey.h).  m1 − m2 is
+ * taken modulo p by adding p first where m1 < m2 mod p, which keeps it
+ * unsigned.
+ * ---------------------------------------------------------------------- */
+int rsa_decrypt(const struct rsa_key *k, struct bn *m, const struct bn *c)
+{
+    struct bn m1, m2, h, t;
+
+    if (!k->crt) {
+        rsa_decrypt_plain(k, m, c);
+        return 0;
+    }
+
+    bn_mod_pow_mont(&m1, c, &k->dp, &k->mp);   /* c^dP mod p */
+    bn_mod_pow_mont(&m2, c, &k->dq, &k->mq);   /* c^dQ mod q */
+
+    /* h = qInv · (m1 − m2) mod p */
+    bn_mod(&t, &m2, &k->p);
+    if (bn_cmp(&m1, &t) < 0) {
+        bn_add(&m1, &m1, &k->p);
+    }
+    bn_sub(&h, &m1, &t);
+    bn_mul(&h, &h, &k->qinv);
+    bn_mod(&h, &h, &k->p);
+
+    /* m = m2 + h · q < N */
+    bn_mul(&t, &h, &k->q);
+    bn_add(m, &m2, &t);
+
+    /* consistency check: m^e mod N must give c back */
+    pow_n(k, &t, m, &k->e);
+    return bn_cmp(&t, c) == 0 ? 0 : -1;
+}
+
+/*
+ * copy_bn, copy_mont — Copy the limbs in use into a zeroed destination,
+ * so that a saved key holds nothing but the key: no stale limbs above
+ * the top one, and no padding from the stack.
+ */
+static void copy_bn(struct bn *r, const struct bn *a)
+{
+    r->n = a->n;
+    memcpy(r->d, a->d, (size_t)a->n * sizeof(bn_limb));
+}
+
+static void copy_mont(struct bn_mont *r, const struct bn_mont *a)
+{
+    r->n  = a->n;
+    r->n0 = a->n0;
+    copy_bn(&r->m, &a->m);
+    copy_bn(&r->rr, &a->rr);
+}
+
+/* -------------------------------------------------------------------------
+ * rsa_key_save — Builds the file image field by field, leaving out the
+ * constants the key's flags say were never computed.
+ * ---------------------------------------------------------------------- */
+int rsa_key_save(const struct rsa_key *k, const char *path)
+{
+    static struct rsa_key_file f; /* 15 KB: off the stack */
+    FILE                      *out;
+    int                        fd, ok;
+
+    memset(&f, 0, sizeof f);
+    memcpy(f.magic, RSA_KEY_MAGIC, sizeof f.magic);
+    f.version = RSA_KEY_VERSION;
+    f.size    = (uint32_t)sizeof f;
+    f.order   = RSA_KEY_ORDER;
+    copy_bn(&f.key.n, &k->n);
+    copy_bn(&f.key.e, &k->e);
+    copy_bn(&f.key.d, &k->d);
+    copy_bn(&f.key.p, &k->p);
+    copy_bn(&f.key.q, &k->q);
+    f.key.odd = k->odd;
+    f.key.crt = k->crt;
+    if (k->odd) {
+        copy_mont(&f.key.mn, &k->mn);
+    }
+    if (k->crt) {
+        copy_bn(&f.key.dp, &k->dp);
+        copy_bn(&f.key.dq, &k->dq);
+        copy_bn(&f.key.qinv, &k->qinv);
+        copy_mont(&f.key.mp, &k->mp);
+        copy_mont(&f.key.mq, &k->mq);
+    }
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    out = fdopen(fd, "wb");
+    if (out == NULL) {
+        close(fd);
+        return -1;
+    }
+    ok = (fwrite(&f, sizeof f, 1, out) == 1);
+    return (fclose(out) == 0 && ok) ? 0 : -1;
+}
+
+/*
+ * bn_fits — 1 if a mapped value stays within 'limbs' limbs and is
+ * normalised (no zero top limb), so that a damaged file can neither
+ * send the arithmetic out of bounds nor stall it on a zero divisor.
+ */
+static int bn_fits(const struct bn *a, int limbs)
+{
+    return a->n >= 0 && a->n <= limbs && (a->n == 0 || a->d[a->n - 1] != 0);
+}
+
+/*
+ * mont_fits — 1 if the constants in 'a' are for the modulus 'm', itself
+ * nonzero and within BN_LIMBS / 2 limbs.
+ */
+static int mont_fits(const struct bn_mont *a, const struct bn *m)
+{
+    return a->n >= 1 && a->n <= BN_LIMBS / 2 && a->m.n == a->n
+           && bn_fits(&a->m, a->n) && bn_cmp(&a->m, m) == 0
+           && bn_fits(&a->rr, a->n);
+}
+
+/* -------------------------------------------------------------------------
+ * rsa_key_map — The file must be exactly one struct rsa_key_file with
+ * this build's magic, version, size and byte order.  The numbers are
+ * then only given checks that cost no arithmetic: that they fit their
+ * arrays and are normalised, and that N, p and q are nonzero and match
+ * the moduli of their Montgomery constants.  That they form a valid
+ * key was established when the file was written.
+ * ---------------------------------------------------------------------- */
+const struct rsa_key *rsa_key_map(const char *path)
+{
+    const struct rsa_key_file *f;
+    const struct rsa_key      *k;
+    struct stat                st;
+    void                      *map;
+    int                        fd, ok;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size != (off_t)sizeof *f) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, sizeof *f, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* the mapping stays */
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    f  = map;
+    k  = &f->key;
+    ok = memcmp(f->magic, RSA_KEY_MAGIC, sizeof f->magic) == 0
+         && f->version == RSA_KEY_VERSION && f->size == sizeof *f
+         && f->order == RSA_KEY_ORDER
+         && bn_fits(&k->n, BN_LIMBS / 2) && bn_fits(&k->e, BN_LIMBS)
+         && bn_fits(&k->d, BN_LIMBS) && bn_fits(&k->p, BN_LIMBS / 2)
+         && bn_fits(&k->q, BN_LIMBS / 2)
+         && k->n.n > 0 && k->p.n > 0 && k->q.n > 0
+         && (k->odd == 0 || (k->odd == 1 && mont_fits(&k->mn, &k->n)))
+         && (k->crt == 0
+             || (k->crt == 1 && bn_fits(&k->dp, BN_LIMBS / 2)
+                 && bn_fits(&k->dq, BN_LIMBS / 2)
+                 && bn_fits(&k->qinv, BN_LIMBS / 2)
+                 && mont_fits(&k->mp, &k->p)
+                 && mont_fits(&k->mq, &k->q)));
+    if (!ok) {
+        munmap(map, sizeof *f);
+        return NULL;
+    }
+    return k;
+}
+
+void rsa_key_unmap(const struct rsa_key *k)
+{
+    const char *map = (const char *)k - offsetof(struct rsa_key_file, key);
+
+    munmap((void *)map, sizeof(struct rsa_key_file));
+}
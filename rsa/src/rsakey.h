@@ -0,0 +1,99 @@
+/*
+ * rsakey.h — An RSA key with everything precomputed for its operations.
+ *
+ * rsa_key_init takes the four numbers rsa's command line gives (e, d, p
+ * and q, already validated) and derives N and the constants that make
+ * each operation cheap: Montgomery constants for N, p and q, and the
+ * Chinese Remainder Theorem values dP = d mod (p − 1),
+ * dQ = d mod (q − 1) and qInv = q⁻¹ mod p.
+ *
+ * Decryption by the CRT exponentiates modulo p and q separately with
+ * half-size exponents and recombines the two with Garner's formula:
+ *   m1 = c^dP mod p,  m2 = c^dQ mod q
+ *   h  = qInv · (m1 − m2) mod p
+ *   m  = m2 + h · q
+ * Half-size operands make each product about four times cheaper and
+ * the exponents are half as long, so the two exponentiations together
+ * cost about a quarter of one over N.
+ *
+ * A key can be saved to a compiled key file and mapped back into memory
+ * by a later process, with every constant ready: the file is a header
+ * followed by the struct rsa_key itself, so loading it is one mmap and
+ * a few comparisons.  The layout is this machine's (64-bit limbs in its
+ * byte order); the header records enough of it that a file from a
+ * different build is refused rather than misread.
+ *
+ * Compilation: built together with rsa.c (see rsa.c).
+ */
+
+#ifndef RSAKEY_H
+#define RSAKEY_H
+
+#include <stdint.h> /* uint32_t, uint64_t */
+
+#include "bn.h"
+
+struct rsa_key {
+    struct bn      n, e, d, p, q;  /* the key                            */
+    struct bn      dp, dq, qinv;   /* CRT exponents and coefficient      */
+    struct bn_mont mn, mp, mq;     /* Montgomery constants for N, p, q   */
+    int            odd;            /* N is odd: mn is set                */
+    int            crt;            /* p, q odd and distinct: CRT applies */
+};
+
+/*
+ * rsa_key_init — Fills 'k' from e, d, p and q.  Returns -1 if N = p·q
+ * is wider than BN_MAX_BITS / 2.  Keys where the CRT does not apply
+ * (p = q, or p or q is 2) are still usable, by plain exponentiation.
+ */
+int rsa_key_init(struct rsa_key *k, const struct bn *e, const struct bn *d,
+                 const struct bn *p, const struct bn *q);
+
+/* rsa_encrypt — c = m^e mod N, for m < N. */
+void rsa_encrypt(const struct rsa_key *k, struct bn *c, const struct bn *m);
+
+/*
+ * rsa_decrypt — m = c^d mod N, for c < N, by the CRT when the key
+ * allows.  The CRT result is checked by encrypting it again, which
+ * must give c back; returns -1 if it does not (a fault, or a key whose
+ * d does not match e), with m undefined.
+ */
+int rsa_decrypt(const struct rsa_key *k, struct bn *m, const struct bn *c);
+
+/* rsa_decrypt_plain — m = c^d mod N over the full modulus, no CRT. */
+void rsa_decrypt_plain(const struct rsa_key *k, struct bn *m,
+                       const struct bn *c);
+
+/* Compiled key files: "RSAKEYBN", then the version */
+#define RSA_KEY_MAGIC   "RSAKEYBN"
+#define RSA_KEY_VERSION 1
+
+/* Byte-order mark: reads back the same only on a machine like this one */
+#define RSA_KEY_ORDER 0x0102030405060708ULL
+
+struct rsa_key_file {
+    char           magic[8]; /* RSA_KEY_MAGIC, not NUL-terminated */
+    uint32_t       version;  /* RSA_KEY_VERSION                   */
+    uint32_t       size;     /* sizeof(struct rsa_key_file)       */
+    uint64_t       order;    /* RSA_KEY_ORDER                     */
+    struct rsa_key key;
+};
+
+/*
+ * rsa_key_save — Writes 'k' to 'path' as a compiled key file, readable
+ * by its owner only.  Returns 0, or -1 if it cannot be written.
+ */
+int rsa_key_save(const struct rsa_key *k, const char *path);
+
+/*
+ * rsa_key_map — Maps the compiled key file 'path' read-only into
+ * memory and returns its key, without checking the key itself again.
+ * Returns NULL if the file cannot be mapped or is not a compiled key
+ * of this version and layout.
+ */
+const struct rsa_key *rsa_key_map(const char *path);
+
+/* rsa_key_unmap — Releases a key from rsa_key_map. */
+void rsa_key_unmap(const struct rsa_key *k);
+
+#endif /* RSAKEY_H */